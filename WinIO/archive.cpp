@@ -0,0 +1,422 @@
+#include "archive.h"
+#include "asyncfile.h"
+#include "checksum.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+static uint64 AlignUp(uint64 v, uint64 alignment)
+{
+	return (v + alignment - 1) / alignment * alignment;
+}
+
+static int Seek64(FILE* f, uint64 off)
+{
+#ifdef _WIN32
+	return _fseeki64(f, int64(off), SEEK_SET);
+#else
+	return fseeko(f, off_t(off), SEEK_SET);
+#endif
+}
+
+uint64 HashAssetName(const char* szName)
+{
+	return XxHash64(szName, strlen(szName), 0);
+}
+
+bool CArchive::Open(const char* szFilename)
+{
+	FILE* f = fopen(szFilename, "rb");
+	if (!f)
+		return false;
+	std::unique_ptr<FILE, decltype(&fclose)> fCloser(f, &fclose);
+
+	SArchiveHeader header{};
+	if (fread(&header, sizeof(header), 1, f) != 1)
+		return false;
+	if (header.magic != s_archiveMagic || header.version != s_archiveVersion)
+		return false;
+
+	m_entries.resize(header.assetCount);
+	if (Seek64(f, header.tocOffset) != 0)
+		return false;
+	if (header.assetCount && fread(m_entries.data(), sizeof(SArchiveEntry), header.assetCount, f) != header.assetCount)
+		return false;
+
+	for (size_t i = 0; i < m_entries.size(); ++i)
+	{
+		const SArchiveEntry& e = m_entries[i];
+		if (e.offset % s_archiveAlignment != 0 || e.offset + e.size > header.tocOffset)
+			return false;
+		if (i > 0 && m_entries[i - 1].nameHash >= e.nameHash)
+			return false;
+	}
+	return true;
+}
+
+const SArchiveEntry* CArchive::Find(uint64 nameHash) const
+{
+	auto it = std::lower_bound(m_entries.begin(), m_entries.end(), nameHash,
+		[](const SArchiveEntry& e, uint64 h) { return e.nameHash < h; });
+	if (it == m_entries.end() || it->nameHash != nameHash)
+		return nullptr;
+	return &*it;
+}
+
+int BuildArchive(const char* szSrcFilename, const char* szDstFilename, uint32 assetCount)
+{
+	PROF_FUNC();
+
+	FILE* fSrc = fopen(szSrcFilename, "rb");
+	if (!fSrc)
+	{
+		std::cerr << "Failed to open " << szSrcFilename << std::endl;
+		return 1;
+	}
+	std::unique_ptr<FILE, decltype(&fclose)> srcCloser(fSrc, &fclose);
+
+	FILE* fDst = fopen(szDstFilename, "wb");
+	if (!fDst)
+	{
+		std::cerr << "Failed to open " << szDstFilename << std::endl;
+		return 1;
+	}
+	std::unique_ptr<FILE, decltype(&fclose)> dstCloser(fDst, &fclose);
+
+	// Log-uniform sizes, most assets are small, some are a few MB.
+	const double minSize = 1024;
+	const double maxSize = 4 * 1024 * 1024;
+	std::mt19937_64 rng(42);
+	std::uniform_real_distribution<double> logSize(std::log(minSize), std::log(maxSize));
+
+	std::vector<char> buf(size_t(maxSize) + s_archiveAlignment);
+	std::vector<SArchiveEntry> entries;
+
+	uint64 off = s_archiveAlignment;
+	if (Seek64(fDst, off) != 0)
+		return 2;
+
+	for (uint32 i = 0; i < assetCount; ++i)
+	{
+		const size_t wanted = size_t(std::exp(logSize(rng)));
+		const size_t size = fread(buf.data(), 1, wanted, fSrc);
+		if (size == 0)
+			break;
+
+		const std::string name = "asset_" + std::to_string(i);
+		entries.push_back(SArchiveEntry{ HashAssetName(name.c_str()), off, size });
+
+		const uint64 padded = AlignUp(size, s_archiveAlignment);
+		memset(buf.data() + size, 0, size_t(padded - size));
+		if (fwrite(buf.data(), 1, size_t(padded), fDst) != padded)
+		{
+			std::cerr << "Failed to write " << szDstFilename << std::endl;
+			return 3;
+		}
+		off += padded;
+
+		if (size < wanted)
+			break;
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const SArchiveEntry& a, const SArchiveEntry& b) { return a.nameHash < b.nameHash; });
+
+	SArchiveHeader header{};
+	header.magic = s_archiveMagic;
+	header.version = s_archiveVersion;
+	header.assetCount = uint32(entries.size());
+	header.tocOffset = off;
+
+	std::vector<char> headerBlock(s_archiveAlignment, 0);
+	memcpy(headerBlock.data(), &header, sizeof(header));
+
+	if ((entries.size() && fwrite(entries.data(), sizeof(SArchiveEntry), entries.size(), fDst) != entries.size())
+		|| Seek64(fDst, 0) != 0
+		|| fwrite(headerBlock.data(), 1, headerBlock.size(), fDst) != headerBlock.size())
+	{
+		std::cerr << "Failed to write " << szDstFilename << std::endl;
+		return 3;
+	}
+
+	uint64 total = 0;
+	for (const SArchiveEntry& e : entries)
+		total += e.size;
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "assetCount " << entries.size() << " bytes " << total << " file " << off + entries.size() * sizeof(SArchiveEntry) << std::endl;
+	std::cout << std::endl;
+	return 0;
+}
+
+
+namespace
+{
+
+struct SAssetState
+{
+	const SArchiveEntry* pEntry = nullptr;
+	uint32 batchIdx = 0;
+	AlignedUniquePtr pData;
+	std::atomic<uint32> pendingReads = { 0 };
+	STimestamp pushTime{};
+};
+
+struct SBatchState
+{
+	std::atomic<uint32> pendingAssets = { 0 };
+};
+
+struct SChunk
+{
+	uint32 assetIdx;
+	uint32 size;
+	uint64 offset;
+	uint64 dstOffset;
+};
+
+struct SLoadContext
+{
+	CAsyncFile* pFile = nullptr;
+	const CAssetLoader::AssetCallback* pOnAsset = nullptr;
+	const CAssetLoader::BatchCallback* pOnBatch = nullptr;
+
+	std::unique_ptr<SAssetState[]> assets;
+	std::unique_ptr<SBatchState[]> batches;
+	std::vector<SChunk> chunks;
+	std::vector<STimestamp> batchDoneTime;
+	STimestamp startTime{};
+
+	std::atomic<size_t> nextChunk = { 0 };
+	std::atomic<int> activeReads = {};
+
+	std::mutex mtx;
+	std::condition_variable cond;
+	bool done = false;
+};
+
+struct SLoaderWorkerState
+{
+	SLoadContext* pCtx = nullptr;
+	uint64 sum = 0;
+	CLatencyHistogram assetLatency;
+	uint32 idx = 0;
+};
+
+struct alignas(128) SLoaderState
+{
+	static constexpr size_t alignment = 128;
+
+	SLoaderWorkerState s;
+	char padding[alignment - sizeof(s) % alignment];
+};
+static_assert(sizeof(SLoaderState) % SLoaderState::alignment == 0, "Broken alignment");
+
+static bool PushNextRead(SAsyncRead& r, SLoadContext& ctx)
+{
+	const size_t idx = ctx.nextChunk.fetch_add(1, std::memory_order_relaxed);
+	if (idx >= ctx.chunks.size())
+		return false;
+
+	const SChunk& chunk = ctx.chunks[idx];
+	SAssetState& asset = ctx.assets[chunk.assetIdx];
+	if (chunk.dstOffset == 0)
+		asset.pushTime = ts::now();
+
+	r.pBuf = asset.pData.get() + chunk.dstOffset;
+	r.offset = chunk.offset;
+	r.size = chunk.size;
+	r.pUser = reinterpret_cast<void*>(idx);
+	if (!ctx.pFile->Read(r))
+		exit(1);
+	return true;
+}
+
+static void SignalDone(SLoadContext& ctx)
+{
+	{
+		std::scoped_lock lock(ctx.mtx);
+		ctx.done = true;
+	}
+	ctx.cond.notify_one();
+}
+
+static void LoaderWorkerFunc(SLoaderWorkerState& state)
+{
+	SetThreadName(L"Loader_%u", state.idx);
+
+	PROF_FUNC();
+
+	SLoadContext& ctx = *state.pCtx;
+	bool keepPushing = true;
+
+	while (true)
+	{
+		SAsyncRead* pRead;
+		{
+			PROF_REGION("Wait");
+			pRead = ctx.pFile->Wait();
+		}
+		if (!pRead)
+			break;
+
+		const SChunk& chunk = ctx.chunks[reinterpret_cast<size_t>(pRead->pUser)];
+		SAssetState& asset = ctx.assets[chunk.assetIdx];
+		const uint64 needed = std::min<uint64>(chunk.size, asset.pEntry->size - chunk.dstOffset);
+		if (pRead->result < 0 || uint64(pRead->result) < needed)
+		{
+			std::cerr << "Failed to read asset, res " << pRead->result << std::endl;
+			exit(3);
+		}
+
+		if (asset.pendingReads.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			state.assetLatency.Record(ts::now() - asset.pushTime);
+
+			{
+				PROF_REGION("process");
+				state.sum += process(asset.pData.get(), size_t(asset.pEntry->size));
+			}
+
+			if (*ctx.pOnAsset)
+				(*ctx.pOnAsset)(SLoadedAsset{ asset.pEntry->nameHash, asset.pData.get(), asset.pEntry->size, asset.batchIdx });
+
+			if (ctx.batches[asset.batchIdx].pendingAssets.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				ctx.batchDoneTime[asset.batchIdx] = ts::now() - ctx.startTime;
+				if (*ctx.pOnBatch)
+					(*ctx.pOnBatch)(asset.batchIdx);
+			}
+		}
+
+		if (keepPushing)
+		{
+			keepPushing = PushNextRead(*pRead, ctx);
+		}
+		if (!keepPushing)
+		{
+			if (ctx.activeReads.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				SignalDone(ctx);
+		}
+	}
+}
+
+}
+
+CAssetLoader::SStats CAssetLoader::Load(const uint64* pIds, size_t count, const AssetCallback& onAsset, const BatchCallback& onBatch)
+{
+	PROF_FUNC();
+
+	SStats stats;
+	SLoadContext ctx;
+	ctx.pFile = &m_file;
+	ctx.pOnAsset = &onAsset;
+	ctx.pOnBatch = &onBatch;
+
+	// Resolve, split into batches in request order, sort by offset inside a batch.
+	std::vector<const SArchiveEntry*> entries;
+	std::vector<uint32> batchOf;
+	entries.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const SArchiveEntry* pEntry = m_archive.Find(pIds[i]);
+		if (!pEntry)
+		{
+			++stats.missingCount;
+			continue;
+		}
+		entries.push_back(pEntry);
+	}
+
+	const uint32 batchSize = std::max(m_params.batchSize, 1u);
+	const uint32 batchCount = uint32((entries.size() + batchSize - 1) / batchSize);
+	for (uint32 b = 0; b < batchCount; ++b)
+	{
+		auto first = entries.begin() + size_t(b) * batchSize;
+		auto last = entries.begin() + std::min(entries.size(), size_t(b + 1) * batchSize);
+		std::sort(first, last, [](const SArchiveEntry* a, const SArchiveEntry* b) { return a->offset < b->offset; });
+	}
+
+	ctx.assets.reset(new SAssetState[entries.size()]);
+	ctx.batches.reset(new SBatchState[batchCount]);
+	ctx.batchDoneTime.resize(batchCount);
+
+	const uint64 maxReadSize = std::max<uint64>(m_params.maxReadSize / s_archiveAlignment * s_archiveAlignment, s_archiveAlignment);
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		SAssetState& asset = ctx.assets[i];
+		asset.pEntry = entries[i];
+		asset.batchIdx = uint32(i / batchSize);
+		ctx.batches[asset.batchIdx].pendingAssets.fetch_add(1, std::memory_order_relaxed);
+
+		// Reads are rounded up to alignment, assets are padded in the archive.
+		const uint64 alignedSize = std::max<uint64>(AlignUp(asset.pEntry->size, s_archiveAlignment), s_archiveAlignment);
+		asset.pData = AlignedAlloc(size_t(alignedSize), s_archiveAlignment);
+
+		uint32 reads = 0;
+		for (uint64 off = 0; off < alignedSize; off += maxReadSize)
+		{
+			const uint32 size = uint32(std::min(maxReadSize, alignedSize - off));
+			ctx.chunks.push_back(SChunk{ uint32(i), size, asset.pEntry->offset + off, off });
+			++reads;
+		}
+		asset.pendingReads.store(reads, std::memory_order_relaxed);
+
+		stats.bytes += asset.pEntry->size;
+	}
+	stats.assetCount = entries.size();
+	stats.readCount = ctx.chunks.size();
+
+	const uint32 workerCount = std::max(m_params.workerCount, 1u);
+	std::vector<SAsyncRead> reads(std::max(m_params.maxInFlight, 1u));
+
+	std::unique_ptr<SLoaderState[]> states(new SLoaderState[workerCount]);
+	std::vector<std::thread> workers;
+	for (uint32 i = 0; i < workerCount; ++i)
+	{
+		states[i].s.idx = i;
+		states[i].s.pCtx = &ctx;
+		workers.emplace_back(std::thread(&LoaderWorkerFunc, std::ref(states[i].s)));
+	}
+
+	ctx.startTime = ts::now();
+
+	{
+		PROF_REGION("initial push");
+		ctx.activeReads += int(reads.size());
+		size_t pushed = 0;
+		while (pushed < reads.size() && PushNextRead(reads[pushed], ctx))
+			++pushed;
+
+		const int unused = int(reads.size() - pushed);
+		if (unused > 0 && ctx.activeReads.fetch_sub(unused) == unused)
+			SignalDone(ctx);
+	}
+
+	{
+		PROF_REGION("wait done");
+		std::unique_lock lock(ctx.mtx);
+		ctx.cond.wait(lock, [&]() { return ctx.done; });
+	}
+
+	for (uint32 i = 0; i < workerCount; ++i)
+		m_file.Wake();
+	for (auto& t : workers)
+		t.join();
+
+	stats.totalTime = ts::now() - ctx.startTime;
+	for (uint32 i = 0; i < workerCount; ++i)
+	{
+		stats.sum += states[i].s.sum;
+		stats.assetLatency.Merge(states[i].s.assetLatency);
+	}
+	stats.batchDoneTime = std::move(ctx.batchDoneTime);
+	return stats;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "common.h"
+#include "histogram.h"
+
+#include <functional>
+#include <vector>
+
+class CAsyncFile;
+
+// Packed archive of many assets.
+// Layout: SArchiveHeader padded to s_archiveAlignment, assets each starting at s_archiveAlignment,
+// then table of contents: SArchiveEntry array sorted by nameHash.
+
+static constexpr uint32 s_archiveMagic = 0x414F4957; // "WIOA"
+static constexpr uint32 s_archiveVersion = 1;
+static constexpr size_t s_archiveAlignment = 4096;
+
+struct SArchiveHeader
+{
+	uint32 magic;
+	uint32 version;
+	uint32 assetCount;
+	uint32 reserved;
+	uint64 tocOffset;
+};
+
+struct SArchiveEntry
+{
+	uint64 nameHash;
+	uint64 offset;
+	uint64 size;
+};
+
+uint64 HashAssetName(const char* szName);
+
+class CArchive
+{
+public:
+	bool Open(const char* szFilename);
+
+	// Binary search in TOC, nullptr if there is no such asset.
+	const SArchiveEntry* Find(uint64 nameHash) const;
+
+	const std::vector<SArchiveEntry>& GetEntries() const { return m_entries; }
+
+private:
+	std::vector<SArchiveEntry> m_entries;
+};
+
+// Slices szSrcFilename into up to assetCount assets of random size named "asset_<n>". Returns 0 on success, like main().
+int BuildArchive(const char* szSrcFilename, const char* szDstFilename, uint32 assetCount);
+
+
+struct SLoadedAsset
+{
+	uint64 nameHash;
+	const char* pData;
+	uint64 size;
+	uint32 batchIdx;
+};
+
+// Loads lists of assets through async reads on worker threads.
+// Request list is split into batches in given order, reads inside a batch are sorted by file offset,
+// big assets are split into several reads. Callbacks are called on worker threads.
+class CAssetLoader
+{
+public:
+	struct SParams
+	{
+		uint32 workerCount = 1;
+		uint32 maxInFlight = 32;
+		uint32 maxReadSize = 1024 * 1024;
+		uint32 batchSize = 64;
+	};
+
+	struct SStats
+	{
+		uint64 assetCount = 0;
+		uint64 missingCount = 0;
+		uint64 readCount = 0;
+		uint64 bytes = 0;
+		uint64 sum = 0;
+		STimestamp totalTime{};
+		// From first read push to asset completion
+		CLatencyHistogram assetLatency;
+		std::vector<STimestamp> batchDoneTime;
+	};
+
+	using AssetCallback = std::function<void(const SLoadedAsset&)>;
+	using BatchCallback = std::function<void(uint32 batchIdx)>;
+
+	CAssetLoader(CAsyncFile& file, const CArchive& archive, const SParams& params)
+		: m_file(file)
+		, m_archive(archive)
+		, m_params(params)
+	{}
+
+	// Blocks until all assets are loaded and processed.
+	SStats Load(const uint64* pIds, size_t count, const AssetCallback& onAsset, const BatchCallback& onBatch);
+
+private:
+	CAsyncFile& m_file;
+	const CArchive& m_archive;
+	SParams m_params;
+};
@@ -0,0 +1,183 @@
+#include "asyncfile.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+
+static const ULONG_PTR s_fileCompKey = 42;
+static const ULONG_PTR s_wakeCompKey = 28;
+
+CAsyncFile::~CAsyncFile()
+{
+	if (m_hComp != NULL)
+		CloseHandle(m_hComp);
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hFile);
+}
+
+bool CAsyncFile::Open(const char* szFilename, bool unbuffered, uint32 queueDepth)
+{
+	PROF_FUNC();
+
+	DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED;
+	if (unbuffered)
+	{
+		flags |= FILE_FLAG_NO_BUFFERING;
+	}
+
+	m_hFile = CreateFileA(szFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+	{
+		const DWORD err = GetLastError();
+		std::cerr << "Failed to open file, err " << err << std::endl;
+		return false;
+	}
+
+	LARGE_INTEGER size{};
+	GetFileSizeEx(m_hFile, &size);
+	m_size = uint64(size.QuadPart);
+
+	m_hComp = CreateIoCompletionPort(m_hFile, NULL, s_fileCompKey, 0);
+	if (m_hComp == NULL)
+	{
+		const DWORD err = GetLastError();
+		std::cerr << "Failed to create completion port, err " << err << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool CAsyncFile::Read(SAsyncRead& r)
+{
+	memset(&r.overlapped, 0, sizeof(r.overlapped));
+	r.overlapped.Offset = static_cast<DWORD>(r.offset);
+	r.overlapped.OffsetHigh = static_cast<DWORD>(r.offset >> 32);
+	r.pushTime = STimestamp::now();
+
+	const BOOL res = ReadFile(m_hFile, r.pBuf, r.size, nullptr, &r.overlapped);
+	const DWORD err = GetLastError();
+	if (res == FALSE && err != ERROR_IO_PENDING)
+	{
+		std::cerr << "Failed to read file, err " << err << std::endl;
+		return false;
+	}
+	return true;
+}
+
+SAsyncRead* CAsyncFile::Wait()
+{
+	DWORD transferred = 0;
+	ULONG_PTR key = 0;
+	OVERLAPPED* pOverlapped = nullptr;
+	const BOOL res = GetQueuedCompletionStatus(m_hComp, &transferred, &key, &pOverlapped, INFINITE);
+	if (pOverlapped == nullptr)
+	{
+		if (res == FALSE)
+		{
+			const DWORD err = GetLastError();
+			std::cerr << "Failed to get completion status, err " << err << std::endl;
+			exit(3);
+		}
+		return nullptr;
+	}
+
+	SAsyncRead* pRead = reinterpret_cast<SAsyncRead*>(pOverlapped);
+	pRead->result = res ? int64(transferred) : -int64(GetLastError());
+	return pRead;
+}
+
+void CAsyncFile::Wake()
+{
+	PostQueuedCompletionStatus(m_hComp, 0, s_wakeCompKey, nullptr);
+}
+
+#else
+
+CAsyncFile::~CAsyncFile() = default;
+
+bool CAsyncFile::Open(const char* szFilename, bool unbuffered, uint32 queueDepth)
+{
+	PROF_FUNC();
+
+	int flags = O_RDONLY;
+	if (unbuffered)
+	{
+		flags |= O_DIRECT;
+	}
+
+	m_file = open(szFilename, flags);
+	if (m_file.fd == -1)
+	{
+		std::cerr << "Failed to open file, err " << errno << std::endl;
+		return false;
+	}
+
+	const off_t size = lseek(m_file.fd, 0, SEEK_END);
+	m_size = size < 0 ? 0 : uint64(size);
+
+	// Extra space for wake requests
+	int res = m_ring.Init(queueDepth * 2);
+	if (res < 0)
+	{
+		std::cerr << "Failed to create io_uring, err " << -res << std::endl;
+		return false;
+	}
+
+	res = m_ring.RegisterFiles(&m_file.fd, 1);
+	if (res < 0)
+	{
+		std::cerr << "Failed to register file, err " << -res << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool CAsyncFile::Read(SAsyncRead& r)
+{
+	r.pushTime = STimestamp::now();
+
+	const int res = m_ring.Submit([&](io_uring_sqe& sqe)
+	{
+		sqe.opcode = IORING_OP_READ;
+		sqe.fd = 0;
+		sqe.flags = IOSQE_FIXED_FILE;
+		sqe.off = r.offset;
+		sqe.addr = reinterpret_cast<uint64>(r.pBuf);
+		sqe.len = r.size;
+		sqe.user_data = reinterpret_cast<uint64>(&r);
+	});
+	if (res < 0)
+	{
+		std::cerr << "Failed to read file, err " << -res << std::endl;
+		return false;
+	}
+	return true;
+}
+
+SAsyncRead* CAsyncFile::Wait()
+{
+	io_uring_cqe cqe{};
+	const int res = m_ring.WaitCompletion(cqe);
+	if (res < 0)
+	{
+		std::cerr << "Failed to get completion status, err " << -res << std::endl;
+		exit(3);
+	}
+
+	SAsyncRead* pRead = reinterpret_cast<SAsyncRead*>(cqe.user_data);
+	if (pRead)
+		pRead->result = cqe.res;
+	return pRead;
+}
+
+void CAsyncFile::Wake()
+{
+	m_ring.Submit([](io_uring_sqe& sqe)
+	{
+		sqe.opcode = IORING_OP_NOP;
+		sqe.user_data = 0;
+	});
+}
+
+#endif
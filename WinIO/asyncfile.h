@@ -0,0 +1,58 @@
+#pragma once
+
+#include "common.h"
+
+#ifdef __linux__
+#include "linuxio.h"
+#endif
+
+// Portable async file reads with a completion queue that many workers can wait on:
+// IOCP on Windows (as in Test3), io_uring on Linux (as in Test5).
+
+struct SAsyncRead
+{
+#ifdef _WIN32
+	// Has to stay first, completion gives back OVERLAPPED pointer
+	OVERLAPPED overlapped{};
+#endif
+	char* pBuf = nullptr;
+	uint64 offset = 0;
+	uint32 size = 0;
+	// Filled on completion, bytes transferred or -error
+	int64 result = 0;
+	void* pUser = nullptr;
+	STimestamp pushTime{};
+};
+
+class CAsyncFile
+{
+public:
+	CAsyncFile() = default;
+	CAsyncFile(const CAsyncFile&) = delete;
+	CAsyncFile& operator=(const CAsyncFile&) = delete;
+	~CAsyncFile();
+
+	// queueDepth is maximum count of reads in flight. Prints error and returns false on failure.
+	bool Open(const char* szFilename, bool unbuffered, uint32 queueDepth);
+
+	uint64 GetSize() const { return m_size; }
+
+	// Offset, size and buffer have to be aligned when opened unbuffered.
+	bool Read(SAsyncRead& r);
+
+	// Blocks until some read completes. Returns nullptr when woken by Wake().
+	SAsyncRead* Wait();
+
+	// Wakes one waiting thread, like posting stop key to IOCP.
+	void Wake();
+
+private:
+#ifdef _WIN32
+	HANDLE m_hFile = INVALID_HANDLE_VALUE;
+	HANDLE m_hComp = NULL;
+#else
+	SFdCloser m_file;
+	CUring m_ring;
+#endif
+	uint64 m_size = 0;
+};
@@ -0,0 +1,803 @@
+#include "bench.h"
+#include "checksum.h"
+#include "fileset.h"
+#include "pagecache.h"
+#include "testdata.h"
+#include "tests.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static SRunConfig s_runConfig;
+static std::vector<SRunResult>* s_pRunResults = nullptr;
+
+const SRunConfig& GetRunConfig()
+{
+	return s_runConfig;
+}
+
+void SetRunConfig(const SRunConfig& cfg)
+{
+	s_runConfig = cfg;
+}
+
+void ReportRunResult(const SRunResult& result)
+{
+	if (s_pRunResults)
+		s_pRunResults->push_back(result);
+}
+
+
+namespace
+{
+
+struct SEngine
+{
+	const char* name;
+	void (*func)(const char* szFilename, FILE* f, int64 fsize);
+	// Reads every file of the active file set, see fileset.h
+	bool fileSets = false;
+	// Reads GetAdaptiveInFlight, so --inflight auto means something, see inflight.h
+	bool adaptiveInFlight = false;
+};
+
+const SEngine s_engines[] = {
+#ifdef _WIN32
+	{ "seq", [](const char*, FILE* f, int64 fsize) { rewind(f); Test1_Seq(f, fsize); } },
+	{ "par", [](const char*, FILE* f, int64 fsize) { rewind(f); Test2_Par(f, fsize); } },
+	{ "iocp", [](const char* szFilename, FILE*, int64 fsize) { Test3_CompIOWorkers(szFilename, fsize); }, true, true },
+	{ "dstorage", [](const char* szFilename, FILE*, int64 fsize) { Test4_DStorage(szFilename, fsize); } },
+#endif
+#ifdef __linux__
+	{ "iouring", [](const char* szFilename, FILE*, int64 fsize) { Test5_IoUring(szFilename, fsize); }, true, true },
+	{ "aio", [](const char* szFilename, FILE*, int64 fsize) { Test6_LinuxAio(szFilename, fsize); }, true, true },
+	{ "mmap", [](const char* szFilename, FILE*, int64 fsize) { Test7_Mmap(szFilename, fsize); } },
+	{ "dsqueue", [](const char* szFilename, FILE*, int64 fsize) { Test10_DStorageQueue(szFilename, fsize); } },
+	{ "compport", [](const char* szFilename, FILE*, int64 fsize) { Test11_CompPortWorkers(szFilename, fsize); } },
+	{ "priority", [](const char* szFilename, FILE*, int64 fsize) { Test13_Priority(szFilename, fsize); } },
+#endif
+	{ "coroutines", [](const char* szFilename, FILE*, int64 fsize) { Test12_Coroutines(szFilename, fsize); } },
+};
+
+const SEngine* FindEngine(const std::string& name)
+{
+	for (const SEngine& e : s_engines)
+	{
+		if (name == e.name)
+			return &e;
+	}
+	return nullptr;
+}
+
+std::vector<std::string> SplitList(const char* szList)
+{
+	std::vector<std::string> res;
+	std::string cur;
+	for (const char* p = szList; ; ++p)
+	{
+		if (*p == ',' || *p == 0)
+		{
+			if (!cur.empty())
+				res.push_back(cur);
+			cur.clear();
+			if (*p == 0)
+				break;
+		}
+		else
+		{
+			cur += *p;
+		}
+	}
+	return res;
+}
+
+// Numbers with optional k/m suffix
+bool ParseUintList(const char* szList, std::vector<uint32>& values)
+{
+	values.clear();
+	for (const std::string& s : SplitList(szList))
+	{
+		char* pEnd = nullptr;
+		uint64 v = strtoull(s.c_str(), &pEnd, 10);
+		if (pEnd == s.c_str())
+			return false;
+		if (*pEnd == 'k' || *pEnd == 'K')
+		{
+			v *= 1024;
+			++pEnd;
+		}
+		else if (*pEnd == 'm' || *pEnd == 'M')
+		{
+			v *= 1024 * 1024;
+			++pEnd;
+		}
+		if (*pEnd || v == 0 || v > UINT32_MAX)
+			return false;
+		values.push_back(uint32(v));
+	}
+	return !values.empty();
+}
+
+const char* IoModeName(SRunConfig::EIoMode mode)
+{
+	switch (mode)
+	{
+	case SRunConfig::EIoMode::Buffered: return "buffered";
+	case SRunConfig::EIoMode::Unbuffered: return "unbuffered";
+	default: return "default";
+	}
+}
+
+// Buffer is a multiple of s_processingBlockSize, so hash stages give the same result as tests.
+uint64 ComputeReferenceSum(FILE* f)
+{
+	std::vector<char> buf(4 * 1024 * 1024);
+	rewind(f);
+	uint64 s = 0;
+	size_t read;
+	while ((read = fread(buf.data(), 1, buf.size(), f)) > 0)
+		s += process(buf.data(), read);
+	rewind(f);
+	return s;
+}
+
+// Requests one by one, same as engines process them
+uint64 ComputeWorkloadSum(FILE* f, const SWorkload& workload)
+{
+	std::vector<char> buf(workload.maxRequestSize);
+	uint64 s = 0;
+	for (const SIoRequest& req : workload.requests)
+	{
+#ifdef _WIN32
+		_fseeki64(f, int64(req.offset), SEEK_SET);
+#else
+		fseeko(f, off_t(req.offset), SEEK_SET);
+#endif
+		const size_t read = fread(buf.data(), 1, req.size, f);
+		s += process(buf.data(), read);
+	}
+	rewind(f);
+	return s;
+}
+
+struct SRecord
+{
+	uint32 rep;
+	const char* engine;
+	SCacheControl cache;
+	// Measured before the run, -1 if unknown
+	double residency;
+	bool bufferPool;
+	const char* pin;
+	bool pinSubmitter;
+	ENumaBuffers numaBuffers;
+	const char* wait;
+	EWakeOrder wake;
+	const char* submit;
+	SNodeTraffic traffic;
+	SRunResult result;
+	bool sumOk;
+};
+
+static constexpr const char* s_csvHeader = "rep,engine,test,stage,bufSize,inFlight,settledInFlight,fenceGroup,workers,io,cache,residency,pool,pin,pinSubmitter,numaBuffers,wait,wake,concurrency,submit,files,bytes,requests,reads,totalMs,MBps,IOPS,p50Us,p90Us,p99Us,p999Us,maxUs,minorFaults,majorFaults,nodeLoads,remoteLoads,wakeups,switches,fairness,cpuMs,spinMs,spinHits,sum,sumOk";
+
+void WriteCsv(FILE* f, const SRecord& r)
+{
+	const SRunResult& res = r.result;
+	const double totalSec = sec(res.totalTime.dur());
+	const auto us = [](const STimestamp t) { return sec(t.dur()) * 1e6; };
+	fprintf(f, "%u,%s,%s,%s,%u,%u,%u,%u,%u,%s,%s,%.3f,%s,%s,%s,%s,%s,%s,%u,%s,%u,%llu,%llu,%llu,%.3f,%.2f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%lld,%lld,%lld,%lld,%lld,%lld,%.3f,%.3f,%.3f,%llu,%llu,%s\n",
+		r.rep, r.engine, res.engine, GetActiveProcessingStage().name,
+		res.bufSize, res.maxInFlight, res.settledInFlight, res.fenceGroup, res.workerCount, res.unbuffered ? "unbuffered" : "buffered",
+		GetCacheStateName(r.cache.state), r.residency, r.bufferPool ? "on" : "off",
+		r.pin, r.pinSubmitter ? "on" : "off", GetNumaBuffersName(r.numaBuffers), r.wait, GetWakeOrderName(r.wake), res.concurrency, r.submit, res.fileCount,
+		(unsigned long long)res.bytes, (unsigned long long)res.requests, (unsigned long long)res.reads,
+		totalSec * 1000, res.bytes / totalSec / 1024 / 1024, res.requests / totalSec,
+		us(res.latency.GetPercentile(50)), us(res.latency.GetPercentile(90)), us(res.latency.GetPercentile(99)),
+		us(res.latency.GetPercentile(99.9)), us(res.latency.GetMax()),
+		(long long)res.pageFaults.minor, (long long)res.pageFaults.major,
+		(long long)r.traffic.loads, (long long)r.traffic.remoteLoads, (long long)res.wakeups, (long long)res.switches, res.fairness,
+		ms(res.cpuTime.Total().dur()), ms(res.spin.spinTime.dur()), (unsigned long long)res.spin.hits,
+		(unsigned long long)res.sum, r.sumOk ? "1" : "0");
+}
+
+void WriteJson(FILE* f, const SRecord& r)
+{
+	const SRunResult& res = r.result;
+	const double totalSec = sec(res.totalTime.dur());
+	const auto us = [](const STimestamp t) { return sec(t.dur()) * 1e6; };
+	fprintf(f, "{\"rep\":%u,\"engine\":\"%s\",\"test\":\"%s\",\"stage\":\"%s\","
+		"\"bufSize\":%u,\"inFlight\":%u,\"settledInFlight\":%u,\"fenceGroup\":%u,\"workers\":%u,\"io\":\"%s\",\"cache\":\"%s\",\"residency\":%.3f,\"pool\":%s,"
+		"\"pin\":\"%s\",\"pinSubmitter\":%s,\"numaBuffers\":\"%s\",\"wait\":\"%s\",\"wake\":\"%s\",\"concurrency\":%u,\"submit\":\"%s\",\"files\":%u,"
+		"\"bytes\":%llu,\"requests\":%llu,\"reads\":%llu,\"totalMs\":%.3f,\"MBps\":%.2f,\"IOPS\":%.1f,"
+		"\"latencyUs\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p99.9\":%.1f,\"max\":%.1f},"
+		"\"pageFaults\":{\"minor\":%lld,\"major\":%lld},\"nodeLoads\":%lld,\"remoteLoads\":%lld,\"wakeups\":%lld,\"switches\":%lld,\"fairness\":%.3f,\"cpuMs\":%.3f,\"spinMs\":%.3f,\"spinHits\":%llu,"
+		"\"sum\":%llu,\"sumOk\":%s}\n",
+		r.rep, r.engine, res.engine, GetActiveProcessingStage().name,
+		res.bufSize, res.maxInFlight, res.settledInFlight, res.fenceGroup, res.workerCount, res.unbuffered ? "unbuffered" : "buffered",
+		GetCacheStateName(r.cache.state), r.residency, r.bufferPool ? "true" : "false",
+		r.pin, r.pinSubmitter ? "true" : "false", GetNumaBuffersName(r.numaBuffers), r.wait, GetWakeOrderName(r.wake), res.concurrency, r.submit, res.fileCount,
+		(unsigned long long)res.bytes, (unsigned long long)res.requests, (unsigned long long)res.reads,
+		totalSec * 1000, res.bytes / totalSec / 1024 / 1024, res.requests / totalSec,
+		us(res.latency.GetPercentile(50)), us(res.latency.GetPercentile(90)), us(res.latency.GetPercentile(99)),
+		us(res.latency.GetPercentile(99.9)), us(res.latency.GetMax()),
+		(long long)res.pageFaults.minor, (long long)res.pageFaults.major,
+		(long long)r.traffic.loads, (long long)r.traffic.remoteLoads, (long long)res.wakeups, (long long)res.switches, res.fairness,
+		ms(res.cpuTime.Total().dur()), ms(res.spin.spinTime.dur()), (unsigned long long)res.spin.hits,
+		(unsigned long long)res.sum, r.sumOk ? "true" : "false");
+}
+
+int PrintUsage()
+{
+	std::cerr << "WinIO bench <file> [--engines e1,e2] [--buf 64k,512k] [--inflight 8,32,auto,auto:64] [--workers 1,3]\n"
+		"    [--fence request,8,batch] [--io buffered,unbuffered] [--cache keep,cold,warm,partial:0.5] [--pool on,off]\n"
+		"    [--pin none,compact,scatter,0+2+8-11] [--pin-submitter off,on] [--numa-buffers first-touch,device,spread]\n"
+		"    [--wait block,spin:20,adaptive,adaptive:100] [--wake lifo,fifo] [--concurrency 0,1,2]\n"
+		"    [--submit none,merge:1m,merge:1m+gap:16k,split:128k,window:256+merge:1m] [--random uniform|zipf|hotset[:requests]]\n"
+		"    [--files f2,f3] [--reps N] [--stage bytesum|crc32c|xxhash64] [--json out.jsonl] [--csv out.csv]\n"
+		"engines:";
+	for (const SEngine& e : s_engines)
+		std::cerr << " " << e.name;
+	std::cerr << std::endl;
+	return 1;
+}
+
+}
+
+int RunBenchmarkMatrix(int argc, char** argv)
+{
+	PROF_FUNC();
+
+	if (argc < 1)
+		return PrintUsage();
+
+	const char* szFilename = argv[0];
+	std::vector<const SEngine*> engines;
+	std::vector<uint32> bufSizes = { 0 };
+	// "auto" lets the engine pick the depth at runtime, "auto:64" caps it
+	struct SInFlight
+	{
+		uint32 depth;
+		bool adaptive;
+	};
+	std::vector<SInFlight> inFlights = { SInFlight{ 0, false } };
+	std::vector<uint32> workerCounts = { 0 };
+	// Only the dsqueue engine has fences, a number is the count of requests per fence
+	struct SFence
+	{
+		std::string name;
+		SRunConfig::EFenceMode mode;
+		uint32 interval;
+	};
+	std::vector<SFence> fences = { SFence{ "default", SRunConfig::EFenceMode::Default, 0 } };
+	std::vector<SRunConfig::EIoMode> ioModes = { SRunConfig::EIoMode::Default };
+	std::vector<SCacheControl> cacheControls = { SCacheControl() };
+	std::vector<bool> bufferPools = { true };
+	// CPU lists are written with + instead of , here
+	struct SPin
+	{
+		std::string name;
+		EPinMode mode;
+		std::vector<uint32> cpus;
+	};
+	std::vector<SPin> pins = { SPin{ "none", EPinMode::None, {} } };
+	std::vector<bool> pinSubmitters = { false };
+	std::vector<ENumaBuffers> numaBuffersModes = { ENumaBuffers::FirstTouch };
+	// Spin budget in microseconds after the colon
+	struct SWait
+	{
+		std::string name;
+		EWaitMode mode;
+		uint32 spinUs;
+	};
+	std::vector<SWait> waits = { SWait{ "block", EWaitMode::Block, 0 } };
+	std::vector<EWakeOrder> wakeOrders = { EWakeOrder::Lifo };
+	// Running workers of the completion port, 0 is CPU count
+	std::vector<uint32> concurrencies = { 0 };
+	struct SSubmit
+	{
+		std::string name;
+		SSubmitParams params;
+	};
+	std::vector<SSubmit> submits = { SSubmit{ "none", SSubmitParams() } };
+	// Engines that support workloads read the same random requests instead of the whole file, see workload.h
+	bool randomAccess = false;
+	SWorkloadParams workloadParams;
+	// Streamed together with <file> by the engines that take a file set
+	std::vector<std::string> extraFiles;
+	uint32 reps = 1;
+	const char* szJson = nullptr;
+	const char* szCsv = nullptr;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* szArg = argv[i];
+		const char* szVal = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (!szVal)
+			return PrintUsage();
+		++i;
+
+		if (strcmp(szArg, "--engines") == 0)
+		{
+			for (const std::string& name : SplitList(szVal))
+			{
+				const SEngine* pEngine = FindEngine(name);
+				if (!pEngine)
+					return PrintUsage();
+				engines.push_back(pEngine);
+			}
+		}
+		else if (strcmp(szArg, "--buf") == 0)
+		{
+			// Has to stay aligned for unbuffered IO, engines round read sizes up to 4 KiB.
+			if (!ParseUintList(szVal, bufSizes))
+				return PrintUsage();
+			for (uint32 b : bufSizes)
+			{
+				if (b % 4096 != 0)
+				{
+					std::cerr << "Buffer size " << b << " is not multiple of 4096" << std::endl;
+					return 1;
+				}
+			}
+		}
+		else if (strcmp(szArg, "--inflight") == 0)
+		{
+			inFlights.clear();
+			for (const std::string& value : SplitList(szVal))
+			{
+				SInFlight inFlight{ 0, false };
+				const char* szDepth = value.c_str();
+				if (value.compare(0, 4, "auto") == 0)
+				{
+					inFlight.adaptive = true;
+					szDepth += 4;
+					if (*szDepth == ':')
+						++szDepth;
+					else if (*szDepth)
+						return PrintUsage();
+				}
+				std::vector<uint32> depths;
+				if (*szDepth || !inFlight.adaptive)
+				{
+					if (!ParseUintList(szDepth, depths))
+						return PrintUsage();
+					inFlight.depth = depths[0];
+				}
+				inFlights.push_back(inFlight);
+			}
+			if (inFlights.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--workers") == 0)
+		{
+			if (!ParseUintList(szVal, workerCounts))
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--fence") == 0)
+		{
+			fences.clear();
+			for (const std::string& value : SplitList(szVal))
+			{
+				SFence fence{ value, SRunConfig::EFenceMode::Interval, 0 };
+				std::vector<uint32> intervals;
+				if (value == "request")
+					fence.mode = SRunConfig::EFenceMode::Request;
+				else if (value == "batch")
+					fence.mode = SRunConfig::EFenceMode::Batch;
+				else if (ParseUintList(value.c_str(), intervals))
+					fence.interval = intervals[0];
+				else
+					return PrintUsage();
+				fences.push_back(fence);
+			}
+			if (fences.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--io") == 0)
+		{
+			ioModes.clear();
+			for (const std::string& mode : SplitList(szVal))
+			{
+				if (mode == "buffered")
+					ioModes.push_back(SRunConfig::EIoMode::Buffered);
+				else if (mode == "unbuffered")
+					ioModes.push_back(SRunConfig::EIoMode::Unbuffered);
+				else
+					return PrintUsage();
+			}
+			if (ioModes.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--cache") == 0)
+		{
+			cacheControls.clear();
+			for (const std::string& value : SplitList(szVal))
+			{
+				SCacheControl control;
+				if (!ParseCacheControl(value.c_str(), control))
+					return PrintUsage();
+				cacheControls.push_back(control);
+			}
+			if (cacheControls.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--pool") == 0)
+		{
+			bufferPools.clear();
+			for (const std::string& value : SplitList(szVal))
+			{
+				if (value == "on")
+					bufferPools.push_back(true);
+				else if (value == "off")
+					bufferPools.push_back(false);
+				else
+					return PrintUsage();
+			}
+			if (bufferPools.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--pin") == 0)
+		{
+			pins.clear();
+			for (const std::string& value : SplitList(szVal))
+			{
+				SPin pin{ value, EPinMode::None, {} };
+				if (!ParsePinMode(value.c_str(), pin.mode, pin.cpus))
+					return PrintUsage();
+				pins.push_back(pin);
+			}
+			if (pins.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--pin-submitter") == 0)
+		{
+			pinSubmitters.clear();
+			for (const std::string& value : SplitList(szVal))
+			{
+				if (value == "on")
+					pinSubmitters.push_back(true);
+				else if (value == "off")
+					pinSubmitters.push_back(false);
+				else
+					return PrintUsage();
+			}
+			if (pinSubmitters.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--numa-buffers") == 0)
+		{
+			numaBuffersModes.clear();
+			for (const std::string& value : SplitList(szVal))
+			{
+				ENumaBuffers mode;
+				if (!ParseNumaBuffers(value.c_str(), mode))
+					return PrintUsage();
+				numaBuffersModes.push_back(mode);
+			}
+			if (numaBuffersModes.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--wait") == 0)
+		{
+			waits.clear();
+			for (const std::string& value : SplitList(szVal))
+			{
+				SWait wait{ value, EWaitMode::Block, 0 };
+				if (!ParseWaitMode(value.c_str(), wait.mode, wait.spinUs))
+					return PrintUsage();
+				waits.push_back(wait);
+			}
+			if (waits.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--wake") == 0)
+		{
+			wakeOrders.clear();
+			for (const std::string& value : SplitList(szVal))
+			{
+				EWakeOrder order;
+				if (!ParseWakeOrder(value.c_str(), order))
+					return PrintUsage();
+				wakeOrders.push_back(order);
+			}
+			if (wakeOrders.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--concurrency") == 0)
+		{
+			concurrencies.clear();
+			for (const std::string& value : SplitList(szVal))
+				concurrencies.push_back(uint32(strtoul(value.c_str(), nullptr, 10)));
+			if (concurrencies.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--submit") == 0)
+		{
+			submits.clear();
+			for (const std::string& value : SplitList(szVal))
+			{
+				SSubmit submit{ value, SSubmitParams() };
+				if (!ParseSubmitParams(value.c_str(), submit.params))
+					return PrintUsage();
+				submits.push_back(submit);
+			}
+			if (submits.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--random") == 0)
+		{
+			const std::string value = szVal;
+			const size_t colon = value.find(':');
+			if (!ParseAccessPattern(value.substr(0, colon).c_str(), workloadParams.pattern))
+				return PrintUsage();
+			if (colon != std::string::npos && (workloadParams.requestCount = strtoull(value.c_str() + colon + 1, nullptr, 10)) == 0)
+				return PrintUsage();
+			randomAccess = true;
+		}
+		else if (strcmp(szArg, "--files") == 0)
+		{
+			extraFiles = SplitList(szVal);
+			if (extraFiles.empty())
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--reps") == 0)
+		{
+			reps = uint32(strtoul(szVal, nullptr, 10));
+			if (reps == 0)
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--stage") == 0)
+		{
+			bool found = false;
+			for (size_t s = 0; s < size_t(EProcessingStage::Count); ++s)
+			{
+				if (strcmp(szVal, GetProcessingStage(EProcessingStage(s)).name) == 0)
+				{
+					SetProcessingStage(EProcessingStage(s));
+					found = true;
+				}
+			}
+			if (!found)
+				return PrintUsage();
+		}
+		else if (strcmp(szArg, "--json") == 0)
+		{
+			szJson = szVal;
+		}
+		else if (strcmp(szArg, "--csv") == 0)
+		{
+			szCsv = szVal;
+		}
+		else
+		{
+			return PrintUsage();
+		}
+	}
+
+	const bool adaptive = std::any_of(inFlights.begin(), inFlights.end(), [](const SInFlight& i) { return i.adaptive; });
+	if (engines.empty())
+	{
+		for (const SEngine& e : s_engines)
+		{
+			if ((extraFiles.empty() || e.fileSets) && (!adaptive || e.adaptiveInFlight))
+				engines.push_back(&e);
+		}
+		if (adaptive)
+			std::cout << "--inflight auto runs only the engines with adaptive depth" << std::endl;
+	}
+	else if (adaptive)
+	{
+		for (const SEngine* pEngine : engines)
+		{
+			if (!pEngine->adaptiveInFlight)
+			{
+				std::cerr << "Engine " << pEngine->name << " has no adaptive depth for --inflight auto" << std::endl;
+				return PrintUsage();
+			}
+		}
+	}
+	if (!extraFiles.empty())
+	{
+		if (randomAccess)
+		{
+			std::cerr << "--files can't be combined with --random" << std::endl;
+			return PrintUsage();
+		}
+		for (const SEngine* pEngine : engines)
+		{
+			if (!pEngine->fileSets)
+			{
+				std::cerr << "Engine " << pEngine->name << " reads a single file only" << std::endl;
+				return PrintUsage();
+			}
+		}
+	}
+
+	FILE* f = fopen(szFilename, "rb");
+	if (!f)
+	{
+		std::cerr << "Failed to open " << szFilename << std::endl;
+		return 1;
+	}
+	std::unique_ptr<FILE, decltype(&fclose)> fCloser(f, &fclose);
+
+#ifdef _WIN32
+	_fseeki64(f, 0, SEEK_END);
+	const int64 fsize = _ftelli64(f);
+#else
+	fseeko(f, 0, SEEK_END);
+	const int64 fsize = int64(ftello(f));
+#endif
+
+	// Generated files come with results of every stage, others are read once here.
+	SExpectedSums expectedSums;
+	uint64 referenceSum = 0;
+	SWorkload workload;
+	if (randomAccess)
+	{
+		if (!GenerateWorkload(workloadParams, uint64(fsize), workload))
+			return 1;
+		SetWorkload(&workload);
+		PrintWorkload(workload);
+		referenceSum = ComputeWorkloadSum(f, workload);
+	}
+	else if (LoadExpectedSums(szFilename, expectedSums))
+	{
+		SetExpectedSums(expectedSums);
+		GetExpectedSum(referenceSum);
+	}
+	else
+	{
+		referenceSum = ComputeReferenceSum(f);
+	}
+
+	// Engines report one sum over all files of the set
+	SFileSet fileSet;
+	if (!extraFiles.empty())
+	{
+		std::vector<std::string> names = { szFilename };
+		names.insert(names.end(), extraFiles.begin(), extraFiles.end());
+		if (!LoadFileSet(names, fileSet))
+			return 1;
+		for (const std::string& name : extraFiles)
+		{
+			std::unique_ptr<FILE, decltype(&fclose)> fExtra(fopen(name.c_str(), "rb"), &fclose);
+			if (!fExtra)
+				return 1;
+			referenceSum += ComputeReferenceSum(fExtra.get());
+		}
+		SetFileSet(&fileSet);
+		std::cout << "Files " << fileSet.names.size() << " MB " << fileSet.totalSize / 1024 / 1024 << std::endl;
+	}
+
+	FILE* fJson = szJson ? fopen(szJson, "wb") : nullptr;
+	FILE* fCsv = szCsv ? fopen(szCsv, "wb") : nullptr;
+	if ((szJson && !fJson) || (szCsv && !fCsv))
+	{
+		std::cerr << "Failed to open result file" << std::endl;
+		return 1;
+	}
+	if (fCsv)
+		fprintf(fCsv, "%s\n", s_csvHeader);
+
+	// Submission thread goes next to the device, workers and buffers follow --pin and --numa-buffers.
+	const int deviceNode = GetFileNumaNode(szFilename);
+	std::cout << "cpus " << GetCpus().size() << " nodes " << GetNumaNodeCount() << " device node " << deviceNode << std::endl;
+
+	std::vector<SRecord> records;
+	std::vector<SRunResult> results;
+	s_pRunResults = &results;
+
+	const size_t runCount = bufSizes.size() * inFlights.size() * workerCounts.size() * fences.size() * ioModes.size() * cacheControls.size() * bufferPools.size()
+		* pins.size() * pinSubmitters.size() * numaBuffersModes.size() * waits.size() * wakeOrders.size() * concurrencies.size() * submits.size() * reps * engines.size();
+	size_t runIdx = 0;
+	uint32 failedCount = 0;
+
+	for (uint32 bufSize : bufSizes)
+	for (const SInFlight& inFlight : inFlights)
+	for (uint32 workers : workerCounts)
+	for (const SFence& fence : fences)
+	for (SRunConfig::EIoMode ioMode : ioModes)
+	for (const SCacheControl& cache : cacheControls)
+	for (bool bufferPool : bufferPools)
+	for (const SPin& pin : pins)
+	for (bool pinSubmitter : pinSubmitters)
+	for (ENumaBuffers numaBuffers : numaBuffersModes)
+	for (const SWait& wait : waits)
+	for (EWakeOrder wakeOrder : wakeOrders)
+	for (uint32 concurrency : concurrencies)
+	for (const SSubmit& submit : submits)
+	for (uint32 rep = 0; rep < reps; ++rep)
+	for (const SEngine* pEngine : engines)
+	{
+		SRunConfig cfg;
+		cfg.bufSize = bufSize;
+		cfg.maxInFlight = inFlight.depth;
+		cfg.inFlightMode = inFlight.adaptive ? SRunConfig::EInFlightMode::Adaptive : SRunConfig::EInFlightMode::Default;
+		cfg.workerCount = workers;
+		cfg.fenceMode = fence.mode;
+		cfg.fenceInterval = fence.interval;
+		cfg.ioMode = ioMode;
+		cfg.checkExpectedSum = false;
+		cfg.bufferPool = bufferPool;
+		cfg.pinMode = pin.mode;
+		cfg.pinCpus = pin.cpus;
+		cfg.numaBuffers = numaBuffers;
+		cfg.deviceNode = deviceNode;
+		cfg.waitMode = wait.mode;
+		cfg.spinUs = wait.spinUs;
+		cfg.wakeOrder = wakeOrder;
+		cfg.portConcurrency = concurrency;
+		cfg.submit = submit.params;
+		SetRunConfig(cfg);
+
+		++runIdx;
+		std::cout << "Run " << runIdx << "/" << runCount << " " << pEngine->name
+			<< " buf " << bufSize << " inflight " << (inFlight.adaptive ? "auto:" : "") << inFlight.depth << " workers " << workers
+			<< (fence.mode != SRunConfig::EFenceMode::Default ? " fence " + fence.name : std::string())
+			<< " " << IoModeName(ioMode) << " cache " << GetCacheStateName(cache.state)
+			<< " pool " << (bufferPool ? "on" : "off") << " pin " << pin.name << (pinSubmitter ? " pinned submitter" : "")
+			<< " buffers " << GetNumaBuffersName(numaBuffers) << " wait " << wait.name
+			<< " wake " << GetWakeOrderName(wakeOrder) << " concurrency " << concurrency << " submit " << submit.name << " rep " << rep << std::endl;
+
+		// After everything else, so the reference sum and the previous run don't leave the file cached.
+		double residency = PrepareFileCache(szFilename, cache);
+		// Lowest of the set, a single cold file is what the engine waits for
+		for (size_t i = 1; i < fileSet.names.size(); ++i)
+			residency = std::min(residency, PrepareFileCache(fileSet.names[i].c_str(), cache));
+
+		results.clear();
+		SNodeTraffic traffic;
+		{
+			CNodeAffinityScope submitterScope(pinSubmitter ? deviceNode : -1);
+			CNodeTrafficCounter trafficCounter;
+			trafficCounter.Start();
+			pEngine->func(szFilename, f, fsize);
+			traffic = trafficCounter.Stop();
+		}
+		if (results.empty())
+		{
+			std::cerr << "No result from " << pEngine->name << std::endl;
+			++failedCount;
+			continue;
+		}
+
+		for (const SRunResult& res : results)
+		{
+			SRecord r{ rep, pEngine->name, cache, residency, bufferPool, pin.name.c_str(), pinSubmitter, numaBuffers, wait.name.c_str(), wakeOrder, submit.name.c_str(), traffic, res, res.sum == referenceSum };
+			if (!r.sumOk)
+			{
+				std::cerr << pEngine->name << " sum " << res.sum << " differs from " << referenceSum << std::endl;
+				++failedCount;
+			}
+			if (fJson)
+				WriteJson(fJson, r);
+			if (fCsv)
+				WriteCsv(fCsv, r);
+			records.push_back(r);
+		}
+	}
+
+	s_pRunResults = nullptr;
+	SetRunConfig(SRunConfig());
+	SetWorkload(nullptr);
+	SetFileSet(nullptr);
+	if (fJson)
+		fclose(fJson);
+	if (fCsv)
+		fclose(fCsv);
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << s_csvHeader << std::endl;
+	for (const SRecord& r : records)
+		WriteCsv(stdout, r);
+	std::cout << "runs " << records.size() << " failed " << failedCount << std::endl;
+	std::cout << std::endl;
+	return failedCount ? 2 : 0;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "common.h"
+#include "bufferpool.h"
+#include "compport.h"
+#include "histogram.h"
+#include "numa.h"
+#include "spinwait.h"
+#include "submitplan.h"
+
+// Parameters tests take instead of their built-in constants, so they can be swept without recompiling.
+// Zero / Default keeps what the test uses on its own.
+struct SRunConfig
+{
+	enum class EIoMode
+	{
+		Default,
+		Buffered,
+		Unbuffered,
+	};
+
+	enum class EInFlightMode
+	{
+		Default,
+		Fixed,
+		// maxInFlight is the cap, see inflight.h
+		Adaptive,
+	};
+
+	// Where Test10 signals its fence, see dsqueue.h
+	enum class EFenceMode
+	{
+		Default,
+		Request,
+		// Every fenceInterval requests
+		Interval,
+		Batch,
+	};
+
+	uint32 bufSize = 0;
+	uint32 maxInFlight = 0;
+	EInFlightMode inFlightMode = EInFlightMode::Default;
+	EFenceMode fenceMode = EFenceMode::Default;
+	uint32 fenceInterval = 0;
+	uint32 workerCount = 0;
+	EIoMode ioMode = EIoMode::Default;
+	// Tests compare sum with the one of the original test file, runner checks sums itself.
+	bool checkExpectedSum = true;
+	// IO buffers come from the shared pre-faulted pool, see bufferpool.h
+	bool bufferPool = true;
+	// Worker threads pin themselves, see numa.h
+	EPinMode pinMode = EPinMode::None;
+	std::vector<uint32> pinCpus;
+	ENumaBuffers numaBuffers = ENumaBuffers::FirstTouch;
+	// Node of the storage device, -1 when unknown
+	int deviceNode = -1;
+	// How workers wait for completions, see spinwait.h. Zero spinUs is the default budget.
+	EWaitMode waitMode = EWaitMode::Block;
+	uint32 spinUs = 0;
+	// Which sleeping worker CCompletionPort wakes and how many run at once, see compport.h. Zero is CPU count.
+	EWakeOrder wakeOrder = EWakeOrder::Lifo;
+	uint32 portConcurrency = 0;
+	// Merging and splitting of requests before they are submitted, see submitplan.h
+	SSubmitParams submit;
+
+	uint32 GetBufSize(uint32 testDefault) const { return bufSize ? bufSize : testDefault; }
+	uint32 GetMaxInFlight(uint32 testDefault) const { return maxInFlight ? maxInFlight : testDefault; }
+	uint32 GetWorkerCount(uint32 testDefault) const { return workerCount ? workerCount : testDefault; }
+	bool GetUnbufferedIo(bool testDefault) const { return ioMode == EIoMode::Default ? testDefault : ioMode == EIoMode::Unbuffered; }
+	bool GetAdaptiveInFlight(bool testDefault) const { return inFlightMode == EInFlightMode::Default ? testDefault : inFlightMode == EInFlightMode::Adaptive; }
+};
+
+const SRunConfig& GetRunConfig();
+void SetRunConfig(const SRunConfig& cfg);
+
+// What a test actually ran with and what it measured. Tests hand it to ReportRunResult at the end.
+struct SRunResult
+{
+	const char* engine = "";
+	uint32 bufSize = 0;
+	uint32 maxInFlight = 0;
+	// Depth the adaptive controller ended at, 0 for fixed depth
+	uint32 settledInFlight = 0;
+	// Requests per fence signal, 0 for engines without fences
+	uint32 fenceGroup = 0;
+	uint32 workerCount = 0;
+	// Running workers the completion port allows, 0 for engines without one
+	uint32 concurrency = 0;
+	bool unbuffered = false;
+
+	uint64 bytes = 0;
+	uint64 requests = 0;
+	// Device reads after merging and splitting, 0 when every request went out as it is
+	uint64 reads = 0;
+	// Files streamed at once and Jain's index of their throughput, -1 for a single file, see fileset.h
+	uint32 fileCount = 1;
+	double fairness = -1;
+	uint64 sum = 0;
+	STimestamp totalTime{};
+	CLatencyHistogram latency;
+	// Whole process, between start and end of the timed part
+	SPageFaults pageFaults;
+	// Waits that blocked and had to be woken up, -1 when the engine doesn't count them
+	int64 wakeups = -1;
+	// Whole process, spinning included
+	SCpuTime cpuTime;
+	SSpinWaitStats spin;
+	// Completions handled by a different worker than the previous one, -1 when not counted
+	int64 switches = -1;
+};
+
+// Collected by the matrix runner, ignored otherwise.
+void ReportRunResult(const SRunResult& result);
+
+// WinIO bench <file> [options], see bench.cpp. Returns exit code.
+int RunBenchmarkMatrix(int argc, char** argv);
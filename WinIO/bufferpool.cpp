@@ -0,0 +1,315 @@
+#include "bufferpool.h"
+#include "bench.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#include <psapi.h>
+#endif
+
+static constexpr size_t s_slotAlignment = 4096;
+static constexpr size_t s_hugePageSize = 2 * 1024 * 1024;
+
+static const char* s_backingNames[] = { "hugepages", "thp", "normal" };
+
+const char* GetPoolBackingName(EPoolBacking backing)
+{
+	return s_backingNames[size_t(backing)];
+}
+
+void FreePoolSlot(CBufferPool* pPool, void* ptr)
+{
+	pPool->Free(ptr);
+}
+
+CBufferPool::~CBufferPool()
+{
+	Release();
+}
+
+#ifdef _WIN32
+
+// Large pages need SeLockMemoryPrivilege, held by accounts that got "Lock pages in memory" in the local policy.
+static bool EnableLockMemoryPrivilege()
+{
+	HANDLE hToken = nullptr;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+		return false;
+	TOKEN_PRIVILEGES tp{};
+	tp.PrivilegeCount = 1;
+	tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool ok = LookupPrivilegeValueW(nullptr, L"SeLockMemoryPrivilege", &tp.Privileges[0].Luid)
+		&& AdjustTokenPrivileges(hToken, FALSE, &tp, 0, nullptr, nullptr)
+		&& GetLastError() == ERROR_SUCCESS;
+	CloseHandle(hToken);
+	return ok;
+}
+
+static char* MapArena(size_t& size, EPoolBacking& backing, bool& locked)
+{
+	static const bool s_canUseLargePages = EnableLockMemoryPrivilege();
+	const size_t largePage = GetLargePageMinimum();
+	if (s_canUseLargePages && largePage)
+	{
+		const size_t largeSize = (size + largePage - 1) / largePage * largePage;
+		void* p = VirtualAlloc(nullptr, largeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (p)
+		{
+			size = largeSize;
+			backing = EPoolBacking::HugePages;
+			// Large pages are never paged out
+			locked = true;
+			return static_cast<char*>(p);
+		}
+	}
+
+	void* p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!p)
+		return nullptr;
+	backing = EPoolBacking::Normal;
+
+	// VirtualLock is limited by the minimum working set, raise it by the arena size first.
+	SIZE_T minWs = 0;
+	SIZE_T maxWs = 0;
+	if (GetProcessWorkingSetSize(GetCurrentProcess(), &minWs, &maxWs))
+		SetProcessWorkingSetSize(GetCurrentProcess(), minWs + size, std::max(maxWs, minWs + size));
+	locked = VirtualLock(p, size) != 0;
+	return static_cast<char*>(p);
+}
+
+static void UnmapArena(char* p, size_t size, bool locked)
+{
+	if (locked)
+		VirtualUnlock(p, size);
+	VirtualFree(p, 0, MEM_RELEASE);
+}
+
+#else
+
+static char* MapArena(size_t& size, EPoolBacking& backing, bool& locked)
+{
+	const size_t hugeSize = (size + s_hugePageSize - 1) / s_hugePageSize * s_hugePageSize;
+
+	// Needs pages reserved in /proc/sys/vm/nr_hugepages
+	void* p = mmap(nullptr, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+	{
+		size = hugeSize;
+		backing = EPoolBacking::HugePages;
+	}
+	else
+	{
+		// THP only backs 2 MiB aligned ranges, map more and cut the unaligned ends off.
+		void* pRaw = mmap(nullptr, hugeSize + s_hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (pRaw == MAP_FAILED)
+			return nullptr;
+		char* pAligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(pRaw) + s_hugePageSize - 1) / s_hugePageSize * s_hugePageSize);
+		const size_t head = size_t(pAligned - static_cast<char*>(pRaw));
+		if (head)
+			munmap(pRaw, head);
+		if (s_hugePageSize - head)
+			munmap(pAligned + hugeSize, s_hugePageSize - head);
+		p = pAligned;
+		size = hugeSize;
+		backing = madvise(p, size, MADV_HUGEPAGE) == 0 ? EPoolBacking::Thp : EPoolBacking::Normal;
+	}
+
+	// Limited by RLIMIT_MEMLOCK, pool still works unlocked.
+	locked = mlock(p, size) == 0;
+	return static_cast<char*>(p);
+}
+
+static void UnmapArena(char* p, size_t size, bool locked)
+{
+	if (locked)
+		munlock(p, size);
+	munmap(p, size);
+}
+
+#endif
+
+bool CBufferPool::Init(size_t slotSize, uint32 slotCount)
+{
+	PROF_FUNC();
+
+	Release();
+
+	m_slotSize = (slotSize + s_slotAlignment - 1) / s_slotAlignment * s_slotAlignment;
+	m_arenaSize = m_slotSize * slotCount;
+	m_pArena = MapArena(m_arenaSize, m_backing, m_locked);
+	if (!m_pArena)
+	{
+		std::cerr << "Failed to allocate buffer pool of " << m_arenaSize << " bytes" << std::endl;
+		m_arenaSize = 0;
+		return false;
+	}
+
+	// Writes, so every page is really backed and not just mapped to the zero page.
+	{
+		PROF_REGION("prefault");
+		for (size_t off = 0; off < m_arenaSize; off += s_slotAlignment)
+			m_pArena[off] = 0;
+	}
+
+	m_slotCount = slotCount;
+	m_pNext.reset(new std::atomic<uint32>[slotCount]);
+	for (uint32 i = 0; i < slotCount; ++i)
+		m_pNext[i].store(i + 1 < slotCount ? i + 2 : 0, std::memory_order_relaxed);
+	m_head.store(slotCount ? 1 : 0, std::memory_order_relaxed);
+	m_freeCount.store(slotCount, std::memory_order_relaxed);
+	return true;
+}
+
+void CBufferPool::Release()
+{
+	if (m_freeCount.load(std::memory_order_relaxed) != m_slotCount)
+		std::cerr << "Buffer pool released with " << m_slotCount - m_freeCount.load() << " slots in use" << std::endl;
+	if (m_pArena)
+		UnmapArena(m_pArena, m_arenaSize, m_locked);
+	m_pArena = nullptr;
+	m_arenaSize = 0;
+	m_slotCount = 0;
+	m_pNext.reset();
+	m_head.store(0, std::memory_order_relaxed);
+	m_freeCount.store(0, std::memory_order_relaxed);
+}
+
+AlignedUniquePtr CBufferPool::Alloc()
+{
+	uint64 head = m_head.load(std::memory_order_acquire);
+	while (true)
+	{
+		const uint32 top = uint32(head);
+		if (top == 0)
+			return nullptr;
+		const uint64 next = m_pNext[top - 1].load(std::memory_order_relaxed);
+		const uint64 newHead = ((head >> 32) + 1) << 32 | next;
+		if (m_head.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire))
+		{
+			m_freeCount.fetch_sub(1, std::memory_order_relaxed);
+			return AlignedUniquePtr(m_pArena + size_t(top - 1) * m_slotSize, AlignedArrDeleter{ this });
+		}
+	}
+}
+
+void CBufferPool::Free(void* ptr)
+{
+	const uint32 slot = uint32((static_cast<char*>(ptr) - m_pArena) / m_slotSize);
+	uint64 head = m_head.load(std::memory_order_relaxed);
+	while (true)
+	{
+		m_pNext[slot].store(uint32(head), std::memory_order_relaxed);
+		const uint64 newHead = ((head >> 32) + 1) << 32 | (slot + 1);
+		if (m_head.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed))
+			break;
+	}
+	m_freeCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+static CBufferPool s_ioPool;
+static bool s_lastRunUsedPool = false;
+
+// Placement the pool slots were last moved to, so repeated runs don't migrate pages again.
+struct SIoBufferPlacement
+{
+	const char* pArena = nullptr;
+	ENumaBuffers mode = ENumaBuffers::FirstTouch;
+	int deviceNode = -1;
+	EPinMode pinMode = EPinMode::None;
+	std::vector<uint32> pinCpus;
+
+	bool operator==(const SIoBufferPlacement& o) const
+	{
+		return pArena == o.pArena && mode == o.mode && deviceNode == o.deviceNode && pinMode == o.pinMode && pinCpus == o.pinCpus;
+	}
+};
+static SIoBufferPlacement s_ioPlacement;
+
+static void PlaceIoBuffers(const SRunConfig& cfg)
+{
+	SIoBufferPlacement placement{ s_ioPool.GetSlot(0), cfg.numaBuffers, cfg.deviceNode, cfg.pinMode, cfg.pinCpus };
+	if (placement == s_ioPlacement || GetNumaNodeCount() < 2)
+		return;
+	s_ioPlacement = placement;
+
+	PROF_FUNC();
+	const uint32 nodeCount = GetNumaNodeCount();
+	for (uint32 i = 0; i < s_ioPool.GetSlotCount(); ++i)
+	{
+		// First touch after an earlier move goes back to the node Init would have faulted them in on.
+		int node = cfg.numaBuffers == ENumaBuffers::Device ? cfg.deviceNode : GetCurrentThreadNode();
+		if (cfg.numaBuffers == ENumaBuffers::Spread)
+		{
+			const int cpu = GetWorkerCpu(cfg.pinMode, cfg.pinCpus, i);
+			node = cpu >= 0 ? GetCpuNode(uint32(cpu)) : int(i % nodeCount);
+		}
+		if (node >= 0)
+			BindMemoryToNode(s_ioPool.GetSlot(i), s_ioPool.GetSlotSize(), node);
+	}
+}
+
+bool ReserveIoBuffers(size_t size, uint32 count)
+{
+	s_lastRunUsedPool = false;
+	if (!GetRunConfig().bufferPool)
+		return false;
+
+	if (s_ioPool.GetSlotSize() < size || s_ioPool.GetSlotCount() < count)
+	{
+		// Can't move slots that are still in use, this run gets heap buffers then.
+		if (s_ioPool.GetFreeCount() != s_ioPool.GetSlotCount())
+			return false;
+		if (!s_ioPool.Init(std::max(size, s_ioPool.GetSlotSize()), std::max(count, s_ioPool.GetSlotCount())))
+			return false;
+	}
+	PlaceIoBuffers(GetRunConfig());
+	s_lastRunUsedPool = true;
+	return true;
+}
+
+AlignedUniquePtr AllocIoBuffer(size_t size, size_t alignment)
+{
+	if (s_lastRunUsedPool && size <= s_ioPool.GetSlotSize() && alignment <= s_slotAlignment)
+	{
+		if (AlignedUniquePtr p = s_ioPool.Alloc())
+			return p;
+	}
+	return AlignedAlloc(size, alignment);
+}
+
+void PrintIoBuffers()
+{
+	if (s_lastRunUsedPool)
+	{
+		std::cout << "buffers pool " << s_ioPool.GetSlotCount() << " x " << s_ioPool.GetSlotSize()
+			<< " " << GetPoolBackingName(s_ioPool.GetBacking()) << (s_ioPool.IsLocked() ? " locked" : "") << std::endl;
+	}
+	else
+	{
+		std::cout << "buffers heap" << std::endl;
+	}
+}
+
+SPageFaults SPageFaults::Now()
+{
+	SPageFaults res;
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc{};
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		res.minor = int64(pmc.PageFaultCount);
+#else
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	res.minor = usage.ru_minflt;
+	res.major = usage.ru_majflt;
+#endif
+	return res;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <memory>
+
+// IO buffers from one arena that is allocated once, backed by huge pages where possible, locked and pre-faulted.
+// Freshly allocated buffers take a page fault and a TLB miss on first touch, which the first reads
+// into them pay for. Pool slots are faulted in before any test starts and stay mapped between runs.
+
+enum class EPoolBacking
+{
+	// MAP_HUGETLB on Linux, MEM_LARGE_PAGES on Windows
+	HugePages,
+	// Transparent huge pages, Linux only
+	Thp,
+	Normal,
+};
+
+const char* GetPoolBackingName(EPoolBacking backing);
+
+class CBufferPool
+{
+public:
+	CBufferPool() = default;
+	~CBufferPool();
+	CBufferPool(const CBufferPool&) = delete;
+	CBufferPool& operator=(const CBufferPool&) = delete;
+
+	// slotSize is rounded up to 4 KiB, slots are 4 KiB aligned.
+	bool Init(size_t slotSize, uint32 slotCount);
+	void Release();
+
+	// nullptr when all slots are taken. Deleter returns the slot.
+	AlignedUniquePtr Alloc();
+	void Free(void* ptr);
+	char* GetSlot(uint32 slot) const { return m_pArena + size_t(slot) * m_slotSize; }
+
+	size_t GetSlotSize() const { return m_slotSize; }
+	uint32 GetSlotCount() const { return m_slotCount; }
+	uint32 GetFreeCount() const { return m_freeCount.load(std::memory_order_relaxed); }
+	EPoolBacking GetBacking() const { return m_backing; }
+	bool IsLocked() const { return m_locked; }
+
+private:
+	char* m_pArena = nullptr;
+	size_t m_arenaSize = 0;
+	size_t m_slotSize = 0;
+	uint32 m_slotCount = 0;
+	EPoolBacking m_backing = EPoolBacking::Normal;
+	bool m_locked = false;
+
+	// Treiber stack of slot indices. Low 32 bits are top slot + 1 (0 when empty), high 32 bits count
+	// changes, so a pop that raced with pop+push of the same slot fails its CAS instead of corrupting the list.
+	alignas(128) std::atomic<uint64> m_head = { 0 };
+	std::unique_ptr<std::atomic<uint32>[]> m_pNext;
+	std::atomic<uint32> m_freeCount = { 0 };
+};
+
+// Pool shared by all engines. Grows (is recreated) when a run needs more or bigger slots,
+// otherwise the next run gets the same, already faulted memory.
+bool ReserveIoBuffers(size_t size, uint32 count);
+// Slot of the shared pool when the run config enables it and it fits, aligned heap allocation otherwise.
+AlignedUniquePtr AllocIoBuffer(size_t size, size_t alignment);
+// "pool 16 x 524288 thp locked" or "heap", for test reports.
+void PrintIoBuffers();
+
+struct SPageFaults
+{
+	int64 minor = 0;
+	// Windows doesn't tell them apart, everything is in minor
+	int64 major = 0;
+
+	static SPageFaults Now();
+
+	SPageFaults operator-(const SPageFaults& o) const { return SPageFaults{ minor - o.minor, major - o.major }; }
+};
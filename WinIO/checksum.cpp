@@ -0,0 +1,454 @@
+#include "checksum.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SUM_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define SUM_X86 0
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SUM_TARGET(T)
+#else
+#define SUM_TARGET(T) __attribute__((target(T)))
+#endif
+
+
+static uint64 SumScalar(const char* pBuf, size_t size)
+{
+	uint64 s = 0;
+	for (const char* p = pBuf; p < (pBuf + size); ++p)
+	{
+		s += (uint8)*p;
+	}
+	return s;
+}
+
+#if SUM_X86
+
+// PSADBW against zero sums each 8 bytes into a 64-bit lane, so lanes can't overflow
+// and 4 independent accumulators keep the adder ports busy.
+
+SUM_TARGET("sse2")
+static uint64 SumSse2(const char* pBuf, size_t size)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+
+	const char* p = pBuf;
+	const char* pEnd = pBuf + size;
+	for (; p + 64 <= pEnd; p += 64)
+	{
+		acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0)), zero));
+		acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16)), zero));
+		acc2 = _mm_add_epi64(acc2, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32)), zero));
+		acc3 = _mm_add_epi64(acc3, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 48)), zero));
+	}
+	for (; p + 16 <= pEnd; p += 16)
+	{
+		acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), zero));
+	}
+
+	const __m128i acc = _mm_add_epi64(_mm_add_epi64(acc0, acc1), _mm_add_epi64(acc2, acc3));
+	alignas(16) uint64 lanes[2];
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+	return lanes[0] + lanes[1] + SumScalar(p, size_t(pEnd - p));
+}
+
+SUM_TARGET("avx2")
+static uint64 SumAvx2(const char* pBuf, size_t size)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+
+	const char* p = pBuf;
+	const char* pEnd = pBuf + size;
+	for (; p + 128 <= pEnd; p += 128)
+	{
+		acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 0)), zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32)), zero));
+		acc2 = _mm256_add_epi64(acc2, _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 64)), zero));
+		acc3 = _mm256_add_epi64(acc3, _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 96)), zero));
+	}
+	for (; p + 32 <= pEnd; p += 32)
+	{
+		acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), zero));
+	}
+
+	const __m256i acc = _mm256_add_epi64(_mm256_add_epi64(acc0, acc1), _mm256_add_epi64(acc2, acc3));
+	alignas(32) uint64 lanes[4];
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + SumScalar(p, size_t(pEnd - p));
+}
+
+SUM_TARGET("avx512f,avx512bw")
+static uint64 SumAvx512(const char* pBuf, size_t size)
+{
+	const __m512i zero = _mm512_setzero_si512();
+	__m512i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+
+	const char* p = pBuf;
+	const char* pEnd = pBuf + size;
+	for (; p + 256 <= pEnd; p += 256)
+	{
+		acc0 = _mm512_add_epi64(acc0, _mm512_sad_epu8(_mm512_loadu_si512(p + 0), zero));
+		acc1 = _mm512_add_epi64(acc1, _mm512_sad_epu8(_mm512_loadu_si512(p + 64), zero));
+		acc2 = _mm512_add_epi64(acc2, _mm512_sad_epu8(_mm512_loadu_si512(p + 128), zero));
+		acc3 = _mm512_add_epi64(acc3, _mm512_sad_epu8(_mm512_loadu_si512(p + 192), zero));
+	}
+	for (; p + 64 <= pEnd; p += 64)
+	{
+		acc0 = _mm512_add_epi64(acc0, _mm512_sad_epu8(_mm512_loadu_si512(p), zero));
+	}
+
+	const __m512i acc = _mm512_add_epi64(_mm512_add_epi64(acc0, acc1), _mm512_add_epi64(acc2, acc3));
+	alignas(64) uint64 lanes[8];
+	_mm512_store_si512(lanes, acc);
+	uint64 s = 0;
+	for (uint64 l : lanes)
+		s += l;
+	return s + SumScalar(p, size_t(pEnd - p));
+}
+
+struct SCpuFeatures
+{
+	bool sse2 = false;
+	bool sse42 = false;
+	bool avx2 = false;
+	bool avx512bw = false;
+};
+
+static void Cpuid(uint32 leaf, uint32 subleaf, uint32 (&regs)[4])
+{
+#ifdef _MSC_VER
+	int r[4];
+	__cpuidex(r, int(leaf), int(subleaf));
+	for (int i = 0; i < 4; ++i)
+		regs[i] = uint32(r[i]);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64 Xgetbv(uint32 idx)
+{
+#ifdef _MSC_VER
+	return _xgetbv(idx);
+#else
+	uint32 eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(idx));
+	return (uint64(edx) << 32) | eax;
+#endif
+}
+
+static SCpuFeatures DetectCpuFeatures()
+{
+	SCpuFeatures f;
+
+	uint32 regs[4] = {};
+	Cpuid(0, 0, regs);
+	const uint32 maxLeaf = regs[0];
+
+	Cpuid(1, 0, regs);
+	f.sse2 = (regs[3] & (1u << 26)) != 0;
+	f.sse42 = (regs[2] & (1u << 20)) != 0;
+
+	// Wide registers are usable only if OS saves their state, check XCR0 as well.
+	const bool osxsave = (regs[2] & (1u << 27)) != 0;
+	const uint64 xcr0 = osxsave ? Xgetbv(0) : 0;
+	const bool osAvx = (xcr0 & 0x6) == 0x6;
+	const bool osAvx512 = (xcr0 & 0xe6) == 0xe6;
+
+	if (maxLeaf >= 7)
+	{
+		Cpuid(7, 0, regs);
+		f.avx2 = osAvx && (regs[1] & (1u << 5)) != 0;
+		const bool avx512f = (regs[1] & (1u << 16)) != 0;
+		const bool avx512bw = (regs[1] & (1u << 30)) != 0;
+		f.avx512bw = osAvx512 && avx512f && avx512bw;
+	}
+
+	return f;
+}
+
+static const SCpuFeatures& CpuFeatures()
+{
+	static const SCpuFeatures f = DetectCpuFeatures();
+	return f;
+}
+
+#endif // SUM_X86
+
+
+static std::array<SSumKernel, SUM_X86 ? 4 : 1> InitSumKernels()
+{
+#if SUM_X86
+	const SCpuFeatures& f = CpuFeatures();
+	return { {
+		{ "scalar", &SumScalar, true },
+		{ "sse2", &SumSse2, f.sse2 },
+		{ "avx2", &SumAvx2, f.avx2 },
+		{ "avx512bw", &SumAvx512, f.avx512bw },
+	} };
+#else
+	return { {
+		{ "scalar", &SumScalar, true },
+	} };
+#endif
+}
+
+static const auto& SumKernels()
+{
+	static const auto kernels = InitSumKernels();
+	return kernels;
+}
+
+const SSumKernel* GetSumKernels(size_t& count)
+{
+	count = SumKernels().size();
+	return SumKernels().data();
+}
+
+const SSumKernel& GetActiveSumKernel()
+{
+	static const SSumKernel& active = []() -> const SSumKernel&
+	{
+		const auto& kernels = SumKernels();
+		// Last supported one is the widest.
+		const SSumKernel* pBest = &kernels[0];
+		for (const SSumKernel& k : kernels)
+		{
+			if (k.supported)
+				pBest = &k;
+		}
+		return *pBest;
+	}();
+	return active;
+}
+
+static uint64 SumResolve(const char* pBuf, size_t size)
+{
+	const SumFunc func = GetActiveSumKernel().func;
+	g_sumFunc.store(func, std::memory_order_relaxed);
+	return func(pBuf, size);
+}
+
+// Constant initialized, so sum() is safe to call at any point, even before dynamic init.
+std::atomic<SumFunc> g_sumFunc = { &SumResolve };
+
+
+static uint64 ReadU64(const char* p)
+{
+	uint64 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32 ReadU32(const char* p)
+{
+	uint32 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+// CRC32C (Castagnoli), reflected polynomial 0x82F63B78. Table version is fallback for CPUs without SSE4.2.
+
+static const std::array<uint32, 256>& Crc32cTable()
+{
+	static const std::array<uint32, 256> table = []()
+	{
+		std::array<uint32, 256> t{};
+		for (uint32 i = 0; i < 256; ++i)
+		{
+			uint32 c = i;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : (c >> 1);
+			t[i] = c;
+		}
+		return t;
+	}();
+	return table;
+}
+
+static uint32 Crc32cSoft(uint32 crc, const char* pBuf, size_t size)
+{
+	const auto& table = Crc32cTable();
+	crc = ~crc;
+	for (const char* p = pBuf; p < (pBuf + size); ++p)
+		crc = table[(crc ^ uint8(*p)) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+#if SUM_X86
+SUM_TARGET("sse4.2")
+static uint32 Crc32cHw(uint32 crc, const char* pBuf, size_t size)
+{
+	const char* p = pBuf;
+	const char* pEnd = pBuf + size;
+	uint64 c = ~crc;
+#if defined(_M_X64) || defined(__x86_64__)
+	for (; p + 8 <= pEnd; p += 8)
+		c = _mm_crc32_u64(c, ReadU64(p));
+#endif
+	uint32 c32 = uint32(c);
+	for (; p + 4 <= pEnd; p += 4)
+		c32 = _mm_crc32_u32(c32, ReadU32(p));
+	for (; p < pEnd; ++p)
+		c32 = _mm_crc32_u8(c32, uint8(*p));
+	return ~c32;
+}
+#endif
+
+uint32 Crc32c(uint32 crc, const char* pBuf, size_t size)
+{
+#if SUM_X86
+	if (CpuFeatures().sse42)
+		return Crc32cHw(crc, pBuf, size);
+#endif
+	return Crc32cSoft(crc, pBuf, size);
+}
+
+
+// xxHash64, port of the reference implementation.
+
+static constexpr uint64 s_xxPrime1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64 s_xxPrime2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64 s_xxPrime3 = 0x165667B19E3779F9ull;
+static constexpr uint64 s_xxPrime4 = 0x85EBCA77C2B2AE63ull;
+static constexpr uint64 s_xxPrime5 = 0x27D4EB2F165667C5ull;
+
+static uint64 Rotl64(uint64 v, int r)
+{
+	return (v << r) | (v >> (64 - r));
+}
+
+static uint64 XxRound(uint64 acc, uint64 input)
+{
+	acc += input * s_xxPrime2;
+	acc = Rotl64(acc, 31);
+	return acc * s_xxPrime1;
+}
+
+static uint64 XxMergeRound(uint64 acc, uint64 val)
+{
+	acc ^= XxRound(0, val);
+	return acc * s_xxPrime1 + s_xxPrime4;
+}
+
+uint64 XxHash64(const char* pBuf, size_t size, uint64 seed)
+{
+	const char* p = pBuf;
+	const char* pEnd = pBuf + size;
+	uint64 h;
+
+	if (size >= 32)
+	{
+		uint64 v1 = seed + s_xxPrime1 + s_xxPrime2;
+		uint64 v2 = seed + s_xxPrime2;
+		uint64 v3 = seed;
+		uint64 v4 = seed - s_xxPrime1;
+		for (; p + 32 <= pEnd; p += 32)
+		{
+			v1 = XxRound(v1, ReadU64(p + 0));
+			v2 = XxRound(v2, ReadU64(p + 8));
+			v3 = XxRound(v3, ReadU64(p + 16));
+			v4 = XxRound(v4, ReadU64(p + 24));
+		}
+		h = Rotl64(v1, 1) + Rotl64(v2, 7) + Rotl64(v3, 12) + Rotl64(v4, 18);
+		h = XxMergeRound(h, v1);
+		h = XxMergeRound(h, v2);
+		h = XxMergeRound(h, v3);
+		h = XxMergeRound(h, v4);
+	}
+	else
+	{
+		h = seed + s_xxPrime5;
+	}
+
+	h += uint64(size);
+
+	for (; p + 8 <= pEnd; p += 8)
+	{
+		h ^= XxRound(0, ReadU64(p));
+		h = Rotl64(h, 27) * s_xxPrime1 + s_xxPrime4;
+	}
+	if (p + 4 <= pEnd)
+	{
+		h ^= uint64(ReadU32(p)) * s_xxPrime1;
+		h = Rotl64(h, 23) * s_xxPrime2 + s_xxPrime3;
+		p += 4;
+	}
+	for (; p < pEnd; ++p)
+	{
+		h ^= uint64(uint8(*p)) * s_xxPrime5;
+		h = Rotl64(h, 11) * s_xxPrime1;
+	}
+
+	h ^= h >> 33;
+	h *= s_xxPrime2;
+	h ^= h >> 29;
+	h *= s_xxPrime3;
+	h ^= h >> 32;
+	return h;
+}
+
+
+// Hash stages work on fixed blocks and add up block hashes, so result doesn't depend on
+// completion order and on buffer size, as long as buffers start at multiples of s_processingBlockSize.
+
+static uint64 ProcessByteSum(const char* pBuf, size_t size)
+{
+	return sum(pBuf, size);
+}
+
+static uint64 ProcessCrc32c(const char* pBuf, size_t size)
+{
+	uint64 s = 0;
+	for (size_t off = 0; off < size; off += s_processingBlockSize)
+		s += Crc32c(0, pBuf + off, std::min(s_processingBlockSize, size - off));
+	return s;
+}
+
+static uint64 ProcessXxHash64(const char* pBuf, size_t size)
+{
+	uint64 s = 0;
+	for (size_t off = 0; off < size; off += s_processingBlockSize)
+		s += XxHash64(pBuf + off, std::min(s_processingBlockSize, size - off), 0);
+	return s;
+}
+
+static const std::array<SProcessingStage, size_t(EProcessingStage::Count)> s_processingStages = { {
+	{ EProcessingStage::ByteSum, "bytesum", &ProcessByteSum },
+	{ EProcessingStage::Crc32c, "crc32c", &ProcessCrc32c },
+	{ EProcessingStage::XxHash64, "xxhash64", &ProcessXxHash64 },
+} };
+
+const SProcessingStage& GetProcessingStage(EProcessingStage stage)
+{
+	return s_processingStages[size_t(stage)];
+}
+
+static std::atomic<const SProcessingStage*> s_pActiveStage = { &s_processingStages[0] };
+
+const SProcessingStage& GetActiveProcessingStage()
+{
+	return *s_pActiveStage.load(std::memory_order_relaxed);
+}
+
+void SetProcessingStage(EProcessingStage stage)
+{
+	s_pActiveStage.store(&GetProcessingStage(stage), std::memory_order_relaxed);
+	g_processFunc.store(GetProcessingStage(stage).func, std::memory_order_relaxed);
+}
+
+std::atomic<SumFunc> g_processFunc = { &ProcessByteSum };
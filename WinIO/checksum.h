@@ -0,0 +1,48 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+
+struct SSumKernel
+{
+	const char* name;
+	SumFunc func;
+	bool supported;
+};
+
+// All kernels compiled in, with support flags filled from CPUID.
+const SSumKernel* GetSumKernels(size_t& count);
+
+// Kernel used by sum(), picked on first call.
+const SSumKernel& GetActiveSumKernel();
+
+
+uint32 Crc32c(uint32 crc, const char* pBuf, size_t size);
+uint64 XxHash64(const char* pBuf, size_t size, uint64 seed);
+
+
+enum class EProcessingStage
+{
+	ByteSum,
+	Crc32c,
+	XxHash64,
+
+	Count
+};
+
+// Hash stages are computed per block of this size and summed up, see checksum.cpp
+static constexpr size_t s_processingBlockSize = 64 * 1024;
+
+struct SProcessingStage
+{
+	EProcessingStage id;
+	const char* name;
+	SumFunc func;
+};
+
+const SProcessingStage& GetProcessingStage(EProcessingStage stage);
+
+// Stage used by process()
+const SProcessingStage& GetActiveProcessingStage();
+void SetProcessingStage(EProcessingStage stage);
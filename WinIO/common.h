@@ -2,16 +2,39 @@
 
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <atomic>
 #include <cstdint>
+#include <cstdlib>
 #include <chrono>
+#include <memory>
+
+#include "trace.h"
+
+#define PROF_CONCAT_IMPL(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT_IMPL(a, b)
+
+#ifdef _WIN32
 
 #include "wininclude.h"
 
 #define USE_PIX
 #include <pix3.h>
 
-#define PROF_FUNC() PIXScopedEvent(PIX_COLOR_INDEX(0), __FUNCTION__)
-#define PROF_REGION(NAME) PIXScopedEvent(PIX_COLOR_INDEX(1), NAME)
+// PIX events and the built-in trace, see trace.h
+#define PROF_FUNC() PIXScopedEvent(PIX_COLOR_INDEX(0), __FUNCTION__); CTraceScope PROF_CONCAT(traceScope_, __LINE__)(__FUNCTION__)
+#define PROF_REGION(NAME) PIXScopedEvent(PIX_COLOR_INDEX(1), NAME); CTraceScope PROF_CONCAT(traceScope_, __LINE__)(NAME)
+
+#else
+
+#include <time.h>
+
+// No PIX here, only the built-in trace, see trace.h
+#define PROF_FUNC() CTraceScope PROF_CONCAT(traceScope_, __LINE__)(__FUNCTION__)
+#define PROF_REGION(NAME) CTraceScope PROF_CONCAT(traceScope_, __LINE__)(NAME)
+
+#define __debugbreak() __builtin_trap()
+
+#endif
 
 using uint64 = uint64_t;
 using uint32 = uint32_t;
@@ -20,6 +43,7 @@ using int64 = int64_t;
 
 struct STimestamp
 {
+#ifdef _WIN32
 	static STimestamp now()
 	{
 		LARGE_INTEGER time;
@@ -33,6 +57,19 @@ struct STimestamp
 		QueryPerformanceFrequency(&freq);
 		return freq.QuadPart;
 	}
+#else
+	static STimestamp now()
+	{
+		timespec time{};
+		clock_gettime(CLOCK_MONOTONIC, &time);
+		return STimestamp{ int64(time.tv_sec) * 1000000000 + time.tv_nsec };
+	}
+
+	static int64 GetFrequency()
+	{
+		return 1000000000;
+	}
+#endif
 
 	std::chrono::high_resolution_clock::duration dur() const
 	{
@@ -76,19 +113,62 @@ struct STsRegion
 	STimestamp start{};
 };
 
+class CBufferPool;
+void FreePoolSlot(CBufferPool* pPool, void* ptr);
+
+struct AlignedArrDeleter
+{
+	// Set for slots of a buffer pool, see bufferpool.h
+	CBufferPool* pPool = nullptr;
+
+	void operator()(void* ptr)
+	{
+		if (pPool)
+		{
+			FreePoolSlot(pPool, ptr);
+			return;
+		}
+#ifdef _WIN32
+		_aligned_free(ptr);
+#else
+		free(ptr);
+#endif
+	}
+};
+using AlignedUniquePtr = std::unique_ptr<char[], AlignedArrDeleter>;
+
+inline AlignedUniquePtr AlignedAlloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+	return AlignedUniquePtr(static_cast<char*>(_aligned_malloc(size, alignment)));
+#else
+	void* p = nullptr;
+	if (posix_memalign(&p, alignment, size) != 0)
+		return nullptr;
+	return AlignedUniquePtr(static_cast<char*>(p));
+#endif
+}
+
 template <typename D> constexpr auto ms(const D& d) { return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(d).count(); }
 template <typename D> constexpr auto sec(const D& d) { return std::chrono::duration_cast<std::chrono::duration<double, std::ratio<1, 1>>>(d).count(); }
 template <typename D> auto MBsec(size_t size, const D& d) { return (size / sec(d)) / 1024 / 1024; }
 inline auto MBsec(size_t size, const STimestamp& d) { return (size / sec(d.dur())) / 1024 / 1024; }
 
+// Byte sum, dispatched at runtime to the widest SIMD kernel CPU supports. See checksum.h
+using SumFunc = uint64(*)(const char* pBuf, size_t size);
+extern std::atomic<SumFunc> g_sumFunc;
+
 inline uint64 sum(const char* pBuf, size_t size)
 {
-	uint64 s = 0;
-	for (const char* p = pBuf; p < (pBuf + size); ++p)
-	{
-		s += (uint8)*p;
-	}
-	return s;
+	return g_sumFunc.load(std::memory_order_relaxed)(pBuf, size);
+}
+
+// Per-buffer work done by the tests, byte sum by default. See SetProcessingStage in checksum.h
+extern std::atomic<SumFunc> g_processFunc;
+
+inline uint64 process(const char* pBuf, size_t size)
+{
+	return g_processFunc.load(std::memory_order_relaxed)(pBuf, size);
 }
 
 void SetThreadName(const wchar_t* format, ...);
@@ -0,0 +1,147 @@
+#include "compport.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+static const char* s_wakeOrderNames[] = { "lifo", "fifo" };
+static_assert(sizeof(s_wakeOrderNames) / sizeof(s_wakeOrderNames[0]) == size_t(EWakeOrder::Count), "Missing wake order name");
+
+// Port the thread was released from by its last Get, like IOCP associates a thread with one port.
+static thread_local const CCompletionPort* t_pRunningOn = nullptr;
+
+const char* GetWakeOrderName(EWakeOrder order)
+{
+	return s_wakeOrderNames[size_t(order)];
+}
+
+bool ParseWakeOrder(const char* szValue, EWakeOrder& order)
+{
+	for (size_t i = 0; i < size_t(EWakeOrder::Count); ++i)
+	{
+		if (strcmp(szValue, s_wakeOrderNames[i]) == 0)
+		{
+			order = EWakeOrder(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+CCompletionPort::CCompletionPort(uint32 concurrency, EWakeOrder order)
+	: m_concurrency(concurrency ? concurrency : std::max(std::thread::hardware_concurrency(), 1u))
+	, m_order(order)
+{
+}
+
+void CCompletionPort::Post(const SCompletionPacket& packet)
+{
+	SWaiter* pWaiter = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_stats.posted;
+		if (m_running < m_concurrency && !m_waiters.empty())
+			pWaiter = HandOff(packet);
+		else
+			m_packets.push_back(packet);
+	}
+	if (pWaiter)
+		Wake(pWaiter);
+}
+
+void CCompletionPort::Get(SCompletionPacket& packet)
+{
+	SWaiter waiter;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		LeaveLocked();
+		// Thread that is already running takes the packet, nobody has to be woken up.
+		if (!m_packets.empty() && m_running < m_concurrency)
+		{
+			packet = m_packets.front();
+			m_packets.pop_front();
+			++m_running;
+			++m_stats.immediate;
+			t_pRunningOn = this;
+			return;
+		}
+		m_waiters.push_back(&waiter);
+	}
+
+	while (waiter.ready.load(std::memory_order_acquire) == 0)
+		FutexWait(waiter.ready, 0);
+	packet = waiter.packet;
+	t_pRunningOn = this;
+}
+
+bool CCompletionPort::TryGet(SCompletionPacket& packet)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	LeaveLocked();
+	if (m_packets.empty() || m_running >= m_concurrency)
+		return false;
+	packet = m_packets.front();
+	m_packets.pop_front();
+	++m_running;
+	++m_stats.immediate;
+	t_pRunningOn = this;
+	return true;
+}
+
+void CCompletionPort::Leave()
+{
+	SWaiter* pWaiter = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		LeaveLocked();
+		// Freed slot goes to a sleeping thread when packets were held back by the concurrency.
+		if (!m_packets.empty() && !m_waiters.empty() && m_running < m_concurrency)
+		{
+			pWaiter = HandOff(m_packets.front());
+			m_packets.pop_front();
+		}
+	}
+	if (pWaiter)
+		Wake(pWaiter);
+}
+
+SCompletionPortStats CCompletionPort::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+CCompletionPort::SWaiter* CCompletionPort::HandOff(const SCompletionPacket& packet)
+{
+	SWaiter* pWaiter;
+	if (m_order == EWakeOrder::Lifo)
+	{
+		pWaiter = m_waiters.back();
+		m_waiters.pop_back();
+	}
+	else
+	{
+		pWaiter = m_waiters.front();
+		m_waiters.pop_front();
+	}
+	pWaiter->packet = packet;
+	++m_running;
+	++m_stats.wakeups;
+	return pWaiter;
+}
+
+void CCompletionPort::LeaveLocked()
+{
+	if (t_pRunningOn != this)
+		return;
+	t_pRunningOn = nullptr;
+	--m_running;
+}
+
+void CCompletionPort::Wake(SWaiter* pWaiter)
+{
+	// Waiter may see the flag, return and free its stack before the wake. Futex wake on such address
+	// finds nobody or causes a spurious wakeup, which every FutexWait caller checks for.
+	pWaiter->ready.store(1, std::memory_order_release);
+	FutexWake(pWaiter->ready, false);
+}
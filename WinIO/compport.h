@@ -0,0 +1,86 @@
+#pragma once
+
+#include "common.h"
+#include "eventcount.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+// GetQueuedCompletionStatus-like port on futexes, so the IOCP wakeup policy can be measured on Linux.
+//  - LIFO: the thread that started waiting last is woken first. Its stack and cache are still warm,
+//    and while it comes back faster than completions arrive, it handles long runs of them alone.
+//  - Concurrency: like NumberOfConcurrentThreads of CreateIoCompletionPort, at most that many threads
+//    run between two Get calls, further packets stay queued until one of them comes back. IOCP also
+//    notices when such a thread blocks somewhere else, here only Get and Leave count.
+// Fifo wakes the longest waiting thread instead, like events spread completions evenly.
+enum class EWakeOrder
+{
+	Lifo,
+	Fifo,
+
+	Count
+};
+
+const char* GetWakeOrderName(EWakeOrder order);
+bool ParseWakeOrder(const char* szValue, EWakeOrder& order);
+
+struct SCompletionPacket
+{
+	uint64 key = 0;
+	int64 bytes = 0;
+	void* pContext = nullptr;
+};
+
+struct SCompletionPortStats
+{
+	uint64 posted = 0;
+	// Get calls that found a packet right away
+	uint64 immediate = 0;
+	// Sleeping threads a packet was handed to
+	uint64 wakeups = 0;
+};
+
+class CCompletionPort
+{
+public:
+	// Zero concurrency is the count of CPUs, same as for CreateIoCompletionPort.
+	CCompletionPort(uint32 concurrency, EWakeOrder order);
+	CCompletionPort(const CCompletionPort&) = delete;
+	CCompletionPort& operator=(const CCompletionPort&) = delete;
+
+	void Post(const SCompletionPacket& packet);
+	// Blocks until there is a packet and room under the concurrency. The calling thread counts as running
+	// until its next Get or Leave, like a thread is associated with the port it last waited on.
+	void Get(SCompletionPacket& packet);
+	// Get with zero timeout, false when it would block.
+	bool TryGet(SCompletionPacket& packet);
+	// Thread is done with the port and no longer counts as running.
+	void Leave();
+
+	SCompletionPortStats GetStats() const;
+
+private:
+	struct SWaiter
+	{
+		std::atomic<uint32> ready = { 0 };
+		SCompletionPacket packet;
+	};
+
+	// Under the lock. Newest or oldest sleeping thread gets the packet and a running slot.
+	SWaiter* HandOff(const SCompletionPacket& packet);
+	// Under the lock. Calling thread stops counting as running.
+	void LeaveLocked();
+	// Outside of the lock
+	static void Wake(SWaiter* pWaiter);
+
+	const uint32 m_concurrency;
+	const EWakeOrder m_order;
+
+	mutable std::mutex m_mutex;
+	std::deque<SCompletionPacket> m_packets;
+	// Newest at the back
+	std::deque<SWaiter*> m_waiters;
+	uint32 m_running = 0;
+	SCompletionPortStats m_stats;
+};
@@ -0,0 +1,182 @@
+#include "compressedfile.h"
+#include "checksum.h"
+#include "lz.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+
+static uint64 AlignUp(uint64 v, uint64 alignment)
+{
+	return (v + alignment - 1) / alignment * alignment;
+}
+
+static int Seek64(FILE* f, uint64 off)
+{
+#ifdef _WIN32
+	return _fseeki64(f, int64(off), SEEK_SET);
+#else
+	return fseeko(f, off_t(off), SEEK_SET);
+#endif
+}
+
+static int64 Tell64(FILE* f)
+{
+#ifdef _WIN32
+	return _ftelli64(f);
+#else
+	return int64(ftello(f));
+#endif
+}
+
+uint64 SCompressedToc::GetCompressedSize() const
+{
+	uint64 s = 0;
+	for (const SCompressedBlock& b : blocks)
+		s += b.compressedSize;
+	return s;
+}
+
+uint32 SCompressedToc::GetUncompressedBlockSize(uint32 blockIdx) const
+{
+	const uint64 off = uint64(blockIdx) * header.blockSize;
+	return uint32(std::min<uint64>(header.blockSize, header.uncompressedSize - off));
+}
+
+bool ReadCompressedToc(const char* szFilename, SCompressedToc& toc)
+{
+	FILE* f = fopen(szFilename, "rb");
+	if (!f)
+		return false;
+	std::unique_ptr<FILE, decltype(&fclose)> fCloser(f, &fclose);
+
+	SCompressedFileHeader header{};
+	if (fread(&header, sizeof(header), 1, f) != 1)
+		return false;
+	if (header.magic != s_compressedFileMagic || header.version != s_compressedFileVersion || header.blockSize == 0)
+		return false;
+	if (AlignUp(header.uncompressedSize, header.blockSize) / header.blockSize != header.blockCount)
+		return false;
+
+	toc.header = header;
+	toc.blocks.resize(header.blockCount);
+	if (header.blockCount && fread(toc.blocks.data(), sizeof(SCompressedBlock), header.blockCount, f) != header.blockCount)
+		return false;
+
+	for (const SCompressedBlock& b : toc.blocks)
+	{
+		if (b.offset % s_compressedFileAlignment != 0 || b.compressedSize > header.blockSize)
+			return false;
+	}
+	return true;
+}
+
+int PackCompressedFile(const char* szSrcFilename, const char* szDstFilename, uint32 blockSize)
+{
+	PROF_FUNC();
+
+	// Keeps block boundaries aligned with hash blocks of processing stages, see checksum.h
+	if (blockSize == 0 || blockSize % s_processingBlockSize != 0)
+	{
+		std::cerr << "Block size has to be multiple of " << s_processingBlockSize << std::endl;
+		return 1;
+	}
+
+	FILE* fSrc = fopen(szSrcFilename, "rb");
+	if (!fSrc)
+	{
+		std::cerr << "Failed to open " << szSrcFilename << std::endl;
+		return 1;
+	}
+	std::unique_ptr<FILE, decltype(&fclose)> srcCloser(fSrc, &fclose);
+
+	FILE* fDst = fopen(szDstFilename, "wb");
+	if (!fDst)
+	{
+		std::cerr << "Failed to open " << szDstFilename << std::endl;
+		return 1;
+	}
+	std::unique_ptr<FILE, decltype(&fclose)> dstCloser(fDst, &fclose);
+
+	fseek(fSrc, 0, SEEK_END);
+	const uint64 srcSize = uint64(Tell64(fSrc));
+	fseek(fSrc, 0, SEEK_SET);
+
+	SCompressedFileHeader header{};
+	header.magic = s_compressedFileMagic;
+	header.version = s_compressedFileVersion;
+	header.blockSize = blockSize;
+	header.blockCount = uint32(AlignUp(srcSize, blockSize) / blockSize);
+	header.uncompressedSize = srcSize;
+
+	std::vector<SCompressedBlock> blocks(header.blockCount);
+	const uint64 dataStart = AlignUp(sizeof(header) + blocks.size() * sizeof(SCompressedBlock), s_compressedFileAlignment);
+
+	std::unique_ptr<char[]> pIn(new char[blockSize]);
+	std::unique_ptr<char[]> pOut(new char[LzCompressBound(blockSize)]);
+	std::vector<char> padding(s_compressedFileAlignment, 0);
+
+	auto startTime = ts::now();
+
+	uint64 off = dataStart;
+	if (Seek64(fDst, off) != 0)
+		return 2;
+
+	for (uint32 i = 0; i < header.blockCount; ++i)
+	{
+		const size_t inSize = fread(pIn.get(), 1, blockSize, fSrc);
+		if (inSize != std::min<uint64>(blockSize, srcSize - uint64(i) * blockSize))
+		{
+			std::cerr << "Failed to read " << szSrcFilename << std::endl;
+			return 2;
+		}
+
+		SCompressedBlock& b = blocks[i];
+		b.offset = off;
+
+		const size_t outSize = LzCompress(pIn.get(), inSize, pOut.get(), LzCompressBound(blockSize));
+		const char* pData = pOut.get();
+		if (outSize == 0 || outSize >= inSize)
+		{
+			b.flags = eCBF_Raw;
+			b.compressedSize = uint32(inSize);
+			pData = pIn.get();
+		}
+		else
+		{
+			b.flags = 0;
+			b.compressedSize = uint32(outSize);
+		}
+
+		const uint64 padded = AlignUp(b.compressedSize, s_compressedFileAlignment);
+		if (fwrite(pData, 1, b.compressedSize, fDst) != b.compressedSize
+			|| fwrite(padding.data(), 1, size_t(padded - b.compressedSize), fDst) != padded - b.compressedSize)
+		{
+			std::cerr << "Failed to write " << szDstFilename << std::endl;
+			return 3;
+		}
+		off += padded;
+	}
+
+	if (Seek64(fDst, 0) != 0
+		|| fwrite(&header, sizeof(header), 1, fDst) != 1
+		|| (header.blockCount && fwrite(blocks.data(), sizeof(SCompressedBlock), blocks.size(), fDst) != blocks.size()))
+	{
+		std::cerr << "Failed to write " << szDstFilename << std::endl;
+		return 3;
+	}
+
+	auto endTime = ts::now();
+
+	uint64 compressedSize = 0;
+	for (const SCompressedBlock& b : blocks)
+		compressedSize += b.compressedSize;
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(srcSize, (endTime - startTime)) << std::endl;
+	std::cout << "blockSize " << blockSize << " blockCount " << header.blockCount << std::endl;
+	std::cout << "Size " << srcSize << " -> " << compressedSize << " (" << (srcSize ? 100.0 * compressedSize / srcSize : 0.0) << "%), file " << off << std::endl;
+	std::cout << std::endl;
+	return 0;
+}
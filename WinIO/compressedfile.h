@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.h"
+
+#include <vector>
+
+// Chunked compressed container.
+// Layout: SCompressedFileHeader, table of SCompressedBlock, then blocks.
+// Header with table and every block start at s_compressedFileAlignment, so blocks can be read with unbuffered IO.
+// Every block holds blockSize uncompressed bytes, except the last one.
+
+static constexpr uint32 s_compressedFileMagic = 0x5A4F4957; // "WIOZ"
+static constexpr uint32 s_compressedFileVersion = 1;
+static constexpr size_t s_compressedFileAlignment = 4096;
+static constexpr uint32 s_compressedDefaultBlockSize = 256 * 1024;
+
+struct SCompressedFileHeader
+{
+	uint32 magic;
+	uint32 version;
+	uint32 blockSize;
+	uint32 blockCount;
+	uint64 uncompressedSize;
+};
+
+enum ECompressedBlockFlags : uint32
+{
+	// Block didn't compress and is stored as is
+	eCBF_Raw = 1 << 0,
+};
+
+struct SCompressedBlock
+{
+	uint64 offset;
+	uint32 compressedSize;
+	uint32 flags;
+};
+
+struct SCompressedToc
+{
+	SCompressedFileHeader header{};
+	std::vector<SCompressedBlock> blocks;
+
+	uint64 GetCompressedSize() const;
+	uint32 GetUncompressedBlockSize(uint32 blockIdx) const;
+};
+
+// Returns false if file can't be read or isn't a compressed container.
+bool ReadCompressedToc(const char* szFilename, SCompressedToc& toc);
+
+// Packs szSrcFilename into container szDstFilename. Returns 0 on success, like main().
+int PackCompressedFile(const char* szSrcFilename, const char* szDstFilename, uint32 blockSize);
@@ -0,0 +1,60 @@
+#include "coread.h"
+#include "numa.h"
+
+CCoReader::~CCoReader()
+{
+	StopWorkers();
+}
+
+bool CCoReader::Open(const char* szFilename, bool unbuffered, uint32 queueDepth)
+{
+	return m_file.Open(szFilename, unbuffered, queueDepth);
+}
+
+void CCoReader::StartWorkers(uint32 workerCount)
+{
+	for (uint32 i = 0; i < workerCount; ++i)
+		m_workers.emplace_back(&CCoReader::WorkerFunc, this, i);
+}
+
+void CCoReader::StopWorkers()
+{
+	for (size_t i = 0; i < m_workers.size(); ++i)
+		m_file.Wake();
+	for (std::thread& t : m_workers)
+		t.join();
+	m_workers.clear();
+}
+
+void CCoReader::Spawn(CCoTask task)
+{
+	m_activeTasks.fetch_add(1, std::memory_order_relaxed);
+	RunDetached(*this, std::move(task));
+}
+
+void CCoReader::WaitAll()
+{
+	PROF_FUNC();
+
+	uint32 active;
+	while ((active = m_activeTasks.load(std::memory_order_acquire)) != 0)
+		FutexWait(m_activeTasks, active);
+}
+
+SCoDetached CCoReader::RunDetached(CCoReader& reader, CCoTask task)
+{
+	co_await task;
+	if (reader.m_activeTasks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		FutexWake(reader.m_activeTasks, true);
+}
+
+void CCoReader::WorkerFunc(uint32 idx)
+{
+	SetThreadName(L"CoWorker_%u", idx);
+	PinWorkerThread(idx);
+
+	PROF_FUNC();
+
+	while (SAsyncRead* pRead = m_file.Wait())
+		std::coroutine_handle<>::from_address(pRead->pUser).resume();
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "common.h"
+#include "asyncfile.h"
+#include "eventcount.h"
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// C++20 coroutines over CAsyncFile. `co_await reader.Read(off, size, pBuf)` submits the read and suspends,
+// a worker of the reader resumes the coroutine once the completion arrives. Code after co_await then runs
+// on that worker, so a plain loop keeps its state in locals instead of SBuffer / SWorkerState.
+// Many such loops started at once are what keeps requests in flight.
+
+// Lazily started coroutine without result. Awaiting it starts it and resumes the awaiter when it ends.
+class CCoTask
+{
+public:
+	struct promise_type
+	{
+		struct SFinalAwaiter
+		{
+			bool await_ready() const noexcept { return false; }
+			// Continue right in the awaiter instead of returning to whoever resumed us
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+			{
+				const std::coroutine_handle<> continuation = h.promise().continuation;
+				return continuation ? continuation : std::noop_coroutine();
+			}
+			void await_resume() const noexcept {}
+		};
+
+		CCoTask get_return_object() { return CCoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		SFinalAwaiter final_suspend() const noexcept { return {}; }
+		void return_void() const noexcept {}
+		void unhandled_exception() const noexcept { std::terminate(); }
+
+		std::coroutine_handle<> continuation;
+	};
+
+	CCoTask(CCoTask&& other) noexcept : m_handle(other.m_handle) { other.m_handle = nullptr; }
+	CCoTask(const CCoTask&) = delete;
+	CCoTask& operator=(const CCoTask&) = delete;
+	~CCoTask()
+	{
+		if (m_handle)
+			m_handle.destroy();
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+	{
+		m_handle.promise().continuation = awaiter;
+		return m_handle;
+	}
+	void await_resume() const noexcept {}
+
+private:
+	explicit CCoTask(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+
+	std::coroutine_handle<promise_type> m_handle;
+};
+
+// Fire and forget coroutine, runs right away and frees itself when it ends.
+struct SCoDetached
+{
+	struct promise_type
+	{
+		SCoDetached get_return_object() const noexcept { return {}; }
+		std::suspend_never initial_suspend() const noexcept { return {}; }
+		std::suspend_never final_suspend() const noexcept { return {}; }
+		void return_void() const noexcept {}
+		void unhandled_exception() const noexcept { std::terminate(); }
+	};
+};
+
+class CCoReader
+{
+public:
+	struct SReadAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+		// Completion may resume the coroutine on a worker before this returns, nothing is touched after Read.
+		bool await_suspend(std::coroutine_handle<> h)
+		{
+			read.pUser = h.address();
+			if (pFile->Read(read))
+				return true;
+			read.result = -1;
+			return false;
+		}
+		// Bytes read or -error
+		int64 await_resume() const noexcept { return read.result; }
+
+		CAsyncFile* pFile;
+		SAsyncRead read;
+	};
+
+	CCoReader() = default;
+	CCoReader(const CCoReader&) = delete;
+	CCoReader& operator=(const CCoReader&) = delete;
+	~CCoReader();
+
+	// queueDepth is maximum count of reads in flight. Prints error and returns false on failure.
+	bool Open(const char* szFilename, bool unbuffered, uint32 queueDepth);
+	uint64 GetSize() const { return m_file.GetSize(); }
+
+	// Threads that wait for completions and resume the coroutines.
+	void StartWorkers(uint32 workerCount);
+	// After WaitAll, resumes nothing anymore.
+	void StopWorkers();
+
+	// Same rules for alignment as CAsyncFile::Read.
+	SReadAwaiter Read(uint64 offset, uint32 size, char* pBuf)
+	{
+		SReadAwaiter awaiter{ &m_file, {} };
+		awaiter.read.offset = offset;
+		awaiter.read.size = size;
+		awaiter.read.pBuf = pBuf;
+		return awaiter;
+	}
+
+	// Runs the task on the calling thread until its first co_await, the rest continues on the workers.
+	void Spawn(CCoTask task);
+	// Blocks until all spawned tasks ended.
+	void WaitAll();
+
+private:
+	static SCoDetached RunDetached(CCoReader& reader, CCoTask task);
+	void WorkerFunc(uint32 idx);
+
+	CAsyncFile m_file;
+	std::vector<std::thread> m_workers;
+	std::atomic<uint32> m_activeTasks = { 0 };
+};
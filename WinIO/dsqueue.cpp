@@ -0,0 +1,246 @@
+#ifdef __linux__
+
+#include "dsqueue.h"
+
+#include <iostream>
+
+void CQueueFence::Signal(uint64 value)
+{
+	uint64 cur = m_value.load(std::memory_order_relaxed);
+	while (cur < value && !m_value.compare_exchange_weak(cur, value, std::memory_order_release, std::memory_order_relaxed))
+		;
+	m_event.Notify(true);
+}
+
+void CQueueFence::Wait(uint64 value)
+{
+	while (m_value.load(std::memory_order_acquire) < value)
+	{
+		const uint32 key = m_event.PrepareWait();
+		if (m_value.load(std::memory_order_acquire) >= value)
+		{
+			m_event.CancelWait();
+			break;
+		}
+		m_blockedWaits.fetch_add(1, std::memory_order_relaxed);
+		m_event.Wait(key);
+	}
+}
+
+CQueueStatusArray::CQueueStatusArray(uint32 count)
+	: m_entries(new SEntry[count])
+{
+}
+
+CRequestQueue::~CRequestQueue()
+{
+	if (!m_worker.joinable())
+		return;
+	m_stop.store(true);
+	m_ring.Submit([](io_uring_sqe& sqe)
+	{
+		sqe.opcode = IORING_OP_NOP;
+		sqe.user_data = 0;
+	});
+	m_worker.join();
+}
+
+bool CRequestQueue::Init(uint32 capacity)
+{
+	PROF_FUNC();
+
+	m_capacity = capacity;
+	// Completion ring is twice as big, room for the stop request as well.
+	const int res = m_ring.Init(capacity);
+	if (res < 0)
+	{
+		std::cerr << "Failed to create io_uring, err " << -res << std::endl;
+		return false;
+	}
+	m_slots.resize(capacity);
+	m_worker = std::thread(&CRequestQueue::WorkerFunc, this);
+	return true;
+}
+
+void CRequestQueue::EnqueueRequest(const SQueueRequest& request)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_enqueuedRequests.push_back(request);
+}
+
+void CRequestQueue::EnqueueSignal(CQueueFence& fence, uint64 value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_enqueuedEntries.push_back(SEntry{ m_submittedRequests + m_enqueuedRequests.size(), &fence, value, nullptr, 0, 0 });
+}
+
+void CRequestQueue::EnqueueStatus(CQueueStatusArray& status, uint32 idx)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	status.m_entries[idx].complete.store(false, std::memory_order_relaxed);
+	m_enqueuedEntries.push_back(SEntry{ m_submittedRequests + m_enqueuedRequests.size(), nullptr, 0, &status, idx, 0 });
+}
+
+void CRequestQueue::Submit()
+{
+	PROF_FUNC();
+
+	std::vector<SEntry> fired;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_stats.submits;
+		m_stats.requests += m_enqueuedRequests.size();
+		m_submittedRequests += m_enqueuedRequests.size();
+		m_waiting.insert(m_waiting.end(), m_enqueuedRequests.begin(), m_enqueuedRequests.end());
+		m_entries.insert(m_entries.end(), m_enqueuedEntries.begin(), m_enqueuedEntries.end());
+		m_enqueuedRequests.clear();
+		m_enqueuedEntries.clear();
+
+		IssueRequests();
+		// Signals with nothing before them are done right away
+		AdvancePrefix(fired);
+	}
+	FireEntries(fired);
+}
+
+SRequestQueueStats CRequestQueue::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+void CRequestQueue::IssueRequests()
+{
+	unsigned prepared = 0;
+	while (!m_waiting.empty() && m_issuedRequests < m_completedPrefix + m_capacity)
+	{
+		const SQueueRequest& r = m_waiting.front();
+		// 0 is the stop request
+		const uint64 userData = m_issuedRequests + 1;
+		const int res = m_ring.Prepare([&](io_uring_sqe& sqe)
+		{
+			sqe.opcode = IORING_OP_READ;
+			sqe.fd = r.fd;
+			sqe.off = r.offset;
+			sqe.addr = reinterpret_cast<uint64>(r.pDest);
+			sqe.len = r.size;
+			sqe.user_data = userData;
+		});
+		if (res < 0)
+			break;
+		m_waiting.pop_front();
+		++m_issuedRequests;
+		++prepared;
+	}
+
+	while (prepared)
+	{
+		++m_stats.enters;
+		const int res = m_ring.SubmitPrepared(prepared);
+		if (res == -EINTR || res == -EAGAIN)
+			continue;
+		if (res <= 0)
+		{
+			std::cerr << "Failed to submit reads, err " << -res << std::endl;
+			exit(1);
+		}
+		prepared -= unsigned(res);
+	}
+}
+
+void CRequestQueue::AdvancePrefix(std::vector<SEntry>& fired)
+{
+	while (true)
+	{
+		while (!m_entries.empty() && m_entries.front().afterRequest <= m_completedPrefix)
+		{
+			SEntry e = m_entries.front();
+			m_entries.pop_front();
+			if (e.pStatus)
+			{
+				e.result = m_pendingError;
+				m_pendingError = 0;
+			}
+			else
+			{
+				++m_stats.signals;
+			}
+			fired.push_back(e);
+		}
+
+		if (m_completedPrefix == m_issuedRequests)
+			break;
+		SSlot& slot = m_slots[m_completedPrefix % m_capacity];
+		if (!slot.done)
+			break;
+		if (slot.result < 0 && m_pendingError == 0)
+			m_pendingError = slot.result;
+		slot.done = false;
+		++m_completedPrefix;
+	}
+}
+
+void CRequestQueue::FireEntries(const std::vector<SEntry>& fired)
+{
+	for (const SEntry& e : fired)
+	{
+		if (e.pFence)
+		{
+			e.pFence->Signal(e.value);
+		}
+		else
+		{
+			CQueueStatusArray::SEntry& status = e.pStatus->m_entries[e.statusIdx];
+			status.result = e.result;
+			status.complete.store(true, std::memory_order_release);
+		}
+	}
+}
+
+void CRequestQueue::WorkerFunc()
+{
+	SetThreadName(L"RequestQueue");
+
+	std::vector<SEntry> fired;
+	while (true)
+	{
+		io_uring_cqe cqe{};
+		{
+			PROF_REGION("WaitCompletion");
+			const int res = m_ring.WaitCompletion(cqe);
+			if (res < 0)
+			{
+				std::cerr << "Failed to get completion status, err " << -res << std::endl;
+				exit(3);
+			}
+		}
+
+		// Everything that completed meanwhile is handled under one lock and one round of signals.
+		bool stop = false;
+		fired.clear();
+		{
+			PROF_REGION("complete");
+			std::lock_guard<std::mutex> lock(m_mutex);
+			do
+			{
+				if (cqe.user_data == 0)
+				{
+					stop = true;
+					continue;
+				}
+				SSlot& slot = m_slots[(cqe.user_data - 1) % m_capacity];
+				slot.done = true;
+				slot.result = cqe.res;
+			} while (m_ring.TryPopCompletion(cqe));
+
+			AdvancePrefix(fired);
+			IssueRequests();
+		}
+		FireEntries(fired);
+
+		if (stop && m_stop.load())
+			break;
+	}
+}
+
+#endif
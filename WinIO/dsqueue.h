@@ -0,0 +1,149 @@
+#pragma once
+
+#include "common.h"
+
+#ifdef __linux__
+
+#include "eventcount.h"
+#include "linuxio.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Model of IDStorageQueue1 on Linux, so batching and fence placement can be measured without DirectStorage.
+// Requests, fence signals and status entries are only recorded until Submit, which hands the whole batch
+// to io_uring with one io_uring_enter. A worker thread reaps completions, like the DirectStorage Worker
+// thread does on Windows 10. A signal or status entry completes once every request enqueued before it
+// has completed, in queue order, no matter in which order the reads finished.
+
+// ID3D12Fence-like counter, waiters block until it reaches their value.
+class CQueueFence
+{
+public:
+	uint64 GetCompletedValue() const { return m_value.load(std::memory_order_acquire); }
+
+	// Never goes back, a smaller value is ignored.
+	void Signal(uint64 value);
+	void Wait(uint64 value);
+
+	// Waits that had to block, i.e. wakeups of the waiting thread
+	uint64 GetBlockedWaitCount() const { return m_blockedWaits.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64> m_value = { 0 };
+	CEventCount m_event;
+	std::atomic<uint64> m_blockedWaits = { 0 };
+};
+
+// DSTORAGE_REQUEST_STATUS_ARRAY-like, one entry per EnqueueStatus slot.
+class CQueueStatusArray
+{
+public:
+	explicit CQueueStatusArray(uint32 count);
+
+	bool IsComplete(uint32 idx) const { return m_entries[idx].complete.load(std::memory_order_acquire); }
+	// First failed read (-errno) between the previous status entry and this one, 0 when all succeeded
+	int GetResult(uint32 idx) const { return m_entries[idx].result; }
+
+private:
+	friend class CRequestQueue;
+
+	struct SEntry
+	{
+		std::atomic<bool> complete = { true };
+		int result = 0;
+	};
+	std::unique_ptr<SEntry[]> m_entries;
+};
+
+struct SQueueRequest
+{
+	int fd = -1;
+	uint64 offset = 0;
+	// Has to be aligned for files opened with O_DIRECT
+	uint32 size = 0;
+	char* pDest = nullptr;
+};
+
+struct SRequestQueueStats
+{
+	uint64 requests = 0;
+	uint64 signals = 0;
+	uint64 submits = 0;
+	// io_uring_enter calls that submitted reads, from Submit and from the worker topping up the window
+	uint64 enters = 0;
+};
+
+class CRequestQueue
+{
+public:
+	CRequestQueue() = default;
+	CRequestQueue(const CRequestQueue&) = delete;
+	CRequestQueue& operator=(const CRequestQueue&) = delete;
+	~CRequestQueue();
+
+	// capacity is the count of reads handed to the kernel at once. Prints error and returns false on failure.
+	bool Init(uint32 capacity);
+
+	// Enqueue* only record, thread safe.
+	void EnqueueRequest(const SQueueRequest& request);
+	void EnqueueSignal(CQueueFence& fence, uint64 value);
+	// Marks the entry incomplete now, complete (with result) once everything before it is done.
+	void EnqueueStatus(CQueueStatusArray& status, uint32 idx);
+	void Submit();
+
+	SRequestQueueStats GetStats() const;
+
+private:
+	struct SEntry
+	{
+		// Requests enqueued before this signal or status entry
+		uint64 afterRequest;
+		CQueueFence* pFence;
+		uint64 value;
+		CQueueStatusArray* pStatus;
+		uint32 statusIdx;
+		int result;
+	};
+
+	struct SSlot
+	{
+		bool done = false;
+		int result = 0;
+	};
+
+	void WorkerFunc();
+	// Hands waiting requests to io_uring while they fit the window, with one io_uring_enter.
+	void IssueRequests();
+	// Moves past completed requests in queue order, collects signals and status entries that are due.
+	void AdvancePrefix(std::vector<SEntry>& fired);
+	// Outside of the lock, waiters wake up right away
+	static void FireEntries(const std::vector<SEntry>& fired);
+
+	CUring m_ring;
+	uint32 m_capacity = 0;
+	std::thread m_worker;
+	std::atomic<bool> m_stop = { false };
+
+	mutable std::mutex m_mutex;
+	// Enqueued since the last Submit
+	std::vector<SQueueRequest> m_enqueuedRequests;
+	std::vector<SEntry> m_enqueuedEntries;
+	// Submitted and waiting for room in the window, requests are numbered in queue order
+	std::deque<SQueueRequest> m_waiting;
+	uint64 m_submittedRequests = 0;
+	uint64 m_issuedRequests = 0;
+	// Every request below is complete
+	uint64 m_completedPrefix = 0;
+	// Requests in [m_completedPrefix, m_completedPrefix + m_capacity), by number modulo capacity
+	std::vector<SSlot> m_slots;
+	int m_pendingError = 0;
+	std::deque<SEntry> m_entries;
+	SRequestQueueStats m_stats;
+};
+
+#endif
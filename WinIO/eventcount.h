@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <climits>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Blocks while *pAddr == expected, may return spuriously. WaitOnAddress on Windows, futex on Linux.
+inline void FutexWait(std::atomic<uint32>& addr, uint32 expected)
+{
+	static_assert(sizeof(std::atomic<uint32>) == sizeof(uint32), "Futex needs plain 32 bit word");
+#ifdef _WIN32
+	WaitOnAddress(&addr, &expected, sizeof(expected), INFINITE);
+#else
+	syscall(SYS_futex, reinterpret_cast<uint32*>(&addr), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#endif
+}
+
+inline void FutexWake(std::atomic<uint32>& addr, bool all)
+{
+#ifdef _WIN32
+	if (all)
+		WakeByAddressAll(&addr);
+	else
+		WakeByAddressSingle(&addr);
+#else
+	syscall(SYS_futex, reinterpret_cast<uint32*>(&addr), FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, nullptr, nullptr, 0);
+#endif
+}
+
+// Lets lock-free structures park waiting threads without a mutex on the fast path.
+// Waiter: key = PrepareWait(), check the condition again, then CancelWait() or Wait(key).
+// Notifier: change the state, then Notify(). Notify is a load and nothing else while nobody waits.
+class CEventCount
+{
+public:
+	uint32 PrepareWait()
+	{
+		m_waiters.fetch_add(1, std::memory_order_seq_cst);
+		return m_epoch.load(std::memory_order_seq_cst);
+	}
+
+	void CancelWait()
+	{
+		m_waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	void Wait(uint32 key)
+	{
+		while (m_epoch.load(std::memory_order_acquire) == key)
+			FutexWait(m_epoch, key);
+		m_waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	void Notify(bool all = false)
+	{
+		// Orders the state change before reading m_waiters, pairs with fetch_add in PrepareWait.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_waiters.load(std::memory_order_relaxed) == 0)
+			return;
+		m_epoch.fetch_add(1, std::memory_order_release);
+		FutexWake(m_epoch, all);
+	}
+
+private:
+	std::atomic<uint32> m_epoch = { 0 };
+	std::atomic<uint32> m_waiters = { 0 };
+};
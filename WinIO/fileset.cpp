@@ -0,0 +1,135 @@
+#include "fileset.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+bool LoadFileSet(const std::vector<std::string>& names, SFileSet& set)
+{
+	SFileSet res;
+	for (const std::string& name : names)
+	{
+		FILE* f = fopen(name.c_str(), "rb");
+		if (!f)
+		{
+			std::cerr << "Failed to open " << name << std::endl;
+			return false;
+		}
+#ifdef _WIN32
+		_fseeki64(f, 0, SEEK_END);
+		const int64 size = _ftelli64(f);
+#else
+		fseeko(f, 0, SEEK_END);
+		const int64 size = int64(ftello(f));
+#endif
+		fclose(f);
+
+		res.names.push_back(name);
+		res.sizes.push_back(size);
+		res.totalSize += uint64(size);
+	}
+	set = std::move(res);
+	return !set.names.empty();
+}
+
+
+static const SFileSet* s_pActiveFileSet = nullptr;
+
+const SFileSet* GetActiveFileSet()
+{
+	return s_pActiveFileSet;
+}
+
+void SetFileSet(const SFileSet* pSet)
+{
+	s_pActiveFileSet = pSet;
+}
+
+
+CFileStreams::CFileStreams(const SFileSet& set)
+	: m_set(set)
+	, m_streams(new SStream[set.names.size()])
+{
+	for (size_t i = 0; i < set.names.size(); ++i)
+	{
+		m_streams[i].size = set.sizes[i];
+		m_streams[i].remaining = set.sizes[i];
+	}
+}
+
+void CFileStreams::Start(STimestamp startTime)
+{
+	m_startTime = startTime;
+}
+
+bool CFileStreams::Next(int64 maxSize, uint32& fileIdx, int64& off, int64& size)
+{
+	const uint32 count = uint32(m_set.names.size());
+	const uint32 first = m_nextFile.fetch_add(1, std::memory_order_relaxed);
+	for (uint32 i = 0; i < count; ++i)
+	{
+		const uint32 idx = (first + i) % count;
+		SStream& stream = m_streams[idx];
+		// Finished files are skipped without touching their cursor
+		if (stream.off.load(std::memory_order_relaxed) >= stream.size)
+			continue;
+		const int64 o = stream.off.fetch_add(maxSize, std::memory_order_relaxed);
+		if (o >= stream.size)
+			continue;
+
+		stream.requests.fetch_add(1, std::memory_order_relaxed);
+		fileIdx = idx;
+		off = o;
+		size = std::min(maxSize, stream.size - o);
+		return true;
+	}
+	return false;
+}
+
+void CFileStreams::OnProcessed(uint32 fileIdx, int64 bytes)
+{
+	SStream& stream = m_streams[fileIdx];
+	if (stream.remaining.fetch_sub(bytes, std::memory_order_acq_rel) == bytes)
+		stream.doneTime = STimestamp::now() - m_startTime;
+}
+
+uint64 CFileStreams::GetRequestCount() const
+{
+	uint64 count = 0;
+	for (size_t i = 0; i < m_set.names.size(); ++i)
+		count += m_streams[i].requests.load(std::memory_order_relaxed);
+	return count;
+}
+
+double CFileStreams::GetFairness() const
+{
+	double sum = 0;
+	double sumSq = 0;
+	size_t count = 0;
+	for (size_t i = 0; i < m_set.names.size(); ++i)
+	{
+		const SStream& stream = m_streams[i];
+		if (stream.size == 0 || stream.doneTime.time == 0)
+			continue;
+		const double mbps = MBsec(size_t(stream.size), stream.doneTime);
+		sum += mbps;
+		sumSq += mbps * mbps;
+		++count;
+	}
+	return count && sumSq > 0 ? sum * sum / (double(count) * sumSq) : 1.0;
+}
+
+void CFileStreams::Print() const
+{
+	STimestamp lastDone{};
+	for (size_t i = 0; i < m_set.names.size(); ++i)
+		lastDone.time = std::max(lastDone.time, m_streams[i].doneTime.time);
+
+	std::cout << "Files " << m_set.names.size() << ", fairness " << GetFairness() << ", all done " << ms(lastDone.dur()) << " ms" << std::endl;
+	for (size_t i = 0; i < m_set.names.size(); ++i)
+	{
+		const SStream& stream = m_streams[i];
+		std::cout << "  file " << i << " " << m_set.names[i] << " MB " << stream.size / 1024 / 1024 << " requests " << stream.requests
+			<< " done " << ms(stream.doneTime.dur()) << " ms - MB/s " << (stream.doneTime.time ? MBsec(size_t(stream.size), stream.doneTime) : 0) << std::endl;
+	}
+}
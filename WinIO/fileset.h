@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Several files streamed at once, like a level load reading dozens of packages. Engines open all of them,
+// buffers take their next request from the files in turn, so every file shares the same in-flight budget.
+// Cursors and progress are kept per file, to see how fair the engine is to each of them.
+struct SFileSet
+{
+	std::vector<std::string> names;
+	std::vector<int64> sizes;
+	uint64 totalSize = 0;
+};
+
+// Sizes are taken from the file system. Prints error and returns false when a file can't be opened.
+bool LoadFileSet(const std::vector<std::string>& names, SFileSet& set);
+
+// File set read by the async engines, nullptr means the single file they were given.
+const SFileSet* GetActiveFileSet();
+void SetFileSet(const SFileSet* pSet);
+
+class CFileStreams
+{
+public:
+	explicit CFileStreams(const SFileSet& set);
+	CFileStreams(const CFileStreams&) = delete;
+	CFileStreams& operator=(const CFileStreams&) = delete;
+
+	// Completion times are measured from here.
+	void Start(STimestamp startTime);
+
+	// Next request of up to maxSize bytes, files take turns. False when all files are read.
+	bool Next(int64 maxSize, uint32& fileIdx, int64& off, int64& size);
+	// After the bytes were processed, the call that finishes the file records its completion time.
+	void OnProcessed(uint32 fileIdx, int64 bytes);
+
+	uint64 GetRequestCount() const;
+	// Jain's index of per-file MB/s, 1 when all files got the same throughput, 1/N when one got everything.
+	double GetFairness() const;
+	void Print() const;
+
+private:
+	struct alignas(128) SStream
+	{
+		int64 size = 0;
+		std::atomic<int64> off = { 0 };
+		// Bytes not processed yet
+		std::atomic<int64> remaining = { 0 };
+		std::atomic<uint64> requests = { 0 };
+		STimestamp doneTime{};
+	};
+
+	const SFileSet& m_set;
+	std::unique_ptr<SStream[]> m_streams;
+	std::atomic<uint32> m_nextFile = { 0 };
+	STimestamp m_startTime{};
+};
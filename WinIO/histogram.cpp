@@ -0,0 +1,57 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+void CLatencyHistogram::Merge(const CLatencyHistogram& other)
+{
+	for (size_t i = 0; i < s_bucketCount; ++i)
+		m_counts[i] += other.m_counts[i];
+	m_count += other.m_count;
+	m_total += other.m_total;
+	m_max = std::max(m_max, other.m_max);
+}
+
+void CLatencyHistogram::Reset()
+{
+	*this = CLatencyHistogram();
+}
+
+int64 CLatencyHistogram::GetBucketHighValue(size_t idx)
+{
+	if (int64(idx) < s_subBucketCount)
+		return int64(idx);
+	const int shift = int(int64(idx) / s_subBucketHalf) - 1;
+	const int64 sub = int64(idx) - shift * s_subBucketHalf;
+	return ((sub + 1) << shift) - 1;
+}
+
+STimestamp CLatencyHistogram::GetPercentile(double percentile) const
+{
+	if (m_count == 0)
+		return STimestamp{ 0 };
+
+	const double clamped = std::min(std::max(percentile, 0.0), 100.0);
+	const uint64 target = std::max<uint64>(uint64(std::ceil(clamped / 100.0 * double(m_count))), 1);
+
+	uint64 seen = 0;
+	for (size_t i = 0; i < s_bucketCount; ++i)
+	{
+		seen += m_counts[i];
+		if (seen >= target)
+			return STimestamp{ std::min(GetBucketHighValue(i), m_max) };
+	}
+	return STimestamp{ m_max };
+}
+
+void CLatencyHistogram::Print(const char* szName) const
+{
+	std::cout << szName << " latency"
+		<< " p50 " << ms(GetPercentile(50).dur())
+		<< " p90 " << ms(GetPercentile(90).dur())
+		<< " p99 " << ms(GetPercentile(99).dur())
+		<< " p99.9 " << ms(GetPercentile(99.9).dur())
+		<< " max " << ms(GetMax().dur())
+		<< " ms (" << m_count << ")" << std::endl;
+}
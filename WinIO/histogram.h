@@ -0,0 +1,69 @@
+#pragma once
+
+#include "common.h"
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+// HDR style latency histogram in STimestamp ticks.
+// Values below 2^s_subBucketBits are counted exactly, every power of two range above is split into
+// 2^(s_subBucketBits - 1) linear buckets, so percentiles are within 1/64 of the real value.
+// Not thread safe, keep one per worker and Merge() at the end.
+class CLatencyHistogram
+{
+public:
+	static constexpr int s_subBucketBits = 7;
+	static constexpr int64 s_subBucketCount = int64(1) << s_subBucketBits;
+	static constexpr int64 s_subBucketHalf = s_subBucketCount / 2;
+	static constexpr size_t s_bucketCount = size_t((63 - s_subBucketBits + 1) * s_subBucketHalf + s_subBucketCount);
+
+	void Record(STimestamp t)
+	{
+		const int64 v = t.time < 0 ? 0 : t.time;
+		++m_counts[GetBucketIdx(v)];
+		++m_count;
+		m_total += v;
+		m_max = v > m_max ? v : m_max;
+	}
+
+	void Merge(const CLatencyHistogram& other);
+	void Reset();
+
+	uint64 GetCount() const { return m_count; }
+	STimestamp GetMax() const { return STimestamp{ m_max }; }
+	STimestamp GetMean() const { return STimestamp{ m_count ? m_total / int64(m_count) : 0 }; }
+
+	// percentile in [0, 100], returns upper bound of the bucket it falls into.
+	STimestamp GetPercentile(double percentile) const;
+
+	// One report line: "<name> latency p50 .. p90 .. p99 .. p99.9 .. max .. ms"
+	void Print(const char* szName) const;
+
+private:
+	static int Log2(uint64 v)
+	{
+#ifdef _WIN32
+		unsigned long idx;
+		_BitScanReverse64(&idx, v);
+		return int(idx);
+#else
+		return 63 - __builtin_clzll(v);
+#endif
+	}
+
+	static size_t GetBucketIdx(int64 v)
+	{
+		if (v < s_subBucketCount)
+			return size_t(v);
+		const int shift = Log2(uint64(v)) - s_subBucketBits + 1;
+		return size_t(shift * s_subBucketHalf + (v >> shift));
+	}
+
+	static int64 GetBucketHighValue(size_t idx);
+
+	uint64 m_counts[s_bucketCount] = {};
+	uint64 m_count = 0;
+	int64 m_total = 0;
+	int64 m_max = 0;
+};
@@ -0,0 +1,224 @@
+#include "inflight.h"
+
+#include <algorithm>
+#include <iostream>
+
+// Throughput change smaller than this is noise
+static constexpr double s_minGain = 0.05;
+static constexpr int64 s_minSampleMs = 20;
+static constexpr uint64 s_minSampleRequests = 8;
+// Steady samples between two probes
+static constexpr uint32 s_probeEvery = 8;
+
+void CInFlightController::Init(uint32 maxDepth)
+{
+	m_maxDepth = std::max(maxDepth, 1u);
+	m_startTime = STimestamp::now();
+	m_target.store(std::min(s_initialDepth, m_maxDepth), std::memory_order_relaxed);
+	m_inFlight.store(0, std::memory_order_relaxed);
+	m_exhausted.store(false, std::memory_order_relaxed);
+	m_sampleBytes.store(0, std::memory_order_relaxed);
+	m_sampleCount.store(0, std::memory_order_relaxed);
+	m_sampleLatency.store(0, std::memory_order_relaxed);
+	m_sampleStart = m_startTime;
+	m_phase = EPhase::SlowStart;
+	m_skipSample = false;
+	m_steadySamples = 0;
+	m_nextProbeUp = true;
+	m_prevDepth = m_target.load(std::memory_order_relaxed);
+	m_refMbps = 0;
+	m_bestMbps = 0;
+	m_refLatency = STimestamp{};
+	m_decisions.clear();
+	m_parked.clear();
+	m_parked.reserve(m_maxDepth);
+	m_parkedCount.store(0, std::memory_order_relaxed);
+}
+
+bool CInFlightController::TryAcquire()
+{
+	// Slots and parked buffers are seq_cst, so a buffer parked while the last read completes is either
+	// seen by that completion or the parking thread sees the free slot when it unparks after Park.
+	uint32 cur = m_inFlight.load();
+	while (cur < m_target.load(std::memory_order_relaxed))
+	{
+		if (m_inFlight.compare_exchange_weak(cur, cur + 1))
+			return true;
+	}
+	return false;
+}
+
+void CInFlightController::Release()
+{
+	m_inFlight.fetch_sub(1);
+}
+
+void CInFlightController::OnCompletion(uint64 bytes, STimestamp latency)
+{
+	m_inFlight.fetch_sub(1);
+
+	m_sampleBytes.fetch_add(bytes, std::memory_order_relaxed);
+	m_sampleLatency.fetch_add(latency.time, std::memory_order_relaxed);
+	const uint64 count = m_sampleCount.fetch_add(1, std::memory_order_relaxed) + 1;
+	if (count < std::max<uint64>(s_minSampleRequests, 2 * m_target.load(std::memory_order_relaxed)))
+		return;
+
+	// Whoever gets here first closes the sample, the others go on with their completions.
+	if (!m_sampleMutex.try_lock())
+		return;
+	std::lock_guard<std::mutex> lock(m_sampleMutex, std::adopt_lock);
+	CloseSample();
+}
+
+void CInFlightController::CloseSample()
+{
+	const STimestamp now = STimestamp::now();
+	const STimestamp elapsed = now - m_sampleStart;
+	if (elapsed.time < STimestamp::GetFrequency() * s_minSampleMs / 1000)
+		return;
+
+	const uint64 count = m_sampleCount.exchange(0, std::memory_order_relaxed);
+	const uint64 bytes = m_sampleBytes.exchange(0, std::memory_order_relaxed);
+	const int64 latencySum = m_sampleLatency.exchange(0, std::memory_order_relaxed);
+	m_sampleStart = now;
+	if (count == 0)
+		return;
+	if (m_skipSample)
+	{
+		m_skipSample = false;
+		return;
+	}
+
+	const double mbps = bytes / sec(elapsed.dur()) / 1024 / 1024;
+	const STimestamp latency{ latencySum / int64(count) };
+	const uint32 depth = m_target.load(std::memory_order_relaxed);
+	const uint32 step = std::max(depth / 4, 1u);
+
+	// Little's law: latency is depth / IOPS, so at a given depth throughput says it all and latency
+	// only matters between depths. Deeper has to be clearly faster, shallower only must not be slower.
+	switch (m_phase)
+	{
+	case EPhase::SlowStart:
+		if (mbps > m_refMbps * (1 + s_minGain))
+		{
+			m_refMbps = mbps;
+			m_bestMbps = std::max(m_bestMbps, mbps);
+			m_refLatency = latency;
+			m_prevDepth = depth;
+			if (depth < m_maxDepth)
+			{
+				SetTarget(std::min(depth * 2, m_maxDepth), mbps, latency, "grow");
+			}
+			else
+			{
+				m_phase = EPhase::Steady;
+				SetTarget(depth, mbps, latency, "cap");
+			}
+		}
+		else
+		{
+			m_phase = EPhase::Steady;
+			SetTarget(m_prevDepth, mbps, latency, "knee");
+		}
+		break;
+
+	case EPhase::Steady:
+		m_refMbps = m_refMbps * 0.75 + mbps * 0.25;
+		m_refLatency = STimestamp{ (m_refLatency.time * 3 + latency.time) / 4 };
+		m_bestMbps = std::max(m_bestMbps, m_refMbps);
+		if (++m_steadySamples < s_probeEvery)
+			break;
+		m_steadySamples = 0;
+		m_prevDepth = depth;
+		if (m_nextProbeUp && depth < m_maxDepth)
+		{
+			m_phase = EPhase::ProbeUp;
+			SetTarget(std::min(depth + step, m_maxDepth), mbps, latency, "probe up");
+		}
+		else if (depth > 1)
+		{
+			m_phase = EPhase::ProbeDown;
+			SetTarget(depth - step, mbps, latency, "probe down");
+		}
+		m_nextProbeUp = !m_nextProbeUp;
+		break;
+
+	case EPhase::ProbeUp:
+	case EPhase::ProbeDown:
+	{
+		const bool up = m_phase == EPhase::ProbeUp;
+		// Shallower is measured against the best steady throughput, not against the last accepted step,
+		// so a walk down loses s_minGain at most in total and not s_minGain per step.
+		const bool better = up ? mbps > m_refMbps * (1 + s_minGain) : mbps >= m_bestMbps * (1 - s_minGain);
+		m_phase = EPhase::Steady;
+		if (better)
+		{
+			// Keep going the same way on the next probe
+			m_nextProbeUp = up;
+			m_refMbps = mbps;
+			if (up)
+				m_bestMbps = std::max(m_bestMbps, mbps);
+			m_refLatency = latency;
+			SetTarget(depth, mbps, latency, up ? "keep deeper" : "keep shallower");
+		}
+		else
+		{
+			SetTarget(m_prevDepth, mbps, latency, "revert");
+		}
+		break;
+	}
+	}
+}
+
+void CInFlightController::SetTarget(uint32 depth, double mbps, STimestamp latency, const char* szReason)
+{
+	const uint32 cur = m_target.load(std::memory_order_relaxed);
+	m_decisions.push_back(SInFlightDecision{ STimestamp::now() - m_startTime, cur, depth, mbps, latency, szReason });
+	if (depth != cur)
+	{
+		m_target.store(depth, std::memory_order_relaxed);
+		m_skipSample = true;
+	}
+}
+
+void CInFlightController::Park(uint32 bufIdx)
+{
+	std::lock_guard<std::mutex> lock(m_parkedMutex);
+	m_parked.push_back(bufIdx);
+	m_parkedCount.fetch_add(1);
+}
+
+bool CInFlightController::TryUnpark(uint32& bufIdx)
+{
+	if (m_parkedCount.load() == 0)
+		return false;
+	if (!TryAcquire())
+		return false;
+	if (!TakeParked(bufIdx))
+	{
+		Release();
+		return false;
+	}
+	return true;
+}
+
+bool CInFlightController::TakeParked(uint32& bufIdx)
+{
+	std::lock_guard<std::mutex> lock(m_parkedMutex);
+	if (m_parked.empty())
+		return false;
+	bufIdx = m_parked.back();
+	m_parked.pop_back();
+	m_parkedCount.fetch_sub(1);
+	return true;
+}
+
+void CInFlightController::Print() const
+{
+	for (const SInFlightDecision& d : m_decisions)
+	{
+		std::cout << "inflight " << ms(d.time.dur()) << " ms " << d.from << " -> " << d.to << " " << d.reason
+			<< ", MB/s " << d.mbps << " latency " << ms(d.latency.dur()) << " ms" << std::endl;
+	}
+	std::cout << "inflight settled at " << GetTarget() << " of " << m_maxDepth << " after " << m_decisions.size() << " decisions" << std::endl;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Number of outstanding reads picked at runtime, like TCP congestion control picks its window.
+// Starts shallow and doubles while throughput grows, steps back to the best depth at the knee, then
+// keeps probing a step up and down. Depth that doesn't add throughput only adds latency, so a
+// smaller depth wins ties.
+//
+// Engines keep all buffers up to the cap and hand back the ones over the target:
+//  - OnCompletion for every finished read, frees its slot
+//  - finished buffer is resubmitted after TryAcquire, or Park-ed when over the target
+//  - TryUnpark after each completion (and after each Park) takes parked buffers back while under the target
+//  - when there's nothing left to read, SetExhausted and retire everything TakeParked returns
+
+struct SInFlightDecision
+{
+	// Since Init
+	STimestamp time;
+	uint32 from;
+	uint32 to;
+	double mbps;
+	STimestamp latency;
+	const char* reason;
+};
+
+class CInFlightController
+{
+public:
+	static constexpr uint32 s_initialDepth = 4;
+	// Cap when the run config doesn't give one, engines allocate this many buffers
+	static constexpr uint32 s_defaultMaxDepth = 128;
+
+	CInFlightController() = default;
+	CInFlightController(const CInFlightController&) = delete;
+	CInFlightController& operator=(const CInFlightController&) = delete;
+
+	void Init(uint32 maxDepth);
+
+	// Takes a request slot when fewer than the target are outstanding.
+	bool TryAcquire();
+	// Returns a slot TryAcquire gave out that ended up without a request.
+	void Release();
+	// Every finished request, frees its slot. May move the target.
+	void OnCompletion(uint64 bytes, STimestamp latency);
+
+	void Park(uint32 bufIdx);
+	// Parked buffer together with a slot for it, false when at the target or nothing is parked.
+	bool TryUnpark(uint32& bufIdx);
+	// Parked buffer without a slot, for retiring them at the end.
+	bool TakeParked(uint32& bufIdx);
+
+	// Park followed by IsExhausted and SetExhausted followed by TakeParked can't both miss a buffer.
+	void SetExhausted() { m_exhausted.store(true, std::memory_order_seq_cst); }
+	bool IsExhausted() const { return m_exhausted.load(std::memory_order_seq_cst); }
+
+	uint32 GetTarget() const { return m_target.load(std::memory_order_relaxed); }
+	uint32 GetMaxDepth() const { return m_maxDepth; }
+	const std::vector<SInFlightDecision>& GetDecisions() const { return m_decisions; }
+
+	// "inflight 4 -> 8 grow ..." line per decision and the depth it settled on
+	void Print() const;
+
+private:
+	enum class EPhase
+	{
+		SlowStart,
+		Steady,
+		ProbeUp,
+		ProbeDown,
+	};
+
+	void CloseSample();
+	void SetTarget(uint32 depth, double mbps, STimestamp latency, const char* szReason);
+
+	uint32 m_maxDepth = 0;
+	STimestamp m_startTime{};
+
+	alignas(128) std::atomic<uint32> m_target = { 0 };
+	std::atomic<uint32> m_inFlight = { 0 };
+	std::atomic<bool> m_exhausted = { false };
+
+	alignas(128) std::atomic<uint64> m_sampleBytes = { 0 };
+	std::atomic<uint64> m_sampleCount = { 0 };
+	std::atomic<int64> m_sampleLatency = { 0 };
+
+	// Everything below is only touched by the thread that closes a sample
+	alignas(128) std::mutex m_sampleMutex;
+	STimestamp m_sampleStart{};
+	EPhase m_phase = EPhase::SlowStart;
+	// Sample after a change still has requests issued at the old depth
+	bool m_skipSample = false;
+	uint32 m_steadySamples = 0;
+	bool m_nextProbeUp = true;
+	uint32 m_prevDepth = 0;
+	double m_refMbps = 0;
+	// Highest throughput of any depth that was kept, shallower depths are compared to it
+	double m_bestMbps = 0;
+	STimestamp m_refLatency{};
+	std::vector<SInFlightDecision> m_decisions;
+
+	std::mutex m_parkedMutex;
+	std::vector<uint32> m_parked;
+	std::atomic<uint32> m_parkedCount = { 0 };
+};
@@ -0,0 +1,297 @@
+#pragma once
+
+#include "common.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <linux/aio_abi.h>
+#include <linux/io_uring.h>
+
+
+struct SFdCloser
+{
+	SFdCloser() = default;
+	SFdCloser(int fd) : fd(fd) {}
+	~SFdCloser()
+	{
+		Close();
+	}
+
+	SFdCloser(const SFdCloser&) = delete;
+	SFdCloser& operator=(const SFdCloser&) = delete;
+
+	SFdCloser(SFdCloser&& o) noexcept
+	{
+		Close();
+		std::swap(fd, o.fd);
+	}
+	SFdCloser& operator=(SFdCloser&& o) noexcept
+	{
+		Close();
+		std::swap(fd, o.fd);
+		return *this;
+	}
+
+	void Close()
+	{
+		if (fd != -1)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	int fd = -1;
+};
+
+
+// Minimal io_uring wrapper on top of raw syscalls, so there is no dependency on liburing.
+// Submission is serialized with a mutex, completions can be popped from any number of threads,
+// similar to how several workers can wait on one IOCP.
+class CUring
+{
+public:
+	CUring() = default;
+	CUring(const CUring&) = delete;
+	CUring& operator=(const CUring&) = delete;
+
+	~CUring()
+	{
+		if (m_sqes)
+			munmap(m_sqes, m_sqesSize);
+		if (m_cqPtr && m_cqPtr != m_sqPtr)
+			munmap(m_cqPtr, m_cqSize);
+		if (m_sqPtr)
+			munmap(m_sqPtr, m_sqSize);
+	}
+
+	// Returns 0 or -errno
+	int Init(unsigned entries)
+	{
+		io_uring_params p{};
+		const int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+		if (fd < 0)
+			return -errno;
+		m_ringFd = fd;
+
+		m_sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		m_cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		const bool singleMmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMmap)
+			m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+
+		m_sqPtr = mmap(nullptr, m_sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd.fd, IORING_OFF_SQ_RING);
+		if (m_sqPtr == MAP_FAILED)
+		{
+			m_sqPtr = nullptr;
+			return -errno;
+		}
+
+		if (singleMmap)
+		{
+			m_cqPtr = m_sqPtr;
+		}
+		else
+		{
+			m_cqPtr = mmap(nullptr, m_cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd.fd, IORING_OFF_CQ_RING);
+			if (m_cqPtr == MAP_FAILED)
+			{
+				m_cqPtr = nullptr;
+				return -errno;
+			}
+		}
+
+		m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd.fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+			return -errno;
+		m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+		char* sq = static_cast<char*>(m_sqPtr);
+		m_sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+		m_sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+		m_sqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+		m_sqEntries = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_entries);
+		m_sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+
+		char* cq = static_cast<char*>(m_cqPtr);
+		m_cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+		m_cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+		m_cqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+		m_cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+		return 0;
+	}
+
+	int RegisterFiles(const int* fds, unsigned count)
+	{
+		const int res = (int)syscall(__NR_io_uring_register, m_ringFd.fd, IORING_REGISTER_FILES, fds, count);
+		return res < 0 ? -errno : res;
+	}
+
+	int RegisterBuffers(const iovec* iovs, unsigned count)
+	{
+		const int res = (int)syscall(__NR_io_uring_register, m_ringFd.fd, IORING_REGISTER_BUFFERS, iovs, count);
+		return res < 0 ? -errno : res;
+	}
+
+	// Callback receives zeroed sqe to fill. Returns io_uring_enter result, i.e. count of submitted entries or -errno.
+	template <typename F>
+	int Submit(F&& fill)
+	{
+		const int res = Prepare(std::forward<F>(fill));
+		if (res < 0)
+			return res;
+		return Enter(1, 0, 0);
+	}
+
+	// Fills the next sqe without telling the kernel, -EBUSY when the ring is full.
+	// SubmitPrepared then hands all prepared entries over with one io_uring_enter.
+	template <typename F>
+	int Prepare(F&& fill)
+	{
+		std::scoped_lock lock(m_submitMtx);
+
+		const unsigned tail = *m_sqTail;
+		const unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+		if (tail - head >= m_sqEntries)
+			return -EBUSY;
+
+		const unsigned idx = tail & m_sqMask;
+		io_uring_sqe* sqe = &m_sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		fill(*sqe);
+		m_sqArray[idx] = idx;
+		__atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	int SubmitPrepared(unsigned count)
+	{
+		return Enter(count, 0, 0);
+	}
+
+	// Non-blocking. Safe to call from several threads at once.
+	bool TryPopCompletion(io_uring_cqe& out)
+	{
+		unsigned head = __atomic_load_n(m_cqHead, __ATOMIC_RELAXED);
+		while (true)
+		{
+			const unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+			if (head == tail)
+				return false;
+
+			// Copy before advancing head, after that kernel may reuse the slot.
+			// If another thread wins the race, copy is discarded and we retry with updated head.
+			out = m_cqes[head & m_cqMask];
+			if (__atomic_compare_exchange_n(m_cqHead, &head, head + 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+				return true;
+		}
+	}
+
+	// Blocks until completion is popped. Returns 0 or -errno.
+	int WaitCompletion(io_uring_cqe& out)
+	{
+		while (!TryPopCompletion(out))
+		{
+			const int res = Enter(0, 1, IORING_ENTER_GETEVENTS);
+			if (res < 0 && res != -EINTR)
+				return res;
+		}
+		return 0;
+	}
+
+private:
+	int Enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+	{
+		const int res = (int)syscall(__NR_io_uring_enter, m_ringFd.fd, toSubmit, minComplete, flags, nullptr, 0);
+		return res < 0 ? -errno : res;
+	}
+
+	SFdCloser m_ringFd;
+
+	void* m_sqPtr = nullptr;
+	size_t m_sqSize = 0;
+	void* m_cqPtr = nullptr;
+	size_t m_cqSize = 0;
+	io_uring_sqe* m_sqes = nullptr;
+	size_t m_sqesSize = 0;
+
+	unsigned* m_sqHead = nullptr;
+	unsigned* m_sqTail = nullptr;
+	unsigned* m_sqArray = nullptr;
+	unsigned m_sqMask = 0;
+	unsigned m_sqEntries = 0;
+
+	unsigned* m_cqHead = nullptr;
+	unsigned* m_cqTail = nullptr;
+	io_uring_cqe* m_cqes = nullptr;
+	unsigned m_cqMask = 0;
+
+	std::mutex m_submitMtx;
+};
+
+
+// Linux native AIO via raw syscalls, same as libaio does. Works only as real async IO with O_DIRECT.
+// io_submit and io_getevents are both thread-safe, so no locks needed here.
+class CAioContext
+{
+public:
+	CAioContext() = default;
+	CAioContext(const CAioContext&) = delete;
+	CAioContext& operator=(const CAioContext&) = delete;
+
+	~CAioContext()
+	{
+		if (m_ctx)
+			syscall(__NR_io_destroy, m_ctx);
+	}
+
+	// Returns 0 or -errno
+	int Init(unsigned maxEvents)
+	{
+		const int res = (int)syscall(__NR_io_setup, maxEvents, &m_ctx);
+		return res < 0 ? -errno : 0;
+	}
+
+	// Returns count of submitted iocbs or -errno
+	int Submit(iocb** ppIocbs, long count)
+	{
+		const int res = (int)syscall(__NR_io_submit, m_ctx, count, ppIocbs);
+		return res < 0 ? -errno : res;
+	}
+
+	int Submit(iocb& cb)
+	{
+		iocb* pCb = &cb;
+		return Submit(&pCb, 1);
+	}
+
+	// Blocks until at least minCount events are available. Returns count of events or -errno.
+	int GetEvents(io_event* pEvents, long minCount, long maxCount, timespec* pTimeout = nullptr)
+	{
+		while (true)
+		{
+			const int res = (int)syscall(__NR_io_getevents, m_ctx, minCount, maxCount, pEvents, pTimeout);
+			if (res >= 0)
+				return res;
+			if (errno != EINTR)
+				return -errno;
+		}
+	}
+
+private:
+	aio_context_t m_ctx = 0;
+};
@@ -0,0 +1,212 @@
+#include "lz.h"
+
+#include <cstring>
+#include <vector>
+
+static constexpr size_t s_minMatch = 4;
+// Format rules: last 5 bytes are always literals, last match starts at least 12 bytes before end.
+static constexpr size_t s_lastLiterals = 5;
+static constexpr size_t s_mfLimit = 12;
+static constexpr size_t s_maxOffset = 65535;
+
+static constexpr int s_hashLog = 14;
+static constexpr size_t s_wildCopy = 16;
+
+static uint32 Read32(const char* p)
+{
+	uint32 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32 Hash4(uint32 v)
+{
+	return (v * 2654435761u) >> (32 - s_hashLog);
+}
+
+// Writes 255-run encoded length remainder, used for both literal and match lengths.
+static bool WriteLength(char*& op, const char* oend, size_t len)
+{
+	for (; len >= 255; len -= 255)
+	{
+		if (op >= oend)
+			return false;
+		*op++ = char(255);
+	}
+	if (op >= oend)
+		return false;
+	*op++ = char(len);
+	return true;
+}
+
+static bool WriteSequence(char*& op, const char* oend, const char* pLit, size_t litLen, size_t offset, size_t matchLen)
+{
+	if (op >= oend)
+		return false;
+
+	const bool last = matchLen == 0;
+	const size_t ml = last ? 0 : matchLen - s_minMatch;
+	char* pToken = op++;
+	*pToken = char(((litLen >= 15 ? 15 : litLen) << 4) | (ml >= 15 ? 15 : ml));
+
+	if (litLen >= 15 && !WriteLength(op, oend, litLen - 15))
+		return false;
+
+	if (size_t(oend - op) < litLen)
+		return false;
+	memcpy(op, pLit, litLen);
+	op += litLen;
+
+	if (last)
+		return true;
+
+	if (oend - op < 2)
+		return false;
+	*op++ = char(offset & 0xff);
+	*op++ = char(offset >> 8);
+
+	if (ml >= 15 && !WriteLength(op, oend, ml - 15))
+		return false;
+
+	return true;
+}
+
+size_t LzCompress(const char* pSrc, size_t srcSize, char* pDst, size_t dstCapacity)
+{
+	char* op = pDst;
+	const char* oend = pDst + dstCapacity;
+
+	const char* ip = pSrc;
+	const char* anchor = pSrc;
+	const char* iend = pSrc + srcSize;
+
+	if (srcSize > s_mfLimit)
+	{
+		const char* mflimit = iend - s_mfLimit;
+		const char* matchlimit = iend - s_lastLiterals;
+
+		// Positions are relative to pSrc, 0 doubles as empty slot, which is fine since match is verified.
+		thread_local std::vector<uint32> table;
+		table.assign(size_t(1) << s_hashLog, 0);
+
+		while (ip < mflimit)
+		{
+			const uint32 seq = Read32(ip);
+			const uint32 h = Hash4(seq);
+			const char* ref = pSrc + table[h];
+			table[h] = uint32(ip - pSrc);
+
+			if (ref >= ip || size_t(ip - ref) > s_maxOffset || Read32(ref) != seq)
+			{
+				// Skip faster through data which doesn't compress.
+				ip += 1 + (size_t(ip - anchor) >> 6);
+				continue;
+			}
+
+			const char* mp = ip + s_minMatch;
+			const char* rp = ref + s_minMatch;
+			while (mp < matchlimit && *mp == *rp)
+			{
+				++mp;
+				++rp;
+			}
+
+			if (!WriteSequence(op, oend, anchor, size_t(ip - anchor), size_t(ip - ref), size_t(mp - ip)))
+				return 0;
+
+			ip = mp;
+			anchor = ip;
+		}
+	}
+
+	if (!WriteSequence(op, oend, anchor, size_t(iend - anchor), 0, 0))
+		return 0;
+
+	return size_t(op - pDst);
+}
+
+int64 LzDecompress(const char* pSrc, size_t srcSize, char* pDst, size_t dstCapacity)
+{
+	const uint8* ip = reinterpret_cast<const uint8*>(pSrc);
+	const uint8* iend = ip + srcSize;
+	char* op = pDst;
+	const char* oend = pDst + dstCapacity;
+
+	while (ip < iend)
+	{
+		const uint32 token = *ip++;
+
+		size_t litLen = token >> 4;
+		if (litLen == 15)
+		{
+			uint32 b;
+			do
+			{
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				litLen += b;
+			} while (b == 255);
+		}
+
+		if (size_t(iend - ip) < litLen || size_t(oend - op) < litLen)
+			return -1;
+		// Short literal runs are copied with one fixed size copy when there is room for overrun.
+		if (litLen <= s_wildCopy && iend - ip >= ptrdiff_t(s_wildCopy) && oend - op >= ptrdiff_t(s_wildCopy))
+			memcpy(op, ip, s_wildCopy);
+		else
+			memcpy(op, ip, litLen);
+		ip += litLen;
+		op += litLen;
+
+		// Last sequence has literals only
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+		const size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+		ip += 2;
+		if (offset == 0 || offset > size_t(op - pDst))
+			return -1;
+
+		size_t matchLen = token & 15;
+		if (matchLen == 15)
+		{
+			uint32 b;
+			do
+			{
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				matchLen += b;
+			} while (b == 255);
+		}
+		matchLen += s_minMatch;
+
+		if (size_t(oend - op) < matchLen)
+			return -1;
+
+		const char* match = op - offset;
+		if (offset >= s_wildCopy && size_t(oend - op) >= matchLen + s_wildCopy)
+		{
+			// Each chunk reads only bytes written before it
+			for (size_t i = 0; i < matchLen; i += s_wildCopy)
+				memcpy(op + i, match + i, s_wildCopy);
+			op += matchLen;
+		}
+		else if (offset >= matchLen)
+		{
+			memcpy(op, match, matchLen);
+			op += matchLen;
+		}
+		else
+		{
+			// Overlapping copy repeats the pattern
+			for (size_t i = 0; i < matchLen; ++i)
+				*op++ = *match++;
+		}
+	}
+
+	return int64(op - pDst);
+}
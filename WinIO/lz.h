@@ -0,0 +1,17 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+
+// Self-contained LZ77 codec producing LZ4 block format (token, literals, 16-bit offset, match length).
+// Greedy single-probe compressor, decompressor validates all bounds.
+
+// Worst case size of compressed data for input of srcSize bytes.
+inline size_t LzCompressBound(size_t srcSize) { return srcSize + srcSize / 255 + 16; }
+
+// Returns compressed size, or 0 when output doesn't fit into dstCapacity.
+size_t LzCompress(const char* pSrc, size_t srcSize, char* pDst, size_t dstCapacity);
+
+// Returns decompressed size, or -1 on malformed input or when output doesn't fit into dstCapacity.
+int64 LzDecompress(const char* pSrc, size_t srcSize, char* pDst, size_t dstCapacity);
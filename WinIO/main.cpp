@@ -1,10 +1,132 @@
 #include "tests.h"
+#include "archive.h"
+#include "bench.h"
+#include "compressedfile.h"
+#include "fileset.h"
+#include "pagecache.h"
+#include "testdata.h"
+#include "workload.h"
 
-int main()
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <iostream>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+int main(int argc, char** argv)
 {
+	// WINIO_TRACE=<file.json> records PROF_FUNC/PROF_REGION into Chrome trace, written at exit
+	if (const char* szTrace = getenv("WINIO_TRACE"))
+		StartTrace(szTrace);
+
 	SetThreadName(L"Main");
 
-	const char* szFilename = "f:/code/winio/test/datapc64_merged_bnk_textures1.forge";
+	// WinIO pack <src> <dst> [blockSize] - writes compressed container, see compressedfile.h
+	if (argc > 3 && strcmp(argv[1], "pack") == 0)
+	{
+		const uint32 blockSize = argc > 4 ? uint32(strtoul(argv[4], nullptr, 0)) : s_compressedDefaultBlockSize;
+		return PackCompressedFile(argv[2], argv[3], blockSize);
+	}
+
+	// WinIO gen <dst> <size> [seed] [compressibility] - writes deterministic test file and <dst>.sums, see testdata.h
+	if (argc > 3 && strcmp(argv[1], "gen") == 0)
+	{
+		STestDataParams params;
+		if (!ParseDataSize(argv[3], params.size))
+			return 1;
+		if (argc > 4)
+			params.seed = strtoull(argv[4], nullptr, 0);
+		if (argc > 5)
+			params.compressibility = strtod(argv[5], nullptr);
+		return GenerateTestFile(argv[2], params);
+	}
+
+	// WinIO bench <file> [options] - runs engines over parameter sweeps, writes JSON/CSV records, see bench.cpp
+	if (argc > 2 && strcmp(argv[1], "bench") == 0)
+	{
+		SetProcessingStage(EProcessingStage::ByteSum);
+		return RunBenchmarkMatrix(argc - 2, argv + 2);
+	}
+
+	// WinIO mkarchive <src> <dst> [assetCount] - slices file into packed archive, see archive.h
+	if (argc > 3 && strcmp(argv[1], "mkarchive") == 0)
+	{
+		const uint32 assetCount = argc > 4 ? uint32(strtoul(argv[4], nullptr, 0)) : 4096;
+		return BuildArchive(argv[2], argv[3], assetCount);
+	}
+
+	// WinIO archive <archive> [requestCount] - one by one vs batched asset loading
+	if (argc > 2 && strcmp(argv[1], "archive") == 0)
+	{
+		const uint32 requestCount = argc > 3 ? uint32(strtoul(argv[3], nullptr, 0)) : 1024;
+		SetProcessingStage(EProcessingStage::ByteSum);
+		Test9_Archive(argv[2], requestCount);
+		return 0;
+	}
+
+	// WinIO sumkernels - compares the checksum kernels on a buffer in memory, no file needed
+	if (argc > 1 && strcmp(argv[1], "sumkernels") == 0)
+	{
+		Test8_SumKernels();
+		return 0;
+	}
+
+	// WinIO files <file1> <file2> ... - async engines stream all files at once, see fileset.h
+	if (argc > 3 && strcmp(argv[1], "files") == 0)
+	{
+		SFileSet fileSet;
+		if (!LoadFileSet(std::vector<std::string>(argv + 2, argv + argc), fileSet))
+			return 1;
+		SetProcessingStage(EProcessingStage::ByteSum);
+		SetFileSet(&fileSet);
+#ifdef _WIN32
+		Test3_CompIOWorkers(argv[2], fileSet.sizes[0]);
+#endif
+#ifdef __linux__
+		Test5_IoUring(argv[2], fileSet.sizes[0]);
+		Test6_LinuxAio(argv[2], fileSet.sizes[0]);
+#endif
+		SetFileSet(nullptr);
+		return 0;
+	}
+
+	// WinIO random <file> [uniform|zipf|hotset] [requestCount] [sizeMix] - async engines do random reads, see workload.h
+	SWorkloadParams workloadParams;
+	const bool randomAccess = argc > 2 && strcmp(argv[1], "random") == 0;
+	if (randomAccess)
+	{
+		if (argc > 3 && !ParseAccessPattern(argv[3], workloadParams.pattern))
+			return 1;
+		if (argc > 4)
+			workloadParams.requestCount = strtoull(argv[4], nullptr, 0);
+		if (argc > 5 && !ParseSizeMix(argv[5], workloadParams.sizeMix))
+			return 1;
+	}
+
+	const char* szDefaultFilename = "f:/code/winio/test/datapc64_merged_bnk_textures1.forge";
+	const char* szFilename = randomAccess ? argv[2]
+		: argc > 1 ? argv[1] : szDefaultFilename;
+
+	// Results are checked against <file>.sums when there is one, see testdata.h
+	SExpectedSums expectedSums;
+	if (LoadExpectedSums(szFilename, expectedSums))
+	{
+		SetExpectedSums(expectedSums);
+	}
+	else if (szFilename == szDefaultFilename)
+	{
+		expectedSums.known[size_t(EProcessingStage::ByteSum)] = true;
+		expectedSums.sums[size_t(EProcessingStage::ByteSum)] = 1226802104644;
+		SetExpectedSums(expectedSums);
+	}
+	else
+	{
+		std::cout << "No " << szFilename << ".sums, results are not verified" << std::endl;
+	}
 
 	FILE* f = fopen(szFilename, "rb");
 	if (!f)
@@ -15,21 +137,138 @@ int main()
 		return 2;
 
 	long fsize = ftell(f);
+#ifdef _WIN32
 	long long fsize64 = _ftelli64(f);
+#else
+	long long fsize64 = ftello(f);
+#endif
 
-	fpos_t fsizePos = 0;
+	fpos_t fsizePos{};
 	res = fgetpos(f, &fsizePos);
 
+	SWorkload workload;
+	if (randomAccess)
+	{
+		if (!GenerateWorkload(workloadParams, uint64(fsize64), workload))
+			return 2;
+		SetWorkload(&workload);
+	}
+
+	// WINIO_CACHE=cold|warm|partial:<fraction> puts the file in the same page cache state before every test
+	SCacheControl cacheControl;
+	if (const char* szCache = getenv("WINIO_CACHE"))
+	{
+		if (!ParseCacheControl(szCache, cacheControl))
+			return 1;
+	}
+	// WINIO_PIN=compact|scatter|<cpu list> pins test workers, WINIO_NUMA_BUFFERS=device|spread places IO buffers
+	{
+		SRunConfig cfg = GetRunConfig();
+		if (const char* szPin = getenv("WINIO_PIN"))
+		{
+			if (!ParsePinMode(szPin, cfg.pinMode, cfg.pinCpus))
+				return 1;
+		}
+		if (const char* szNumaBuffers = getenv("WINIO_NUMA_BUFFERS"))
+		{
+			if (!ParseNumaBuffers(szNumaBuffers, cfg.numaBuffers))
+				return 1;
+		}
+		// WINIO_INFLIGHT=auto[:cap] lets the async engines pick their depth, see inflight.h
+		if (const char* szInFlight = getenv("WINIO_INFLIGHT"))
+		{
+			if (strncmp(szInFlight, "auto", 4) != 0 || (szInFlight[4] && szInFlight[4] != ':'))
+				return 1;
+			cfg.inFlightMode = SRunConfig::EInFlightMode::Adaptive;
+			cfg.maxInFlight = szInFlight[4] ? uint32(strtoul(szInFlight + 5, nullptr, 10)) : 0;
+		}
+		// WINIO_FENCE=request|batch|<requests> places the fence signals of Test10, see dsqueue.h
+		if (const char* szFence = getenv("WINIO_FENCE"))
+		{
+			if (strcmp(szFence, "request") == 0)
+				cfg.fenceMode = SRunConfig::EFenceMode::Request;
+			else if (strcmp(szFence, "batch") == 0)
+				cfg.fenceMode = SRunConfig::EFenceMode::Batch;
+			else if ((cfg.fenceInterval = uint32(strtoul(szFence, nullptr, 10))) != 0)
+				cfg.fenceMode = SRunConfig::EFenceMode::Interval;
+			else
+				return 1;
+		}
+		// WINIO_WAIT=spin|adaptive[:us] makes workers poll for completions before they block, see spinwait.h
+		if (const char* szWait = getenv("WINIO_WAIT"))
+		{
+			if (!ParseWaitMode(szWait, cfg.waitMode, cfg.spinUs))
+				return 1;
+		}
+		// WINIO_WAKE=lifo|fifo and WINIO_CONCURRENCY=<threads> set up the completion port of Test11, see compport.h
+		if (const char* szWake = getenv("WINIO_WAKE"))
+		{
+			if (!ParseWakeOrder(szWake, cfg.wakeOrder))
+				return 1;
+		}
+		if (const char* szConcurrency = getenv("WINIO_CONCURRENCY"))
+			cfg.portConcurrency = uint32(strtoul(szConcurrency, nullptr, 10));
+		// WINIO_SUBMIT=merge:1m+split:256k merges and splits requests of io_uring before submission, see submitplan.h
+		if (const char* szSubmit = getenv("WINIO_SUBMIT"))
+		{
+			if (!ParseSubmitParams(szSubmit, cfg.submit))
+				return 1;
+		}
+		cfg.deviceNode = GetFileNumaNode(szFilename);
+		SetRunConfig(cfg);
+		if (cfg.pinMode != EPinMode::None || cfg.numaBuffers != ENumaBuffers::FirstTouch)
+		{
+			std::cout << "Pin " << GetPinModeName(cfg.pinMode) << ", buffers " << GetNumaBuffersName(cfg.numaBuffers)
+				<< ", nodes " << GetNumaNodeCount() << ", device node " << cfg.deviceNode << std::endl;
+		}
+	}
+
+	const auto prepareCache = [&]()
+	{
+		if (cacheControl.state == ECacheState::Keep)
+			return;
+		const double residency = PrepareFileCache(szFilename, cacheControl);
+		std::cout << "Cache " << GetCacheStateName(cacheControl.state) << ", resident " << residency * 100 << "%" << std::endl;
+	};
+
+	// Work done on every read buffer, see checksum.h
+	SetProcessingStage(EProcessingStage::ByteSum);
+
 	for (int i = 0; i < 1; ++i)
 	{
+#ifdef _WIN32
 		//res = fseek(f, 0, SEEK_SET);
 		//Test1_Seq(f, fsizePos);
 		//
 		//res = fseek(f, 0, SEEK_SET);
 		//Test2_Par(f, fsizePos);
 
+		prepareCache();
 		Test3_CompIOWorkers(szFilename, fsizePos);
+		prepareCache();
 		Test4_DStorage(szFilename, fsizePos);
+#endif
+
+#ifdef __linux__
+		prepareCache();
+		Test5_IoUring(szFilename, fsize64);
+		prepareCache();
+		Test6_LinuxAio(szFilename, fsize64);
+		prepareCache();
+		Test7_Mmap(szFilename, fsize64);
+		prepareCache();
+		Test10_DStorageQueue(szFilename, fsize64);
+		prepareCache();
+		Test11_CompPortWorkers(szFilename, fsize64);
+#endif
+
+		prepareCache();
+		Test12_Coroutines(szFilename, fsize64);
+
+#ifdef __linux__
+		prepareCache();
+		Test13_Priority(szFilename, fsize64);
+#endif
 	}
 
 	int isEof = feof(f);
@@ -45,9 +284,24 @@ void SetThreadName(const wchar_t* format, ...)
 	wchar_t buffer[256];
 	va_list args;
 	va_start(args, format);
+#ifdef _WIN32
 	vswprintf_s(buffer, format, args);
+#else
+	vswprintf(buffer, sizeof(buffer) / sizeof(buffer[0]), format, args);
+#endif
 	va_end(args);
 
+#ifdef _WIN32
 	HRESULT r = SetThreadDescription(GetCurrentThread(), buffer);
+#else
+	// Linux limits thread names to 15 chars
+	char name[16] = {};
+	wcstombs(name, buffer, sizeof(name) - 1);
+	pthread_setname_np(pthread_self(), name);
+#endif
+
+	char traceName[32] = {};
+	wcstombs(traceName, buffer, sizeof(traceName) - 1);
+	SetTraceThreadName(traceName);
 }
 
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <atomic>
+
+// Bounded multi-producer multi-consumer FIFO, D. Vyukov's design. Every cell has a sequence number
+// that tells whether it's ready for the producer or the consumer at a given position, so producers and
+// consumers only share a cell when they actually hand it over. Head, tail and cells are on separate
+// cache lines. Try* never block, combine with CEventCount to park (see eventcount.h).
+template <class T, size_t Capacity>
+class CMpmcQueue
+{
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity has to be power of two");
+	static constexpr size_t s_cacheLine = 128;
+
+public:
+	CMpmcQueue()
+	{
+		for (size_t i = 0; i < Capacity; ++i)
+			m_cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	CMpmcQueue(const CMpmcQueue&) = delete;
+	CMpmcQueue& operator=(const CMpmcQueue&) = delete;
+
+	bool TryPush(const T& value)
+	{
+		size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		SCell* pCell;
+		while (true)
+		{
+			pCell = &m_cells[pos & (Capacity - 1)];
+			const size_t seq = pCell->seq.load(std::memory_order_acquire);
+			const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+			if (diff == 0)
+			{
+				if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+			{
+				// Consumer hasn't freed the cell from the previous lap yet, full.
+				return false;
+			}
+			else
+			{
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		pCell->value = value;
+		pCell->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool TryPop(T& value)
+	{
+		size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		SCell* pCell;
+		while (true)
+		{
+			pCell = &m_cells[pos & (Capacity - 1)];
+			const size_t seq = pCell->seq.load(std::memory_order_acquire);
+			const intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+			if (diff == 0)
+			{
+				if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+			{
+				// Producer hasn't filled the cell yet, empty.
+				return false;
+			}
+			else
+			{
+				pos = m_dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+		value = pCell->value;
+		pCell->seq.store(pos + Capacity, std::memory_order_release);
+		return true;
+	}
+
+private:
+	struct alignas(s_cacheLine) SCell
+	{
+		std::atomic<size_t> seq;
+		T value;
+	};
+
+	alignas(s_cacheLine) std::atomic<size_t> m_enqueuePos = { 0 };
+	alignas(s_cacheLine) std::atomic<size_t> m_dequeuePos = { 0 };
+	std::array<SCell, Capacity> m_cells;
+};
@@ -0,0 +1,472 @@
+#include "numa.h"
+#include "bench.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#endif
+
+static const char* s_pinModeNames[] = { "none", "compact", "scatter", "list" };
+static_assert(sizeof(s_pinModeNames) / sizeof(s_pinModeNames[0]) == size_t(EPinMode::Count), "Missing pin mode name");
+
+static const char* s_numaBuffersNames[] = { "first-touch", "device", "spread" };
+static_assert(sizeof(s_numaBuffersNames) / sizeof(s_numaBuffersNames[0]) == size_t(ENumaBuffers::Count), "Missing placement name");
+
+const char* GetPinModeName(EPinMode mode)
+{
+	return s_pinModeNames[size_t(mode)];
+}
+
+const char* GetNumaBuffersName(ENumaBuffers mode)
+{
+	return s_numaBuffersNames[size_t(mode)];
+}
+
+bool ParseNumaBuffers(const char* szValue, ENumaBuffers& mode)
+{
+	for (size_t i = 0; i < size_t(ENumaBuffers::Count); ++i)
+	{
+		if (strcmp(szValue, s_numaBuffersNames[i]) == 0)
+		{
+			mode = ENumaBuffers(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+// "0-3,8,10-11", bench lists use + instead of ,
+static bool ParseCpuList(const char* szList, std::vector<uint32>& cpus)
+{
+	cpus.clear();
+	const char* p = szList;
+	while (*p && *p != '\n')
+	{
+		char* pEnd = nullptr;
+		const unsigned long first = strtoul(p, &pEnd, 10);
+		if (pEnd == p)
+			return false;
+		unsigned long last = first;
+		p = pEnd;
+		if (*p == '-')
+		{
+			++p;
+			last = strtoul(p, &pEnd, 10);
+			if (pEnd == p || last < first)
+				return false;
+			p = pEnd;
+		}
+		for (unsigned long c = first; c <= last; ++c)
+			cpus.push_back(uint32(c));
+		if (*p == ',' || *p == '+')
+			++p;
+		else if (*p && *p != '\n')
+			return false;
+	}
+	return true;
+}
+
+bool ParsePinMode(const char* szValue, EPinMode& mode, std::vector<uint32>& cpus)
+{
+	for (size_t i = 0; i < size_t(EPinMode::List); ++i)
+	{
+		if (strcmp(szValue, s_pinModeNames[i]) == 0)
+		{
+			mode = EPinMode(i);
+			cpus.clear();
+			return true;
+		}
+	}
+	std::vector<uint32> list;
+	if (!ParseCpuList(szValue, list) || list.empty())
+		return false;
+	mode = EPinMode::List;
+	cpus = list;
+	return true;
+}
+
+#ifdef __linux__
+
+static bool ReadSysFile(const std::string& path, char* pBuf, size_t size)
+{
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f)
+		return false;
+	const size_t read = fread(pBuf, 1, size - 1, f);
+	fclose(f);
+	pBuf[read] = 0;
+	return read > 0;
+}
+
+static std::vector<SCpuInfo> ReadCpus()
+{
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	sched_getaffinity(0, sizeof(mask), &mask);
+
+	std::vector<SCpuInfo> cpus;
+	char buf[4096];
+	for (uint32 c = 0; c < CPU_SETSIZE; ++c)
+	{
+		if (!CPU_ISSET(c, &mask))
+			continue;
+		SCpuInfo info{ c, c, 0 };
+		if (ReadSysFile("/sys/devices/system/cpu/cpu" + std::to_string(c) + "/topology/core_id", buf, sizeof(buf)))
+		{
+			// core_id is only unique within a package
+			uint32 package = 0;
+			if (ReadSysFile("/sys/devices/system/cpu/cpu" + std::to_string(c) + "/topology/physical_package_id", buf + 64, sizeof(buf) - 64))
+				package = uint32(strtoul(buf + 64, nullptr, 10));
+			info.core = package << 16 | uint32(strtoul(buf, nullptr, 10));
+		}
+		cpus.push_back(info);
+	}
+
+	std::vector<uint32> nodeCpus;
+	for (int node = 0; node < 1024; ++node)
+	{
+		if (!ReadSysFile("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", buf, sizeof(buf)))
+		{
+			if (node > 0)
+				break;
+			continue;
+		}
+		if (!ParseCpuList(buf, nodeCpus))
+			continue;
+		for (SCpuInfo& info : cpus)
+		{
+			if (std::find(nodeCpus.begin(), nodeCpus.end(), info.id) != nodeCpus.end())
+				info.node = node;
+		}
+	}
+	return cpus;
+}
+
+int GetCurrentThreadNode()
+{
+	const int cpu = sched_getcpu();
+	return cpu >= 0 ? GetCpuNode(uint32(cpu)) : -1;
+}
+
+bool PinCurrentThread(uint32 cpu)
+{
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	return sched_setaffinity(0, sizeof(mask), &mask) == 0;
+}
+
+CNodeAffinityScope::CNodeAffinityScope(int node)
+{
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	bool any = false;
+	for (const SCpuInfo& info : GetCpus())
+	{
+		if (info.node == node)
+		{
+			CPU_SET(info.id, &mask);
+			any = true;
+		}
+	}
+	if (!any)
+		return;
+
+	m_prev.resize(sizeof(cpu_set_t));
+	if (sched_getaffinity(0, sizeof(cpu_set_t), reinterpret_cast<cpu_set_t*>(m_prev.data())) != 0)
+		return;
+	m_pinned = sched_setaffinity(0, sizeof(mask), &mask) == 0;
+}
+
+CNodeAffinityScope::~CNodeAffinityScope()
+{
+	if (m_pinned)
+		sched_setaffinity(0, sizeof(cpu_set_t), reinterpret_cast<const cpu_set_t*>(m_prev.data()));
+}
+
+int GetFileNumaNode(const char* szFilename)
+{
+	struct stat st {};
+	if (stat(szFilename, &st) != 0)
+		return -1;
+
+	// Block device in sysfs, partitions sit below their disk, the PCI device above has numa_node.
+	const std::string devLink = "/sys/dev/block/" + std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+	char* szReal = realpath(devLink.c_str(), nullptr);
+	if (!szReal)
+		return -1;
+	std::string path = szReal;
+	free(szReal);
+
+	char buf[64];
+	while (path.size() > strlen("/sys/devices"))
+	{
+		if (ReadSysFile(path + "/numa_node", buf, sizeof(buf)) || ReadSysFile(path + "/device/numa_node", buf, sizeof(buf)))
+			return atoi(buf);
+		path.resize(path.rfind('/'));
+	}
+	return -1;
+}
+
+bool BindMemoryToNode(void* p, size_t size, int node)
+{
+	if (node < 0 || node >= 64)
+		return false;
+	static constexpr int s_mpolPreferred = 1;
+	static constexpr unsigned s_mpolMfMove = 1 << 1;
+	const unsigned long nodeMask = 1ul << node;
+	return syscall(SYS_mbind, p, size, s_mpolPreferred, &nodeMask, 64ul, s_mpolMfMove) == 0;
+}
+
+static int OpenNodeCounter(uint64 result)
+{
+	perf_event_attr attr{};
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+void CNodeTrafficCounter::Start()
+{
+	m_loadsFd = OpenNodeCounter(PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+	m_missesFd = m_loadsFd >= 0 ? OpenNodeCounter(PERF_COUNT_HW_CACHE_RESULT_MISS) : -1;
+	for (int fd : { m_loadsFd, m_missesFd })
+	{
+		if (fd >= 0)
+		{
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+SNodeTraffic CNodeTrafficCounter::Stop()
+{
+	SNodeTraffic res;
+	uint64 v = 0;
+	if (m_loadsFd >= 0 && read(m_loadsFd, &v, sizeof(v)) == sizeof(v))
+		res.loads = int64(v);
+	if (m_missesFd >= 0 && read(m_missesFd, &v, sizeof(v)) == sizeof(v))
+		res.remoteLoads = int64(v);
+	for (int* pFd : { &m_loadsFd, &m_missesFd })
+	{
+		if (*pFd >= 0)
+			close(*pFd);
+		*pFd = -1;
+	}
+	return res;
+}
+
+CNodeTrafficCounter::~CNodeTrafficCounter()
+{
+	Stop();
+}
+
+#endif
+
+#ifdef _WIN32
+
+static std::vector<SCpuInfo> ReadCpus()
+{
+	std::vector<SCpuInfo> cpus;
+	DWORD size = 0;
+	GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &size);
+	std::vector<uint8> buf(size);
+	if (!GetLogicalProcessorInformationEx(RelationProcessorCore, reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buf.data()), &size))
+		return cpus;
+
+	uint32 core = 0;
+	for (DWORD off = 0; off < size; ++core)
+	{
+		const auto* pInfo = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buf.data() + off);
+		off += pInfo->Size;
+		const GROUP_AFFINITY& ga = pInfo->Processor.GroupMask[0];
+		for (uint32 bit = 0; bit < 64; ++bit)
+		{
+			if (!(ga.Mask & (KAFFINITY(1) << bit)))
+				continue;
+			PROCESSOR_NUMBER pn{};
+			pn.Group = ga.Group;
+			pn.Number = BYTE(bit);
+			USHORT node = 0;
+			GetNumaProcessorNodeEx(&pn, &node);
+			cpus.push_back(SCpuInfo{ uint32(ga.Group) * 64 + bit, core, int(node) });
+		}
+	}
+	std::sort(cpus.begin(), cpus.end(), [](const SCpuInfo& a, const SCpuInfo& b) { return a.id < b.id; });
+	return cpus;
+}
+
+int GetCurrentThreadNode()
+{
+	PROCESSOR_NUMBER pn{};
+	GetCurrentProcessorNumberEx(&pn);
+	USHORT node = 0;
+	return GetNumaProcessorNodeEx(&pn, &node) ? int(node) : -1;
+}
+
+bool PinCurrentThread(uint32 cpu)
+{
+	GROUP_AFFINITY ga{};
+	ga.Group = WORD(cpu / 64);
+	ga.Mask = KAFFINITY(1) << (cpu % 64);
+	return SetThreadGroupAffinity(GetCurrentThread(), &ga, nullptr) != 0;
+}
+
+CNodeAffinityScope::CNodeAffinityScope(int node)
+{
+	if (node < 0)
+		return;
+	// Node can span groups, thread affinity is within one group, take the first one.
+	GROUP_AFFINITY ga{};
+	if (!GetNumaNodeProcessorMaskEx(USHORT(node), &ga) || !ga.Mask)
+		return;
+	m_pinned = SetThreadGroupAffinity(GetCurrentThread(), &ga, &m_prev) != 0;
+}
+
+CNodeAffinityScope::~CNodeAffinityScope()
+{
+	if (m_pinned)
+		SetThreadGroupAffinity(GetCurrentThread(), &m_prev, nullptr);
+}
+
+int GetFileNumaNode(const char*)
+{
+	return -1;
+}
+
+bool BindMemoryToNode(void*, size_t, int)
+{
+	// No way to move committed pages, VirtualAllocExNuma only places new allocations.
+	return false;
+}
+
+void CNodeTrafficCounter::Start()
+{
+}
+
+SNodeTraffic CNodeTrafficCounter::Stop()
+{
+	return SNodeTraffic();
+}
+
+CNodeTrafficCounter::~CNodeTrafficCounter()
+{
+}
+
+#endif
+
+const std::vector<SCpuInfo>& GetCpus()
+{
+	static const std::vector<SCpuInfo> s_cpus = ReadCpus();
+	return s_cpus;
+}
+
+uint32 GetNumaNodeCount()
+{
+	int maxNode = 0;
+	for (const SCpuInfo& info : GetCpus())
+		maxNode = std::max(maxNode, info.node);
+	return uint32(maxNode + 1);
+}
+
+int GetCpuNode(uint32 cpu)
+{
+	for (const SCpuInfo& info : GetCpus())
+	{
+		if (info.id == cpu)
+			return info.node;
+	}
+	return -1;
+}
+
+// Pin orders are computed once per mode.
+static std::vector<uint32> MakePinOrder(EPinMode mode)
+{
+	std::vector<SCpuInfo> cpus = GetCpus();
+	std::vector<uint32> order;
+	if (mode == EPinMode::Compact)
+	{
+		std::stable_sort(cpus.begin(), cpus.end(), [](const SCpuInfo& a, const SCpuInfo& b)
+		{
+			return a.node != b.node ? a.node < b.node : a.core != b.core ? a.core < b.core : a.id < b.id;
+		});
+		for (const SCpuInfo& info : cpus)
+			order.push_back(info.id);
+	}
+	else if (mode == EPinMode::Scatter)
+	{
+		// SMT rank of each CPU among the siblings of its core, then nodes take turns.
+		std::vector<std::pair<uint32, const SCpuInfo*>> ranked;
+		for (const SCpuInfo& info : cpus)
+		{
+			uint32 rank = 0;
+			for (const SCpuInfo& other : cpus)
+			{
+				if (other.core == info.core && other.node == info.node && other.id < info.id)
+					++rank;
+			}
+			ranked.emplace_back(rank, &info);
+		}
+		std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b)
+		{
+			return a.first != b.first ? a.first < b.first : a.second->id < b.second->id;
+		});
+
+		const uint32 nodeCount = GetNumaNodeCount();
+		std::vector<std::vector<uint32>> perNode(nodeCount);
+		for (const auto& r : ranked)
+			perNode[size_t(std::max(r.second->node, 0))].push_back(r.second->id);
+		for (size_t i = 0; order.size() < cpus.size(); ++i)
+		{
+			for (const std::vector<uint32>& node : perNode)
+			{
+				if (i < node.size())
+					order.push_back(node[i]);
+			}
+		}
+	}
+	return order;
+}
+
+int GetWorkerCpu(EPinMode mode, const std::vector<uint32>& cpus, uint32 idx)
+{
+	static const std::vector<uint32> s_compactOrder = MakePinOrder(EPinMode::Compact);
+	static const std::vector<uint32> s_scatterOrder = MakePinOrder(EPinMode::Scatter);
+
+	const std::vector<uint32>* pOrder = nullptr;
+	switch (mode)
+	{
+	case EPinMode::Compact: pOrder = &s_compactOrder; break;
+	case EPinMode::Scatter: pOrder = &s_scatterOrder; break;
+	case EPinMode::List: pOrder = &cpus; break;
+	default: return -1;
+	}
+	if (pOrder->empty())
+		return -1;
+	return int((*pOrder)[idx % pOrder->size()]);
+}
+
+void PinWorkerThread(uint32 idx)
+{
+	const SRunConfig& cfg = GetRunConfig();
+	const int cpu = GetWorkerCpu(cfg.pinMode, cfg.pinCpus, idx);
+	if (cpu >= 0)
+		PinCurrentThread(uint32(cpu));
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "common.h"
+
+#include <vector>
+
+// CPU topology, worker pinning and NUMA placement. On multi-socket machines unpinned workers and
+// buffers on the wrong node turn completions into cross-socket traffic.
+
+struct SCpuInfo
+{
+	// Logical CPU, group * 64 + index on Windows
+	uint32 id;
+	uint32 core;
+	int node;
+};
+
+// CPUs the process is allowed to run on, read once.
+const std::vector<SCpuInfo>& GetCpus();
+uint32 GetNumaNodeCount();
+int GetCpuNode(uint32 cpu);
+// Node the calling thread runs on right now
+int GetCurrentThreadNode();
+
+enum class EPinMode
+{
+	None,
+	// Fill one node before the next one, SMT siblings next to each other
+	Compact,
+	// Alternate nodes, all physical cores before SMT siblings
+	Scatter,
+	// Explicit CPU list, workers take CPUs from it in turn
+	List,
+
+	Count
+};
+
+const char* GetPinModeName(EPinMode mode);
+// "none", "compact", "scatter" or a CPU list like "0,2,8-11" or "0+2+8-11". Returns false on bad input.
+bool ParsePinMode(const char* szValue, EPinMode& mode, std::vector<uint32>& cpus);
+
+// CPU worker idx runs on, -1 when not pinned.
+int GetWorkerCpu(EPinMode mode, const std::vector<uint32>& cpus, uint32 idx);
+bool PinCurrentThread(uint32 cpu);
+// Pins the calling worker as the run config says, called at the start of worker threads.
+void PinWorkerThread(uint32 idx);
+
+// Pins the calling thread to all CPUs of a node while alive, restores previous affinity after.
+class CNodeAffinityScope
+{
+public:
+	explicit CNodeAffinityScope(int node);
+	~CNodeAffinityScope();
+	CNodeAffinityScope(const CNodeAffinityScope&) = delete;
+	CNodeAffinityScope& operator=(const CNodeAffinityScope&) = delete;
+
+private:
+	bool m_pinned = false;
+#ifdef _WIN32
+	GROUP_AFFINITY m_prev{};
+#else
+	std::vector<uint8> m_prev;
+#endif
+};
+
+// Node of the storage device the file is on, -1 when unknown (always on Windows).
+int GetFileNumaNode(const char* szFilename);
+
+enum class ENumaBuffers
+{
+	// Pages stay where the pool faulted them in, node of the submitting thread
+	FirstTouch,
+	// All IO buffers on the node of the storage device
+	Device,
+	// Buffers round robin over the nodes workers are pinned to. They are shared by all workers,
+	// so this spreads the memory traffic instead of making it local.
+	Spread,
+
+	Count
+};
+
+const char* GetNumaBuffersName(ENumaBuffers mode);
+bool ParseNumaBuffers(const char* szValue, ENumaBuffers& mode);
+
+// Moves pages of the range to the node. Linux only, false elsewhere or on failure.
+bool BindMemoryToNode(void* p, size_t size, int node);
+
+// Loads that went to memory of the local vs a remote node, from PERF_COUNT_HW_CACHE_NODE.
+// -1 when perf counters aren't available (Windows, VMs, perf_event_paranoid).
+struct SNodeTraffic
+{
+	int64 loads = -1;
+	int64 remoteLoads = -1;
+};
+
+// Counts the calling thread and threads it creates after Start, so start it before workers.
+class CNodeTrafficCounter
+{
+public:
+	CNodeTrafficCounter() = default;
+	~CNodeTrafficCounter();
+	CNodeTrafficCounter(const CNodeTrafficCounter&) = delete;
+	CNodeTrafficCounter& operator=(const CNodeTrafficCounter&) = delete;
+
+	void Start();
+	SNodeTraffic Stop();
+
+private:
+	int m_loadsFd = -1;
+	int m_missesFd = -1;
+};
@@ -0,0 +1,222 @@
+#include "pagecache.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#ifdef __linux__
+#include "linuxio.h"
+
+#include <sys/stat.h>
+#endif
+
+static const char* s_cacheStateNames[] = { "keep", "cold", "warm", "partial" };
+static_assert(sizeof(s_cacheStateNames) / sizeof(s_cacheStateNames[0]) == size_t(ECacheState::Count), "Missing cache state name");
+
+// Warming reads and residency checks go in these steps.
+static constexpr size_t s_chunkSize = 1024 * 1024;
+
+const char* GetCacheStateName(ECacheState state)
+{
+	return s_cacheStateNames[size_t(state)];
+}
+
+bool ParseCacheControl(const char* szValue, SCacheControl& control)
+{
+	const char* szColon = strchr(szValue, ':');
+	const size_t nameLen = szColon ? size_t(szColon - szValue) : strlen(szValue);
+	for (size_t i = 0; i < size_t(ECacheState::Count); ++i)
+	{
+		if (strlen(s_cacheStateNames[i]) != nameLen || strncmp(szValue, s_cacheStateNames[i], nameLen) != 0)
+			continue;
+
+		SCacheControl res;
+		res.state = ECacheState(i);
+		if (szColon)
+		{
+			if (res.state != ECacheState::Partial)
+				return false;
+			char* pEnd = nullptr;
+			res.warmFraction = strtod(szColon + 1, &pEnd);
+			if (pEnd == szColon + 1 || *pEnd || res.warmFraction < 0 || res.warmFraction > 1)
+				return false;
+		}
+		control = res;
+		return true;
+	}
+	return false;
+}
+
+// Spreads warmed chunks evenly, e.g. 0.25 warms every 4th chunk instead of the first quarter of the file.
+static bool IsChunkWarmed(uint64 i, double fraction)
+{
+	return uint64((i + 1) * fraction) > uint64(i * fraction);
+}
+
+#ifdef __linux__
+
+double MeasureCacheResidency(const char* szFilename)
+{
+	PROF_FUNC();
+
+	SFdCloser hFile(open(szFilename, O_RDONLY));
+	if (hFile.fd == -1)
+		return -1;
+
+	struct stat st {};
+	if (fstat(hFile.fd, &st) != 0)
+		return -1;
+	if (st.st_size == 0)
+		return 1;
+
+	const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+	// Mapping doesn't fault anything in, mincore only reads page cache state. Mapped in windows so huge files don't need huge vectors.
+	const uint64 windowSize = uint64(1024) * s_chunkSize;
+	std::vector<unsigned char> pages(size_t(windowSize / pageSize));
+	uint64 residentPages = 0;
+	uint64 totalPages = 0;
+	for (uint64 off = 0; off < uint64(st.st_size); off += windowSize)
+	{
+		const size_t size = size_t(std::min<uint64>(windowSize, uint64(st.st_size) - off));
+		void* pMap = mmap(nullptr, size, PROT_READ, MAP_SHARED, hFile.fd, off_t(off));
+		if (pMap == MAP_FAILED)
+			return -1;
+		const size_t pageCount = (size + pageSize - 1) / pageSize;
+		const int res = mincore(pMap, size, pages.data());
+		munmap(pMap, size);
+		if (res != 0)
+			return -1;
+		for (size_t i = 0; i < pageCount; ++i)
+			residentPages += pages[i] & 1;
+		totalPages += pageCount;
+	}
+	return double(residentPages) / double(totalPages);
+}
+
+static bool EvictFile(const char* szFilename)
+{
+	PROF_FUNC();
+
+	SFdCloser hFile(open(szFilename, O_RDONLY));
+	if (hFile.fd == -1)
+		return false;
+	// DONTNEED skips dirty pages, write them back first.
+	fdatasync(hFile.fd);
+	return posix_fadvise(hFile.fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+}
+
+static bool WarmFile(const char* szFilename, double fraction)
+{
+	PROF_FUNC();
+
+	SFdCloser hFile(open(szFilename, O_RDONLY));
+	if (hFile.fd == -1)
+		return false;
+	// No readahead, otherwise partial warming pulls in the neighbours of every warmed chunk.
+	if (fraction < 1)
+		posix_fadvise(hFile.fd, 0, 0, POSIX_FADV_RANDOM);
+
+	struct stat st {};
+	if (fstat(hFile.fd, &st) != 0)
+		return false;
+
+	std::unique_ptr<char[]> pBuf(new char[s_chunkSize]);
+	for (uint64 i = 0; i * s_chunkSize < uint64(st.st_size); ++i)
+	{
+		if (fraction < 1 && !IsChunkWarmed(i, fraction))
+			continue;
+		if (pread(hFile.fd, pBuf.get(), s_chunkSize, off_t(i * s_chunkSize)) < 0)
+			return false;
+	}
+	return true;
+}
+
+#endif
+
+#ifdef _WIN32
+
+double MeasureCacheResidency(const char*)
+{
+	// Nothing like mincore for the system cache.
+	return -1;
+}
+
+static bool EvictFile(const char* szFilename)
+{
+	PROF_FUNC();
+
+	// Opening a non-cached handle makes the cache manager flush and purge the file,
+	// as long as nobody else has it open cached or mapped.
+	HANDLE hFile = CreateFileA(szFilename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	CloseHandle(hFile);
+	return true;
+}
+
+static bool WarmFile(const char* szFilename, double fraction)
+{
+	PROF_FUNC();
+
+	HANDLE hFile = CreateFileA(szFilename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		fraction < 1 ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fsize{};
+	GetFileSizeEx(hFile, &fsize);
+
+	std::unique_ptr<char[]> pBuf(new char[s_chunkSize]);
+	bool ok = true;
+	for (uint64 i = 0; i * s_chunkSize < uint64(fsize.QuadPart); ++i)
+	{
+		if (fraction < 1 && !IsChunkWarmed(i, fraction))
+			continue;
+		OVERLAPPED ov{};
+		const uint64 off = i * s_chunkSize;
+		ov.Offset = DWORD(off);
+		ov.OffsetHigh = DWORD(off >> 32);
+		DWORD read = 0;
+		if (!ReadFile(hFile, pBuf.get(), DWORD(s_chunkSize), &read, &ov))
+		{
+			ok = false;
+			break;
+		}
+	}
+	CloseHandle(hFile);
+	return ok;
+}
+
+#endif
+
+double PrepareFileCache(const char* szFilename, const SCacheControl& control)
+{
+	PROF_FUNC();
+
+	bool ok = true;
+	switch (control.state)
+	{
+	case ECacheState::Keep:
+		break;
+	case ECacheState::Cold:
+		ok = EvictFile(szFilename);
+		break;
+	case ECacheState::Warm:
+		ok = WarmFile(szFilename, 1);
+		break;
+	case ECacheState::Partial:
+		ok = EvictFile(szFilename) && WarmFile(szFilename, control.warmFraction);
+		break;
+	case ECacheState::Count:
+		break;
+	}
+	if (!ok)
+		std::cerr << "Failed to make " << szFilename << " " << GetCacheStateName(control.state) << std::endl;
+
+	const double residency = MeasureCacheResidency(szFilename);
+	if (residency >= 0 && control.state == ECacheState::Cold && residency > 0.01)
+		std::cerr << "Cold cache requested, but " << residency * 100 << "% of " << szFilename << " is still resident" << std::endl;
+	return residency;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.h"
+
+// Page cache state of the test file before a run. Buffered engines read cached data several times faster
+// than the disk, so without this the numbers depend on which test ran before.
+
+enum class ECacheState
+{
+	// Leave the cache as the previous run left it.
+	Keep,
+	// Evict the file, every read goes to the disk.
+	Cold,
+	// Read the whole file once, buffered engines read from memory.
+	Warm,
+	// Evict, then read warmFraction of the file spread evenly over it.
+	Partial,
+
+	Count
+};
+
+struct SCacheControl
+{
+	ECacheState state = ECacheState::Keep;
+	double warmFraction = 0.5;
+};
+
+const char* GetCacheStateName(ECacheState state);
+// "cold", "warm", "keep" or "partial[:fraction]". Returns false on bad input.
+bool ParseCacheControl(const char* szValue, SCacheControl& control);
+
+// Fraction of file pages in the page cache, -1 when it can't be measured (Windows).
+double MeasureCacheResidency(const char* szFilename);
+
+// Brings the file to the requested state. Returns residency measured afterwards, -1 if unknown.
+// Eviction is best effort, pages mapped or locked by someone else stay resident, that shows in the result.
+double PrepareFileCache(const char* szFilename, const SCacheControl& control);
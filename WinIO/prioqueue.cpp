@@ -0,0 +1,329 @@
+#include "prioqueue.h"
+
+#include <cstring>
+
+static const char* s_ioPriorityNames[] = { "realtime", "normal", "background" };
+static_assert(sizeof(s_ioPriorityNames) / sizeof(s_ioPriorityNames[0]) == size_t(EIoPriority::Count), "Missing priority name");
+
+const char* GetIoPriorityName(EIoPriority priority)
+{
+	return s_ioPriorityNames[size_t(priority)];
+}
+
+bool ParseIoPriority(const char* szValue, EIoPriority& priority)
+{
+	for (size_t i = 0; i < size_t(EIoPriority::Count); ++i)
+	{
+		if (strcmp(szValue, s_ioPriorityNames[i]) == 0)
+		{
+			priority = EIoPriority(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <iostream>
+
+// Bandwidth a capped class may save up while idle
+static constexpr int64 s_burstUs = 10000;
+// Shorter waits for the cap are rounded up, the timeout costs a wakeup of its own
+static constexpr int64 s_minTimerNs = 20000;
+
+// 0 is the stop request, 1 the timeout, reads are slot index + 2
+static constexpr uint64 s_stopUserData = 0;
+static constexpr uint64 s_timerUserData = 1;
+static constexpr uint64 s_firstSlotUserData = 2;
+
+static int64 ToTicks(int64 ns)
+{
+	return ns * STimestamp::GetFrequency() / 1000000000;
+}
+
+static double GetBurstBytes(const SPriorityClassParams& params)
+{
+	return double(params.bandwidthCap) * s_burstUs / 1e6;
+}
+
+CPriorityQueue::~CPriorityQueue()
+{
+	if (!m_worker.joinable())
+		return;
+	m_stop.store(true);
+	m_ring.Submit([](io_uring_sqe& sqe)
+	{
+		sqe.opcode = IORING_OP_NOP;
+		sqe.user_data = s_stopUserData;
+	});
+	m_worker.join();
+}
+
+bool CPriorityQueue::Init(uint32 capacity, const SPriorityClassParams* pParams)
+{
+	PROF_FUNC();
+
+	m_capacity = capacity;
+	// Room for the timeout and the stop request next to the reads
+	const int res = m_ring.Init(capacity + 2);
+	if (res < 0)
+	{
+		std::cerr << "Failed to create io_uring, err " << -res << std::endl;
+		return false;
+	}
+
+	m_slots.resize(capacity);
+	for (uint32 i = capacity; i > 0; --i)
+		m_freeSlots.push_back(i - 1);
+	for (size_t i = 0; i < size_t(EIoPriority::Count); ++i)
+	{
+		m_classes[i].params = pParams[i];
+		m_classes[i].tokens = GetBurstBytes(pParams[i]);
+	}
+	m_refillTime = ts::now();
+	m_worker = std::thread(&CPriorityQueue::WorkerFunc, this);
+	return true;
+}
+
+void CPriorityQueue::Enqueue(const SPriorityRequest& request)
+{
+	const STimestamp now = ts::now();
+	SPending p{ request, now, STimestamp{}, STimestamp{} };
+	if (request.deadlineUs)
+	{
+		p.deadline = now + STimestamp{ ToTicks(int64(request.deadlineUs) * 1000) };
+		p.promoteTime = now + STimestamp{ ToTicks(int64(request.deadlineUs) * 500) };
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	SClass& c = m_classes[size_t(request.priority)];
+	if (request.deadlineUs)
+	{
+		c.deadlines.push_back(p);
+		std::push_heap(c.deadlines.begin(), c.deadlines.end(), [](const SPending& a, const SPending& b) { return a.deadline.time > b.deadline.time; });
+	}
+	else
+	{
+		c.fifo.push_back(p);
+	}
+	Dispatch();
+}
+
+SPriorityClassStats CPriorityQueue::GetStats(EIoPriority priority) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_classes[size_t(priority)].stats;
+}
+
+void CPriorityQueue::RefillTokens(STimestamp now)
+{
+	const double elapsed = sec((now - m_refillTime).dur());
+	m_refillTime = now;
+	for (SClass& c : m_classes)
+	{
+		if (c.params.bandwidthCap)
+			c.tokens = std::min(GetBurstBytes(c.params), c.tokens + double(c.params.bandwidthCap) * elapsed);
+	}
+}
+
+CPriorityQueue::SPending CPriorityQueue::PopNext(SClass& c, bool promoted)
+{
+	if (promoted || !c.deadlines.empty())
+	{
+		std::pop_heap(c.deadlines.begin(), c.deadlines.end(), [](const SPending& a, const SPending& b) { return a.deadline.time > b.deadline.time; });
+		const SPending p = c.deadlines.back();
+		c.deadlines.pop_back();
+		return p;
+	}
+	const SPending p = c.fifo.front();
+	c.fifo.pop_front();
+	return p;
+}
+
+bool CPriorityQueue::ArmTimer(int64 waitNs)
+{
+	if (m_timerArmed)
+		return false;
+	waitNs = std::max(waitNs, s_minTimerNs);
+	m_timerSpec.tv_sec = waitNs / 1000000000;
+	m_timerSpec.tv_nsec = waitNs % 1000000000;
+	const int res = m_ring.Prepare([&](io_uring_sqe& sqe)
+	{
+		sqe.opcode = IORING_OP_TIMEOUT;
+		sqe.addr = reinterpret_cast<uint64>(&m_timerSpec);
+		sqe.len = 1;
+		sqe.user_data = s_timerUserData;
+	});
+	m_timerArmed = res >= 0;
+	return m_timerArmed;
+}
+
+void CPriorityQueue::Dispatch()
+{
+	const STimestamp now = ts::now();
+	RefillTokens(now);
+
+	unsigned prepared = 0;
+	bool throttled[size_t(EIoPriority::Count)] = {};
+	while (!m_freeSlots.empty())
+	{
+		// Deadlines that are close win over classes and caps
+		SClass* pPick = nullptr;
+		bool promoted = false;
+		for (SClass& c : m_classes)
+		{
+			if (c.deadlines.empty() || c.deadlines.front().promoteTime.time > now.time)
+				continue;
+			if (!pPick || c.deadlines.front().deadline.time < pPick->deadlines.front().deadline.time)
+			{
+				pPick = &c;
+				promoted = true;
+			}
+		}
+		if (!pPick)
+		{
+			for (size_t i = 0; i < size_t(EIoPriority::Count); ++i)
+			{
+				SClass& c = m_classes[i];
+				if (!c.HasPending() || (c.params.maxInFlight && c.inFlight >= c.params.maxInFlight))
+					continue;
+				if (c.params.bandwidthCap && c.tokens <= 0)
+				{
+					throttled[i] = true;
+					continue;
+				}
+				pPick = &c;
+				break;
+			}
+		}
+		if (!pPick)
+			break;
+
+		const SPending p = PopNext(*pPick, promoted);
+		const uint32 slotIdx = m_freeSlots.back();
+		const int res = m_ring.Prepare([&](io_uring_sqe& sqe)
+		{
+			sqe.opcode = IORING_OP_READ;
+			sqe.fd = p.request.fd;
+			sqe.off = p.request.offset;
+			sqe.addr = reinterpret_cast<uint64>(p.request.pDest);
+			sqe.len = p.request.size;
+			sqe.user_data = slotIdx + s_firstSlotUserData;
+		});
+		if (res < 0)
+		{
+			std::cerr << "Failed to prepare read, err " << -res << std::endl;
+			exit(1);
+		}
+		m_freeSlots.pop_back();
+		m_slots[slotIdx] = SSlot{ p.request, p.enqueueTime, p.deadline };
+		++pPick->inFlight;
+		if (pPick->params.bandwidthCap)
+			pPick->tokens -= double(p.request.size);
+		if (promoted)
+			++pPick->stats.promoted;
+		++prepared;
+	}
+
+	// Nothing else wakes the dispatcher when the window has room but the rest waits for a cap or a promotion.
+	if (!m_freeSlots.empty())
+	{
+		int64 waitNs = 0;
+		for (size_t i = 0; i < size_t(EIoPriority::Count); ++i)
+		{
+			SClass& c = m_classes[i];
+			if (throttled[i])
+			{
+				++c.stats.throttled;
+				const int64 ns = int64(-c.tokens * 1e9 / double(c.params.bandwidthCap)) + 1;
+				waitNs = waitNs ? std::min(waitNs, ns) : ns;
+			}
+			if (!c.deadlines.empty())
+			{
+				const int64 ns = int64(sec((c.deadlines.front().promoteTime - now).dur()) * 1e9) + 1;
+				waitNs = waitNs ? std::min(waitNs, ns) : ns;
+			}
+		}
+		if (waitNs && ArmTimer(waitNs))
+			++prepared;
+	}
+
+	while (prepared)
+	{
+		const int res = m_ring.SubmitPrepared(prepared);
+		if (res == -EINTR || res == -EAGAIN)
+			continue;
+		if (res <= 0)
+		{
+			std::cerr << "Failed to submit reads, err " << -res << std::endl;
+			exit(1);
+		}
+		prepared -= unsigned(res);
+	}
+}
+
+void CPriorityQueue::WorkerFunc()
+{
+	SetThreadName(L"PriorityQueue");
+
+	std::vector<SCompleted> completed;
+	while (true)
+	{
+		io_uring_cqe cqe{};
+		{
+			PROF_REGION("WaitCompletion");
+			const int res = m_ring.WaitCompletion(cqe);
+			if (res < 0)
+			{
+				std::cerr << "Failed to get completion status, err " << -res << std::endl;
+				exit(3);
+			}
+		}
+
+		// Everything that completed meanwhile frees its slot before the next dispatch round.
+		bool stop = false;
+		completed.clear();
+		{
+			PROF_REGION("complete");
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const STimestamp now = ts::now();
+			do
+			{
+				if (cqe.user_data == s_stopUserData)
+				{
+					stop = true;
+					continue;
+				}
+				if (cqe.user_data == s_timerUserData)
+				{
+					m_timerArmed = false;
+					continue;
+				}
+
+				const uint32 slotIdx = uint32(cqe.user_data - s_firstSlotUserData);
+				const SSlot& slot = m_slots[slotIdx];
+				SClass& c = m_classes[size_t(slot.request.priority)];
+				--c.inFlight;
+				++c.stats.requests;
+				c.stats.bytes += cqe.res > 0 ? uint64(cqe.res) : 0;
+				c.stats.latency.Record(now - slot.enqueueTime);
+				if (slot.deadline.time && now.time > slot.deadline.time)
+					++c.stats.missed;
+				if (slot.request.pCallback)
+					completed.push_back(SCompleted{ slot.request.pCallback, slot.request.pContext, cqe.res });
+				m_freeSlots.push_back(slotIdx);
+			} while (m_ring.TryPopCompletion(cqe));
+
+			Dispatch();
+		}
+		for (const SCompleted& c : completed)
+			c.pCallback(c.pContext, c.result);
+
+		if (stop && m_stop.load())
+			break;
+	}
+}
+
+#endif
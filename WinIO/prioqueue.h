@@ -0,0 +1,152 @@
+#pragma once
+
+#include "common.h"
+
+// Request classes, highest first. Test4 maps them to DSTORAGE_PRIORITY, the queue below dispatches them on io_uring.
+enum class EIoPriority
+{
+	Realtime,
+	Normal,
+	Background,
+
+	Count
+};
+
+const char* GetIoPriorityName(EIoPriority priority);
+bool ParseIoPriority(const char* szValue, EIoPriority& priority);
+
+#ifdef __linux__
+
+#include "histogram.h"
+#include "linuxio.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// One io_uring shared by request classes, each with its own queue. Only capacity reads are in the kernel at once,
+// whenever a slot frees up the dispatcher picks the next read:
+//  - Requests past half of their deadline budget go first, earliest deadline of all classes, caps ignored.
+//  - Otherwise the highest class that has a request, room under its maxInFlight and bandwidth left.
+//    Within a class requests with deadlines go in deadline order, then the rest in enqueue order.
+// Keeping background below the window leaves free slots, so a small urgent read doesn't queue behind a bulk
+// stream in the device. Caps are token buckets that may run into debt by one read, an io_uring timeout
+// wakes the dispatcher when a throttled class has bandwidth again.
+struct SPriorityClassParams
+{
+	// Bytes per second, 0 is no cap
+	uint64 bandwidthCap = 0;
+	// Reads of the class in the kernel at once, 0 is the whole window
+	uint32 maxInFlight = 0;
+};
+
+struct SPriorityRequest
+{
+	int fd = -1;
+	uint64 offset = 0;
+	// Has to be aligned for files opened with O_DIRECT
+	uint32 size = 0;
+	char* pDest = nullptr;
+	EIoPriority priority = EIoPriority::Normal;
+	// From Enqueue, 0 is none
+	uint32 deadlineUs = 0;
+	// Called on the dispatcher thread with bytes read or -errno, outside of the lock. Keep it short.
+	void (*pCallback)(void* pContext, int result) = nullptr;
+	void* pContext = nullptr;
+};
+
+struct SPriorityClassStats
+{
+	uint64 requests = 0;
+	uint64 bytes = 0;
+	// Dispatched on the deadline path, ahead of caps, in-flight limits and higher classes
+	uint64 promoted = 0;
+	// Completed after their deadline
+	uint64 missed = 0;
+	// Dispatch rounds that left the class waiting for its cap
+	uint64 throttled = 0;
+	// Enqueue to completion, time in the class queue included
+	CLatencyHistogram latency;
+};
+
+class CPriorityQueue
+{
+public:
+	CPriorityQueue() = default;
+	CPriorityQueue(const CPriorityQueue&) = delete;
+	CPriorityQueue& operator=(const CPriorityQueue&) = delete;
+	~CPriorityQueue();
+
+	// capacity is the count of reads handed to the kernel at once, params has one entry per class.
+	// Prints error and returns false on failure.
+	bool Init(uint32 capacity, const SPriorityClassParams* pParams);
+
+	// Thread safe, goes to the kernel right away when the class may have one more read in flight.
+	void Enqueue(const SPriorityRequest& request);
+
+	SPriorityClassStats GetStats(EIoPriority priority) const;
+
+private:
+	struct SPending
+	{
+		SPriorityRequest request;
+		STimestamp enqueueTime;
+		// Zero without deadline
+		STimestamp deadline;
+		STimestamp promoteTime;
+	};
+
+	struct SClass
+	{
+		SPriorityClassParams params;
+		// Min-heap by deadline
+		std::vector<SPending> deadlines;
+		std::deque<SPending> fifo;
+		uint32 inFlight = 0;
+		// Bytes the class may still read, negative is debt
+		double tokens = 0;
+		SPriorityClassStats stats;
+
+		bool HasPending() const { return !deadlines.empty() || !fifo.empty(); }
+	};
+
+	struct SSlot
+	{
+		SPriorityRequest request;
+		STimestamp enqueueTime;
+		STimestamp deadline;
+	};
+
+	struct SCompleted
+	{
+		void (*pCallback)(void* pContext, int result);
+		void* pContext;
+		int result;
+	};
+
+	void WorkerFunc();
+	// Under the lock. Hands the next reads to io_uring while there is room, with one io_uring_enter.
+	void Dispatch();
+	void RefillTokens(STimestamp now);
+	// Under the lock. Prepares the timeout unless one is running already, true when it has to be submitted.
+	bool ArmTimer(int64 waitNs);
+	SPending PopNext(SClass& c, bool promoted);
+
+	CUring m_ring;
+	uint32 m_capacity = 0;
+	std::thread m_worker;
+	std::atomic<bool> m_stop = { false };
+
+	mutable std::mutex m_mutex;
+	SClass m_classes[size_t(EIoPriority::Count)];
+	std::vector<SSlot> m_slots;
+	std::vector<uint32> m_freeSlots;
+	STimestamp m_refillTime{};
+	bool m_timerArmed = false;
+	// Read by the kernel when the timeout is submitted
+	__kernel_timespec m_timerSpec{};
+};
+
+#endif
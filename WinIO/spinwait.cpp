@@ -0,0 +1,113 @@
+#include "spinwait.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+static const char* s_waitModeNames[] = { "block", "spin", "adaptive" };
+static_assert(sizeof(s_waitModeNames) / sizeof(s_waitModeNames[0]) == size_t(EWaitMode::Count), "Missing wait mode name");
+
+const char* GetWaitModeName(EWaitMode mode)
+{
+	return s_waitModeNames[size_t(mode)];
+}
+
+bool ParseWaitMode(const char* szValue, EWaitMode& mode, uint32& spinUs)
+{
+	for (size_t i = 0; i < size_t(EWaitMode::Count); ++i)
+	{
+		const size_t len = strlen(s_waitModeNames[i]);
+		if (strncmp(szValue, s_waitModeNames[i], len) != 0)
+			continue;
+		const char* pRest = szValue + len;
+		uint32 us = 0;
+		if (*pRest == ':' && EWaitMode(i) != EWaitMode::Block)
+		{
+			char* pEnd = nullptr;
+			us = uint32(strtoul(pRest + 1, &pEnd, 10));
+			if (pEnd == pRest + 1 || *pEnd || us == 0)
+				return false;
+		}
+		else if (*pRest)
+		{
+			return false;
+		}
+		mode = EWaitMode(i);
+		spinUs = us;
+		return true;
+	}
+	return false;
+}
+
+void SSpinWaitStats::Print() const
+{
+	std::cout << "Spin " << ms(spinTime.dur()) << " ms, hits " << hits << ", misses " << misses << ", blocks " << blocks << std::endl;
+}
+
+CSpinWait::CSpinWait(EWaitMode mode, uint32 maxSpinUs)
+	: m_mode(mode)
+	, m_maxSpin(STimestamp::GetFrequency() * (maxSpinUs ? maxSpinUs : s_defaultSpinUs) / 1000000)
+{
+}
+
+void CSpinWait::OnCompletion()
+{
+	if (m_mode != EWaitMode::Adaptive)
+		return;
+
+	const STimestamp now = STimestamp::now();
+	if (m_lastCompletion.time != 0)
+	{
+		const int64 gap = (now - m_lastCompletion).time;
+		// Recent gaps matter, one long stall shouldn't turn spinning off for long.
+		m_gap = m_gap ? (m_gap * 7 + gap) / 8 : gap;
+	}
+	m_lastCompletion = now;
+}
+
+int64 CSpinWait::GetBudget() const
+{
+	switch (m_mode)
+	{
+	case EWaitMode::Spin:
+		return m_maxSpin;
+	case EWaitMode::Adaptive:
+		// Next completion is likely to come after about the average gap. When that is past the budget,
+		// spinning would mostly end in a block anyway.
+		if (m_gap == 0)
+			return m_maxSpin;
+		return m_gap <= m_maxSpin ? std::min(2 * m_gap, m_maxSpin) : 0;
+	default:
+		return 0;
+	}
+}
+
+SCpuTime SCpuTime::Now()
+{
+	SCpuTime res;
+#ifdef _WIN32
+	FILETIME creation{}, exitTime{}, kernel{}, user{};
+	if (GetProcessTimes(GetCurrentProcess(), &creation, &exitTime, &kernel, &user))
+	{
+		// 100 ns units
+		const auto toTs = [](const FILETIME& ft)
+		{
+			const int64 t = int64((uint64(ft.dwHighDateTime) << 32) | ft.dwLowDateTime);
+			return STimestamp{ t / 10000000 * STimestamp::GetFrequency() + t % 10000000 * STimestamp::GetFrequency() / 10000000 };
+		};
+		res.user = toTs(user);
+		res.system = toTs(kernel);
+	}
+#else
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	res.user = STimestamp{ int64(usage.ru_utime.tv_sec) * 1000000000 + int64(usage.ru_utime.tv_usec) * 1000 };
+	res.system = STimestamp{ int64(usage.ru_stime.tv_sec) * 1000000000 + int64(usage.ru_stime.tv_usec) * 1000 };
+#endif
+	return res;
+}
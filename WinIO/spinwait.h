@@ -0,0 +1,130 @@
+#pragma once
+
+#include "common.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#else
+#include <thread>
+#endif
+
+// Completion waiting that polls before it blocks. On fast NVMe the wakeup of a blocked thread costs
+// about as much as the read itself, spinning saves it and burns a core instead.
+//  - Block: straight to the blocking wait, like the tests always did
+//  - Spin: polls for the whole budget before blocking
+//  - Adaptive: budget follows the recent gaps between completions of the waiting thread. Spins for
+//    twice the average gap when that fits the budget, blocks right away when completions are further apart.
+//
+// Waiter: if (!spin.Spin(tryPop)) blocking pop; then spin.OnCompletion().
+enum class EWaitMode
+{
+	Block,
+	Spin,
+	Adaptive,
+
+	Count
+};
+
+const char* GetWaitModeName(EWaitMode mode);
+// "block", "spin", "adaptive", optionally with ":<max spin us>". Returns false on bad input.
+bool ParseWaitMode(const char* szValue, EWaitMode& mode, uint32& spinUs);
+
+// Budget when the run config doesn't give one
+static constexpr uint32 s_defaultSpinUs = 50;
+
+inline void CpuRelax()
+{
+#if defined(_M_X64) || defined(__x86_64__)
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+struct SSpinWaitStats
+{
+	// Completions found while spinning
+	uint64 hits = 0;
+	// Spins that ran out of budget and blocked after all
+	uint64 misses = 0;
+	// Waits that blocked, misses included
+	uint64 blocks = 0;
+	STimestamp spinTime{};
+
+	void Merge(const SSpinWaitStats& o)
+	{
+		hits += o.hits;
+		misses += o.misses;
+		blocks += o.blocks;
+		spinTime += o.spinTime;
+	}
+
+	// "Spin 1.2 ms, hits 900, misses 40, blocks 60" for test reports
+	void Print() const;
+};
+
+// One per waiting thread, not thread safe.
+class CSpinWait
+{
+public:
+	CSpinWait() = default;
+	CSpinWait(EWaitMode mode, uint32 maxSpinUs);
+
+	// Polls tryPop until it returns true or the budget runs out. False means block now.
+	template <typename F>
+	bool Spin(F&& tryPop)
+	{
+		const int64 budget = GetBudget();
+		if (budget <= 0)
+		{
+			++m_stats.blocks;
+			return false;
+		}
+
+		const STimestamp start = STimestamp::now();
+		STimestamp now = start;
+		do
+		{
+			if (tryPop())
+			{
+				m_stats.spinTime += STimestamp::now() - start;
+				++m_stats.hits;
+				return true;
+			}
+			CpuRelax();
+			now = STimestamp::now();
+		} while ((now - start).time < budget);
+
+		m_stats.spinTime += now - start;
+		++m_stats.misses;
+		++m_stats.blocks;
+		return false;
+	}
+
+	// After every completion, spun for or blocked for.
+	void OnCompletion();
+
+	const SSpinWaitStats& GetStats() const { return m_stats; }
+
+private:
+	int64 GetBudget() const;
+
+	EWaitMode m_mode = EWaitMode::Block;
+	int64 m_maxSpin = 0;
+	STimestamp m_lastCompletion{};
+	// Average gap between completions, 0 until there are two of them
+	int64 m_gap = 0;
+	SSpinWaitStats m_stats;
+};
+
+// User and system time of the whole process, to put spinning against what it saves.
+struct SCpuTime
+{
+	STimestamp user{};
+	STimestamp system{};
+
+	static SCpuTime Now();
+
+	SCpuTime operator-(const SCpuTime& o) const { return SCpuTime{ user - o.user, system - o.system }; }
+	STimestamp Total() const { return user + system; }
+};
@@ -0,0 +1,122 @@
+#include "submitplan.h"
+#include "testdata.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+bool ParseSubmitParams(const char* szValue, SSubmitParams& params)
+{
+	SSubmitParams res;
+	if (strcmp(szValue, "none") == 0)
+	{
+		params = res;
+		return true;
+	}
+
+	const char* p = szValue;
+	while (*p)
+	{
+		const char* pEnd = strchr(p, '+');
+		const std::string token(p, pEnd ? pEnd : p + strlen(p));
+		p = pEnd ? pEnd + 1 : p + token.size();
+
+		const size_t colon = token.find(':');
+		if (colon == std::string::npos)
+			return false;
+		const std::string key = token.substr(0, colon);
+		uint64 value = 0;
+		if (!ParseDataSize(token.c_str() + colon + 1, value) || value > UINT32_MAX)
+			return false;
+
+		if (key == "merge")
+			res.mergeSize = uint32(value);
+		else if (key == "gap")
+			res.mergeGap = uint32(value);
+		else if (key == "split" && value % 4096 == 0)
+			res.splitSize = uint32(value);
+		else if (key == "window" && value)
+			res.window = uint32(value);
+		else
+			return false;
+	}
+	params = res;
+	return true;
+}
+
+void BuildSubmitPlan(const SWorkload& workload, const SSubmitParams& params, SSubmitPlan& plan)
+{
+	PROF_FUNC();
+
+	plan = SSubmitPlan();
+	plan.params = params;
+	plan.units.reserve(workload.requests.size());
+	plan.requests.reserve(workload.requests.size());
+
+	const auto addUnit = [&](const SIoRequest& req)
+	{
+		plan.units.push_back(SSubmitUnit{ req.offset, req.size, uint32(plan.requests.size()), 0 });
+	};
+	const auto addRequest = [&](const SIoRequest& req)
+	{
+		SSubmitUnit& unit = plan.units.back();
+		plan.requests.push_back(SIoRequest{ req.offset - unit.offset, req.size });
+		++unit.requestCount;
+	};
+
+	std::vector<SIoRequest> window;
+	for (size_t begin = 0; begin < workload.requests.size(); begin += params.window)
+	{
+		const size_t end = std::min(workload.requests.size(), begin + params.window);
+		window.assign(workload.requests.begin() + begin, workload.requests.begin() + end);
+
+		// Without merging the order stays as it was generated
+		if (params.mergeSize == 0)
+		{
+			for (const SIoRequest& req : window)
+			{
+				addUnit(req);
+				addRequest(req);
+			}
+			continue;
+		}
+
+		std::stable_sort(window.begin(), window.end(), [](const SIoRequest& a, const SIoRequest& b) { return a.offset < b.offset; });
+		bool open = false;
+		for (const SIoRequest& req : window)
+		{
+			if (open)
+			{
+				SSubmitUnit& unit = plan.units.back();
+				const uint64 unitEnd = unit.offset + unit.size;
+				const uint64 newEnd = std::max(unitEnd, req.offset + req.size);
+				if (req.offset <= unitEnd + params.mergeGap && newEnd - unit.offset <= params.mergeSize)
+				{
+					unit.size = uint32(newEnd - unit.offset);
+					addRequest(req);
+					continue;
+				}
+			}
+			addUnit(req);
+			addRequest(req);
+			open = true;
+		}
+	}
+
+	for (const SSubmitUnit& unit : plan.units)
+	{
+		plan.readCount += params.GetSplitCount(unit.size);
+		plan.readBytes += unit.size;
+		plan.maxUnitSize = std::max(plan.maxUnitSize, unit.size);
+	}
+}
+
+void PrintSubmitPlan(const SWorkload& workload, const SSubmitPlan& plan)
+{
+	const SSubmitParams& params = plan.params;
+	std::cout << "Submit merge " << params.mergeSize / 1024 << "k gap " << params.mergeGap / 1024 << "k split " << params.splitSize / 1024
+		<< "k window " << params.window << std::endl;
+	std::cout << "Requests " << workload.requests.size() << " -> merged " << plan.units.size() << " -> reads " << plan.readCount
+		<< ", read MB " << plan.readBytes / 1024 / 1024 << " of requested " << workload.totalBytes / 1024 / 1024 << std::endl;
+}
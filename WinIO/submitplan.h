@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common.h"
+#include "workload.h"
+
+#include <vector>
+
+// Submission stage between the request list and device reads.
+//  - Merge: requests of one window are sorted by offset, the ones that overlap or are at most mergeGap apart
+//    go out as one read of up to mergeSize. Bytes of the gaps are read and thrown away.
+//  - Split: reads bigger than splitSize go out as several parallel reads into consecutive parts of one buffer,
+//    the buffer is processed after the last of them completes.
+// Every request is still processed on its own, so sums stay the same as without the stage.
+struct SSubmitParams
+{
+	// 0 turns merging off
+	uint32 mergeSize = 0;
+	uint32 mergeGap = 0;
+	// 0 turns splitting off, multiple of 4096 so the parts stay aligned for unbuffered IO
+	uint32 splitSize = 0;
+	// Requests sorted together, like a batch of asset loads
+	uint32 window = 64;
+
+	bool IsEnabled() const { return mergeSize || splitSize; }
+	// Parallel reads a read of given size goes out as.
+	uint32 GetSplitCount(uint64 size) const { return splitSize && size > splitSize ? uint32((size + splitSize - 1) / splitSize) : 1; }
+};
+
+// "none" or '+' separated "merge:1m", "gap:16k", "split:256k", "window:128". Returns false on bad input.
+bool ParseSubmitParams(const char* szValue, SSubmitParams& params);
+
+// One buffer worth of work, read from offset and then processed request by request.
+struct SSubmitUnit
+{
+	uint64 offset;
+	uint32 size;
+	uint32 firstRequest;
+	uint32 requestCount;
+};
+
+struct SSubmitPlan
+{
+	SSubmitParams params;
+	std::vector<SSubmitUnit> units;
+	// Grouped by unit, offsets are from start of the unit
+	std::vector<SIoRequest> requests;
+	// Device reads after splitting
+	uint64 readCount = 0;
+	// Gaps of merged reads included
+	uint64 readBytes = 0;
+	uint32 maxUnitSize = 0;
+};
+
+void BuildSubmitPlan(const SWorkload& workload, const SSubmitParams& params, SSubmitPlan& plan);
+
+// Request counts before and after, for test reports.
+void PrintSubmitPlan(const SWorkload& workload, const SSubmitPlan& plan);
@@ -0,0 +1,474 @@
+#ifdef __linux__
+
+#include "tests.h"
+#include "bench.h"
+#include "bufferpool.h"
+#include "dsqueue.h"
+#include "histogram.h"
+#include "spinwait.h"
+#include "testdata.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <atomic>
+#include <thread>
+
+#include <sys/eventfd.h>
+
+// Test4 on top of the DirectStorage-like queue from dsqueue.h. Buffers are split into groups and
+// every group gets one status entry and one fence signal, workers take fence values in order.
+// Group of one is a fence per request, group of all buffers is a fence per batch.
+namespace Test10
+{
+
+static constexpr bool s_unbufferedIo = true;
+static constexpr SRunConfig::EFenceMode s_fenceMode = SRunConfig::EFenceMode::Interval;
+static constexpr uint32 s_fenceInterval = 8;
+
+
+struct SBuffer final
+{
+	SBuffer(AlignedUniquePtr p, size_t s)
+		: pBuf(std::move(p))
+		, bufSize(s)
+	{}
+
+	AlignedUniquePtr pBuf;
+	size_t bufSize;
+	size_t readSize = 0;
+
+	STimestamp pushTime;
+};
+
+struct SGroup
+{
+	uint32 firstBuf = 0;
+	uint32 bufCount = 0;
+	// Buffers that got a read in the last push, the rest is retired. All of them are active at the start.
+	uint32 pushedCount = 0;
+};
+
+
+struct SFileInfo
+{
+	std::atomic<int64> off = { 0 };
+	int64 fsizePos = 0;
+
+	int fd = -1;
+	size_t readAlignment = 1;
+
+	CRequestQueue* pQueue = nullptr;
+	CQueueFence* pFence = nullptr;
+	CQueueStatusArray* pStatus = nullptr;
+
+	SBuffer* pBuffers = nullptr;
+	SGroup* pGroups = nullptr;
+
+	// Fence values have to be signaled in the order they are given out
+	std::mutex pushMutex;
+	uint64 lastValue = 0;
+	// Group of every value given out. Indexed by value, not reused: one group can go around many
+	// times while the worker that took an earlier value is still on its way to the fence.
+	std::unique_ptr<uint32[]> groupOfValue;
+	std::atomic<uint64> nextValue = { 0 };
+	std::atomic<bool> stop = { false };
+
+	int bufDoneEvent = -1;
+	std::atomic<int> activeBufCount = {};
+
+	// Set for random access, requests are taken from the list instead of streaming.
+	const SWorkload* pWorkload = nullptr;
+	std::atomic<uint64> nextRequest = { 0 };
+};
+
+
+static bool EnqueueRead(SBuffer& buf, SFileInfo& fi)
+{
+	int64 readSize = buf.bufSize;
+	int64 off;
+	if (fi.pWorkload)
+	{
+		const uint64 reqIdx = fi.nextRequest.fetch_add(1, std::memory_order_relaxed);
+		if (reqIdx >= fi.pWorkload->requests.size())
+		{
+			return false;
+		}
+		const SIoRequest& req = fi.pWorkload->requests[reqIdx];
+		off = int64(req.offset);
+		readSize = req.size;
+	}
+	else
+	{
+		off = fi.off.fetch_add(readSize, std::memory_order_acq_rel);
+
+		if (off >= fi.fsizePos)
+		{
+			return false;
+		}
+	}
+	readSize = std::min<int64>(readSize, fi.fsizePos - off);
+	buf.readSize = size_t(readSize);
+
+	// O_DIRECT needs aligned size as well, read of the tail is short anyway.
+	SQueueRequest r;
+	r.fd = fi.fd;
+	r.offset = uint64(off);
+	r.size = uint32((readSize + fi.readAlignment - 1) / fi.readAlignment * fi.readAlignment);
+	r.pDest = buf.pBuf.get();
+	fi.pQueue->EnqueueRequest(r);
+
+	buf.pushTime = STimestamp::now();
+	return true;
+}
+
+static void RetireBuffers(SFileInfo& fi, int count)
+{
+	if (count > 0 && fi.activeBufCount.fetch_sub(count, std::memory_order_relaxed) == count)
+	{
+		const uint64 one = 1;
+		write(fi.bufDoneEvent, &one, sizeof(one));
+	}
+}
+
+// Reads into every buffer of the group, followed by its status entry and fence signal.
+// Buffers left without a read are retired. False when the whole group is.
+static bool PushGroup(uint32 groupIdx, SFileInfo& fi, bool submit)
+{
+	PROF_FUNC();
+
+	SGroup& group = fi.pGroups[groupIdx];
+	std::lock_guard<std::mutex> lock(fi.pushMutex);
+
+	uint32 pushed = 0;
+	while (pushed < group.bufCount && EnqueueRead(fi.pBuffers[group.firstBuf + pushed], fi))
+		++pushed;
+	// Offsets only grow, nothing is left for the rest of the group
+	RetireBuffers(fi, int(group.pushedCount - pushed));
+	group.pushedCount = pushed;
+	if (pushed == 0)
+		return false;
+
+	const uint64 value = ++fi.lastValue;
+	fi.groupOfValue[value] = groupIdx;
+	fi.pQueue->EnqueueStatus(*fi.pStatus, groupIdx);
+	fi.pQueue->EnqueueSignal(*fi.pFence, value);
+	if (submit)
+		fi.pQueue->Submit();
+	return true;
+}
+
+struct SWorkerState
+{
+	SFileInfo* pFi = nullptr;
+	int64 sum = 0;
+	STimestamp popTime{};
+	STimestamp sumTime{};
+	STimestamp pushTime{};
+	STimestamp readTime{};
+	CLatencyHistogram readLatency;
+	SSpinWaitStats spin;
+	uint32 idx = 0;
+};
+
+struct alignas(128) SState
+{
+	static constexpr size_t alignment = 128;
+
+	SState() = default;
+	SState(SState&&) = default;
+	SState& operator=(SState&&) = default;
+	SState(const SState&) = delete;
+	SState& operator=(const SState&) = delete;
+
+	SWorkerState s;
+	char padding[alignment - sizeof(s) % alignment];
+};
+static_assert(sizeof(SState) % SState::alignment == 0, "Broken alignment");
+
+static void WorkerFunc(SWorkerState& state)
+{
+	SetThreadName(L"Worker_%u", state.idx);
+	PinWorkerThread(state.idx);
+
+	PROF_FUNC();
+
+	SFileInfo& fi = *state.pFi;
+	uint64 s = 0;
+	STimestamp popTime{};
+	STimestamp sumTime{};
+	STimestamp pushTime{};
+	STimestamp readTime{};
+	CSpinWait spin(GetRunConfig().waitMode, GetRunConfig().spinUs);
+
+	while (true)
+	{
+		// Values are taken in order, so are the groups they complete.
+		const uint64 value = fi.nextValue.fetch_add(1, std::memory_order_relaxed) + 1;
+		{
+			PROF_REGION("Wait fence");
+			STsRegion reg(popTime);
+			if (!spin.Spin([&] { return fi.pFence->GetCompletedValue() >= value; }))
+				fi.pFence->Wait(value);
+		}
+		// Set only after every buffer retired, nobody waits for this value.
+		if (fi.stop.load(std::memory_order_acquire))
+		{
+			break;
+		}
+		spin.OnCompletion();
+
+		const uint32 groupIdx = fi.groupOfValue[value];
+		if (!fi.pStatus->IsComplete(groupIdx) || fi.pStatus->GetResult(groupIdx) < 0)
+		{
+			std::cerr << "Failed to finsh reading file, err " << -fi.pStatus->GetResult(groupIdx) << std::endl;
+			exit(3);
+			return;
+		}
+
+		const STimestamp now = STimestamp::now();
+		const SGroup& group = fi.pGroups[groupIdx];
+		for (uint32 i = 0; i < group.pushedCount; ++i)
+		{
+			SBuffer& buf = fi.pBuffers[group.firstBuf + i];
+			const STimestamp latency = now - buf.pushTime;
+			readTime += latency;
+			state.readLatency.Record(latency);
+
+			PROF_REGION("process");
+			STsRegion reg(sumTime);
+			s += process(buf.pBuf.get(), buf.readSize);
+		}
+
+		{
+			STsRegion reg(pushTime);
+			PushGroup(groupIdx, fi, true);
+		}
+	}
+
+	state.sum = s;
+	state.popTime = popTime;
+	state.sumTime = sumTime;
+	state.pushTime = pushTime;
+	state.readTime = readTime;
+	state.spin = spin.GetStats();
+}
+
+static const char* GetFenceModeName(SRunConfig::EFenceMode mode)
+{
+	switch (mode)
+	{
+	case SRunConfig::EFenceMode::Request: return "request";
+	case SRunConfig::EFenceMode::Batch: return "batch";
+	default: return "interval";
+	}
+}
+
+
+}
+
+
+
+void Test10_DStorageQueue(const char* szFilename, const int64 fsizePos)
+{
+	PROF_FUNC();
+
+	using namespace Test10;
+
+	const SRunConfig& cfg = GetRunConfig();
+	const bool unbufferedIo = cfg.GetUnbufferedIo(s_unbufferedIo);
+
+	SFdCloser hFile;
+	{
+		int flags = O_RDONLY;
+		if (unbufferedIo)
+		{
+			flags |= O_DIRECT;
+		}
+
+		PROF_REGION("open");
+		hFile = open(szFilename, flags);
+		if (hFile.fd == -1)
+		{
+			std::cerr << "Failed to open file, err " << errno << std::endl;
+			return;
+		}
+	}
+
+	const uint32 hw = std::min< uint32>(std::thread::hardware_concurrency(), 32);
+	const uint32 maxBuffers = cfg.GetMaxInFlight(32);
+
+	const SRunConfig::EFenceMode fenceMode = cfg.fenceMode == SRunConfig::EFenceMode::Default ? s_fenceMode : cfg.fenceMode;
+	const uint32 groupSize = fenceMode == SRunConfig::EFenceMode::Request ? 1
+		: fenceMode == SRunConfig::EFenceMode::Batch ? maxBuffers
+		: std::min(cfg.fenceInterval ? cfg.fenceInterval : s_fenceInterval, maxBuffers);
+	const uint32 groupCount = (maxBuffers + groupSize - 1) / groupSize;
+
+	CRequestQueue queue;
+	if (!queue.Init(maxBuffers))
+		return;
+	CQueueFence fence;
+	CQueueStatusArray status(groupCount);
+
+	const SWorkload* pWorkload = GetActiveWorkload();
+	const size_t bufSize = std::max<size_t>(cfg.GetBufSize(512 * 1024), pWorkload ? pWorkload->maxRequestSize : 0);
+	const size_t bufAlignment = 4096;
+
+	ReserveIoBuffers(bufSize, maxBuffers);
+	std::vector<SBuffer> buffers;
+	for (uint32 i = 0; i < maxBuffers; ++i)
+	{
+		buffers.emplace_back(AllocIoBuffer(bufSize, bufAlignment), bufSize);
+	}
+
+	std::vector<SGroup> groups(groupCount);
+	for (uint32 i = 0; i < groupCount; ++i)
+	{
+		groups[i].firstBuf = i * groupSize;
+		groups[i].bufCount = std::min(groupSize, maxBuffers - i * groupSize);
+		groups[i].pushedCount = groups[i].bufCount;
+	}
+
+	const uint32 workerCount = cfg.GetWorkerCount(std::max(hw, 2u) - 1);
+	const uint64 requestCount = pWorkload ? pWorkload->requests.size() : (uint64(fsizePos) + bufSize - 1) / bufSize;
+
+	SFileInfo fi;
+	fi.fsizePos = fsizePos;
+	fi.fd = hFile.fd;
+	fi.readAlignment = unbufferedIo ? bufAlignment : 1;
+	fi.pQueue = &queue;
+	fi.pFence = &fence;
+	fi.pStatus = &status;
+	fi.pBuffers = buffers.data();
+	fi.pGroups = groups.data();
+	// Every value covers one request at least
+	fi.groupOfValue.reset(new uint32[requestCount + 1]);
+	fi.bufDoneEvent = eventfd(0, EFD_CLOEXEC);
+	SFdCloser bufDoneEventCloser(fi.bufDoneEvent);
+	fi.pWorkload = pWorkload;
+
+	std::vector<std::thread> workers;
+	std::unique_ptr<SState[]> states(new SState[workerCount]);
+	for (uint32 i = 0; i < workerCount; ++i)
+	{
+		states[i].s.idx = i;
+		states[i].s.pFi = &fi;
+		workers.emplace_back(std::thread(&WorkerFunc, std::ref(states[i].s)));
+	}
+
+	STimestamp sumTime{};
+	STimestamp readTime{};
+	STimestamp workPushTime{};
+	STimestamp waitingForResultTime{};
+	STimestamp stoppingTime{};
+
+	const SPageFaults faultsStart = SPageFaults::Now();
+	const SCpuTime cpuStart = SCpuTime::Now();
+	auto startTime = ts::now();
+
+	{
+		// All groups go with one Submit, like Test4 does with its buffers.
+		STsRegion tsreg(workPushTime);
+		fi.activeBufCount += int(buffers.size());
+		for (uint32 i = 0; i < groupCount; ++i)
+			PushGroup(i, fi, false);
+		queue.Submit();
+	}
+
+	{
+		PROF_REGION("read bufDoneEvent");
+		STsRegion tsreg(waitingForResultTime);
+		uint64 val = 0;
+		while (read(fi.bufDoneEvent, &val, sizeof(val)) < 0 && errno == EINTR)
+			;
+	}
+
+	{
+		PROF_REGION("Signal stop");
+		STsRegion tsreg(stoppingTime);
+		fi.stop.store(true, std::memory_order_release);
+		fence.Signal(UINT64_MAX);
+
+		for (auto& t : workers)
+			t.join();
+	}
+	auto endTime = ts::now();
+	const SPageFaults pageFaults = SPageFaults::Now() - faultsStart;
+	const SCpuTime cpuTime = SCpuTime::Now() - cpuStart;
+
+	uint64 sum = 0;
+	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+		sum += s->s.sum;
+
+	if (cfg.checkExpectedSum && !pWorkload && !CheckExpectedSum(sum))
+		__debugbreak();
+
+	CLatencyHistogram readLatency;
+	STimestamp workersPopTime{};
+	STimestamp workersPushTime{};
+	SSpinWaitStats spin;
+	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+	{
+		spin.Merge(s->s.spin);
+		workersPopTime += s->s.popTime;
+		workersPushTime += s->s.pushTime;
+		readTime += s->s.readTime;
+		readLatency.Merge(s->s.readLatency);
+		sumTime += s->s.sumTime;
+	}
+
+	// Random access reads only requested bytes
+	const uint64 ioSize = pWorkload ? pWorkload->totalBytes : uint64(fsizePos);
+	const SRequestQueueStats stats = queue.GetStats();
+	const uint64 wakeups = fence.GetBlockedWaitCount();
+
+	SRunResult result;
+	result.engine = __FUNCTION__;
+	result.bufSize = uint32(bufSize);
+	result.maxInFlight = maxBuffers;
+	result.fenceGroup = groupSize;
+	result.workerCount = workerCount;
+	result.unbuffered = unbufferedIo;
+	result.bytes = ioSize;
+	result.requests = requestCount;
+	result.sum = sum;
+	result.totalTime = endTime - startTime;
+	result.latency = readLatency;
+	result.pageFaults = pageFaults;
+	result.cpuTime = cpuTime;
+	result.spin = spin;
+	result.wakeups = int64(wakeups);
+	ReportRunResult(result);
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Stage " << GetActiveProcessingStage().name << std::endl;
+	if (pWorkload)
+		PrintWorkload(*pWorkload);
+	std::cout << "Fence per " << GetFenceModeName(fenceMode) << ", " << groupSize << " requests per fence" << std::endl;
+	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(ioSize, (endTime - startTime)) << std::endl;
+	std::cout << "IOPS " << requestCount / sec((endTime - startTime).dur()) << " (" << requestCount << " requests)" << std::endl;
+	std::cout << "Read took   " << ms(readTime.dur()) << " - MB/s " << MBsec(ioSize, readTime) << std::endl;
+	readLatency.Print("Read");
+	std::cout << "Sum took    " << ms(sumTime.dur()) << " - MB/s " << MBsec(ioSize, sumTime) << std::endl;
+	std::cout << "Sum/wr took " << ms(sumTime.dur() / workerCount) << " - MB/s " << MBsec(ioSize, sumTime.dur() / workerCount) << std::endl;
+	std::cout << "Wait " << GetWaitModeName(cfg.waitMode) << std::endl;
+	spin.Print();
+	std::cout << "Fences " << stats.signals << ", wakeups " << wakeups << ", submits " << stats.submits << ", io_uring_enter " << stats.enters << std::endl;
+	std::cout << "workPushTime          " << ms(workPushTime.dur()) << std::endl;
+	std::cout << "waitingForResultTime  " << ms(waitingForResultTime.dur()) << std::endl;
+	std::cout << "stoppingTime          " << ms(stoppingTime.dur()) << std::endl;
+	std::cout << "workersPopTime        " << ms(workersPopTime.dur()) << std::endl;
+	std::cout << "workersPushTime       " << ms(workersPushTime.dur()) << std::endl;
+	std::cout << "pageFaults  minor " << pageFaults.minor << " major " << pageFaults.major << std::endl;
+	std::cout << "cpuTime     user " << ms(cpuTime.user.dur()) << " system " << ms(cpuTime.system.dur()) << std::endl;
+	PrintIoBuffers();
+	std::cout << "Sum is " << sum << std::endl;
+	std::cout << "workerCount " << workerCount << std::endl;
+	std::cout << std::endl;
+}
+
+#endif
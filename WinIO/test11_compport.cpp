@@ -0,0 +1,502 @@
+#ifdef __linux__
+
+#include "tests.h"
+#include "bench.h"
+#include "bufferpool.h"
+#include "compport.h"
+#include "histogram.h"
+#include "linuxio.h"
+#include "spinwait.h"
+#include "testdata.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <atomic>
+#include <thread>
+
+#include <sys/eventfd.h>
+
+// Test3 worker loop on CCompletionPort. io_uring does the reads, a reaper thread moves its completions
+// to the port the way the kernel queues them to an IOCP, workers wait on the port.
+namespace Test11
+{
+
+static const uint64 s_fileCompKey = 42;
+static const uint64 s_stopCompKey = 28;
+
+static constexpr bool s_unbufferedIo = true;
+
+
+struct SBuffer final
+{
+	SBuffer(AlignedUniquePtr p, size_t s)
+		: pBuf(std::move(p))
+		, bufSize(s)
+	{}
+
+	AlignedUniquePtr pBuf;
+	size_t bufSize;
+	size_t readSize = 0;
+
+	STimestamp pushTime;
+};
+
+
+struct SFileInfo
+{
+	std::atomic<int64> off = { 0 };
+	int64 fsizePos = 0;
+
+	int fd = -1;
+	size_t readAlignment = 1;
+	CUring* pRing = nullptr;
+	CCompletionPort* pPort = nullptr;
+
+	int bufDoneEvent = -1;
+	std::atomic<int> activeBufCount = {};
+
+	// Worker that handled the last completion, a change is a switch
+	alignas(128) std::atomic<uint32> lastWorker = { UINT32_MAX };
+
+	// Set for random access, requests are taken from the list instead of streaming.
+	const SWorkload* pWorkload = nullptr;
+	std::atomic<uint64> nextRequest = { 0 };
+};
+
+
+static bool PushMoreRequests(SBuffer* pBuffers, size_t bufCount, SFileInfo& fi)
+{
+	PROF_FUNC();
+
+	SBuffer* pBufEnd = pBuffers + bufCount;
+	for (; pBuffers < pBufEnd; ++pBuffers)
+	{
+		SBuffer& buf = *pBuffers;
+
+		int64 readSize = buf.bufSize;
+		int64 off;
+		if (fi.pWorkload)
+		{
+			const uint64 reqIdx = fi.nextRequest.fetch_add(1, std::memory_order_relaxed);
+			if (reqIdx >= fi.pWorkload->requests.size())
+			{
+				return false;
+			}
+			const SIoRequest& req = fi.pWorkload->requests[reqIdx];
+			off = int64(req.offset);
+			readSize = req.size;
+		}
+		else
+		{
+			off = fi.off.fetch_add(readSize, std::memory_order_acq_rel);
+
+			if (off >= fi.fsizePos)
+			{
+				return false;
+			}
+		}
+		readSize = std::min<int64>(readSize, fi.fsizePos - off);
+		buf.readSize = size_t(readSize);
+		// O_DIRECT needs aligned size as well, read of the tail is short anyway.
+		readSize = (readSize + fi.readAlignment - 1) / fi.readAlignment * fi.readAlignment;
+
+		buf.pushTime = STimestamp::now();
+
+		const int res = fi.pRing->Submit([&](io_uring_sqe& sqe)
+		{
+			sqe.opcode = IORING_OP_READ;
+			sqe.fd = fi.fd;
+			sqe.off = off;
+			sqe.addr = reinterpret_cast<uint64>(buf.pBuf.get());
+			sqe.len = static_cast<uint32>(readSize);
+			sqe.user_data = reinterpret_cast<uint64>(&buf);
+		});
+		if (res < 0)
+		{
+			std::cerr << "Failed to read file, err " << -res << std::endl;
+			exit(1);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void RetireBuffer(SFileInfo& fi)
+{
+	int val = fi.activeBufCount.fetch_sub(1, std::memory_order_relaxed);
+	if (val == 1)
+	{
+		const uint64 one = 1;
+		write(fi.bufDoneEvent, &one, sizeof(one));
+	}
+}
+
+// Stands in for the kernel queuing completions to the port.
+static void ReaperFunc(SFileInfo& fi)
+{
+	SetThreadName(L"Reaper");
+
+	PROF_FUNC();
+
+	while (true)
+	{
+		io_uring_cqe cqe{};
+		const int res = fi.pRing->WaitCompletion(cqe);
+		if (res < 0)
+		{
+			std::cerr << "Failed to get completion status, err " << -res << std::endl;
+			exit(3);
+			return;
+		}
+		if (cqe.user_data == s_stopCompKey)
+		{
+			break;
+		}
+
+		SCompletionPacket packet;
+		packet.key = s_fileCompKey;
+		packet.bytes = cqe.res;
+		packet.pContext = reinterpret_cast<void*>(cqe.user_data);
+		fi.pPort->Post(packet);
+	}
+}
+
+struct SWorkerState
+{
+	SFileInfo* pFi = nullptr;
+	int64 sum = 0;
+	STimestamp popTime{};
+	STimestamp sumTime{};
+	STimestamp pushTime{};
+	STimestamp readTime{};
+	CLatencyHistogram readLatency;
+	SSpinWaitStats spin;
+	uint64 completions = 0;
+	uint64 switches = 0;
+	uint32 idx = 0;
+};
+
+struct alignas(128) SState
+{
+	static constexpr size_t alignment = 128;
+
+	SState() = default;
+	SState(SState&&) = default;
+	SState& operator=(SState&&) = default;
+	SState(const SState&) = delete;
+	SState& operator=(const SState&) = delete;
+
+	SWorkerState s;
+	char padding[alignment - sizeof(s) % alignment];
+};
+static_assert(sizeof(SState) % SState::alignment == 0, "Broken alignment");
+
+static void WorkerFunc(SWorkerState& state)
+{
+	SetThreadName(L"Worker_%u", state.idx);
+	PinWorkerThread(state.idx);
+
+	PROF_FUNC();
+
+	SFileInfo& fi = *state.pFi;
+	uint64 s = 0;
+	STimestamp popTime{};
+	STimestamp sumTime{};
+	STimestamp pushTime{};
+	STimestamp readTime{};
+	uint64 completions = 0;
+	uint64 switches = 0;
+	bool keepPushing = true;
+	CSpinWait spin(GetRunConfig().waitMode, GetRunConfig().spinUs);
+
+	while (true)
+	{
+		SCompletionPacket packet;
+		{
+			PROF_REGION("Get");
+			STsRegion reg(popTime);
+			if (!spin.Spin([&] { return fi.pPort->TryGet(packet); }))
+				fi.pPort->Get(packet);
+		}
+		spin.OnCompletion();
+
+		if (packet.key == s_fileCompKey)
+		{
+			if (packet.bytes < 0)
+			{
+				std::cerr << "Failed to finsh reading file, err " << -packet.bytes << std::endl;
+				exit(3);
+				return;
+			}
+
+			++completions;
+			if (fi.lastWorker.exchange(state.idx, std::memory_order_relaxed) != state.idx)
+				++switches;
+
+			SBuffer& buf = *static_cast<SBuffer*>(packet.pContext);
+			const STimestamp latency = STimestamp::now() - buf.pushTime;
+			readTime += latency;
+			state.readLatency.Record(latency);
+
+			{
+				PROF_REGION("process");
+				STsRegion reg(sumTime);
+				s += process(buf.pBuf.get(), buf.readSize);
+			}
+			if (keepPushing)
+			{
+				STsRegion reg(pushTime);
+				keepPushing = PushMoreRequests(&buf, 1, fi);
+			}
+			if (!keepPushing)
+			{
+				RetireBuffer(fi);
+			}
+		}
+		else if (packet.key == s_stopCompKey)
+		{
+			// Running slot goes to the next worker waiting for its stop packet
+			fi.pPort->Leave();
+			break;
+		}
+		else
+		{
+			__debugbreak();
+		}
+	}
+
+	state.sum = s;
+	state.popTime = popTime;
+	state.sumTime = sumTime;
+	state.pushTime = pushTime;
+	state.readTime = readTime;
+	state.spin = spin.GetStats();
+	state.completions = completions;
+	state.switches = switches;
+}
+
+
+}
+
+
+
+void Test11_CompPortWorkers(const char* szFilename, const int64 fsizePos)
+{
+	PROF_FUNC();
+
+	using namespace Test11;
+
+	const SRunConfig& cfg = GetRunConfig();
+	const bool unbufferedIo = cfg.GetUnbufferedIo(s_unbufferedIo);
+
+	SFdCloser hFile;
+	{
+		int flags = O_RDONLY;
+		if (unbufferedIo)
+		{
+			flags |= O_DIRECT;
+		}
+
+		PROF_REGION("open");
+		hFile = open(szFilename, flags);
+		if (hFile.fd == -1)
+		{
+			std::cerr << "Failed to open file, err " << errno << std::endl;
+			return;
+		}
+	}
+
+	const uint32 hw = std::min< uint32>(std::thread::hardware_concurrency(), 32);
+	const int maxBuffers = int(cfg.GetMaxInFlight(32));
+
+	// Enough space for all buffers and the stop request of the reaper.
+	CUring ring;
+	{
+		PROF_REGION("io_uring_setup");
+		const int res = ring.Init(2 * maxBuffers);
+		if (res < 0)
+		{
+			std::cerr << "Failed to create io_uring, err " << -res << std::endl;
+			return;
+		}
+	}
+
+	// Same as compHw of Test3
+	const uint32 concurrency = cfg.portConcurrency ? cfg.portConcurrency : hw;
+	CCompletionPort port(concurrency, cfg.wakeOrder);
+
+	const SWorkload* pWorkload = GetActiveWorkload();
+	const size_t bufSize = std::max<size_t>(cfg.GetBufSize(512 * 1024), pWorkload ? pWorkload->maxRequestSize : 0);
+	const size_t bufAlignment = 4096;
+
+	ReserveIoBuffers(bufSize, uint32(maxBuffers));
+	std::vector<SBuffer> buffers;
+	for (int i = 0; i < maxBuffers; ++i)
+	{
+		buffers.emplace_back(AllocIoBuffer(bufSize, bufAlignment), bufSize);
+	}
+
+	const uint32 workerCount = cfg.GetWorkerCount(std::max(hw, 2u) - 1);
+
+	SFileInfo fi;
+	fi.fsizePos = fsizePos;
+	fi.fd = hFile.fd;
+	fi.readAlignment = unbufferedIo ? bufAlignment : 1;
+	fi.pRing = &ring;
+	fi.pPort = &port;
+	fi.bufDoneEvent = eventfd(0, EFD_CLOEXEC);
+	SFdCloser bufDoneEventCloser(fi.bufDoneEvent);
+	fi.pWorkload = pWorkload;
+
+	std::thread reaper(&ReaperFunc, std::ref(fi));
+	std::vector<std::thread> workers;
+	std::unique_ptr<SState[]> states(new SState[workerCount]);
+	for (uint32 i = 0; i < workerCount; ++i)
+	{
+		states[i].s.idx = i;
+		states[i].s.pFi = &fi;
+		workers.emplace_back(std::thread(&WorkerFunc, std::ref(states[i].s)));
+	}
+
+	STimestamp sumTime{};
+	STimestamp readTime{};
+	STimestamp workPushTime{};
+	STimestamp waitingForResultTime{};
+	STimestamp stoppingTime{};
+
+	const SPageFaults faultsStart = SPageFaults::Now();
+	const SCpuTime cpuStart = SCpuTime::Now();
+	auto startTime = ts::now();
+
+	{
+		STsRegion tsreg(workPushTime);
+		fi.activeBufCount += (int)buffers.size();
+		size_t pushed = 0;
+		for (; pushed < buffers.size(); ++pushed)
+		{
+			if (!PushMoreRequests(&buffers[pushed], 1, fi))
+				break;
+		}
+
+		// File is smaller than all buffers together, nobody will complete the rest.
+		const int unused = int(buffers.size() - pushed);
+		if (unused > 0 && fi.activeBufCount.fetch_sub(unused) == unused)
+		{
+			const uint64 one = 1;
+			write(fi.bufDoneEvent, &one, sizeof(one));
+		}
+	}
+
+	{
+		PROF_REGION("read bufDoneEvent");
+		STsRegion tsreg(waitingForResultTime);
+		uint64 val = 0;
+		while (read(fi.bufDoneEvent, &val, sizeof(val)) < 0 && errno == EINTR)
+			;
+	}
+
+	{
+		PROF_REGION("Post stop");
+		STsRegion tsreg(stoppingTime);
+		for (uint32 i = 0; i < workerCount; ++i)
+		{
+			SCompletionPacket packet;
+			packet.key = s_stopCompKey;
+			port.Post(packet);
+		}
+		ring.Submit([](io_uring_sqe& sqe)
+		{
+			sqe.opcode = IORING_OP_NOP;
+			sqe.user_data = s_stopCompKey;
+		});
+
+		for (auto& t : workers)
+			t.join();
+		reaper.join();
+	}
+	auto endTime = ts::now();
+	const SPageFaults pageFaults = SPageFaults::Now() - faultsStart;
+	const SCpuTime cpuTime = SCpuTime::Now() - cpuStart;
+
+	uint64 sum = 0;
+	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+		sum += s->s.sum;
+
+	if (cfg.checkExpectedSum && !pWorkload && !CheckExpectedSum(sum))
+		__debugbreak();
+
+	CLatencyHistogram readLatency;
+	STimestamp workersPopTime{};
+	STimestamp workersPushTime{};
+	SSpinWaitStats spin;
+	uint64 switches = 0;
+	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+	{
+		spin.Merge(s->s.spin);
+		workersPopTime += s->s.popTime;
+		workersPushTime += s->s.pushTime;
+		readTime += s->s.readTime;
+		readLatency.Merge(s->s.readLatency);
+		sumTime += s->s.sumTime;
+		switches += s->s.switches;
+	}
+
+	// Random access reads only requested bytes
+	const uint64 ioSize = pWorkload ? pWorkload->totalBytes : uint64(fsizePos);
+	const uint64 requestCount = pWorkload ? pWorkload->requests.size() : (uint64(fsizePos) + bufSize - 1) / bufSize;
+	const SCompletionPortStats portStats = port.GetStats();
+
+	SRunResult result;
+	result.engine = __FUNCTION__;
+	result.bufSize = uint32(bufSize);
+	result.maxInFlight = uint32(maxBuffers);
+	result.workerCount = workerCount;
+	result.concurrency = concurrency;
+	result.unbuffered = unbufferedIo;
+	result.bytes = ioSize;
+	result.requests = requestCount;
+	result.sum = sum;
+	result.totalTime = endTime - startTime;
+	result.latency = readLatency;
+	result.pageFaults = pageFaults;
+	result.cpuTime = cpuTime;
+	result.spin = spin;
+	result.wakeups = int64(portStats.wakeups);
+	result.switches = int64(switches);
+	ReportRunResult(result);
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Stage " << GetActiveProcessingStage().name << std::endl;
+	if (pWorkload)
+		PrintWorkload(*pWorkload);
+	std::cout << "Port " << GetWakeOrderName(cfg.wakeOrder) << ", concurrency " << concurrency << std::endl;
+	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(ioSize, (endTime - startTime)) << std::endl;
+	std::cout << "IOPS " << requestCount / sec((endTime - startTime).dur()) << " (" << requestCount << " requests)" << std::endl;
+	std::cout << "Read took   " << ms(readTime.dur()) << " - MB/s " << MBsec(ioSize, readTime) << std::endl;
+	readLatency.Print("Read");
+	std::cout << "Sum took    " << ms(sumTime.dur()) << " - MB/s " << MBsec(ioSize, sumTime) << std::endl;
+	std::cout << "Sum/wr took " << ms(sumTime.dur() / workerCount) << " - MB/s " << MBsec(ioSize, sumTime.dur() / workerCount) << std::endl;
+	// Few switches mean long runs of completions on one thread
+	std::cout << "Switches " << switches << " of " << requestCount << " completions, posted " << portStats.posted
+		<< ", taken right away " << portStats.immediate << ", wakeups " << portStats.wakeups << std::endl;
+	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+		std::cout << "  completions worker " << s->s.idx << " " << s->s.completions << std::endl;
+	std::cout << "workPushTime          " << ms(workPushTime.dur()) << std::endl;
+	std::cout << "waitingForResultTime  " << ms(waitingForResultTime.dur()) << std::endl;
+	std::cout << "stoppingTime          " << ms(stoppingTime.dur()) << std::endl;
+	std::cout << "workersPopTime        " << ms(workersPopTime.dur()) << std::endl;
+	std::cout << "workersPushTime       " << ms(workersPushTime.dur()) << std::endl;
+	std::cout << "Wait " << GetWaitModeName(cfg.waitMode) << std::endl;
+	spin.Print();
+	std::cout << "pageFaults  minor " << pageFaults.minor << " major " << pageFaults.major << std::endl;
+	std::cout << "cpuTime     user " << ms(cpuTime.user.dur()) << " system " << ms(cpuTime.system.dur()) << std::endl;
+	PrintIoBuffers();
+	std::cout << "Sum is " << sum << std::endl;
+	std::cout << "workerCount " << workerCount << std::endl;
+	std::cout << std::endl;
+}
+
+#endif
@@ -0,0 +1,263 @@
+#include "tests.h"
+#include "bench.h"
+#include "bufferpool.h"
+#include "coread.h"
+#include "histogram.h"
+#include "testdata.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+// Test1_Seq loop written with co_await on async reads. Every stream is such a loop, running all of them
+// at once keeps maxInFlight requests in flight, completions resume the streams on the reader workers.
+namespace Test12
+{
+
+static constexpr bool s_unbufferedIo = true;
+static constexpr uint64 s_dispatchCount = 10000000;
+
+
+struct SStreamState
+{
+	AlignedUniquePtr pBuf;
+	uint64 sum = 0;
+	STimestamp readTime{};
+	STimestamp sumTime{};
+	CLatencyHistogram readLatency;
+};
+
+struct alignas(128) SState
+{
+	static constexpr size_t alignment = 128;
+
+	SState() = default;
+	SState(const SState&) = delete;
+	SState& operator=(const SState&) = delete;
+
+	SStreamState s;
+	char padding[alignment - sizeof(s) % alignment];
+};
+static_assert(sizeof(SState) % SState::alignment == 0, "Broken alignment");
+
+struct SFileInfo
+{
+	std::atomic<int64> off = { 0 };
+	int64 fsizePos = 0;
+	size_t bufSize = 0;
+	size_t readAlignment = 1;
+};
+
+static CCoTask Stream(CCoReader& reader, SFileInfo& fi, SStreamState& state)
+{
+	while (true)
+	{
+		const int64 off = fi.off.fetch_add(fi.bufSize, std::memory_order_relaxed);
+		if (off >= fi.fsizePos)
+			break;
+		const size_t size = size_t(std::min<int64>(fi.bufSize, fi.fsizePos - off));
+
+		int64 read;
+		{
+			auto ss = ts::now();
+			// O_DIRECT needs aligned size as well, read of the tail is short anyway.
+			read = co_await reader.Read(uint64(off), uint32((size + fi.readAlignment - 1) / fi.readAlignment * fi.readAlignment), state.pBuf.get());
+			auto se = ts::now();
+
+			state.readTime += se - ss;
+			state.readLatency.Record(se - ss);
+		}
+		if (read < 0)
+		{
+			std::cerr << "Failed to read file, err " << -read << std::endl;
+			exit(3);
+		}
+
+		{
+			auto ss = ts::now();
+			state.sum += process(state.pBuf.get(), std::min(size, size_t(read)));
+			auto se = ts::now();
+
+			state.sumTime += se - ss;
+		}
+	}
+}
+
+// Same completion delivered without IO, to a suspended coroutine and to a callback like Test3 calls per key.
+struct SManualResume
+{
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h) noexcept { handle = h; }
+	void await_resume() const noexcept {}
+
+	std::coroutine_handle<> handle;
+};
+
+static SCoDetached CountLoop(SManualResume& resume, uint64 count, uint64& s)
+{
+	for (uint64 i = 0; i < count; ++i)
+	{
+		co_await resume;
+		s += i;
+	}
+}
+
+struct SCallback
+{
+	// Called through memory, like a handler looked up by completion key
+	void (* volatile pFunc)(SCallback& cb, uint64 i) = nullptr;
+	uint64 s = 0;
+};
+
+static void CountCallback(SCallback& cb, uint64 i)
+{
+	cb.s += i;
+}
+
+static void MeasureDispatch(STimestamp& coroutineTime, STimestamp& callbackTime)
+{
+	PROF_FUNC();
+
+	uint64 s = 0;
+	{
+		SManualResume resume;
+		CountLoop(resume, s_dispatchCount, s);
+		STsRegion reg(coroutineTime);
+		for (uint64 i = 0; i < s_dispatchCount; ++i)
+			resume.handle.resume();
+	}
+
+	SCallback cb;
+	cb.pFunc = &CountCallback;
+	{
+		STsRegion reg(callbackTime);
+		for (uint64 i = 0; i < s_dispatchCount; ++i)
+			cb.pFunc(cb, i);
+	}
+
+	if (s != cb.s)
+		__debugbreak();
+}
+
+
+}
+
+
+
+void Test12_Coroutines(const char* szFilename, const int64 fsizePos)
+{
+	PROF_FUNC();
+
+	using namespace Test12;
+
+	const SRunConfig& cfg = GetRunConfig();
+	const bool unbufferedIo = cfg.GetUnbufferedIo(s_unbufferedIo);
+
+	const uint32 hw = std::min< uint32>(std::thread::hardware_concurrency(), 32);
+	const uint32 streamCount = cfg.GetMaxInFlight(32);
+	const uint32 workerCount = cfg.GetWorkerCount(std::max(hw, 2u) - 1);
+
+	CCoReader reader;
+	if (!reader.Open(szFilename, unbufferedIo, streamCount))
+		return;
+
+	const size_t bufSize = cfg.GetBufSize(512 * 1024);
+	const size_t bufAlignment = 4096;
+
+	SFileInfo fi;
+	fi.fsizePos = fsizePos;
+	fi.bufSize = bufSize;
+	fi.readAlignment = unbufferedIo ? bufAlignment : 1;
+
+	ReserveIoBuffers(bufSize, streamCount);
+	std::unique_ptr<SState[]> states(new SState[streamCount]);
+	for (uint32 i = 0; i < streamCount; ++i)
+		states[i].s.pBuf = AllocIoBuffer(bufSize, bufAlignment);
+
+	reader.StartWorkers(workerCount);
+
+	STimestamp workPushTime{};
+	STimestamp waitingForResultTime{};
+	STimestamp stoppingTime{};
+
+	const SPageFaults faultsStart = SPageFaults::Now();
+	const SCpuTime cpuStart = SCpuTime::Now();
+	auto startTime = ts::now();
+
+	{
+		STsRegion tsreg(workPushTime);
+		for (uint32 i = 0; i < streamCount; ++i)
+			reader.Spawn(Stream(reader, fi, states[i].s));
+	}
+	{
+		STsRegion tsreg(waitingForResultTime);
+		reader.WaitAll();
+	}
+	{
+		STsRegion tsreg(stoppingTime);
+		reader.StopWorkers();
+	}
+
+	auto endTime = ts::now();
+	const SPageFaults pageFaults = SPageFaults::Now() - faultsStart;
+	const SCpuTime cpuTime = SCpuTime::Now() - cpuStart;
+
+	uint64 sum = 0;
+	STimestamp readTime{};
+	STimestamp sumTime{};
+	CLatencyHistogram readLatency;
+	for (SState* s = states.get(); s != states.get() + streamCount; ++s)
+	{
+		sum += s->s.sum;
+		readTime += s->s.readTime;
+		sumTime += s->s.sumTime;
+		readLatency.Merge(s->s.readLatency);
+	}
+
+	if (cfg.checkExpectedSum && !CheckExpectedSum(sum))
+		__debugbreak();
+
+	STimestamp coroutineTime{};
+	STimestamp callbackTime{};
+	MeasureDispatch(coroutineTime, callbackTime);
+
+	const uint64 requestCount = readLatency.GetCount();
+
+	SRunResult result;
+	result.engine = __FUNCTION__;
+	result.bufSize = uint32(bufSize);
+	result.maxInFlight = streamCount;
+	result.workerCount = workerCount;
+	result.unbuffered = unbufferedIo;
+	result.bytes = uint64(fsizePos);
+	result.requests = requestCount;
+	result.sum = sum;
+	result.totalTime = endTime - startTime;
+	result.latency = readLatency;
+	result.pageFaults = pageFaults;
+	result.cpuTime = cpuTime;
+	ReportRunResult(result);
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Stage " << GetActiveProcessingStage().name << std::endl;
+	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(fsizePos, (endTime - startTime)) << std::endl;
+	std::cout << "IOPS " << requestCount / sec((endTime - startTime).dur()) << " (" << requestCount << " requests)" << std::endl;
+	std::cout << "Read took   " << ms(readTime.dur()) << " - MB/s " << MBsec(fsizePos, readTime) << std::endl;
+	readLatency.Print("Read");
+	std::cout << "Sum took    " << ms(sumTime.dur()) << " - MB/s " << MBsec(fsizePos, sumTime) << std::endl;
+	std::cout << "Sum/wr took " << ms(sumTime.dur() / workerCount) << " - MB/s " << MBsec(fsizePos, sumTime.dur() / workerCount) << std::endl;
+	std::cout << "workPushTime          " << ms(workPushTime.dur()) << std::endl;
+	std::cout << "waitingForResultTime  " << ms(waitingForResultTime.dur()) << std::endl;
+	std::cout << "stoppingTime          " << ms(stoppingTime.dur()) << std::endl;
+	// Suspend and resume against an indirect call, both without the IO
+	std::cout << "Dispatch    coroutine " << sec(coroutineTime.dur()) * 1e9 / s_dispatchCount << " ns, callback "
+		<< sec(callbackTime.dur()) * 1e9 / s_dispatchCount << " ns per request" << std::endl;
+	std::cout << "pageFaults  minor " << pageFaults.minor << " major " << pageFaults.major << std::endl;
+	std::cout << "cpuTime     user " << ms(cpuTime.user.dur()) << " system " << ms(cpuTime.system.dur()) << std::endl;
+	PrintIoBuffers();
+	std::cout << "Sum is " << sum << std::endl;
+	std::cout << "streamCount " << streamCount << std::endl;
+	std::cout << "workerCount " << workerCount << std::endl;
+	std::cout << std::endl;
+}
@@ -0,0 +1,450 @@
+#ifdef __linux__
+
+#include "tests.h"
+#include "bench.h"
+#include "bufferpool.h"
+#include "compport.h"
+#include "eventcount.h"
+#include "histogram.h"
+#include "linuxio.h"
+#include "prioqueue.h"
+#include "testdata.h"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <atomic>
+#include <thread>
+
+// Small urgent reads next to a bulk stream on CPriorityQueue. The foreground thread reads random 64k blocks
+// at a steady rate and waits for each of them, like a game loading what the player is about to see. Background
+// buffers stream the whole file meanwhile, like a level preload, workers take their completions from a port.
+// Phases:
+//  - alone: foreground without background, the best latency there is
+//  - fifo: both in one class sharing the whole window, what the other engines do
+//  - priority: foreground realtime with a deadline, background class limited to a few reads in flight
+//  - saturated: priority with the window only as deep as the background, so the foreground waits for a slot
+//    and is promoted when it waited past half of its deadline
+//  - capped: priority with background capped at half of the MB/s it got in the fifo phase
+namespace Test13
+{
+
+static const uint64 s_fileCompKey = 42;
+static const uint64 s_stopCompKey = 28;
+
+static constexpr bool s_unbufferedIo = true;
+static constexpr uint32 s_foregroundSize = 64 * 1024;
+static constexpr uint32 s_foregroundIntervalUs = 500;
+static constexpr uint32 s_foregroundDeadlineUs = 2000;
+// Foreground reads of the alone phase, the others read until the background is done
+static constexpr uint32 s_foregroundRequests = 1000;
+static constexpr uint32 s_backgroundInFlight = 4;
+
+
+enum class EPhase
+{
+	Alone,
+	Fifo,
+	Priority,
+	Saturated,
+	Capped,
+
+	Count
+};
+
+static const char* s_phaseNames[] = { "alone", "fifo", "priority", "saturated", "capped" };
+static const char* s_phaseEngines[] = { "Test13_Priority/alone", "Test13_Priority/fifo", "Test13_Priority/priority",
+	"Test13_Priority/saturated", "Test13_Priority/capped" };
+static_assert(sizeof(s_phaseNames) / sizeof(s_phaseNames[0]) == size_t(EPhase::Count), "Missing phase name");
+static_assert(sizeof(s_phaseEngines) / sizeof(s_phaseEngines[0]) == size_t(EPhase::Count), "Missing phase name");
+
+struct SBackground;
+
+struct SBuffer final
+{
+	SBuffer(AlignedUniquePtr p, size_t s)
+		: pBuf(std::move(p))
+		, bufSize(s)
+	{}
+
+	AlignedUniquePtr pBuf;
+	size_t bufSize;
+	size_t readSize = 0;
+	SBackground* pBg = nullptr;
+};
+
+struct SBackground
+{
+	std::atomic<int64> off = { 0 };
+	int64 fsizePos = 0;
+
+	int fd = -1;
+	size_t readAlignment = 1;
+	EIoPriority priority = EIoPriority::Background;
+	CPriorityQueue* pQueue = nullptr;
+	CCompletionPort* pPort = nullptr;
+
+	std::atomic<int> activeBufCount = {};
+	std::atomic<uint32> done = { 0 };
+};
+
+struct SForeground
+{
+	std::atomic<uint32> done = { 0 };
+	int result = 0;
+};
+
+struct SPhaseSetup
+{
+	int fd = -1;
+	int64 fsizePos = 0;
+	size_t readAlignment = 1;
+	uint32 workerCount = 0;
+	// Bytes per second for the capped phase
+	uint64 backgroundCap = 0;
+	std::vector<SBuffer>* pBuffers = nullptr;
+	char* pForegroundBuf = nullptr;
+};
+
+struct SPhaseResult
+{
+	CLatencyHistogram foreground;
+	uint64 foregroundRequests = 0;
+	// Over s_foregroundDeadlineUs, whether the phase gave the reads a deadline or not
+	uint64 foregroundLate = 0;
+	uint64 foregroundSum = 0;
+	uint64 backgroundSum = 0;
+	uint64 backgroundRequests = 0;
+	STimestamp totalTime{};
+	SPageFaults pageFaults;
+	SCpuTime cpuTime;
+	SPriorityClassStats stats[size_t(EIoPriority::Count)];
+};
+
+
+// Called on the dispatcher thread
+static void OnBackgroundRead(void* pContext, int result)
+{
+	SBuffer& buf = *static_cast<SBuffer*>(pContext);
+	SCompletionPacket packet;
+	packet.key = s_fileCompKey;
+	packet.bytes = result;
+	packet.pContext = &buf;
+	buf.pBg->pPort->Post(packet);
+}
+
+static void OnForegroundRead(void* pContext, int result)
+{
+	SForeground& fg = *static_cast<SForeground*>(pContext);
+	fg.result = result;
+	fg.done.store(1, std::memory_order_release);
+	FutexWake(fg.done, false);
+}
+
+static bool PushRead(SBuffer& buf, SBackground& bg)
+{
+	const int64 off = bg.off.fetch_add(int64(buf.bufSize), std::memory_order_relaxed);
+	if (off >= bg.fsizePos)
+		return false;
+	buf.readSize = size_t(std::min<int64>(int64(buf.bufSize), bg.fsizePos - off));
+
+	SPriorityRequest req;
+	req.fd = bg.fd;
+	req.offset = uint64(off);
+	// O_DIRECT needs aligned size as well, read of the tail is short anyway.
+	req.size = uint32((buf.readSize + bg.readAlignment - 1) / bg.readAlignment * bg.readAlignment);
+	req.pDest = buf.pBuf.get();
+	req.priority = bg.priority;
+	req.pCallback = &OnBackgroundRead;
+	req.pContext = &buf;
+	bg.pQueue->Enqueue(req);
+	return true;
+}
+
+static void RetireBuffer(SBackground& bg)
+{
+	if (bg.activeBufCount.fetch_sub(1, std::memory_order_relaxed) == 1)
+	{
+		bg.done.store(1, std::memory_order_release);
+		FutexWake(bg.done, true);
+	}
+}
+
+static void WorkerFunc(SBackground& bg, uint32 idx, uint64& sum)
+{
+	SetThreadName(L"Worker_%u", idx);
+	PinWorkerThread(idx);
+
+	PROF_FUNC();
+
+	uint64 s = 0;
+	while (true)
+	{
+		SCompletionPacket packet;
+		bg.pPort->Get(packet);
+		if (packet.key == s_stopCompKey)
+		{
+			bg.pPort->Leave();
+			break;
+		}
+		if (packet.bytes < 0)
+		{
+			std::cerr << "Failed to read file, err " << -packet.bytes << std::endl;
+			exit(3);
+		}
+
+		SBuffer& buf = *static_cast<SBuffer*>(packet.pContext);
+		{
+			PROF_REGION("process");
+			s += process(buf.pBuf.get(), std::min(buf.readSize, size_t(packet.bytes)));
+		}
+		if (!PushRead(buf, bg))
+			RetireBuffer(bg);
+	}
+	sum = s;
+}
+
+static void RunPhase(EPhase phase, const SPhaseSetup& setup, SPhaseResult& res)
+{
+	PROF_FUNC();
+
+	const SRunConfig& cfg = GetRunConfig();
+	const bool withBackground = phase != EPhase::Alone;
+	const bool prioritized = phase != EPhase::Fifo;
+	std::vector<SBuffer>& buffers = *setup.pBuffers;
+
+	SPriorityClassParams params[size_t(EIoPriority::Count)];
+	if (prioritized)
+		params[size_t(EIoPriority::Background)].maxInFlight = s_backgroundInFlight;
+	if (phase == EPhase::Capped)
+		params[size_t(EIoPriority::Background)].bandwidthCap = setup.backgroundCap;
+
+	// Window as deep as the background, without priorities the foreground waits for a slot like everyone else.
+	// Saturated leaves no free slot next to the background, every foreground read waits for one to complete.
+	const uint32 capacity = phase == EPhase::Saturated ? s_backgroundInFlight : uint32(buffers.size());
+	CPriorityQueue queue;
+	if (!queue.Init(capacity, params))
+		exit(1);
+	CCompletionPort port(cfg.portConcurrency, cfg.wakeOrder);
+
+	SBackground bg;
+	bg.fsizePos = setup.fsizePos;
+	bg.fd = setup.fd;
+	bg.readAlignment = setup.readAlignment;
+	bg.priority = prioritized ? EIoPriority::Background : EIoPriority::Normal;
+	bg.pQueue = &queue;
+	bg.pPort = &port;
+
+	std::vector<std::thread> workers;
+	std::vector<uint64> sums(setup.workerCount);
+	if (withBackground)
+	{
+		for (uint32 i = 0; i < setup.workerCount; ++i)
+			workers.emplace_back(std::thread(&WorkerFunc, std::ref(bg), i, std::ref(sums[i])));
+	}
+
+	const EIoPriority fgPriority = prioritized ? EIoPriority::Realtime : EIoPriority::Normal;
+	std::mt19937_64 rng(1234);
+	const uint64 blockCount = std::max<int64>(setup.fsizePos - s_foregroundSize, 0) / 4096 + 1;
+
+	const SPageFaults faultsStart = SPageFaults::Now();
+	const SCpuTime cpuStart = SCpuTime::Now();
+	auto startTime = ts::now();
+
+	if (withBackground)
+	{
+		PROF_REGION("push");
+		bg.activeBufCount += int(buffers.size());
+		for (SBuffer& buf : buffers)
+		{
+			buf.pBg = &bg;
+			if (!PushRead(buf, bg))
+				RetireBuffer(bg);
+		}
+	}
+
+	while (withBackground ? bg.done.load(std::memory_order_acquire) == 0 : res.foregroundRequests < s_foregroundRequests)
+	{
+		SForeground fg;
+		SPriorityRequest req;
+		req.fd = setup.fd;
+		req.offset = rng() % blockCount * 4096;
+		req.size = s_foregroundSize;
+		req.pDest = setup.pForegroundBuf;
+		req.priority = fgPriority;
+		req.deadlineUs = prioritized ? s_foregroundDeadlineUs : 0;
+		req.pCallback = &OnForegroundRead;
+		req.pContext = &fg;
+
+		const STimestamp issueTime = ts::now();
+		queue.Enqueue(req);
+		while (fg.done.load(std::memory_order_acquire) == 0)
+			FutexWait(fg.done, 0);
+		const STimestamp latency = ts::now() - issueTime;
+		if (fg.result < 0)
+		{
+			std::cerr << "Failed to read file, err " << -fg.result << std::endl;
+			exit(3);
+		}
+
+		res.foreground.Record(latency);
+		++res.foregroundRequests;
+		if (sec(latency.dur()) * 1e6 > s_foregroundDeadlineUs)
+			++res.foregroundLate;
+		res.foregroundSum += process(setup.pForegroundBuf, size_t(fg.result));
+
+		// Steady rate, a late read is followed by the next one right away
+		const auto wait = std::chrono::microseconds(s_foregroundIntervalUs) - (ts::now() - issueTime).dur();
+		if (wait.count() > 0)
+			std::this_thread::sleep_for(wait);
+	}
+
+	if (withBackground)
+	{
+		PROF_REGION("wait background");
+		while (bg.done.load(std::memory_order_acquire) == 0)
+			FutexWait(bg.done, 0);
+	}
+	auto endTime = ts::now();
+	res.pageFaults = SPageFaults::Now() - faultsStart;
+	res.cpuTime = SCpuTime::Now() - cpuStart;
+
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		SCompletionPacket packet;
+		packet.key = s_stopCompKey;
+		port.Post(packet);
+	}
+	for (std::thread& t : workers)
+		t.join();
+
+	for (uint64 s : sums)
+		res.backgroundSum += s;
+	res.totalTime = endTime - startTime;
+	for (size_t i = 0; i < size_t(EIoPriority::Count); ++i)
+		res.stats[i] = queue.GetStats(EIoPriority(i));
+	res.backgroundRequests = res.stats[size_t(bg.priority)].requests - (bg.priority == fgPriority ? res.foregroundRequests : 0);
+}
+
+
+}
+
+
+
+void Test13_Priority(const char* szFilename, const int64 fsizePos)
+{
+	PROF_FUNC();
+
+	using namespace Test13;
+
+	const SRunConfig& cfg = GetRunConfig();
+	const bool unbufferedIo = cfg.GetUnbufferedIo(s_unbufferedIo);
+
+	SFdCloser hFile;
+	{
+		int flags = O_RDONLY;
+		if (unbufferedIo)
+		{
+			flags |= O_DIRECT;
+		}
+
+		PROF_REGION("open");
+		hFile = open(szFilename, flags);
+		if (hFile.fd == -1)
+		{
+			std::cerr << "Failed to open file, err " << errno << std::endl;
+			return;
+		}
+	}
+
+	const uint32 hw = std::min< uint32>(std::thread::hardware_concurrency(), 32);
+	const uint32 maxBuffers = cfg.GetMaxInFlight(32);
+	const uint32 workerCount = cfg.GetWorkerCount(std::max(hw, 2u) - 1);
+	const size_t bufSize = cfg.GetBufSize(1024 * 1024);
+	const size_t bufAlignment = 4096;
+
+	ReserveIoBuffers(bufSize, maxBuffers + 1);
+	std::vector<SBuffer> buffers;
+	for (uint32 i = 0; i < maxBuffers; ++i)
+		buffers.emplace_back(AllocIoBuffer(bufSize, bufAlignment), bufSize);
+	AlignedUniquePtr pForegroundBuf = AllocIoBuffer(std::max<size_t>(bufSize, s_foregroundSize), bufAlignment);
+
+	SPhaseSetup setup;
+	setup.fd = hFile.fd;
+	setup.fsizePos = fsizePos;
+	setup.readAlignment = unbufferedIo ? bufAlignment : 1;
+	setup.workerCount = workerCount;
+	setup.pBuffers = &buffers;
+	setup.pForegroundBuf = pForegroundBuf.get();
+
+	std::unique_ptr<SPhaseResult[]> results(new SPhaseResult[size_t(EPhase::Count)]);
+	for (size_t p = 0; p < size_t(EPhase::Count); ++p)
+	{
+		const EPhase phase = EPhase(p);
+		if (phase == EPhase::Capped)
+		{
+			const SPhaseResult& fifo = results[size_t(EPhase::Fifo)];
+			setup.backgroundCap = uint64(double(fsizePos) / sec(fifo.totalTime.dur()) / 2);
+		}
+		RunPhase(phase, setup, results[p]);
+	}
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Stage " << GetActiveProcessingStage().name << std::endl;
+	std::cout << "Foreground " << s_foregroundSize / 1024 << "k every " << s_foregroundIntervalUs << " us, deadline " << s_foregroundDeadlineUs
+		<< " us. Background " << bufSize / 1024 << "k x " << maxBuffers << ", " << s_backgroundInFlight << " in flight when prioritized" << std::endl;
+	for (size_t p = 0; p < size_t(EPhase::Count); ++p)
+	{
+		const EPhase phase = EPhase(p);
+		const SPhaseResult& res = results[p];
+		const SPriorityClassStats& rt = res.stats[size_t(EIoPriority::Realtime)];
+		const SPriorityClassStats& bgStats = res.stats[size_t(EIoPriority::Background)];
+
+		std::cout << "Phase " << s_phaseNames[p] << std::endl;
+		res.foreground.Print("Foreground");
+		std::cout << "Foreground requests " << res.foregroundRequests << ", over deadline " << res.foregroundLate;
+		// Fifo reads have no deadline to promote or miss
+		if (phase == EPhase::Fifo)
+			std::cout << ", promoted n/a, missed n/a" << std::endl;
+		else
+			std::cout << ", promoted " << rt.promoted << ", missed " << rt.missed << std::endl;
+		if (phase == EPhase::Alone)
+			continue;
+
+		if (cfg.checkExpectedSum && !CheckExpectedSum(res.backgroundSum))
+			__debugbreak();
+
+		std::cout << "Total took  " << ms(res.totalTime.dur()) << " - MB/s " << MBsec(fsizePos, res.totalTime) << std::endl;
+		if (phase == EPhase::Capped)
+			std::cout << "Background cap MB/s " << double(setup.backgroundCap) / 1024 / 1024 << ", throttled " << bgStats.throttled << std::endl;
+		std::cout << "Sum is " << res.backgroundSum << std::endl;
+
+		SRunResult result;
+		result.engine = s_phaseEngines[p];
+		result.bufSize = uint32(bufSize);
+		result.maxInFlight = phase == EPhase::Saturated ? s_backgroundInFlight : maxBuffers;
+		result.workerCount = workerCount;
+		result.unbuffered = unbufferedIo;
+		result.bytes = uint64(fsizePos);
+		result.requests = res.backgroundRequests;
+		result.sum = res.backgroundSum;
+		result.totalTime = res.totalTime;
+		// Foreground is what the phases are compared on
+		result.latency = res.foreground;
+		result.pageFaults = res.pageFaults;
+		result.cpuTime = res.cpuTime;
+		ReportRunResult(result);
+	}
+
+	std::cout << "Foreground p99 ms";
+	for (size_t p = 0; p < size_t(EPhase::Count); ++p)
+		std::cout << " " << s_phaseNames[p] << " " << ms(results[p].foreground.GetPercentile(99).dur());
+	std::cout << std::endl;
+	PrintIoBuffers();
+	std::cout << "workerCount " << workerCount << std::endl;
+	std::cout << std::endl;
+}
+
+#endif
@@ -1,21 +1,30 @@
 #include "tests.h"
+#include "bench.h"
+#include "bufferpool.h"
+#include "histogram.h"
+#include "testdata.h"
 
 #include <iostream>
 
 
 void Test1_Seq(FILE* f, const fpos_t fsizePos)
 {
-	const size_t bufSize = 64 * 1024;
-	std::unique_ptr<char[]> pBuf(new char[bufSize]);
+	const SRunConfig& cfg = GetRunConfig();
+	const size_t bufSize = cfg.GetBufSize(64 * 1024);
+	ReserveIoBuffers(bufSize, 1);
+	AlignedUniquePtr pBuf = AllocIoBuffer(bufSize, 4096);
 
 	fpos_t off = 0;
 	size_t read = 0;
 
 	uint64 s = 0;
 
+	const SPageFaults faultsStart = SPageFaults::Now();
+	const SCpuTime cpuStart = SCpuTime::Now();
 	auto startTime = ts::now();
 	STimestamp sumTime{};
 	STimestamp readTime{};
+	CLatencyHistogram readLatency;
 
 
 	while (off < fsizePos)
@@ -26,12 +35,13 @@ void Test1_Seq(FILE* f, const fpos_t fsizePos)
 			auto se = ts::now();
 
 			readTime += se - ss;
+			readLatency.Record(se - ss);
 		}
 		off += read;
 
 		{
 			auto ss = ts::now();
-			s += sum(pBuf.get(), read);
+			s += process(pBuf.get(), read);
 			auto se = ts::now();
 
 			sumTime += se - ss;
@@ -39,15 +49,34 @@ void Test1_Seq(FILE* f, const fpos_t fsizePos)
 	}
 
 	auto endTime = ts::now();
+	const SPageFaults pageFaults = SPageFaults::Now() - faultsStart;
+	const SCpuTime cpuTime = SCpuTime::Now() - cpuStart;
 
-	const int64 expectedSum = 1226802104644;
-	if (s != expectedSum)
+	if (cfg.checkExpectedSum && !CheckExpectedSum(s))
 		__debugbreak();
 
+	SRunResult result;
+	result.engine = __FUNCTION__;
+	result.bufSize = uint32(bufSize);
+	result.maxInFlight = 1;
+	result.bytes = uint64(fsizePos);
+	result.requests = readLatency.GetCount();
+	result.sum = s;
+	result.totalTime = endTime - startTime;
+	result.latency = readLatency;
+	result.pageFaults = pageFaults;
+	result.cpuTime = cpuTime;
+	ReportRunResult(result);
+
 	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Stage " << GetActiveProcessingStage().name << std::endl;
 	std::cout << "Total took " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(fsizePos, (endTime - startTime)) << std::endl;
 	std::cout << "Read took  " << ms(readTime.dur()) << " - MB/s " << MBsec(fsizePos, readTime) << std::endl;
+	readLatency.Print("Read");
 	std::cout << "Sum took   " << ms(sumTime.dur()) << " - MB/s " << MBsec(fsizePos, sumTime) << std::endl;
+	std::cout << "pageFaults  minor " << pageFaults.minor << " major " << pageFaults.major << std::endl;
+	std::cout << "cpuTime     user " << ms(cpuTime.user.dur()) << " system " << ms(cpuTime.system.dur()) << std::endl;
+	PrintIoBuffers();
 	std::cout << "Sum is " << s << std::endl;
 	std::cout << std::endl;
 }
@@ -1,4 +1,11 @@
 #include "tests.h"
+#include "bench.h"
+#include "bufferpool.h"
+#include "eventcount.h"
+#include "histogram.h"
+#include "mpmcqueue.h"
+#include "testdata.h"
+#include "wsdeque.h"
 
 #include <array>
 #include <iostream>
@@ -7,6 +14,7 @@
 #include <atomic>
 #include <mutex>
 #include <thread>
+#include <type_traits>
 
 namespace Test2
 {
@@ -17,6 +25,77 @@ namespace Test2
 	};
 
 	constexpr int maxBuffers = 16;
+
+	enum class EQueueType
+	{
+		// Bitmask of slots, not FIFO, loses buffers under contention
+		Atomic,
+		// std::mutex + condition_variable
+		Mutex,
+		// Lock-free ring, see mpmcqueue.h
+		Ring,
+	};
+
+	static constexpr EQueueType s_queueType = EQueueType::Ring;
+	// Ring only, idle workers sleep on an event count instead of spinning
+	static constexpr bool s_parkIdleWorkers = true;
+
+	static const char* QueueTypeName(EQueueType t)
+	{
+		switch (t)
+		{
+		case EQueueType::Atomic: return "atomic";
+		case EQueueType::Mutex: return "mutex";
+		case EQueueType::Ring: return s_parkIdleWorkers ? "ring+park" : "ring";
+		}
+		return "?";
+	}
+
+	enum class EScheduler
+	{
+		// Reader deals buffers to workers in turn and scans their out queues for free ones
+		RoundRobin,
+		// Shared injection queue and free buffer pool, workers split buffers into chunks and steal them from each other
+		WorkStealing,
+	};
+
+	static constexpr EScheduler s_scheduler = EScheduler::WorkStealing;
+	// Smallest unit of stealing, multiple of processing block so hash stages don't change
+	static constexpr size_t s_minStealChunkSize = 128 * 1024;
+	static_assert(s_minStealChunkSize % s_processingBlockSize == 0, "Chunks have to start at processing blocks");
+	// Bigger buffers get bigger chunks, all chunks of one buffer always fit into a deque
+	static constexpr uint32 s_maxChunksPerBuffer = 64;
+
+	// Task in a deque is buffer index and chunk index
+	static uint32 MakeTask(uint32 bufIdx, uint32 chunkIdx) { return (bufIdx << 16) | chunkIdx; }
+	static uint32 TaskBuffer(uint32 task) { return task >> 16; }
+	static uint32 TaskChunk(uint32 task) { return task & 0xffff; }
+
+	struct SWorkerState;
+
+	struct SStealingBuffer
+	{
+		char* pBuf = nullptr;
+		size_t size = 0;
+		uint32 chunkCount = 0;
+		// Worker that finishes the last chunk returns buffer to the pool
+		std::atomic<uint32> pendingChunks = { 0 };
+	};
+
+	// Shared by reader and workers in WorkStealing mode
+	struct SStealingShared
+	{
+		std::array<SStealingBuffer, maxBuffers> buffers;
+		size_t chunkSize = 0;
+		// Buffers that are read, but not taken by any worker yet
+		CMpmcQueue<uint32, maxBuffers> injected;
+		CMpmcQueue<uint32, maxBuffers> freeBuffers;
+		CEventCount workEvent;
+		CEventCount freeEvent;
+		std::vector<SWorkerState*> workers;
+		std::atomic_bool stop = false;
+	};
+
 	struct SWorkerState
 	{
 	private:
@@ -152,6 +231,66 @@ namespace Test2
 		};
 
 
+		class CQueuesRing
+		{
+		public:
+			void Stop()
+			{
+				stop.store(true, std::memory_order_relaxed);
+				inEvent.Notify(true);
+			}
+
+			bool TryPushToInQueue(const SWork& work)
+			{
+				if (!bufInQueue.TryPush(work))
+					return false;
+				if (s_parkIdleWorkers)
+					inEvent.Notify();
+				return true;
+			}
+
+			bool TryPushToOutQueue(const SWork& work) { return bufOutQueue.TryPush(work); }
+			bool TryPopFromOutQueue(SWork& work) { return bufOutQueue.TryPop(work); }
+
+			bool TryPopFromInQueue(SWork& work)
+			{
+				if (bufInQueue.TryPop(work))
+					return true;
+				if (!s_parkIdleWorkers)
+					return false;
+
+				while (!stop.load(std::memory_order_relaxed))
+				{
+					const uint32 key = inEvent.PrepareWait();
+					if (bufInQueue.TryPop(work))
+					{
+						inEvent.CancelWait();
+						return true;
+					}
+					if (stop.load(std::memory_order_relaxed))
+					{
+						inEvent.CancelWait();
+						break;
+					}
+					inEvent.Wait(key);
+					if (bufInQueue.TryPop(work))
+						return true;
+				}
+				// Reader pushes everything before Stop, drain what's left.
+				return bufInQueue.TryPop(work);
+			}
+
+		private:
+			// Never more than maxBuffers in flight, so pushes don't fail.
+			CMpmcQueue<SWork, maxBuffers> bufInQueue;
+			CMpmcQueue<SWork, maxBuffers> bufOutQueue;
+			CEventCount inEvent;
+			std::atomic_bool stop = false;
+		};
+
+		using CQueues = std::conditional_t<s_queueType == EQueueType::Atomic, CQueuesAtm,
+			std::conditional_t<s_queueType == EQueueType::Mutex, CQueuesMtx, CQueuesRing>>;
+
 	public:
 
 		SWorkerState() = default;
@@ -171,8 +310,13 @@ namespace Test2
 			return shouldStop.load(std::memory_order_relaxed);
 		}
 
-		//CQueuesAtm q;
-		CQueuesMtx q;
+		CQueues q;
+		// WorkStealing only
+		CWorkStealingDeque<uint32, s_maxChunksPerBuffer> deque;
+		SStealingShared* pShared = nullptr;
+		uint32 idx = 0;
+		uint64 stealCount = 0;
+
 		int64 sum = 0;
 		STimestamp popTime{};
 		STimestamp sumTime{};
@@ -199,6 +343,8 @@ namespace Test2
 
 	static void WorkerFunc(SWorkerState& state)
 	{
+		SetThreadName(L"Worker_%u", state.idx);
+		PinWorkerThread(state.idx);
 		uint64 s = 0;
 		SWork work;
 		STimestamp popTime{};
@@ -218,7 +364,7 @@ namespace Test2
 			{
 				{
 					STsRegion reg(sumTime);
-					s += sum(work.pBuf, work.size);
+					s += process(work.pBuf, work.size);
 				}
 
 				{
@@ -239,21 +385,122 @@ namespace Test2
 		state.sumTime = sumTime;
 		state.pushTime = pushTime;
 	}
+
+	// Own deque first, then a new buffer, then other workers' deques.
+	static bool FindWork(SWorkerState& state, uint32& task, uint64& stealCount)
+	{
+		SStealingShared& sh = *state.pShared;
+		if (state.deque.Pop(task))
+			return true;
+
+		uint32 bufIdx;
+		if (sh.injected.TryPop(bufIdx))
+		{
+			// Keeps the first chunk, the rest can be stolen while it's processed.
+			const uint32 chunkCount = sh.buffers[bufIdx].chunkCount;
+			for (uint32 c = chunkCount - 1; c > 0; --c)
+				state.deque.Push(MakeTask(bufIdx, c));
+			if (chunkCount > 1)
+				sh.workEvent.Notify();
+			task = MakeTask(bufIdx, 0);
+			return true;
+		}
+
+		const uint32 workerCount = uint32(sh.workers.size());
+		for (uint32 i = 1; i < workerCount; ++i)
+		{
+			SWorkerState& victim = *sh.workers[(state.idx + i) % workerCount];
+			if (victim.deque.Steal(task))
+			{
+				++stealCount;
+				// Victim may have more, let the next idle worker try.
+				sh.workEvent.Notify();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void StealingWorkerFunc(SWorkerState& state)
+	{
+		SetThreadName(L"Worker_%u", state.idx);
+		PinWorkerThread(state.idx);
+		SStealingShared& sh = *state.pShared;
+		uint64 s = 0;
+		uint64 stealCount = 0;
+		STimestamp popTime{};
+		STimestamp sumTime{};
+		STimestamp pushTime{};
+
+		while (true)
+		{
+			uint32 task = 0;
+			bool found;
+			{
+				STsRegion reg(popTime);
+				found = FindWork(state, task, stealCount);
+				while (!found)
+				{
+					const uint32 key = sh.workEvent.PrepareWait();
+					found = FindWork(state, task, stealCount);
+					if (found)
+					{
+						sh.workEvent.CancelWait();
+						break;
+					}
+					if (sh.stop.load(std::memory_order_acquire))
+					{
+						sh.workEvent.CancelWait();
+						// Everything pushed before stop is visible now.
+						found = FindWork(state, task, stealCount);
+						break;
+					}
+					sh.workEvent.Wait(key);
+					found = FindWork(state, task, stealCount);
+				}
+			}
+			if (!found)
+				break;
+
+			const uint32 bufIdx = TaskBuffer(task);
+			SStealingBuffer& b = sh.buffers[bufIdx];
+			const size_t off = TaskChunk(task) * sh.chunkSize;
+			{
+				STsRegion reg(sumTime);
+				s += process(b.pBuf + off, std::min(sh.chunkSize, b.size - off));
+			}
+
+			if (b.pendingChunks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				STsRegion reg(pushTime);
+				sh.freeBuffers.TryPush(bufIdx);
+				sh.freeEvent.Notify();
+			}
+		}
+
+		state.sum = s;
+		state.stealCount = stealCount;
+		state.popTime = popTime;
+		state.sumTime = sumTime;
+		state.pushTime = pushTime;
+	}
 }
 
 void Test2_Par(FILE* f, const fpos_t fsizePos)
 {
-	const size_t bufSize = 512 * 1024;
+	const SRunConfig& cfg = GetRunConfig();
+	const size_t bufSize = cfg.GetBufSize(512 * 1024);
 
 	using namespace Test2;
 
-	std::vector<std::unique_ptr<char[]>> buffers;
+	ReserveIoBuffers(bufSize, maxBuffers);
+	std::vector<AlignedUniquePtr> buffers;
 	std::vector<char*> freeBuffers;
 	buffers.reserve(maxBuffers);
 	freeBuffers.reserve(maxBuffers);
 	for (int i = 0; i < maxBuffers; ++i)
 	{
-		buffers.emplace_back(new char[bufSize]);
+		buffers.emplace_back(AllocIoBuffer(bufSize, 4096));
 		freeBuffers.push_back(buffers.back().get());
 	}
 
@@ -262,15 +509,33 @@ void Test2_Par(FILE* f, const fpos_t fsizePos)
 
 	const uint32 hw = std::min<uint32>(std::thread::hardware_concurrency(), maxBuffers);
 	//const uint32 hw = 1;
-	const uint32 workerCount = std::max(hw, 2u) - 1; // max(hw-1, 1)
+	const uint32 workerCount = std::min<uint32>(cfg.GetWorkerCount(std::max(hw, 2u) - 1), maxBuffers); // max(hw-1, 1)
 	//const uint32 workerCount = std::max(hw, 1u); // max(hw-1, 1)
 	//states.reserve(workerCount);
 
 	//std::vector<Test2::SState> states;
 	std::unique_ptr<SState[]> states(new SState[workerCount]);
+
+	SStealingShared shared;
+	shared.chunkSize = std::max(s_minStealChunkSize, (bufSize / s_maxChunksPerBuffer + s_processingBlockSize - 1) / s_processingBlockSize * s_processingBlockSize);
+	for (uint32 i = 0; i < maxBuffers; ++i)
+	{
+		shared.buffers[i].pBuf = buffers[i].get();
+		shared.freeBuffers.TryPush(i);
+	}
+	for (uint32 i = 0; i < workerCount; ++i)
+	{
+		states[i].s.pShared = &shared;
+		states[i].s.idx = i;
+		shared.workers.push_back(&states[i].s);
+	}
+
 	for (uint32 i = 0; i < workerCount; ++i)
 	{
-		workers.emplace_back(std::thread(&WorkerFunc, std::ref(states[i].s)));
+		if (s_scheduler == EScheduler::WorkStealing)
+			workers.emplace_back(std::thread(&StealingWorkerFunc, std::ref(states[i].s)));
+		else
+			workers.emplace_back(std::thread(&WorkerFunc, std::ref(states[i].s)));
 	}
 
 
@@ -279,19 +544,37 @@ void Test2_Par(FILE* f, const fpos_t fsizePos)
 
 	STimestamp sumTime{};
 	STimestamp readTime{};
+	CLatencyHistogram readLatency;
 	STimestamp freeBufferFetchTime{};
 	STimestamp workPushTime{};
 	STimestamp waitingForResultTime{};
 
 	uint32 round = 0;
 
+	const SPageFaults faultsStart = SPageFaults::Now();
+	const SCpuTime cpuStart = SCpuTime::Now();
 	auto startTime = ts::now();
 	while (off < fsizePos)
 	{
 		char* pBuf = nullptr;
+		uint32 bufIdx = 0;
 		{
 			STsRegion tsreg(freeBufferFetchTime);
-			if (freeBuffers.empty())
+			if (s_scheduler == EScheduler::WorkStealing)
+			{
+				while (!shared.freeBuffers.TryPop(bufIdx))
+				{
+					const uint32 key = shared.freeEvent.PrepareWait();
+					if (shared.freeBuffers.TryPop(bufIdx))
+					{
+						shared.freeEvent.CancelWait();
+						break;
+					}
+					shared.freeEvent.Wait(key);
+				}
+				pBuf = shared.buffers[bufIdx].pBuf;
+			}
+			else if (freeBuffers.empty())
 			{
 				SWork w;
 				for (uint32 r = round; ; r = (r + 1) % workerCount)
@@ -311,21 +594,37 @@ void Test2_Par(FILE* f, const fpos_t fsizePos)
 		}
 
 		{
-			STsRegion tsreg(readTime);
+			const auto readStart = ts::now();
 			read = fread(pBuf, 1, bufSize, f);
+			const STimestamp latency = ts::now() - readStart;
+			readTime += latency;
+			readLatency.Record(latency);
 		}
 		off += read;
 
 		{
 			STsRegion reg(workPushTime);
-			SWork work{ pBuf, read };
-			while (true)
+			if (s_scheduler == EScheduler::WorkStealing)
+			{
+				SStealingBuffer& b = shared.buffers[bufIdx];
+				b.size = read;
+				b.chunkCount = std::max<uint32>(uint32((read + shared.chunkSize - 1) / shared.chunkSize), 1);
+				b.pendingChunks.store(b.chunkCount, std::memory_order_relaxed);
+				// Never more than maxBuffers in flight, can't fail
+				shared.injected.TryPush(bufIdx);
+				shared.workEvent.Notify();
+			}
+			else
 			{
-				const uint32 r = round;
-				round = (round + 1) % workerCount;
-				if (states[r].s.q.TryPushToInQueue(work))
+				SWork work{ pBuf, read };
+				while (true)
 				{
-					break;
+					const uint32 r = round;
+					round = (round + 1) % workerCount;
+					if (states[r].s.q.TryPushToInQueue(work))
+					{
+						break;
+					}
 				}
 			}
 		}
@@ -334,8 +633,16 @@ void Test2_Par(FILE* f, const fpos_t fsizePos)
 	uint64 sum = 0;
 	{
 		STsRegion reg(waitingForResultTime);
-		for (SState* s = states.get(); s != states.get() + workerCount; ++s)
-			s->s.Stop();
+		if (s_scheduler == EScheduler::WorkStealing)
+		{
+			shared.stop.store(true, std::memory_order_release);
+			shared.workEvent.Notify(true);
+		}
+		else
+		{
+			for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+				s->s.Stop();
+		}
 
 		for (auto& t : workers)
 			t.join();
@@ -346,24 +653,43 @@ void Test2_Par(FILE* f, const fpos_t fsizePos)
 	}
 
 	auto endTime = ts::now();
+	const SPageFaults pageFaults = SPageFaults::Now() - faultsStart;
+	const SCpuTime cpuTime = SCpuTime::Now() - cpuStart;
 
-	const int64 expectedSum = 1226802104644;
-	if (sum != expectedSum)
+	if (cfg.checkExpectedSum && !CheckExpectedSum(sum))
 		__debugbreak();
 
 	STimestamp workersPopTime{};
 	STimestamp workersPushTime{};
+	uint64 stealCount = 0;
 	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
 	{
+		stealCount += s->s.stealCount;
 		workersPopTime += s->s.popTime;
 		workersPushTime += s->s.pushTime;
 		sumTime += s->s.sumTime;
 	}
 
 
+	SRunResult result;
+	result.engine = __FUNCTION__;
+	result.bufSize = uint32(bufSize);
+	result.maxInFlight = maxBuffers;
+	result.workerCount = workerCount;
+	result.bytes = uint64(fsizePos);
+	result.requests = readLatency.GetCount();
+	result.sum = sum;
+	result.totalTime = endTime - startTime;
+	result.latency = readLatency;
+	result.pageFaults = pageFaults;
+	result.cpuTime = cpuTime;
+	ReportRunResult(result);
+
 	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Stage " << GetActiveProcessingStage().name << std::endl;
 	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(fsizePos, (endTime - startTime)) << std::endl;
 	std::cout << "Read took   " << ms(readTime.dur()) << " - MB/s " << MBsec(fsizePos, readTime) << std::endl;
+	readLatency.Print("Read");
 	std::cout << "Sum took    " << ms(sumTime.dur()) << " - MB/s " << MBsec(fsizePos, sumTime) << std::endl;
 	std::cout << "Sum/wr took " << ms(sumTime.dur() / workerCount) << " - MB/s " << MBsec(fsizePos, sumTime.dur() / workerCount) << std::endl;
 	std::cout << "freeBufferFetchTime   " << ms(freeBufferFetchTime.dur()) << std::endl;
@@ -371,6 +697,13 @@ void Test2_Par(FILE* f, const fpos_t fsizePos)
 	std::cout << "waitingForResultTime  " << ms(waitingForResultTime.dur()) << std::endl;
 	std::cout << "workersPopTime        " << ms(workersPopTime.dur()) << std::endl;
 	std::cout << "workersPushTime       " << ms(workersPushTime.dur()) << std::endl;
+	if (s_scheduler == EScheduler::WorkStealing)
+		std::cout << "scheduler work stealing, chunk " << shared.chunkSize << ", steals " << stealCount << std::endl;
+	else
+		std::cout << "scheduler round robin, queue " << QueueTypeName(s_queueType) << std::endl;
+	std::cout << "pageFaults  minor " << pageFaults.minor << " major " << pageFaults.major << std::endl;
+	std::cout << "cpuTime     user " << ms(cpuTime.user.dur()) << " system " << ms(cpuTime.system.dur()) << std::endl;
+	PrintIoBuffers();
 	std::cout << "Sum is " << sum << std::endl;
 	std::cout << "workerCount " << workerCount << std::endl;
 	std::cout << std::endl;
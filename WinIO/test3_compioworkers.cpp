@@ -1,4 +1,14 @@
 #include "tests.h"
+#include "bench.h"
+#include "bufferpool.h"
+#include "histogram.h"
+#include "compressedfile.h"
+#include "fileset.h"
+#include "inflight.h"
+#include "lz.h"
+#include "spinwait.h"
+#include "testdata.h"
+#include "workload.h"
 
 #include <array>
 #include <algorithm>
@@ -18,6 +28,9 @@ static const ULONG_PTR s_finishedCompKey = 20;
 
 static constexpr bool s_singleRequestThread = false;
 static constexpr bool s_unbufferedIo = true;
+// Outstanding reads picked at runtime instead of keeping all buffers in flight, see inflight.h.
+// Only with workers pushing their own requests.
+static constexpr bool s_adaptiveInFlight = false;
 
 
 //struct SOnExit
@@ -64,21 +77,12 @@ struct SHandleCloser
 };
 
 
-struct AlignedArrDeleter
-{
-	void operator()(void* ptr)
-	{
-		_aligned_free(ptr);
-	}
-};
-using AlignedUniquePtr = std::unique_ptr<char[], AlignedArrDeleter>;
-
-
 struct SBuffer final : public OVERLAPPED
 {
-	SBuffer(AlignedUniquePtr p, size_t s)
+	SBuffer(AlignedUniquePtr p, size_t s, uint32 idx)
 		: pBuf(std::move(p))
 		, bufSize(s)
+		, bufIdx(idx)
 	{
 		memset(static_cast<OVERLAPPED*>(this), 0, sizeof(OVERLAPPED));
 	}
@@ -90,6 +94,11 @@ struct SBuffer final : public OVERLAPPED
 
 	AlignedUniquePtr pBuf;
 	size_t bufSize;
+	uint32 bufIdx;
+	uint32 blockIdx = 0;
+	uint32 fileIdx = 0;
+	// Bytes of the file in the buffer, the read itself is rounded up for unbuffered IO
+	size_t dataSize = 0;
 
 	STimestamp pushTime;
 };
@@ -100,12 +109,29 @@ struct SFileInfo
 	std::atomic<fpos_t> off = { 0 };
 	fpos_t fsizePos = 0;
 
-	HANDLE hFile;
+	// One per file of the set, the single file without a set
+	const HANDLE* pFiles = nullptr;
+	size_t readAlignment = 1;
 	HANDLE hComp;
 	HANDLE hCompFinished;
 	
 	HANDLE hBufDoneEvent;
 	std::atomic<int> activeBufCount = {};
+
+	// Set when reading compressed container, requests go block by block instead of bufSize steps.
+	const SCompressedToc* pToc = nullptr;
+	std::atomic<uint32> nextBlock = { 0 };
+
+	// Set for random access, requests are taken from the list instead of streaming.
+	const SWorkload* pWorkload = nullptr;
+	std::atomic<uint64> nextRequest = { 0 };
+
+	// Set for several files at once, requests go to them in turn, see fileset.h
+	CFileStreams* pStreams = nullptr;
+
+	// Set for adaptive depth, buffers over its target wait there.
+	CInFlightController* pInFlight = nullptr;
+	SBuffer* pBuffers = nullptr;
 };
 
 
@@ -119,13 +145,58 @@ static bool PushMoreRequests(SBuffer* pBuffers, size_t bufCount, SFileInfo& fi)
 		SBuffer& buf = *pBuffers;
 
 		fpos_t readSize = buf.bufSize;
-		const fpos_t off = fi.off.fetch_add(readSize, std::memory_order_acq_rel);
-
-		if (off >= fi.fsizePos)
+		fpos_t off;
+		fpos_t fileEnd = fi.fsizePos;
+		if (fi.pToc)
 		{
-			return false;
+			const uint32 blockIdx = fi.nextBlock.fetch_add(1, std::memory_order_relaxed);
+			if (blockIdx >= fi.pToc->header.blockCount)
+			{
+				return false;
+			}
+			const SCompressedBlock& block = fi.pToc->blocks[blockIdx];
+			buf.blockIdx = blockIdx;
+			off = fpos_t(block.offset);
+			// Blocks are padded in the file, so aligned size is fine for unbuffered IO.
+			readSize = fpos_t(block.compressedSize + s_compressedFileAlignment - 1) / s_compressedFileAlignment * s_compressedFileAlignment;
+		}
+		else if (fi.pWorkload)
+		{
+			const uint64 reqIdx = fi.nextRequest.fetch_add(1, std::memory_order_relaxed);
+			if (reqIdx >= fi.pWorkload->requests.size())
+			{
+				return false;
+			}
+			const SIoRequest& req = fi.pWorkload->requests[reqIdx];
+			off = fpos_t(req.offset);
+			readSize = fpos_t(req.size);
+		}
+		else if (fi.pStreams)
+		{
+			int64 streamOff = 0;
+			int64 streamSize = 0;
+			if (!fi.pStreams->Next(int64(readSize), buf.fileIdx, streamOff, streamSize))
+			{
+				return false;
+			}
+			off = fpos_t(streamOff);
+			readSize = fpos_t(streamSize);
+			// Size is cut to the end of that file already
+			fileEnd = off + readSize;
 		}
-		readSize = std::min(readSize, fi.fsizePos - off);
+		else
+		{
+			off = fi.off.fetch_add(readSize, std::memory_order_acq_rel);
+
+			if (off >= fi.fsizePos)
+			{
+				return false;
+			}
+		}
+		readSize = std::min(readSize, fileEnd - off);
+		buf.dataSize = size_t(readSize);
+		// NO_BUFFERING needs aligned size as well, read of the tail is short anyway.
+		readSize = (readSize + fpos_t(fi.readAlignment) - 1) / fpos_t(fi.readAlignment) * fpos_t(fi.readAlignment);
 
 		buf.Offset = static_cast<DWORD>(off);
 		buf.OffsetHigh = static_cast<DWORD>(off >> (sizeof(buf.Offset)*8));
@@ -133,7 +204,7 @@ static bool PushMoreRequests(SBuffer* pBuffers, size_t bufCount, SFileInfo& fi)
 		buf.pushTime = STimestamp::now();
 
 		const DWORD size = static_cast<DWORD>(readSize);
-		const BOOL res = ReadFile(fi.hFile, buf.pBuf.get(), size, nullptr, &buf);
+		const BOOL res = ReadFile(fi.pFiles[buf.fileIdx], buf.pBuf.get(), size, nullptr, &buf);
 		const DWORD err = GetLastError();
 		bool success = (res == TRUE || err == ERROR_IO_PENDING);
 		if (!success)
@@ -146,6 +217,61 @@ static bool PushMoreRequests(SBuffer* pBuffers, size_t bufCount, SFileInfo& fi)
 	return true;
 }
 
+static void RetireBuffer(SFileInfo& fi)
+{
+	int val = fi.activeBufCount.fetch_sub(1, std::memory_order_relaxed);
+	if (val == 1)
+	{
+		SetEvent(fi.hBufDoneEvent);
+	}
+}
+
+static void RetireParkedBuffers(SFileInfo& fi)
+{
+	uint32 idx;
+	while (fi.pInFlight->TakeParked(idx))
+		RetireBuffer(fi);
+}
+
+// Reads into the buffer again, or parks it when the adaptive depth is at its target.
+// False when there's nothing left to read, the buffer is retired then.
+static bool PushOrParkBuffer(SBuffer& buf, SFileInfo& fi)
+{
+	CInFlightController* pInFlight = fi.pInFlight;
+	if (!pInFlight)
+		return PushMoreRequests(&buf, 1, fi);
+
+	if (!pInFlight->TryAcquire())
+	{
+		pInFlight->Park(buf.bufIdx);
+		if (pInFlight->IsExhausted())
+			RetireParkedBuffers(fi);
+		return true;
+	}
+	if (PushMoreRequests(&buf, 1, fi))
+		return true;
+	pInFlight->Release();
+	pInFlight->SetExhausted();
+	RetireParkedBuffers(fi);
+	return false;
+}
+
+// Parked buffers go back while the adaptive depth is under its target.
+static void UnparkBuffers(SFileInfo& fi)
+{
+	uint32 idx;
+	while (!fi.pInFlight->IsExhausted() && fi.pInFlight->TryUnpark(idx))
+	{
+		if (!PushMoreRequests(&fi.pBuffers[idx], 1, fi))
+		{
+			fi.pInFlight->Release();
+			fi.pInFlight->SetExhausted();
+			RetireBuffer(fi);
+			RetireParkedBuffers(fi);
+		}
+	}
+}
+
 struct SWorkerState
 {
 	SFileInfo* pFi = nullptr;
@@ -154,6 +280,10 @@ struct SWorkerState
 	STimestamp sumTime{};
 	STimestamp pushTime{};
 	STimestamp readTime{};
+	CLatencyHistogram readLatency;
+	STimestamp decompTime{};
+	AlignedUniquePtr pDecompBuf;
+	SSpinWaitStats spin;
 	uint32 idx = 0;
 };
 
@@ -175,6 +305,7 @@ static_assert(sizeof(SState) % SState::alignment == 0, "Broken alignment");
 static void WorkerFunc(SWorkerState& state)
 {
 	SetThreadName(L"Worker_%u", state.idx);
+	PinWorkerThread(state.idx);
 
 	PROF_FUNC();
 
@@ -183,19 +314,29 @@ static void WorkerFunc(SWorkerState& state)
 	STimestamp sumTime{};
 	STimestamp pushTime{};
 	STimestamp readTime{};
+	STimestamp decompTime{};
 	bool keepPushing = true;
+	CSpinWait spin(GetRunConfig().waitMode, GetRunConfig().spinUs);
 
 	while (true)
 	{
 		DWORD transferred = 0;
 		ULONG_PTR key = 0;
 		OVERLAPPED* pOverlapped = nullptr;
-		BOOL res;
+		BOOL res = FALSE;
 		{
 			PROF_REGION("GetQueuedCompletionStatus");
 			STsRegion reg(popTime);
-			res = GetQueuedCompletionStatus(state.pFi->hComp, &transferred, &key, &pOverlapped, INFINITE);
+			// Zero timeout fails with WAIT_TIMEOUT and no OVERLAPPED, failed reads come with theirs.
+			const bool spun = spin.Spin([&]
+			{
+				res = GetQueuedCompletionStatus(state.pFi->hComp, &transferred, &key, &pOverlapped, 0);
+				return res != FALSE || pOverlapped != nullptr;
+			});
+			if (!spun)
+				res = GetQueuedCompletionStatus(state.pFi->hComp, &transferred, &key, &pOverlapped, INFINITE);
 		}
+		spin.OnCompletion();
 		if (res == FALSE)
 		{
 			if (pOverlapped == nullptr)
@@ -217,13 +358,46 @@ static void WorkerFunc(SWorkerState& state)
 		if (key == s_fileCompKey)
 		{
 			SBuffer& buf = *static_cast<SBuffer*>(pOverlapped);
-			readTime += (STimestamp::now() - buf.pushTime);
+			const STimestamp latency = STimestamp::now() - buf.pushTime;
+			readTime += latency;
+			state.readLatency.Record(latency);
+			if (state.pFi->pInFlight)
+				state.pFi->pInFlight->OnCompletion(transferred, latency);
+
+			const char* pData = buf.pBuf.get();
+			size_t dataSize = std::min<size_t>(transferred, buf.dataSize);
+			if (const SCompressedToc* pToc = state.pFi->pToc)
+			{
+				const SCompressedBlock& block = pToc->blocks[buf.blockIdx];
+				const uint32 uncompressedSize = pToc->GetUncompressedBlockSize(buf.blockIdx);
+				if (dataSize < block.compressedSize)
+				{
+					std::cerr << "Short read of block " << buf.blockIdx << std::endl;
+					exit(3);
+				}
+				dataSize = block.compressedSize;
+				if (!(block.flags & eCBF_Raw))
+				{
+					PROF_REGION("decompress");
+					STsRegion reg(decompTime);
+					const int64 res = LzDecompress(pData, dataSize, state.pDecompBuf.get(), pToc->header.blockSize);
+					if (res != uncompressedSize)
+					{
+						std::cerr << "Failed to decompress block " << buf.blockIdx << std::endl;
+						exit(3);
+					}
+					pData = state.pDecompBuf.get();
+					dataSize = uncompressedSize;
+				}
+			}
 
 			{
-				PROF_REGION("sum");
+				PROF_REGION("process");
 				STsRegion reg(sumTime);
-				s += sum(buf.pBuf.get(), transferred);
+				s += process(pData, dataSize);
 			}
+			if (state.pFi->pStreams)
+				state.pFi->pStreams->OnProcessed(buf.fileIdx, int64(dataSize));
 			if (keepPushing)
 			{
 				STsRegion reg(pushTime);
@@ -233,16 +407,17 @@ static void WorkerFunc(SWorkerState& state)
 				}
 				else
 				{
-					keepPushing = PushMoreRequests(&buf, 1, *state.pFi);
+					keepPushing = PushOrParkBuffer(buf, *state.pFi);
 				}
 			}
 			if (!keepPushing)
 			{
-				int val = state.pFi->activeBufCount.fetch_sub(1, std::memory_order_relaxed);
-				if (val == 1)
-				{
-					SetEvent(state.pFi->hBufDoneEvent);
-				}
+				RetireBuffer(*state.pFi);
+			}
+			if (state.pFi->pInFlight)
+			{
+				STsRegion reg(pushTime);
+				UnparkBuffers(*state.pFi);
 			}
 		}
 		else if (key == s_stopCompKey)
@@ -260,6 +435,8 @@ static void WorkerFunc(SWorkerState& state)
 	state.sumTime = sumTime;
 	state.pushTime = pushTime;
 	state.readTime = readTime;
+	state.decompTime = decompTime;
+	state.spin = spin.GetStats();
 }
 
 
@@ -273,28 +450,46 @@ void Test3_CompIOWorkers(const char* szFilename, const fpos_t fsizePos)
 
 	using namespace Test3;
 
+	const SRunConfig& cfg = GetRunConfig();
+	const bool unbufferedIo = cfg.GetUnbufferedIo(s_unbufferedIo);
+
+	// Compressed container is detected by its header, then blocks are decompressed on workers.
+	// Every file of the set is streamed at once when there is one, see fileset.h
+	const SFileSet* pFileSet = GetActiveFileSet();
+	SCompressedToc toc;
+	const bool compressed = !pFileSet && ReadCompressedToc(szFilename, toc);
+	const SWorkload* pWorkload = compressed || pFileSet ? nullptr : GetActiveWorkload();
 	
-	SHandleCloser hFile;
+	std::vector<SHandleCloser> files;
+	std::vector<HANDLE> handles;
 	{
 		DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED;
-		if (s_unbufferedIo)
+		if (unbufferedIo)
 		{
 			flags |= FILE_FLAG_NO_BUFFERING;
 		}
 
 		PROF_REGION("CreateFileA");
-		hFile = CreateFileA(szFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
-			flags, NULL);
-		if (hFile.h == INVALID_HANDLE_VALUE)
+		const size_t fileCount = pFileSet ? pFileSet->names.size() : 1;
+		for (size_t i = 0; i < fileCount; ++i)
 		{
-			const DWORD err = GetLastError();
-			std::cerr << "Failed to open file, err " << err << std::endl;
-			return;
+			files.emplace_back(CreateFileA(pFileSet ? pFileSet->names[i].c_str() : szFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+				flags, NULL));
+			if (files.back().h == INVALID_HANDLE_VALUE)
+			{
+				const DWORD err = GetLastError();
+				std::cerr << "Failed to open file, err " << err << std::endl;
+				return;
+			}
+			handles.push_back(files.back().h);
 		}
 	}
+	SHandleCloser& hFile = files[0];
+	std::unique_ptr<CFileStreams> pStreams(pFileSet ? new CFileStreams(*pFileSet) : nullptr);
 
 	const uint32 hw = std::min< uint32>(std::thread::hardware_concurrency(), 32);
-	const int maxBuffers = 32;
+	const bool adaptiveInFlight = !s_singleRequestThread && cfg.GetAdaptiveInFlight(s_adaptiveInFlight);
+	const int maxBuffers = int(cfg.GetMaxInFlight(adaptiveInFlight ? CInFlightController::s_defaultMaxDepth : 32));
 
 	//DWORD compHw = 1;
 	DWORD compHw = hw;
@@ -310,6 +505,17 @@ void Test3_CompIOWorkers(const char* szFilename, const fpos_t fsizePos)
 		return h;
 	}();
 
+	// Rest of the set completes to the same port
+	for (size_t i = 1; i < handles.size(); ++i)
+	{
+		if (CreateIoCompletionPort(handles[i], comp.h, s_fileCompKey, 0) == NULL)
+		{
+			const DWORD err = GetLastError();
+			std::cerr << "Failed to associate file with completion port, err " << err << std::endl;
+			return;
+		}
+	}
+
 	SHandleCloser compFinished = [&]()
 	{
 		PROF_REGION("CreateIoCompletionPort 2");
@@ -322,28 +528,42 @@ void Test3_CompIOWorkers(const char* szFilename, const fpos_t fsizePos)
 		return h;
 	}();
 
-	const size_t bufSize = 512 * 1024;
-	//const size_t bufSize = 4 * 1024 * 1024;
 	const size_t bufAlignment = 4096;
+	const size_t bufSize = compressed
+		? (toc.header.blockSize + bufAlignment - 1) / bufAlignment * bufAlignment
+		: std::max<size_t>(cfg.GetBufSize(512 * 1024), pWorkload ? pWorkload->maxRequestSize : 0);
+	//const size_t bufSize = 4 * 1024 * 1024;
 
 
+	ReserveIoBuffers(bufSize, uint32(maxBuffers));
 	std::vector<SBuffer> buffers;
 	for (int i = 0; i < maxBuffers; ++i)
 	{
-		buffers.emplace_back(AlignedUniquePtr((char*)_aligned_malloc(bufSize, bufAlignment)), bufSize);
+		buffers.emplace_back(AllocIoBuffer(bufSize, bufAlignment), bufSize, uint32(i));
 	}
 
-	const uint32 workerCount = std::max(hw, 2u) - 1;
+	const uint32 workerCount = cfg.GetWorkerCount(std::max(hw, 2u) - 1);
 	//const uint32 workerCount = 1;
 	//const uint32 workerCount = hw;
 
 	SFileInfo fi;
 	fi.fsizePos = fsizePos;
-	fi.hFile = hFile.h;
+	fi.pFiles = handles.data();
+	fi.readAlignment = unbufferedIo ? bufAlignment : 1;
+	fi.pStreams = pStreams.get();
 	fi.hComp = comp.h;
 	fi.hCompFinished = compFinished.h;
 	fi.hBufDoneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 	SHandleCloser bufDoneEventCloser(fi.hBufDoneEvent);
+	fi.pToc = compressed ? &toc : nullptr;
+	fi.pWorkload = pWorkload;
+	CInFlightController inFlight;
+	if (adaptiveInFlight)
+	{
+		inFlight.Init(uint32(maxBuffers));
+		fi.pInFlight = &inFlight;
+		fi.pBuffers = buffers.data();
+	}
 
 	std::vector<std::thread> workers;
 	std::unique_ptr<SState[]> states(new SState[workerCount]);
@@ -351,6 +571,8 @@ void Test3_CompIOWorkers(const char* szFilename, const fpos_t fsizePos)
 	{
 		states[i].s.idx = i;
 		states[i].s.pFi = &fi;
+		if (compressed)
+			states[i].s.pDecompBuf = AlignedAlloc(toc.header.blockSize, bufAlignment);
 		workers.emplace_back(std::thread(&WorkerFunc, std::ref(states[i].s)));
 	}
 	
@@ -361,13 +583,55 @@ void Test3_CompIOWorkers(const char* szFilename, const fpos_t fsizePos)
 	STimestamp waitingForResultTime{};
 	STimestamp stoppingTime{};
 
+	const SPageFaults faultsStart = SPageFaults::Now();
+	const SCpuTime cpuStart = SCpuTime::Now();
 	auto startTime = ts::now();
+	if (pStreams)
+		pStreams->Start(startTime);
 
 	bool keepPushing = false;
 	{
 		STsRegion tsreg(workPushTime);
 		fi.activeBufCount += (int)buffers.size();
-		keepPushing = PushMoreRequests(buffers.data(), buffers.size(), fi);
+		size_t pushed = 0;
+		bool exhausted = false;
+		for (; pushed < buffers.size(); ++pushed)
+		{
+			if (fi.pInFlight && !fi.pInFlight->TryAcquire())
+				break;
+			if (!PushMoreRequests(&buffers[pushed], 1, fi))
+			{
+				if (fi.pInFlight)
+				{
+					fi.pInFlight->Release();
+					fi.pInFlight->SetExhausted();
+				}
+				exhausted = true;
+				break;
+			}
+		}
+		keepPushing = pushed == buffers.size();
+
+		// Rest of the buffers waits until the controller wants more in flight.
+		size_t parked = 0;
+		if (fi.pInFlight && !exhausted)
+		{
+			for (; pushed + parked < buffers.size(); ++parked)
+				fi.pInFlight->Park(buffers[pushed + parked].bufIdx);
+		}
+
+		// File is smaller than all buffers together (e.g. few compressed blocks), nobody will complete the rest.
+		const int unused = int(buffers.size() - pushed - parked);
+		if (!s_singleRequestThread && unused > 0 && fi.activeBufCount.fetch_sub(unused) == unused)
+		{
+			SetEvent(fi.hBufDoneEvent);
+		}
+		if (parked)
+		{
+			if (fi.pInFlight->IsExhausted())
+				RetireParkedBuffers(fi);
+			UnparkBuffers(fi);
+		}
 	}
 
 	if constexpr (s_singleRequestThread)
@@ -423,36 +687,95 @@ void Test3_CompIOWorkers(const char* szFilename, const fpos_t fsizePos)
 			t.join();
 	}
 	auto endTime = ts::now();
+	const SPageFaults pageFaults = SPageFaults::Now() - faultsStart;
+	const SCpuTime cpuTime = SCpuTime::Now() - cpuStart;
 
 	uint64 sum = 0;
 	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
 		sum += s->s.sum;
 
-	const int64 expectedSum = 1226802104644;
-	if (sum != expectedSum)
+	if (cfg.checkExpectedSum && !pWorkload && !pFileSet && !CheckExpectedSum(sum))
 		__debugbreak();
 
+	CLatencyHistogram readLatency;
 	STimestamp workersPopTime{};
 	STimestamp workersPushTime{};
+	STimestamp decompTime{};
+	SSpinWaitStats spin;
 	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
 	{
+		spin.Merge(s->s.spin);
 		workersPopTime += s->s.popTime;
 		workersPushTime += s->s.pushTime;
 		readTime += s->s.readTime;
+		readLatency.Merge(s->s.readLatency);
 		sumTime += s->s.sumTime;
+		decompTime += s->s.decompTime;
 	}
 
+	// Random access reads only requested bytes, processing works on decompressed data
+	const uint64 ioSize = pWorkload ? pWorkload->totalBytes : pFileSet ? pFileSet->totalSize : uint64(fsizePos);
+	const uint64 dataSize = compressed ? toc.header.uncompressedSize : ioSize;
+	const uint64 requestCount = compressed ? toc.header.blockCount
+		: pWorkload ? pWorkload->requests.size()
+		: pStreams ? pStreams->GetRequestCount()
+		: (uint64(fsizePos) + bufSize - 1) / bufSize;
+
+	SRunResult result;
+	result.engine = __FUNCTION__;
+	result.bufSize = uint32(bufSize);
+	result.maxInFlight = uint32(maxBuffers);
+	result.settledInFlight = adaptiveInFlight ? inFlight.GetTarget() : 0;
+	result.workerCount = workerCount;
+	result.unbuffered = unbufferedIo;
+	result.bytes = ioSize;
+	result.requests = requestCount;
+	result.sum = sum;
+	result.totalTime = endTime - startTime;
+	result.latency = readLatency;
+	result.pageFaults = pageFaults;
+	result.cpuTime = cpuTime;
+	result.spin = spin;
+	result.wakeups = int64(spin.blocks);
+	result.fileCount = uint32(handles.size());
+	result.fairness = pStreams ? pStreams->GetFairness() : -1;
+	ReportRunResult(result);
+
 	std::cout << __FUNCTION__ << std::endl;
-	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(fsizePos, (endTime - startTime)) << std::endl;
-	std::cout << "Read took   " << ms(readTime.dur()) << " - MB/s " << MBsec(fsizePos, readTime) << std::endl;
-	std::cout << "Sum took    " << ms(sumTime.dur()) << " - MB/s " << MBsec(fsizePos, sumTime) << std::endl;
-	std::cout << "Sum/wr took " << ms(sumTime.dur() / workerCount) << " - MB/s " << MBsec(fsizePos, sumTime.dur() / workerCount) << std::endl;
+	std::cout << "Stage " << GetActiveProcessingStage().name << std::endl;
+	if (pWorkload)
+		PrintWorkload(*pWorkload);
+	if (pStreams)
+		pStreams->Print();
+	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(ioSize, (endTime - startTime)) << std::endl;
+	std::cout << "IOPS " << requestCount / sec((endTime - startTime).dur()) << " (" << requestCount << " requests)" << std::endl;
+	std::cout << "Read took   " << ms(readTime.dur()) << " - MB/s " << MBsec(ioSize, readTime) << std::endl;
+	readLatency.Print("Read");
+	std::cout << "Sum took    " << ms(sumTime.dur()) << " - MB/s " << MBsec(dataSize, sumTime) << std::endl;
+	std::cout << "Sum/wr took " << ms(sumTime.dur() / workerCount) << " - MB/s " << MBsec(dataSize, sumTime.dur() / workerCount) << std::endl;
+	if (compressed)
+	{
+		const uint64 compressedSize = toc.GetCompressedSize();
+		std::cout << "Input  MB/s " << MBsec(compressedSize, (endTime - startTime)) << " (" << compressedSize << " bytes)" << std::endl;
+		std::cout << "Output MB/s " << MBsec(dataSize, (endTime - startTime)) << " (" << dataSize << " bytes)" << std::endl;
+		std::cout << "Decomp took    " << ms(decompTime.dur()) << " - MB/s " << MBsec(dataSize, decompTime) << std::endl;
+		std::cout << "Decomp/wr took " << ms(decompTime.dur() / workerCount) << " - MB/s " << MBsec(dataSize, decompTime.dur() / workerCount) << std::endl;
+		for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+			std::cout << "  decompTime worker " << s->s.idx << " " << ms(s->s.decompTime.dur()) << std::endl;
+	}
 	//std::cout << "freeBufferFetchTime   " << ms(freeBufferFetchTime.dur()) << std::endl;
 	std::cout << "workPushTime          " << ms(workPushTime.dur()) << std::endl;
 	std::cout << "waitingForResultTime  " << ms(waitingForResultTime.dur()) << std::endl;
 	std::cout << "stoppingTime          " << ms(stoppingTime.dur()) << std::endl;
 	std::cout << "workersPopTime        " << ms(workersPopTime.dur()) << std::endl;
 	std::cout << "workersPushTime       " << ms(workersPushTime.dur()) << std::endl;
+	if (adaptiveInFlight)
+		inFlight.Print();
+	std::cout << "Wait " << GetWaitModeName(cfg.waitMode) << std::endl;
+	spin.Print();
+	std::cout << "pageFaults  minor " << pageFaults.minor << " major " << pageFaults.major << std::endl;
+	std::cout << "cpuTime     user " << ms(cpuTime.user.dur()) << " system " << ms(cpuTime.system.dur()) << std::endl;
+	PrintIoBuffers();
 	std::cout << "Sum is " << sum << std::endl;
 	std::cout << "workerCount " << workerCount << std::endl;
 	std::cout << std::endl;
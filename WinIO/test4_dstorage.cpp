@@ -1,4 +1,11 @@
 #include "tests.h"
+#include "bench.h"
+#include "bufferpool.h"
+#include "histogram.h"
+#include "prioqueue.h"
+#include "spinwait.h"
+#include "testdata.h"
+#include "workload.h"
 
 #include <array>
 #include <algorithm>
@@ -22,6 +29,19 @@ using winrt::check_hresult;
 
 static constexpr bool s_singleRequestThread = false;
 static constexpr bool s_unbufferedIo = true;
+// Class of the queue, Background runs as DSTORAGE_PRIORITY_LOW. See Test13 for classes sharing one device.
+static constexpr EIoPriority s_queuePriority = EIoPriority::Normal;
+
+
+static DSTORAGE_PRIORITY GetDStoragePriority(EIoPriority priority)
+{
+	switch (priority)
+	{
+	case EIoPriority::Realtime: return DSTORAGE_PRIORITY_REALTIME;
+	case EIoPriority::Background: return DSTORAGE_PRIORITY_LOW;
+	default: return DSTORAGE_PRIORITY_NORMAL;
+	}
+}
 
 
 struct SHandleCloser
@@ -61,16 +81,6 @@ struct SHandleCloser
 };
 
 
-struct AlignedArrDeleter
-{
-	void operator()(void* ptr)
-	{
-		_aligned_free(ptr);
-	}
-};
-using AlignedUniquePtr = std::unique_ptr<char[], AlignedArrDeleter>;
-
-
 struct SBuffer final 
 {
 	SBuffer(AlignedUniquePtr p, size_t s)
@@ -104,6 +114,10 @@ struct SFileInfo
 
 	Microsoft::WRL::Wrappers::Event bufDoneEvent;
 	std::atomic<int> activeBufCount = {};
+
+	// Set for random access, requests are taken from the list instead of streaming.
+	const SWorkload* pWorkload = nullptr;
+	std::atomic<uint64> nextRequest = { 0 };
 };
 
 
@@ -117,11 +131,26 @@ static bool PushMoreRequests(SBuffer* pBuffers, size_t bufCount, SFileInfo& fi)
 		SBuffer& buf = *pBuffers;
 
 		fpos_t readSize = buf.bufSize;
-		const fpos_t off = fi.off.fetch_add(readSize, std::memory_order_acq_rel);
-
-		if (off >= fi.fsizePos)
+		fpos_t off;
+		if (fi.pWorkload)
 		{
-			return false;
+			const uint64 reqIdx = fi.nextRequest.fetch_add(1, std::memory_order_relaxed);
+			if (reqIdx >= fi.pWorkload->requests.size())
+			{
+				return false;
+			}
+			const SIoRequest& req = fi.pWorkload->requests[reqIdx];
+			off = fpos_t(req.offset);
+			readSize = fpos_t(req.size);
+		}
+		else
+		{
+			off = fi.off.fetch_add(readSize, std::memory_order_acq_rel);
+
+			if (off >= fi.fsizePos)
+			{
+				return false;
+			}
 		}
 		readSize = std::min(readSize, fi.fsizePos - off);
 		buf.readSize = readSize;
@@ -161,6 +190,8 @@ struct SWorkerState
 	STimestamp sumTime{};
 	STimestamp pushTime{};
 	STimestamp readTime{};
+	CLatencyHistogram readLatency;
+	SSpinWaitStats spin;
 	uint32 idx = 0;
 };
 
@@ -182,6 +213,7 @@ static_assert(sizeof(SState) % SState::alignment == 0, "Broken alignment");
 static void WorkerFunc(SWorkerState& state)
 {
 	SetThreadName(L"Worker_%u", state.idx);
+	PinWorkerThread(state.idx);
 
 	PROF_FUNC();
 
@@ -202,10 +234,24 @@ static void WorkerFunc(SWorkerState& state)
 	assert(eventsCount < MAXIMUM_WAIT_OBJECTS);
 	events[buffersCount] = state.stopEvent;
 
+	CSpinWait spin(GetRunConfig().waitMode, GetRunConfig().spinUs);
+
 	while (true)
 	{
 		constexpr BOOL waitAll = FALSE;
-		DWORD res = WaitForMultipleObjects(eventsCount, events.data(), waitAll, INFINITE);
+		DWORD res = WAIT_TIMEOUT;
+		{
+			PROF_REGION("WaitForMultipleObjects");
+			STsRegion reg(popTime);
+			const bool spun = spin.Spin([&]
+			{
+				res = WaitForMultipleObjects(eventsCount, events.data(), waitAll, 0);
+				return res != WAIT_TIMEOUT;
+			});
+			if (!spun)
+				res = WaitForMultipleObjects(eventsCount, events.data(), waitAll, INFINITE);
+		}
+		spin.OnCompletion();
 		if (res == WAIT_FAILED)
 		{
 			const DWORD err = GetLastError();
@@ -218,12 +264,14 @@ static void WorkerFunc(SWorkerState& state)
 		if (idx < buffersCount)
 		{
 			SBuffer& buf = state.pBuffers[idx];
-			readTime += (STimestamp::now() - buf.pushTime);
+			const STimestamp latency = STimestamp::now() - buf.pushTime;
+			readTime += latency;
+			state.readLatency.Record(latency);
 
 			{
-				PROF_REGION("sum");
+				PROF_REGION("process");
 				STsRegion reg(sumTime);
-				s += sum(buf.pBuf.get(), buf.readSize);
+				s += process(buf.pBuf.get(), buf.readSize);
 			}
 			if (keepPushing)
 			{
@@ -254,6 +302,7 @@ static void WorkerFunc(SWorkerState& state)
 	state.sumTime = sumTime;
 	state.pushTime = pushTime;
 	state.readTime = readTime;
+	state.spin = spin.GetStats();
 }
 
 
@@ -267,6 +316,8 @@ void Test4_DStorage(const char* szFilename, const fpos_t fsizePos)
 
 	using namespace Test4;
 
+	const SRunConfig& cfg = GetRunConfig();
+
 	std::wstring path = std::filesystem::path(szFilename).native();
 
 	com_ptr<IDStorageFactory> factory;
@@ -284,7 +335,7 @@ void Test4_DStorage(const char* szFilename, const fpos_t fsizePos)
 
 	DSTORAGE_QUEUE_DESC queueDesc{};
 	queueDesc.Capacity = DSTORAGE_MAX_QUEUE_CAPACITY;
-	queueDesc.Priority = DSTORAGE_PRIORITY_NORMAL;
+	queueDesc.Priority = GetDStoragePriority(s_queuePriority);
 	queueDesc.SourceType = DSTORAGE_REQUEST_SOURCE_FILE;
 	queueDesc.Device = nullptr;
 
@@ -294,19 +345,22 @@ void Test4_DStorage(const char* szFilename, const fpos_t fsizePos)
 
 
 	const uint32 hw = std::min< uint32>(std::thread::hardware_concurrency(), 32);
-	const int maxBuffers = 32;
+	// Every buffer has its event, workers wait on all of them and the stop event.
+	const int maxBuffers = int(std::min<uint32>(cfg.GetMaxInFlight(32), MAXIMUM_WAIT_OBJECTS - 2));
 
-	const size_t bufSize = 512 * 1024;
+	const SWorkload* pWorkload = GetActiveWorkload();
+	const size_t bufSize = std::max<size_t>(cfg.GetBufSize(512 * 1024), pWorkload ? pWorkload->maxRequestSize : 0);
 	//const size_t bufSize = 4 * 1024 * 1024;
 	const size_t bufAlignment = 4096;
 
+	ReserveIoBuffers(bufSize, uint32(maxBuffers));
 	std::vector<SBuffer> buffers;
 	for (int i = 0; i < maxBuffers; ++i)
 	{
-		buffers.emplace_back(AlignedUniquePtr((char*)_aligned_malloc(bufSize, bufAlignment)), bufSize);
+		buffers.emplace_back(AllocIoBuffer(bufSize, bufAlignment), bufSize);
 	}
 
-	const uint32 workerCount = std::max(hw, 2u) - 1;
+	const uint32 workerCount = cfg.GetWorkerCount(std::max(hw, 2u) - 1);
 	//const uint32 workerCount = 1;
 	//const uint32 workerCount = hw;
 
@@ -315,6 +369,7 @@ void Test4_DStorage(const char* szFilename, const fpos_t fsizePos)
 	fi.pFile = file.get();
 	fi.pQueue = queue.get();
 	fi.bufDoneEvent.Attach(CreateEvent(NULL, FALSE, FALSE, NULL));
+	fi.pWorkload = pWorkload;
 		
 	Microsoft::WRL::Wrappers::Event stopEvent(CreateEvent(nullptr, TRUE, FALSE, nullptr));
 	std::vector<std::thread> workers;
@@ -336,6 +391,8 @@ void Test4_DStorage(const char* szFilename, const fpos_t fsizePos)
 	STimestamp waitingForResultTime{};
 	STimestamp stoppingTime{};
 
+	const SPageFaults faultsStart = SPageFaults::Now();
+	const SCpuTime cpuStart = SCpuTime::Now();
 	auto startTime = ts::now();
 
 	bool keepPushing = false;
@@ -361,36 +418,73 @@ void Test4_DStorage(const char* szFilename, const fpos_t fsizePos)
 			t.join();
 	}
 	auto endTime = ts::now();
+	const SPageFaults pageFaults = SPageFaults::Now() - faultsStart;
+	const SCpuTime cpuTime = SCpuTime::Now() - cpuStart;
 
 	uint64 sum = 0;
 	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
 		sum += s->s.sum;
 
-	const int64 expectedSum = 1226802104644;
-	if (sum != expectedSum)
+	if (cfg.checkExpectedSum && !pWorkload && !CheckExpectedSum(sum))
 		__debugbreak();
 
+	CLatencyHistogram readLatency;
 	STimestamp workersPopTime{};
 	STimestamp workersPushTime{};
+	SSpinWaitStats spin;
 	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
 	{
+		spin.Merge(s->s.spin);
 		workersPopTime += s->s.popTime;
 		workersPushTime += s->s.pushTime;
 		readTime += s->s.readTime;
+		readLatency.Merge(s->s.readLatency);
 		sumTime += s->s.sumTime;
 	}
 
+	// Random access reads only requested bytes
+	const uint64 ioSize = pWorkload ? pWorkload->totalBytes : uint64(fsizePos);
+	const uint64 requestCount = pWorkload ? pWorkload->requests.size() : (uint64(fsizePos) + bufSize - 1) / bufSize;
+
+	SRunResult result;
+	result.engine = __FUNCTION__;
+	result.bufSize = uint32(bufSize);
+	result.maxInFlight = uint32(maxBuffers);
+	result.workerCount = workerCount;
+	result.unbuffered = s_unbufferedIo;
+	result.bytes = ioSize;
+	result.requests = requestCount;
+	result.sum = sum;
+	result.totalTime = endTime - startTime;
+	result.latency = readLatency;
+	result.pageFaults = pageFaults;
+	result.cpuTime = cpuTime;
+	result.spin = spin;
+	result.wakeups = int64(spin.blocks);
+	ReportRunResult(result);
+
 	std::cout << __FUNCTION__ << std::endl;
-	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(fsizePos, (endTime - startTime)) << std::endl;
-	std::cout << "Read took   " << ms(readTime.dur()) << " - MB/s " << MBsec(fsizePos, readTime) << std::endl;
-	std::cout << "Sum took    " << ms(sumTime.dur()) << " - MB/s " << MBsec(fsizePos, sumTime) << std::endl;
-	std::cout << "Sum/wr took " << ms(sumTime.dur() / workerCount) << " - MB/s " << MBsec(fsizePos, sumTime.dur() / workerCount) << std::endl;
+	std::cout << "Stage " << GetActiveProcessingStage().name << std::endl;
+	std::cout << "Queue priority " << GetIoPriorityName(s_queuePriority) << std::endl;
+	if (pWorkload)
+		PrintWorkload(*pWorkload);
+	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(ioSize, (endTime - startTime)) << std::endl;
+	std::cout << "IOPS " << requestCount / sec((endTime - startTime).dur()) << " (" << requestCount << " requests)" << std::endl;
+	std::cout << "Read took   " << ms(readTime.dur()) << " - MB/s " << MBsec(ioSize, readTime) << std::endl;
+	readLatency.Print("Read");
+	std::cout << "Sum took    " << ms(sumTime.dur()) << " - MB/s " << MBsec(ioSize, sumTime) << std::endl;
+	std::cout << "Sum/wr took " << ms(sumTime.dur() / workerCount) << " - MB/s " << MBsec(ioSize, sumTime.dur() / workerCount) << std::endl;
 	//std::cout << "freeBufferFetchTime   " << ms(freeBufferFetchTime.dur()) << std::endl;
 	std::cout << "workPushTime          " << ms(workPushTime.dur()) << std::endl;
 	std::cout << "waitingForResultTime  " << ms(waitingForResultTime.dur()) << std::endl;
 	std::cout << "stoppingTime          " << ms(stoppingTime.dur()) << std::endl;
 	std::cout << "workersPopTime        " << ms(workersPopTime.dur()) << std::endl;
 	std::cout << "workersPushTime       " << ms(workersPushTime.dur()) << std::endl;
+	std::cout << "Wait " << GetWaitModeName(cfg.waitMode) << std::endl;
+	spin.Print();
+	std::cout << "pageFaults  minor " << pageFaults.minor << " major " << pageFaults.major << std::endl;
+	std::cout << "cpuTime     user " << ms(cpuTime.user.dur()) << " system " << ms(cpuTime.system.dur()) << std::endl;
+	PrintIoBuffers();
 	std::cout << "Sum is " << sum << std::endl;
 	std::cout << "workerCount " << workerCount << std::endl;
 	std::cout << std::endl;
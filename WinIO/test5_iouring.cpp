@@ -0,0 +1,747 @@
+#ifdef __linux__
+
+#include "tests.h"
+#include "bench.h"
+#include "bufferpool.h"
+#include "histogram.h"
+#include "compressedfile.h"
+#include "fileset.h"
+#include "inflight.h"
+#include "linuxio.h"
+#include "lz.h"
+#include "spinwait.h"
+#include "submitplan.h"
+#include "testdata.h"
+#include "workload.h"
+
+#include <array>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <atomic>
+#include <thread>
+
+#include <sys/eventfd.h>
+
+namespace Test5
+{
+
+static const uint64 s_stopCompKey = 28;
+
+static constexpr bool s_unbufferedIo = true;
+static constexpr bool s_registeredBuffers = true;
+static constexpr bool s_fixedFiles = true;
+// Outstanding reads picked at runtime instead of keeping all buffers in flight, see inflight.h
+static constexpr bool s_adaptiveInFlight = false;
+
+
+struct SBuffer final
+{
+	SBuffer(AlignedUniquePtr p, size_t s, uint16_t idx)
+		: pBuf(std::move(p))
+		, bufSize(s)
+		, bufIdx(idx)
+	{}
+
+	AlignedUniquePtr pBuf;
+	size_t bufSize;
+	uint16_t bufIdx;
+	uint32 blockIdx = 0;
+	uint32 unitIdx = 0;
+	uint32 fileIdx = 0;
+	// Parallel reads the buffer was filled by and bytes they bring together
+	uint32 readCount = 1;
+	size_t dataSize = 0;
+
+	STimestamp pushTime;
+};
+
+
+struct SFileInfo
+{
+	std::atomic<int64> off = { 0 };
+	int64 fsizePos = 0;
+
+	// One per file of the set, registered in the same order with fixed files
+	const int* pFds = nullptr;
+	CUring* pRing = nullptr;
+	size_t readAlignment = 1;
+
+	int bufDoneEvent = -1;
+	std::atomic<int> activeBufCount = {};
+
+	// Set when reading compressed container, requests go block by block instead of bufSize steps.
+	const SCompressedToc* pToc = nullptr;
+	std::atomic<uint32> nextBlock = { 0 };
+
+	// Set for random access, requests are taken from the list instead of streaming.
+	const SWorkload* pWorkload = nullptr;
+	std::atomic<uint64> nextRequest = { 0 };
+
+	// Set for several files at once, requests go to them in turn, see fileset.h
+	CFileStreams* pStreams = nullptr;
+
+	// Set when the submission stage merges or splits requests, see submitplan.h. Units replace the workload requests.
+	const SSubmitParams* pSubmit = nullptr;
+	const SSubmitPlan* pPlan = nullptr;
+	// Per buffer, parts of a split read still in flight
+	std::unique_ptr<std::atomic<uint32>[]> pPendingReads;
+	std::atomic<uint64> readCount = { 0 };
+
+	// Set for adaptive depth, buffers over its target wait there.
+	CInFlightController* pInFlight = nullptr;
+	SBuffer* pBuffers = nullptr;
+};
+
+
+static bool PushMoreRequests(SBuffer* pBuffers, size_t bufCount, SFileInfo& fi)
+{
+	PROF_FUNC();
+
+	SBuffer* pBufEnd = pBuffers + bufCount;
+	for (; pBuffers < pBufEnd; ++pBuffers)
+	{
+		SBuffer& buf = *pBuffers;
+
+		int64 readSize = buf.bufSize;
+		int64 off;
+		int64 fileEnd = fi.fsizePos;
+		if (fi.pToc)
+		{
+			const uint32 blockIdx = fi.nextBlock.fetch_add(1, std::memory_order_relaxed);
+			if (blockIdx >= fi.pToc->header.blockCount)
+			{
+				return false;
+			}
+			const SCompressedBlock& block = fi.pToc->blocks[blockIdx];
+			buf.blockIdx = blockIdx;
+			off = int64(block.offset);
+			readSize = block.compressedSize;
+		}
+		else if (fi.pPlan)
+		{
+			const uint64 unitIdx = fi.nextRequest.fetch_add(1, std::memory_order_relaxed);
+			if (unitIdx >= fi.pPlan->units.size())
+			{
+				return false;
+			}
+			const SSubmitUnit& unit = fi.pPlan->units[unitIdx];
+			buf.unitIdx = uint32(unitIdx);
+			off = int64(unit.offset);
+			readSize = unit.size;
+		}
+		else if (fi.pWorkload)
+		{
+			const uint64 reqIdx = fi.nextRequest.fetch_add(1, std::memory_order_relaxed);
+			if (reqIdx >= fi.pWorkload->requests.size())
+			{
+				return false;
+			}
+			const SIoRequest& req = fi.pWorkload->requests[reqIdx];
+			off = int64(req.offset);
+			readSize = req.size;
+		}
+		else if (fi.pStreams)
+		{
+			if (!fi.pStreams->Next(readSize, buf.fileIdx, off, readSize))
+			{
+				return false;
+			}
+			fileEnd = off + readSize;
+		}
+		else
+		{
+			off = fi.off.fetch_add(readSize, std::memory_order_acq_rel);
+
+			if (off >= fi.fsizePos)
+			{
+				return false;
+			}
+		}
+		// O_DIRECT needs aligned size as well, read of the tail is short anyway.
+		readSize = std::min<int64>(readSize, fileEnd - off);
+		buf.dataSize = size_t(readSize);
+		readSize = (readSize + fi.readAlignment - 1) / fi.readAlignment * fi.readAlignment;
+
+		// Split parts go to consecutive places of the buffer, splitSize keeps them aligned.
+		const uint32 readCount = fi.pSubmit && !fi.pToc ? fi.pSubmit->GetSplitCount(uint64(readSize)) : 1;
+		const int64 partSize = readCount > 1 ? int64(fi.pSubmit->splitSize) : readSize;
+		buf.readCount = readCount;
+		if (fi.pPendingReads)
+			fi.pPendingReads[buf.bufIdx].store(readCount, std::memory_order_relaxed);
+		fi.readCount.fetch_add(readCount, std::memory_order_relaxed);
+
+		buf.pushTime = STimestamp::now();
+
+		int res = 0;
+		for (uint32 i = 0; i < readCount && res >= 0; ++i)
+		{
+			const int64 partOff = int64(i) * partSize;
+			res = fi.pRing->Prepare([&](io_uring_sqe& sqe)
+			{
+				sqe.opcode = s_registeredBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+				sqe.fd = s_fixedFiles ? int(buf.fileIdx) : fi.pFds[buf.fileIdx];
+				sqe.flags = s_fixedFiles ? IOSQE_FIXED_FILE : 0;
+				sqe.off = off + partOff;
+				sqe.addr = reinterpret_cast<uint64>(buf.pBuf.get() + partOff);
+				sqe.len = static_cast<uint32>(std::min(partSize, readSize - partOff));
+				sqe.buf_index = buf.bufIdx;
+				sqe.user_data = reinterpret_cast<uint64>(&buf);
+			});
+		}
+		if (res >= 0)
+			res = fi.pRing->SubmitPrepared(readCount);
+		if (res < 0)
+		{
+			std::cerr << "Failed to read file, err " << -res << std::endl;
+			exit(1);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void RetireBuffer(SFileInfo& fi)
+{
+	int val = fi.activeBufCount.fetch_sub(1, std::memory_order_relaxed);
+	if (val == 1)
+	{
+		const uint64 one = 1;
+		write(fi.bufDoneEvent, &one, sizeof(one));
+	}
+}
+
+static void RetireParkedBuffers(SFileInfo& fi)
+{
+	uint32 idx;
+	while (fi.pInFlight->TakeParked(idx))
+		RetireBuffer(fi);
+}
+
+// Reads into the buffer again, or parks it when the adaptive depth is at its target.
+// False when there's nothing left to read, the buffer is retired then.
+static bool PushOrParkBuffer(SBuffer& buf, SFileInfo& fi)
+{
+	CInFlightController* pInFlight = fi.pInFlight;
+	if (!pInFlight)
+		return PushMoreRequests(&buf, 1, fi);
+
+	if (!pInFlight->TryAcquire())
+	{
+		pInFlight->Park(buf.bufIdx);
+		if (pInFlight->IsExhausted())
+			RetireParkedBuffers(fi);
+		return true;
+	}
+	if (PushMoreRequests(&buf, 1, fi))
+		return true;
+	pInFlight->Release();
+	pInFlight->SetExhausted();
+	RetireParkedBuffers(fi);
+	return false;
+}
+
+// Parked buffers go back while the adaptive depth is under its target.
+static void UnparkBuffers(SFileInfo& fi)
+{
+	uint32 idx;
+	while (!fi.pInFlight->IsExhausted() && fi.pInFlight->TryUnpark(idx))
+	{
+		if (!PushMoreRequests(&fi.pBuffers[idx], 1, fi))
+		{
+			fi.pInFlight->Release();
+			fi.pInFlight->SetExhausted();
+			RetireBuffer(fi);
+			RetireParkedBuffers(fi);
+		}
+	}
+}
+
+struct SWorkerState
+{
+	SFileInfo* pFi = nullptr;
+	int64 sum = 0;
+	STimestamp popTime{};
+	STimestamp sumTime{};
+	STimestamp pushTime{};
+	STimestamp readTime{};
+	CLatencyHistogram readLatency;
+	STimestamp decompTime{};
+	AlignedUniquePtr pDecompBuf;
+	SSpinWaitStats spin;
+	uint32 idx = 0;
+};
+
+struct alignas(128) SState
+{
+	static constexpr size_t alignment = 128;
+
+	SState() = default;
+	SState(SState&&) = default;
+	SState& operator=(SState&&) = default;
+	SState(const SState&) = delete;
+	SState& operator=(const SState&) = delete;
+
+	SWorkerState s;
+	char padding[alignment - sizeof(s) % alignment];
+};
+static_assert(sizeof(SState) % SState::alignment == 0, "Broken alignment");
+
+static void WorkerFunc(SWorkerState& state)
+{
+	SetThreadName(L"Worker_%u", state.idx);
+	PinWorkerThread(state.idx);
+
+	PROF_FUNC();
+
+	uint64 s = 0;
+	STimestamp popTime{};
+	STimestamp sumTime{};
+	STimestamp pushTime{};
+	STimestamp readTime{};
+	STimestamp decompTime{};
+	bool keepPushing = true;
+	CSpinWait spin(GetRunConfig().waitMode, GetRunConfig().spinUs);
+
+	while (true)
+	{
+		io_uring_cqe cqe{};
+		int res = 0;
+		{
+			PROF_REGION("WaitCompletion");
+			STsRegion reg(popTime);
+			if (!spin.Spin([&] { return state.pFi->pRing->TryPopCompletion(cqe); }))
+				res = state.pFi->pRing->WaitCompletion(cqe);
+		}
+		if (res < 0)
+		{
+			std::cerr << "Failed to get completion status, err " << -res << std::endl;
+			exit(3);
+			return;
+		}
+		spin.OnCompletion();
+
+		if (cqe.user_data == s_stopCompKey)
+		{
+			break;
+		}
+
+		if (cqe.res < 0)
+		{
+			std::cerr << "Failed to finsh reading file, err " << -cqe.res << std::endl;
+			exit(3);
+			return;
+		}
+
+		SBuffer& buf = *reinterpret_cast<SBuffer*>(cqe.user_data);
+		// Parts of a split read complete on any worker, the last one goes on with the buffer.
+		if (state.pFi->pPendingReads && state.pFi->pPendingReads[buf.bufIdx].fetch_sub(1, std::memory_order_acq_rel) != 1)
+			continue;
+
+		const STimestamp latency = STimestamp::now() - buf.pushTime;
+		readTime += latency;
+		state.readLatency.Record(latency);
+		if (state.pFi->pInFlight)
+			state.pFi->pInFlight->OnCompletion(buf.readCount > 1 ? uint64(buf.dataSize) : uint64(cqe.res), latency);
+
+		const char* pData = buf.pBuf.get();
+		size_t dataSize = buf.readCount > 1 ? buf.dataSize : size_t(cqe.res);
+		if (const SCompressedToc* pToc = state.pFi->pToc)
+		{
+			const SCompressedBlock& block = pToc->blocks[buf.blockIdx];
+			const uint32 uncompressedSize = pToc->GetUncompressedBlockSize(buf.blockIdx);
+			if (dataSize < block.compressedSize)
+			{
+				std::cerr << "Short read of block " << buf.blockIdx << std::endl;
+				exit(3);
+			}
+			dataSize = block.compressedSize;
+			if (!(block.flags & eCBF_Raw))
+			{
+				PROF_REGION("decompress");
+				STsRegion reg(decompTime);
+				const int64 res = LzDecompress(pData, dataSize, state.pDecompBuf.get(), pToc->header.blockSize);
+				if (res != uncompressedSize)
+				{
+					std::cerr << "Failed to decompress block " << buf.blockIdx << std::endl;
+					exit(3);
+				}
+				pData = state.pDecompBuf.get();
+				dataSize = uncompressedSize;
+			}
+		}
+
+		{
+			PROF_REGION("process");
+			STsRegion reg(sumTime);
+			if (const SSubmitPlan* pPlan = state.pFi->pPlan)
+			{
+				// Merged read, gaps between requests are skipped. Read of the tail stops at the end of file.
+				const SSubmitUnit& unit = pPlan->units[buf.unitIdx];
+				for (const SIoRequest* pReq = &pPlan->requests[unit.firstRequest]; pReq != &pPlan->requests[unit.firstRequest] + unit.requestCount; ++pReq)
+					s += process(pData + pReq->offset, size_t(std::min<uint64>(pReq->size, dataSize - std::min<uint64>(pReq->offset, dataSize))));
+			}
+			else
+			{
+				s += process(pData, dataSize);
+			}
+		}
+		if (state.pFi->pStreams)
+			state.pFi->pStreams->OnProcessed(buf.fileIdx, int64(dataSize));
+		if (keepPushing)
+		{
+			STsRegion reg(pushTime);
+			keepPushing = PushOrParkBuffer(buf, *state.pFi);
+		}
+		if (!keepPushing)
+		{
+			RetireBuffer(*state.pFi);
+		}
+		if (state.pFi->pInFlight)
+		{
+			STsRegion reg(pushTime);
+			UnparkBuffers(*state.pFi);
+		}
+	}
+
+	state.sum = s;
+	state.popTime = popTime;
+	state.sumTime = sumTime;
+	state.pushTime = pushTime;
+	state.readTime = readTime;
+	state.decompTime = decompTime;
+	state.spin = spin.GetStats();
+}
+
+
+}
+
+
+
+void Test5_IoUring(const char* szFilename, const int64 fsizePos)
+{
+	PROF_FUNC();
+
+	using namespace Test5;
+
+	const SRunConfig& cfg = GetRunConfig();
+	const bool unbufferedIo = cfg.GetUnbufferedIo(s_unbufferedIo);
+
+	// Every file of the set is streamed at once when there is one, see fileset.h
+	const SFileSet* pFileSet = GetActiveFileSet();
+	std::vector<SFdCloser> files;
+	std::vector<int> fds;
+	{
+		int flags = O_RDONLY;
+		if (unbufferedIo)
+		{
+			flags |= O_DIRECT;
+		}
+
+		PROF_REGION("open");
+		const size_t fileCount = pFileSet ? pFileSet->names.size() : 1;
+		for (size_t i = 0; i < fileCount; ++i)
+		{
+			files.emplace_back(open(pFileSet ? pFileSet->names[i].c_str() : szFilename, flags));
+			if (files.back().fd == -1)
+			{
+				std::cerr << "Failed to open file, err " << errno << std::endl;
+				return;
+			}
+			fds.push_back(files.back().fd);
+		}
+	}
+
+	// Compressed container is detected by its header, then blocks are decompressed on workers.
+	SCompressedToc toc;
+	const bool compressed = !pFileSet && ReadCompressedToc(szFilename, toc);
+	const SWorkload* pWorkload = compressed || pFileSet ? nullptr : GetActiveWorkload();
+	std::unique_ptr<CFileStreams> pStreams(pFileSet ? new CFileStreams(*pFileSet) : nullptr);
+
+	// Requests merged and split before they go to the ring, see submitplan.h. Blocks of compressed file go as they are.
+	const SSubmitParams& submit = cfg.submit;
+	const bool submitStage = submit.IsEnabled() && !compressed;
+	SSubmitPlan plan;
+	STimestamp planTime{};
+	if (submitStage && pWorkload)
+	{
+		STsRegion reg(planTime);
+		BuildSubmitPlan(*pWorkload, submit, plan);
+	}
+
+	const uint32 hw = std::min< uint32>(std::thread::hardware_concurrency(), 32);
+	const bool adaptiveInFlight = cfg.GetAdaptiveInFlight(s_adaptiveInFlight);
+	const int maxBuffers = int(cfg.GetMaxInFlight(adaptiveInFlight ? CInFlightController::s_defaultMaxDepth : 32));
+
+	const size_t bufAlignment = 4096;
+	const size_t bufSize = compressed
+		? (toc.header.blockSize + bufAlignment - 1) / bufAlignment * bufAlignment
+		: std::max<size_t>({ cfg.GetBufSize(512 * 1024), pWorkload ? pWorkload->maxRequestSize : 0, plan.maxUnitSize });
+	//const size_t bufSize = 4 * 1024 * 1024;
+	const uint32 maxSplitCount = submitStage ? submit.GetSplitCount(bufSize) : 1;
+
+	// Enough space for all buffers split into parts and stop requests for every worker, up to the io_uring limit.
+	CUring ring;
+	{
+		PROF_REGION("io_uring_setup");
+		const int res = ring.Init(std::min(2u * uint32(maxBuffers) * maxSplitCount, 32768u));
+		if (res < 0)
+		{
+			std::cerr << "Failed to create io_uring, err " << -res << std::endl;
+			return;
+		}
+	}
+
+
+	ReserveIoBuffers(bufSize, uint32(maxBuffers));
+	std::vector<SBuffer> buffers;
+	for (int i = 0; i < maxBuffers; ++i)
+	{
+		buffers.emplace_back(AllocIoBuffer(bufSize, bufAlignment), bufSize, uint16_t(i));
+	}
+
+	if constexpr (s_registeredBuffers)
+	{
+		PROF_REGION("IORING_REGISTER_BUFFERS");
+		std::vector<iovec> iovs;
+		for (SBuffer& b : buffers)
+			iovs.push_back(iovec{ b.pBuf.get(), b.bufSize });
+		const int res = ring.RegisterBuffers(iovs.data(), (unsigned)iovs.size());
+		if (res < 0)
+		{
+			std::cerr << "Failed to register buffers, err " << -res << std::endl;
+			return;
+		}
+	}
+
+	if constexpr (s_fixedFiles)
+	{
+		PROF_REGION("IORING_REGISTER_FILES");
+		const int res = ring.RegisterFiles(fds.data(), unsigned(fds.size()));
+		if (res < 0)
+		{
+			std::cerr << "Failed to register file, err " << -res << std::endl;
+			return;
+		}
+	}
+
+	const uint32 workerCount = cfg.GetWorkerCount(std::max(hw, 2u) - 1);
+	//const uint32 workerCount = 1;
+	//const uint32 workerCount = hw;
+
+	SFileInfo fi;
+	fi.fsizePos = fsizePos;
+	fi.pFds = fds.data();
+	fi.pStreams = pStreams.get();
+	fi.pRing = &ring;
+	fi.readAlignment = unbufferedIo ? bufAlignment : 1;
+	fi.bufDoneEvent = eventfd(0, EFD_CLOEXEC);
+	SFdCloser bufDoneEventCloser(fi.bufDoneEvent);
+	fi.pToc = compressed ? &toc : nullptr;
+	fi.pWorkload = pWorkload;
+	if (submitStage)
+	{
+		fi.pSubmit = &submit;
+		fi.pPlan = pWorkload ? &plan : nullptr;
+		fi.pPendingReads.reset(new std::atomic<uint32>[maxBuffers]());
+	}
+	CInFlightController inFlight;
+	if (adaptiveInFlight)
+	{
+		inFlight.Init(uint32(maxBuffers));
+		fi.pInFlight = &inFlight;
+		fi.pBuffers = buffers.data();
+	}
+
+	std::vector<std::thread> workers;
+	std::unique_ptr<SState[]> states(new SState[workerCount]);
+	for (uint32 i = 0; i < workerCount; ++i)
+	{
+		states[i].s.idx = i;
+		states[i].s.pFi = &fi;
+		if (compressed)
+			states[i].s.pDecompBuf = AlignedAlloc(toc.header.blockSize, bufAlignment);
+		workers.emplace_back(std::thread(&WorkerFunc, std::ref(states[i].s)));
+	}
+
+	STimestamp sumTime{};
+	STimestamp readTime{};
+	STimestamp workPushTime{};
+	STimestamp waitingForResultTime{};
+	STimestamp stoppingTime{};
+
+	const SPageFaults faultsStart = SPageFaults::Now();
+	const SCpuTime cpuStart = SCpuTime::Now();
+	auto startTime = ts::now();
+	if (pStreams)
+		pStreams->Start(startTime);
+
+	{
+		STsRegion tsreg(workPushTime);
+		fi.activeBufCount += (int)buffers.size();
+		size_t pushed = 0;
+		bool exhausted = false;
+		for (; pushed < buffers.size(); ++pushed)
+		{
+			if (fi.pInFlight && !fi.pInFlight->TryAcquire())
+				break;
+			if (!PushMoreRequests(&buffers[pushed], 1, fi))
+			{
+				if (fi.pInFlight)
+				{
+					fi.pInFlight->Release();
+					fi.pInFlight->SetExhausted();
+				}
+				exhausted = true;
+				break;
+			}
+		}
+
+		// Rest of the buffers waits until the controller wants more in flight.
+		size_t parked = 0;
+		if (fi.pInFlight && !exhausted)
+		{
+			for (; pushed + parked < buffers.size(); ++parked)
+				fi.pInFlight->Park(buffers[pushed + parked].bufIdx);
+		}
+
+		// File is smaller than all buffers together, nobody will complete the rest.
+		const int unused = int(buffers.size() - pushed - parked);
+		if (unused > 0 && fi.activeBufCount.fetch_sub(unused) == unused)
+		{
+			const uint64 one = 1;
+			write(fi.bufDoneEvent, &one, sizeof(one));
+		}
+		if (parked)
+		{
+			if (fi.pInFlight->IsExhausted())
+				RetireParkedBuffers(fi);
+			UnparkBuffers(fi);
+		}
+	}
+
+	{
+		PROF_REGION("read bufDoneEvent");
+		STsRegion tsreg(waitingForResultTime);
+		uint64 val = 0;
+		while (read(fi.bufDoneEvent, &val, sizeof(val)) < 0 && errno == EINTR)
+			;
+	}
+
+
+	{
+		PROF_REGION("IORING_OP_NOP");
+		STsRegion tsreg(stoppingTime);
+		for (uint32 i = 0; i < workerCount; ++i)
+		{
+			ring.Submit([](io_uring_sqe& sqe)
+			{
+				sqe.opcode = IORING_OP_NOP;
+				sqe.user_data = s_stopCompKey;
+			});
+		}
+
+		for (auto& t : workers)
+			t.join();
+	}
+	auto endTime = ts::now();
+	const SPageFaults pageFaults = SPageFaults::Now() - faultsStart;
+	const SCpuTime cpuTime = SCpuTime::Now() - cpuStart;
+
+	uint64 sum = 0;
+	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+		sum += s->s.sum;
+
+	if (cfg.checkExpectedSum && !pWorkload && !pFileSet && !CheckExpectedSum(sum))
+		__debugbreak();
+
+	CLatencyHistogram readLatency;
+	STimestamp workersPopTime{};
+	STimestamp workersPushTime{};
+	STimestamp decompTime{};
+	SSpinWaitStats spin;
+	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+	{
+		spin.Merge(s->s.spin);
+		workersPopTime += s->s.popTime;
+		workersPushTime += s->s.pushTime;
+		readTime += s->s.readTime;
+		readLatency.Merge(s->s.readLatency);
+		sumTime += s->s.sumTime;
+		decompTime += s->s.decompTime;
+	}
+
+	// Random access reads only requested bytes, processing works on decompressed data
+	const uint64 ioSize = pWorkload ? pWorkload->totalBytes : pFileSet ? pFileSet->totalSize : uint64(fsizePos);
+	const uint64 dataSize = compressed ? toc.header.uncompressedSize : ioSize;
+	const uint64 requestCount = compressed ? toc.header.blockCount
+		: pWorkload ? pWorkload->requests.size()
+		: pStreams ? pStreams->GetRequestCount()
+		: (uint64(fsizePos) + bufSize - 1) / bufSize;
+
+	SRunResult result;
+	result.engine = __FUNCTION__;
+	result.bufSize = uint32(bufSize);
+	result.maxInFlight = uint32(maxBuffers);
+	result.settledInFlight = adaptiveInFlight ? inFlight.GetTarget() : 0;
+	result.workerCount = workerCount;
+	result.unbuffered = unbufferedIo;
+	result.bytes = ioSize;
+	result.requests = requestCount;
+	result.sum = sum;
+	result.totalTime = endTime - startTime;
+	result.latency = readLatency;
+	result.pageFaults = pageFaults;
+	result.cpuTime = cpuTime;
+	result.spin = spin;
+	result.wakeups = int64(spin.blocks);
+	result.reads = submitStage ? fi.readCount.load() : 0;
+	result.fileCount = uint32(fds.size());
+	result.fairness = pStreams ? pStreams->GetFairness() : -1;
+	ReportRunResult(result);
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Stage " << GetActiveProcessingStage().name << std::endl;
+	if (pWorkload)
+		PrintWorkload(*pWorkload);
+	if (fi.pPlan)
+		PrintSubmitPlan(*pWorkload, plan);
+	if (pStreams)
+		pStreams->Print();
+	if (submitStage)
+		std::cout << "Reads " << fi.readCount.load() << " for " << requestCount << " requests, plan took " << ms(planTime.dur()) << std::endl;
+	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(ioSize, (endTime - startTime)) << std::endl;
+	std::cout << "IOPS " << requestCount / sec((endTime - startTime).dur()) << " (" << requestCount << " requests)" << std::endl;
+	std::cout << "Read took   " << ms(readTime.dur()) << " - MB/s " << MBsec(ioSize, readTime) << std::endl;
+	readLatency.Print("Read");
+	std::cout << "Sum took    " << ms(sumTime.dur()) << " - MB/s " << MBsec(dataSize, sumTime) << std::endl;
+	std::cout << "Sum/wr took " << ms(sumTime.dur() / workerCount) << " - MB/s " << MBsec(dataSize, sumTime.dur() / workerCount) << std::endl;
+	if (compressed)
+	{
+		const uint64 compressedSize = toc.GetCompressedSize();
+		std::cout << "Input  MB/s " << MBsec(compressedSize, (endTime - startTime)) << " (" << compressedSize << " bytes)" << std::endl;
+		std::cout << "Output MB/s " << MBsec(dataSize, (endTime - startTime)) << " (" << dataSize << " bytes)" << std::endl;
+		std::cout << "Decomp took    " << ms(decompTime.dur()) << " - MB/s " << MBsec(dataSize, decompTime) << std::endl;
+		std::cout << "Decomp/wr took " << ms(decompTime.dur() / workerCount) << " - MB/s " << MBsec(dataSize, decompTime.dur() / workerCount) << std::endl;
+		for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+			std::cout << "  decompTime worker " << s->s.idx << " " << ms(s->s.decompTime.dur()) << std::endl;
+	}
+	std::cout << "workPushTime          " << ms(workPushTime.dur()) << std::endl;
+	std::cout << "waitingForResultTime  " << ms(waitingForResultTime.dur()) << std::endl;
+	std::cout << "stoppingTime          " << ms(stoppingTime.dur()) << std::endl;
+	std::cout << "workersPopTime        " << ms(workersPopTime.dur()) << std::endl;
+	std::cout << "workersPushTime       " << ms(workersPushTime.dur()) << std::endl;
+	if (adaptiveInFlight)
+		inFlight.Print();
+	std::cout << "Wait " << GetWaitModeName(cfg.waitMode) << std::endl;
+	spin.Print();
+	std::cout << "pageFaults  minor " << pageFaults.minor << " major " << pageFaults.major << std::endl;
+	std::cout << "cpuTime     user " << ms(cpuTime.user.dur()) << " system " << ms(cpuTime.system.dur()) << std::endl;
+	PrintIoBuffers();
+	std::cout << "Sum is " << sum << std::endl;
+	std::cout << "workerCount " << workerCount << std::endl;
+	std::cout << std::endl;
+}
+
+#endif
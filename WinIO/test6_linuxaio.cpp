@@ -0,0 +1,584 @@
+#ifdef __linux__
+
+#include "tests.h"
+#include "bench.h"
+#include "bufferpool.h"
+#include "fileset.h"
+#include "histogram.h"
+#include "inflight.h"
+#include "linuxio.h"
+#include "spinwait.h"
+#include "testdata.h"
+#include "workload.h"
+
+#include <array>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <atomic>
+#include <thread>
+
+#include <sys/eventfd.h>
+
+namespace Test6
+{
+
+static const uint64 s_stopCompKey = 28;
+
+// Without O_DIRECT io_submit does the read synchronously, same as cached OVERLAPPED reads.
+static constexpr bool s_unbufferedIo = true;
+// Outstanding reads picked at runtime instead of keeping all buffers in flight, see inflight.h
+static constexpr bool s_adaptiveInFlight = false;
+
+
+struct SBuffer final : public iocb
+{
+	SBuffer(AlignedUniquePtr p, size_t s, uint32 idx)
+		: pBuf(std::move(p))
+		, bufSize(s)
+		, bufIdx(idx)
+	{
+		memset(static_cast<iocb*>(this), 0, sizeof(iocb));
+	}
+
+	AlignedUniquePtr pBuf;
+	size_t bufSize;
+	uint32 bufIdx;
+	uint32 fileIdx = 0;
+
+	STimestamp pushTime;
+};
+
+
+struct SFileInfo
+{
+	std::atomic<int64> off = { 0 };
+	int64 fsizePos = 0;
+
+	int fd = -1;
+	// One per file of the set, fd is the first of them
+	const int* pFds = nullptr;
+	CAioContext* pCtx = nullptr;
+	size_t readAlignment = 1;
+
+	int bufDoneEvent = -1;
+	std::atomic<int> activeBufCount = {};
+
+	// Set for random access, requests are taken from the list instead of streaming.
+	const SWorkload* pWorkload = nullptr;
+	std::atomic<uint64> nextRequest = { 0 };
+
+	// Set for several files at once, requests go to them in turn, see fileset.h
+	CFileStreams* pStreams = nullptr;
+
+	// Set for adaptive depth, buffers over its target wait there.
+	CInFlightController* pInFlight = nullptr;
+	SBuffer* pBuffers = nullptr;
+};
+
+
+static bool PushMoreRequests(SBuffer* pBuffers, size_t bufCount, SFileInfo& fi)
+{
+	PROF_FUNC();
+
+	SBuffer* pBufEnd = pBuffers + bufCount;
+	for (; pBuffers < pBufEnd; ++pBuffers)
+	{
+		SBuffer& buf = *pBuffers;
+
+		int64 readSize = buf.bufSize;
+		int64 off;
+		int64 fileEnd = fi.fsizePos;
+		if (fi.pWorkload)
+		{
+			const uint64 reqIdx = fi.nextRequest.fetch_add(1, std::memory_order_relaxed);
+			if (reqIdx >= fi.pWorkload->requests.size())
+			{
+				return false;
+			}
+			const SIoRequest& req = fi.pWorkload->requests[reqIdx];
+			off = int64(req.offset);
+			readSize = req.size;
+		}
+		else if (fi.pStreams)
+		{
+			if (!fi.pStreams->Next(readSize, buf.fileIdx, off, readSize))
+			{
+				return false;
+			}
+			fileEnd = off + readSize;
+		}
+		else
+		{
+			off = fi.off.fetch_add(readSize, std::memory_order_acq_rel);
+
+			if (off >= fi.fsizePos)
+			{
+				return false;
+			}
+		}
+		// O_DIRECT needs aligned size as well, read of the tail is short anyway.
+		readSize = std::min<int64>(readSize, fileEnd - off);
+		readSize = (readSize + fi.readAlignment - 1) / fi.readAlignment * fi.readAlignment;
+
+		buf.pushTime = STimestamp::now();
+
+		buf.aio_lio_opcode = IOCB_CMD_PREAD;
+		buf.aio_fildes = fi.pFds[buf.fileIdx];
+		buf.aio_buf = reinterpret_cast<uint64>(buf.pBuf.get());
+		buf.aio_nbytes = static_cast<uint64>(readSize);
+		buf.aio_offset = off;
+		buf.aio_data = reinterpret_cast<uint64>(&buf);
+
+		const int res = fi.pCtx->Submit(buf);
+		if (res != 1)
+		{
+			std::cerr << "Failed to read file, err " << -res << std::endl;
+			exit(1);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void RetireBuffer(SFileInfo& fi)
+{
+	int val = fi.activeBufCount.fetch_sub(1, std::memory_order_relaxed);
+	if (val == 1)
+	{
+		const uint64 one = 1;
+		write(fi.bufDoneEvent, &one, sizeof(one));
+	}
+}
+
+static void RetireParkedBuffers(SFileInfo& fi)
+{
+	uint32 idx;
+	while (fi.pInFlight->TakeParked(idx))
+		RetireBuffer(fi);
+}
+
+// Reads into the buffer again, or parks it when the adaptive depth is at its target.
+// False when there's nothing left to read, the buffer is retired then.
+static bool PushOrParkBuffer(SBuffer& buf, SFileInfo& fi)
+{
+	CInFlightController* pInFlight = fi.pInFlight;
+	if (!pInFlight)
+		return PushMoreRequests(&buf, 1, fi);
+
+	if (!pInFlight->TryAcquire())
+	{
+		pInFlight->Park(buf.bufIdx);
+		if (pInFlight->IsExhausted())
+			RetireParkedBuffers(fi);
+		return true;
+	}
+	if (PushMoreRequests(&buf, 1, fi))
+		return true;
+	pInFlight->Release();
+	pInFlight->SetExhausted();
+	RetireParkedBuffers(fi);
+	return false;
+}
+
+// Parked buffers go back while the adaptive depth is under its target.
+static void UnparkBuffers(SFileInfo& fi)
+{
+	uint32 idx;
+	while (!fi.pInFlight->IsExhausted() && fi.pInFlight->TryUnpark(idx))
+	{
+		if (!PushMoreRequests(&fi.pBuffers[idx], 1, fi))
+		{
+			fi.pInFlight->Release();
+			fi.pInFlight->SetExhausted();
+			RetireBuffer(fi);
+			RetireParkedBuffers(fi);
+		}
+	}
+}
+
+struct SWorkerState
+{
+	SFileInfo* pFi = nullptr;
+	int64 sum = 0;
+	STimestamp popTime{};
+	STimestamp sumTime{};
+	STimestamp pushTime{};
+	STimestamp readTime{};
+	CLatencyHistogram readLatency;
+	SSpinWaitStats spin;
+	uint32 idx = 0;
+};
+
+struct alignas(128) SState
+{
+	static constexpr size_t alignment = 128;
+
+	SState() = default;
+	SState(SState&&) = default;
+	SState& operator=(SState&&) = default;
+	SState(const SState&) = delete;
+	SState& operator=(const SState&) = delete;
+
+	SWorkerState s;
+	char padding[alignment - sizeof(s) % alignment];
+};
+static_assert(sizeof(SState) % SState::alignment == 0, "Broken alignment");
+
+static void WorkerFunc(SWorkerState& state)
+{
+	SetThreadName(L"Worker_%u", state.idx);
+	PinWorkerThread(state.idx);
+
+	PROF_FUNC();
+
+	uint64 s = 0;
+	STimestamp popTime{};
+	STimestamp sumTime{};
+	STimestamp pushTime{};
+	STimestamp readTime{};
+	bool keepPushing = true;
+	CSpinWait spin(GetRunConfig().waitMode, GetRunConfig().spinUs);
+	// Polling is a syscall here, io_getevents with zero timeout doesn't wait.
+	timespec noWait{};
+
+	while (true)
+	{
+		io_event ev{};
+		int res = 0;
+		{
+			PROF_REGION("io_getevents");
+			STsRegion reg(popTime);
+			if (!spin.Spin([&] { return (res = state.pFi->pCtx->GetEvents(&ev, 0, 1, &noWait)) == 1; }))
+				res = state.pFi->pCtx->GetEvents(&ev, 1, 1);
+		}
+		if (res != 1)
+		{
+			std::cerr << "Failed to get completion status, err " << -res << std::endl;
+			exit(3);
+			return;
+		}
+		spin.OnCompletion();
+
+		if (ev.data == s_stopCompKey)
+		{
+			break;
+		}
+
+		const int64 transferred = ev.res;
+		if (transferred < 0)
+		{
+			std::cerr << "Failed to finsh reading file, err " << -transferred << std::endl;
+			exit(3);
+			return;
+		}
+
+		SBuffer& buf = *reinterpret_cast<SBuffer*>(ev.data);
+		const STimestamp latency = STimestamp::now() - buf.pushTime;
+		readTime += latency;
+		state.readLatency.Record(latency);
+		if (state.pFi->pInFlight)
+			state.pFi->pInFlight->OnCompletion(uint64(transferred), latency);
+
+		{
+			PROF_REGION("process");
+			STsRegion reg(sumTime);
+			s += process(buf.pBuf.get(), transferred);
+		}
+		if (state.pFi->pStreams)
+			state.pFi->pStreams->OnProcessed(buf.fileIdx, transferred);
+		if (keepPushing)
+		{
+			STsRegion reg(pushTime);
+			keepPushing = PushOrParkBuffer(buf, *state.pFi);
+		}
+		if (!keepPushing)
+		{
+			RetireBuffer(*state.pFi);
+		}
+		if (state.pFi->pInFlight)
+		{
+			STsRegion reg(pushTime);
+			UnparkBuffers(*state.pFi);
+		}
+	}
+
+	state.sum = s;
+	state.popTime = popTime;
+	state.sumTime = sumTime;
+	state.pushTime = pushTime;
+	state.readTime = readTime;
+	state.spin = spin.GetStats();
+}
+
+
+}
+
+
+
+void Test6_LinuxAio(const char* szFilename, const int64 fsizePos)
+{
+	PROF_FUNC();
+
+	using namespace Test6;
+
+	const SRunConfig& cfg = GetRunConfig();
+	const bool unbufferedIo = cfg.GetUnbufferedIo(s_unbufferedIo);
+
+	// Every file of the set is streamed at once when there is one, see fileset.h
+	const SFileSet* pFileSet = GetActiveFileSet();
+	std::vector<SFdCloser> files;
+	std::vector<int> fds;
+	{
+		int flags = O_RDONLY;
+		if (unbufferedIo)
+		{
+			flags |= O_DIRECT;
+		}
+
+		PROF_REGION("open");
+		const size_t fileCount = pFileSet ? pFileSet->names.size() : 1;
+		for (size_t i = 0; i < fileCount; ++i)
+		{
+			files.emplace_back(open(pFileSet ? pFileSet->names[i].c_str() : szFilename, flags));
+			if (files.back().fd == -1)
+			{
+				std::cerr << "Failed to open file, err " << errno << std::endl;
+				return;
+			}
+			fds.push_back(files.back().fd);
+		}
+	}
+	std::unique_ptr<CFileStreams> pStreams(pFileSet ? new CFileStreams(*pFileSet) : nullptr);
+
+	const uint32 hw = std::min< uint32>(std::thread::hardware_concurrency(), 32);
+	const bool adaptiveInFlight = cfg.GetAdaptiveInFlight(s_adaptiveInFlight);
+	const int maxBuffers = int(cfg.GetMaxInFlight(adaptiveInFlight ? CInFlightController::s_defaultMaxDepth : 32));
+
+	// Enough space for all buffers and stop requests for every worker.
+	CAioContext ctx;
+	{
+		PROF_REGION("io_setup");
+		const int res = ctx.Init(maxBuffers + std::max(hw, cfg.workerCount));
+		if (res < 0)
+		{
+			std::cerr << "Failed to create aio context, err " << -res << std::endl;
+			return;
+		}
+	}
+
+	const SWorkload* pWorkload = pFileSet ? nullptr : GetActiveWorkload();
+	const size_t bufSize = std::max<size_t>(cfg.GetBufSize(512 * 1024), pWorkload ? pWorkload->maxRequestSize : 0);
+	//const size_t bufSize = 4 * 1024 * 1024;
+	const size_t bufAlignment = 4096;
+
+
+	ReserveIoBuffers(bufSize, uint32(maxBuffers));
+	std::vector<SBuffer> buffers;
+	for (int i = 0; i < maxBuffers; ++i)
+	{
+		buffers.emplace_back(AllocIoBuffer(bufSize, bufAlignment), bufSize, uint32(i));
+	}
+
+	const uint32 workerCount = cfg.GetWorkerCount(std::max(hw, 2u) - 1);
+	//const uint32 workerCount = 1;
+	//const uint32 workerCount = hw;
+
+	SFileInfo fi;
+	fi.fsizePos = fsizePos;
+	fi.fd = fds[0];
+	fi.pFds = fds.data();
+	fi.pStreams = pStreams.get();
+	fi.pCtx = &ctx;
+	fi.readAlignment = unbufferedIo ? bufAlignment : 1;
+	fi.bufDoneEvent = eventfd(0, EFD_CLOEXEC);
+	SFdCloser bufDoneEventCloser(fi.bufDoneEvent);
+	fi.pWorkload = pWorkload;
+	CInFlightController inFlight;
+	if (adaptiveInFlight)
+	{
+		inFlight.Init(uint32(maxBuffers));
+		fi.pInFlight = &inFlight;
+		fi.pBuffers = buffers.data();
+	}
+
+	std::vector<std::thread> workers;
+	std::unique_ptr<SState[]> states(new SState[workerCount]);
+	for (uint32 i = 0; i < workerCount; ++i)
+	{
+		states[i].s.idx = i;
+		states[i].s.pFi = &fi;
+		workers.emplace_back(std::thread(&WorkerFunc, std::ref(states[i].s)));
+	}
+
+	STimestamp sumTime{};
+	STimestamp readTime{};
+	STimestamp workPushTime{};
+	STimestamp waitingForResultTime{};
+	STimestamp stoppingTime{};
+
+	const SPageFaults faultsStart = SPageFaults::Now();
+	const SCpuTime cpuStart = SCpuTime::Now();
+	auto startTime = ts::now();
+	if (pStreams)
+		pStreams->Start(startTime);
+
+	{
+		STsRegion tsreg(workPushTime);
+		fi.activeBufCount += (int)buffers.size();
+		size_t pushed = 0;
+		bool exhausted = false;
+		for (; pushed < buffers.size(); ++pushed)
+		{
+			if (fi.pInFlight && !fi.pInFlight->TryAcquire())
+				break;
+			if (!PushMoreRequests(&buffers[pushed], 1, fi))
+			{
+				if (fi.pInFlight)
+				{
+					fi.pInFlight->Release();
+					fi.pInFlight->SetExhausted();
+				}
+				exhausted = true;
+				break;
+			}
+		}
+
+		// Rest of the buffers waits until the controller wants more in flight.
+		size_t parked = 0;
+		if (fi.pInFlight && !exhausted)
+		{
+			for (; pushed + parked < buffers.size(); ++parked)
+				fi.pInFlight->Park(buffers[pushed + parked].bufIdx);
+		}
+
+		// File is smaller than all buffers together, nobody will complete the rest.
+		const int unused = int(buffers.size() - pushed - parked);
+		if (unused > 0 && fi.activeBufCount.fetch_sub(unused) == unused)
+		{
+			const uint64 one = 1;
+			write(fi.bufDoneEvent, &one, sizeof(one));
+		}
+		if (parked)
+		{
+			if (fi.pInFlight->IsExhausted())
+				RetireParkedBuffers(fi);
+			UnparkBuffers(fi);
+		}
+	}
+
+	{
+		PROF_REGION("read bufDoneEvent");
+		STsRegion tsreg(waitingForResultTime);
+		uint64 val = 0;
+		while (read(fi.bufDoneEvent, &val, sizeof(val)) < 0 && errno == EINTR)
+			;
+	}
+
+
+	{
+		// AIO has no NOP command, empty read completes right away and wakes one worker.
+		PROF_REGION("io_submit stop");
+		STsRegion tsreg(stoppingTime);
+		std::vector<iocb> stopCbs(workerCount);
+		for (iocb& cb : stopCbs)
+		{
+			cb = iocb{};
+			cb.aio_lio_opcode = IOCB_CMD_PREAD;
+			cb.aio_fildes = fi.fd;
+			cb.aio_buf = reinterpret_cast<uint64>(buffers[0].pBuf.get());
+			cb.aio_nbytes = 0;
+			cb.aio_data = s_stopCompKey;
+			const int res = ctx.Submit(cb);
+			if (res != 1)
+			{
+				std::cerr << "Failed to stop workers, err " << -res << std::endl;
+				exit(3);
+			}
+		}
+
+		for (auto& t : workers)
+			t.join();
+	}
+	auto endTime = ts::now();
+	const SPageFaults pageFaults = SPageFaults::Now() - faultsStart;
+	const SCpuTime cpuTime = SCpuTime::Now() - cpuStart;
+
+	uint64 sum = 0;
+	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+		sum += s->s.sum;
+
+	if (cfg.checkExpectedSum && !pWorkload && !pFileSet && !CheckExpectedSum(sum))
+		__debugbreak();
+
+	CLatencyHistogram readLatency;
+	STimestamp workersPopTime{};
+	STimestamp workersPushTime{};
+	SSpinWaitStats spin;
+	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+	{
+		spin.Merge(s->s.spin);
+		workersPopTime += s->s.popTime;
+		workersPushTime += s->s.pushTime;
+		readTime += s->s.readTime;
+		readLatency.Merge(s->s.readLatency);
+		sumTime += s->s.sumTime;
+	}
+
+	// Random access reads only requested bytes
+	const uint64 ioSize = pWorkload ? pWorkload->totalBytes : pFileSet ? pFileSet->totalSize : uint64(fsizePos);
+	const uint64 requestCount = pWorkload ? pWorkload->requests.size()
+		: pStreams ? pStreams->GetRequestCount()
+		: (uint64(fsizePos) + bufSize - 1) / bufSize;
+
+	SRunResult result;
+	result.engine = __FUNCTION__;
+	result.bufSize = uint32(bufSize);
+	result.maxInFlight = uint32(maxBuffers);
+	result.settledInFlight = adaptiveInFlight ? inFlight.GetTarget() : 0;
+	result.workerCount = workerCount;
+	result.unbuffered = unbufferedIo;
+	result.bytes = ioSize;
+	result.requests = requestCount;
+	result.sum = sum;
+	result.totalTime = endTime - startTime;
+	result.latency = readLatency;
+	result.pageFaults = pageFaults;
+	result.cpuTime = cpuTime;
+	result.spin = spin;
+	result.wakeups = int64(spin.blocks);
+	result.fileCount = uint32(fds.size());
+	result.fairness = pStreams ? pStreams->GetFairness() : -1;
+	ReportRunResult(result);
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Stage " << GetActiveProcessingStage().name << std::endl;
+	if (pWorkload)
+		PrintWorkload(*pWorkload);
+	if (pStreams)
+		pStreams->Print();
+	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(ioSize, (endTime - startTime)) << std::endl;
+	std::cout << "IOPS " << requestCount / sec((endTime - startTime).dur()) << " (" << requestCount << " requests)" << std::endl;
+	std::cout << "Read took   " << ms(readTime.dur()) << " - MB/s " << MBsec(ioSize, readTime) << std::endl;
+	readLatency.Print("Read");
+	std::cout << "Sum took    " << ms(sumTime.dur()) << " - MB/s " << MBsec(ioSize, sumTime) << std::endl;
+	std::cout << "Sum/wr took " << ms(sumTime.dur() / workerCount) << " - MB/s " << MBsec(ioSize, sumTime.dur() / workerCount) << std::endl;
+	std::cout << "workPushTime          " << ms(workPushTime.dur()) << std::endl;
+	std::cout << "waitingForResultTime  " << ms(waitingForResultTime.dur()) << std::endl;
+	std::cout << "stoppingTime          " << ms(stoppingTime.dur()) << std::endl;
+	std::cout << "workersPopTime        " << ms(workersPopTime.dur()) << std::endl;
+	std::cout << "workersPushTime       " << ms(workersPushTime.dur()) << std::endl;
+	if (adaptiveInFlight)
+		inFlight.Print();
+	std::cout << "Wait " << GetWaitModeName(cfg.waitMode) << std::endl;
+	spin.Print();
+	std::cout << "pageFaults  minor " << pageFaults.minor << " major " << pageFaults.major << std::endl;
+	std::cout << "cpuTime     user " << ms(cpuTime.user.dur()) << " system " << ms(cpuTime.system.dur()) << std::endl;
+	PrintIoBuffers();
+	std::cout << "Sum is " << sum << std::endl;
+	std::cout << "workerCount " << workerCount << std::endl;
+	std::cout << std::endl;
+}
+
+#endif
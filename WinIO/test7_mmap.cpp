@@ -0,0 +1,282 @@
+#ifdef __linux__
+
+#include "tests.h"
+#include "bench.h"
+#include "histogram.h"
+#include "linuxio.h"
+#include "testdata.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <atomic>
+#include <thread>
+
+#include <sys/resource.h>
+
+namespace Test7
+{
+
+enum class EAdvice
+{
+	None,
+	Sequential,
+	WillNeed,
+	HugePage,
+};
+
+static constexpr EAdvice s_advice = EAdvice::Sequential;
+static constexpr bool s_populate = false;
+
+static const char* AdviceName(EAdvice a)
+{
+	switch (a)
+	{
+	case EAdvice::None: return "none";
+	case EAdvice::Sequential: return "MADV_SEQUENTIAL";
+	case EAdvice::WillNeed: return "MADV_WILLNEED";
+	case EAdvice::HugePage: return "MADV_HUGEPAGE";
+	}
+	return "?";
+}
+
+struct SMapInfo
+{
+	const char* pData = nullptr;
+	int64 fsizePos = 0;
+	size_t chunkSize = 0;
+	size_t pageSize = 0;
+	std::atomic<int64> off = { 0 };
+};
+
+struct SWorkerState
+{
+	SMapInfo* pMi = nullptr;
+	int64 sum = 0;
+	STimestamp faultTime{};
+	STimestamp sumTime{};
+	// Per chunk, this is what a reader waits for instead of read completion.
+	CLatencyHistogram faultLatency;
+	int64 minorFaults = 0;
+	int64 majorFaults = 0;
+	uint32 idx = 0;
+};
+
+struct alignas(128) SState
+{
+	static constexpr size_t alignment = 128;
+
+	SState() = default;
+	SState(SState&&) = default;
+	SState& operator=(SState&&) = default;
+	SState(const SState&) = delete;
+	SState& operator=(const SState&) = delete;
+
+	SWorkerState s;
+	char padding[alignment - sizeof(s) % alignment];
+};
+static_assert(sizeof(SState) % SState::alignment == 0, "Broken alignment");
+
+// Touches one byte per page, so all page faults of the range are taken here and not inside process().
+static void TouchPages(const char* pBuf, size_t size, size_t pageSize)
+{
+	for (size_t i = 0; i < size; i += pageSize)
+		(void)*reinterpret_cast<const volatile uint8*>(pBuf + i);
+}
+
+static void WorkerFunc(SWorkerState& state)
+{
+	SetThreadName(L"Worker_%u", state.idx);
+	PinWorkerThread(state.idx);
+
+	PROF_FUNC();
+
+	SMapInfo& mi = *state.pMi;
+
+	uint64 s = 0;
+	STimestamp faultTime{};
+	STimestamp sumTime{};
+
+	rusage usageStart{};
+	getrusage(RUSAGE_THREAD, &usageStart);
+
+	while (true)
+	{
+		const int64 off = mi.off.fetch_add(mi.chunkSize, std::memory_order_relaxed);
+		if (off >= mi.fsizePos)
+			break;
+		const size_t size = size_t(std::min<int64>(mi.chunkSize, mi.fsizePos - off));
+		const char* pBuf = mi.pData + off;
+
+		{
+			PROF_REGION("fault");
+			const STimestamp faultStart = ts::now();
+			TouchPages(pBuf, size, mi.pageSize);
+			const STimestamp latency = ts::now() - faultStart;
+			faultTime += latency;
+			state.faultLatency.Record(latency);
+		}
+		{
+			PROF_REGION("process");
+			STsRegion reg(sumTime);
+			s += process(pBuf, size);
+		}
+	}
+
+	rusage usageEnd{};
+	getrusage(RUSAGE_THREAD, &usageEnd);
+
+	state.sum = s;
+	state.faultTime = faultTime;
+	state.sumTime = sumTime;
+	state.minorFaults = usageEnd.ru_minflt - usageStart.ru_minflt;
+	state.majorFaults = usageEnd.ru_majflt - usageStart.ru_majflt;
+}
+
+}
+
+
+void Test7_Mmap(const char* szFilename, const int64 fsizePos)
+{
+	PROF_FUNC();
+
+	using namespace Test7;
+
+	const SRunConfig& cfg = GetRunConfig();
+
+	SFdCloser hFile;
+	{
+		PROF_REGION("open");
+		hFile = open(szFilename, O_RDONLY);
+		if (hFile.fd == -1)
+		{
+			std::cerr << "Failed to open file, err " << errno << std::endl;
+			return;
+		}
+	}
+
+	const uint32 hw = std::min< uint32>(std::thread::hardware_concurrency(), 32);
+	const uint32 workerCount = cfg.GetWorkerCount(std::max(hw, 2u) - 1);
+
+	const size_t chunkSize = cfg.GetBufSize(512 * 1024);
+
+	STimestamp mapTime{};
+	STimestamp adviseTime{};
+	STimestamp waitingForResultTime{};
+
+	auto startTime = ts::now();
+
+	void* pMap = nullptr;
+	{
+		PROF_REGION("mmap");
+		STsRegion tsreg(mapTime);
+		int flags = MAP_PRIVATE;
+		if (s_populate)
+		{
+			flags |= MAP_POPULATE;
+		}
+		pMap = mmap(nullptr, size_t(fsizePos), PROT_READ, flags, hFile.fd, 0);
+		if (pMap == MAP_FAILED)
+		{
+			std::cerr << "Failed to map file, err " << errno << std::endl;
+			return;
+		}
+	}
+
+	if (s_advice != EAdvice::None)
+	{
+		PROF_REGION("madvise");
+		STsRegion tsreg(adviseTime);
+		int advice = MADV_NORMAL;
+		switch (s_advice)
+		{
+		case EAdvice::None: break;
+		case EAdvice::Sequential: advice = MADV_SEQUENTIAL; break;
+		case EAdvice::WillNeed: advice = MADV_WILLNEED; break;
+		case EAdvice::HugePage: advice = MADV_HUGEPAGE; break;
+		}
+		if (madvise(pMap, size_t(fsizePos), advice) != 0)
+		{
+			// Not fatal, e.g. MADV_HUGEPAGE requires THP support for page cache.
+			std::cerr << "madvise " << AdviceName(s_advice) << " failed, err " << errno << std::endl;
+		}
+	}
+
+	SMapInfo mi;
+	mi.pData = static_cast<const char*>(pMap);
+	mi.fsizePos = fsizePos;
+	mi.chunkSize = chunkSize;
+	mi.pageSize = size_t(sysconf(_SC_PAGESIZE));
+
+	std::vector<std::thread> workers;
+	std::unique_ptr<SState[]> states(new SState[workerCount]);
+	{
+		PROF_REGION("wait workers");
+		STsRegion tsreg(waitingForResultTime);
+		for (uint32 i = 0; i < workerCount; ++i)
+		{
+			states[i].s.idx = i;
+			states[i].s.pMi = &mi;
+			workers.emplace_back(std::thread(&WorkerFunc, std::ref(states[i].s)));
+		}
+
+		for (auto& t : workers)
+			t.join();
+	}
+
+	auto endTime = ts::now();
+
+	munmap(pMap, size_t(fsizePos));
+
+	uint64 sum = 0;
+	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+		sum += s->s.sum;
+
+	if (cfg.checkExpectedSum && !CheckExpectedSum(sum))
+		__debugbreak();
+
+	STimestamp faultTime{};
+	STimestamp sumTime{};
+	CLatencyHistogram faultLatency;
+	int64 minorFaults = 0;
+	int64 majorFaults = 0;
+	for (SState* s = states.get(); s != states.get() + workerCount; ++s)
+	{
+		faultTime += s->s.faultTime;
+		faultLatency.Merge(s->s.faultLatency);
+		sumTime += s->s.sumTime;
+		minorFaults += s->s.minorFaults;
+		majorFaults += s->s.majorFaults;
+	}
+
+	SRunResult result;
+	result.engine = __FUNCTION__;
+	result.bufSize = uint32(chunkSize);
+	result.workerCount = workerCount;
+	result.bytes = uint64(fsizePos);
+	result.requests = (uint64(fsizePos) + chunkSize - 1) / chunkSize;
+	result.sum = sum;
+	result.totalTime = endTime - startTime;
+	result.latency = faultLatency;
+	ReportRunResult(result);
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Stage " << GetActiveProcessingStage().name << std::endl;
+	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(fsizePos, (endTime - startTime)) << std::endl;
+	std::cout << "Fault took  " << ms(faultTime.dur()) << " - MB/s " << MBsec(fsizePos, faultTime) << std::endl;
+	faultLatency.Print("Fault");
+	std::cout << "Sum took    " << ms(sumTime.dur()) << " - MB/s " << MBsec(fsizePos, sumTime) << std::endl;
+	std::cout << "Fault/wr took " << ms(faultTime.dur() / workerCount) << " - MB/s " << MBsec(fsizePos, faultTime.dur() / workerCount) << std::endl;
+	std::cout << "Sum/wr took " << ms(sumTime.dur() / workerCount) << " - MB/s " << MBsec(fsizePos, sumTime.dur() / workerCount) << std::endl;
+	std::cout << "mapTime               " << ms(mapTime.dur()) << (s_populate ? " (MAP_POPULATE)" : "") << std::endl;
+	std::cout << "adviseTime            " << ms(adviseTime.dur()) << " " << AdviceName(s_advice) << std::endl;
+	std::cout << "waitingForResultTime  " << ms(waitingForResultTime.dur()) << std::endl;
+	std::cout << "minorFaults           " << minorFaults << std::endl;
+	std::cout << "majorFaults           " << majorFaults << std::endl;
+	std::cout << "Sum is " << sum << std::endl;
+	std::cout << "workerCount " << workerCount << std::endl;
+	std::cout << std::endl;
+}
+
+#endif
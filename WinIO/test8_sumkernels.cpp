@@ -0,0 +1,89 @@
+#include "tests.h"
+#include "checksum.h"
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+
+
+void Test8_SumKernels()
+{
+	PROF_FUNC();
+
+	// Bigger than LLC, so it's closer to what workers see after IO completion.
+	const size_t bufSize = 64 * 1024 * 1024;
+	const int repeats = 8;
+
+	std::unique_ptr<char[]> pBuf(new char[bufSize + 1]);
+	std::mt19937_64 rng(42);
+	for (size_t i = 0; i < bufSize; i += sizeof(uint64))
+	{
+		const uint64 v = rng();
+		memcpy(pBuf.get() + i, &v, sizeof(v));
+	}
+
+	size_t kernelCount = 0;
+	const SSumKernel* pKernels = GetSumKernels(kernelCount);
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Active kernel " << GetActiveSumKernel().name << std::endl;
+
+	uint64 expected = 0;
+	for (size_t k = 0; k < kernelCount; ++k)
+	{
+		const SSumKernel& kernel = pKernels[k];
+		if (!kernel.supported)
+		{
+			std::cout << kernel.name << " - not supported" << std::endl;
+			continue;
+		}
+
+		// Odd offset and size to go through unaligned loads and scalar tail.
+		const char* pData = pBuf.get() + 1;
+		const size_t size = bufSize - 1;
+
+		uint64 s = 0;
+		STimestamp sumTime{};
+		for (int r = 0; r < repeats; ++r)
+		{
+			PROF_REGION(kernel.name);
+			STsRegion reg(sumTime);
+			s = kernel.func(pData, size);
+		}
+
+		if (k == 0)
+			expected = s;
+		if (s != expected)
+		{
+			std::cerr << kernel.name << " result " << s << " differs from " << expected << std::endl;
+			__debugbreak();
+		}
+
+		std::cout << kernel.name << " - GB/s " << MBsec(size * repeats, sumTime) / 1024 << std::endl;
+	}
+
+	// Reference values for check strings
+	const char* szCheck = "123456789";
+	const char* szXxCheck = "Nobody inspects the spammish repetition";
+	if (Crc32c(0, szCheck, strlen(szCheck)) != 0xE3069283u)
+		__debugbreak();
+	if (XxHash64("", 0, 0) != 0xEF46DB3751D8E999ull || XxHash64(szXxCheck, strlen(szXxCheck), 0) != 0xFBCEA83C8A378BF1ull)
+		__debugbreak();
+
+	for (size_t st = 0; st < size_t(EProcessingStage::Count); ++st)
+	{
+		const SProcessingStage& stage = GetProcessingStage(EProcessingStage(st));
+
+		STimestamp procTime{};
+		for (int r = 0; r < repeats; ++r)
+		{
+			PROF_REGION(stage.name);
+			STsRegion reg(procTime);
+			stage.func(pBuf.get(), bufSize);
+		}
+
+		std::cout << "stage " << stage.name << " - GB/s " << MBsec(bufSize * repeats, procTime) / 1024 << std::endl;
+	}
+	std::cout << std::endl;
+}
@@ -0,0 +1,191 @@
+#include "tests.h"
+#include "archive.h"
+#include "asyncfile.h"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Test9
+{
+
+static constexpr bool s_unbufferedIo = true;
+static constexpr uint32 s_maxInFlight = 32;
+static constexpr uint32 s_maxReadSize = 1024 * 1024;
+static constexpr uint32 s_batchSize = 64;
+
+
+struct SSeqStats
+{
+	uint64 sum = 0;
+	uint64 bytes = 0;
+	uint64 readCount = 0;
+	STimestamp totalTime{};
+	STimestamp lookupTime{};
+	STimestamp readTime{};
+	STimestamp sumTime{};
+	CLatencyHistogram assetLatency;
+};
+
+// Baseline: look up an asset, read it with one blocking request per chunk, process it, go to the next one.
+static SSeqStats LoadOneByOne(CAsyncFile& file, const CArchive& archive, const std::vector<uint64>& ids)
+{
+	PROF_FUNC();
+
+	SSeqStats stats;
+	std::vector<AlignedUniquePtr> buffers;
+	buffers.reserve(ids.size());
+	for (uint64 id : ids)
+	{
+		const SArchiveEntry* pEntry = archive.Find(id);
+		const size_t alignedSize = pEntry ? size_t((pEntry->size + s_archiveAlignment - 1) / s_archiveAlignment * s_archiveAlignment) : 0;
+		buffers.push_back(AlignedAlloc(std::max(alignedSize, s_archiveAlignment), s_archiveAlignment));
+	}
+
+	const auto startTime = ts::now();
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		const SArchiveEntry* pEntry;
+		{
+			STsRegion reg(stats.lookupTime);
+			pEntry = archive.Find(ids[i]);
+		}
+		if (!pEntry)
+			continue;
+
+		const uint64 alignedSize = (pEntry->size + s_archiveAlignment - 1) / s_archiveAlignment * s_archiveAlignment;
+		const auto readStart = ts::now();
+		{
+			PROF_REGION("read");
+			STsRegion reg(stats.readTime);
+			for (uint64 off = 0; off < alignedSize; off += s_maxReadSize)
+			{
+				SAsyncRead r;
+				r.pBuf = buffers[i].get() + off;
+				r.offset = pEntry->offset + off;
+				r.size = uint32(std::min<uint64>(s_maxReadSize, alignedSize - off));
+				if (!file.Read(r))
+					exit(1);
+				SAsyncRead* pDone = file.Wait();
+				if (pDone != &r || r.result < int64(std::min<uint64>(r.size, pEntry->size - off)))
+				{
+					std::cerr << "Failed to read asset, res " << r.result << std::endl;
+					exit(3);
+				}
+				++stats.readCount;
+			}
+		}
+		stats.assetLatency.Record(ts::now() - readStart);
+
+		{
+			PROF_REGION("process");
+			STsRegion reg(stats.sumTime);
+			stats.sum += process(buffers[i].get(), size_t(pEntry->size));
+		}
+		stats.bytes += pEntry->size;
+	}
+	stats.totalTime = ts::now() - startTime;
+	return stats;
+}
+
+}
+
+
+void Test9_Archive(const char* szArchive, uint32 requestCount)
+{
+	PROF_FUNC();
+
+	using namespace Test9;
+
+	CArchive archive;
+	if (!archive.Open(szArchive))
+	{
+		std::cerr << "Failed to open archive " << szArchive << std::endl;
+		return;
+	}
+	const uint32 assetCount = uint32(archive.GetEntries().size());
+	if (assetCount == 0)
+		return;
+
+	const uint32 hw = std::min< uint32>(std::thread::hardware_concurrency(), 32);
+	const uint32 workerCount = std::max(hw, 2u) - 1;
+
+	// Random subset of assets by name, same every run. Names are known, hashes are looked up in TOC.
+	std::vector<uint64> ids;
+	{
+		std::mt19937 rng(1234);
+		std::vector<uint32> order(assetCount);
+		for (uint32 i = 0; i < assetCount; ++i)
+			order[i] = i;
+		std::shuffle(order.begin(), order.end(), rng);
+		order.resize(std::min(requestCount, assetCount));
+		for (uint32 i : order)
+			ids.push_back(HashAssetName(("asset_" + std::to_string(i)).c_str()));
+	}
+
+	SSeqStats seq;
+	{
+		CAsyncFile file;
+		if (!file.Open(szArchive, s_unbufferedIo, 1))
+			return;
+		seq = LoadOneByOne(file, archive, ids);
+	}
+
+	CAssetLoader::SStats batched;
+	{
+		CAsyncFile file;
+		if (!file.Open(szArchive, s_unbufferedIo, s_maxInFlight))
+			return;
+
+		CAssetLoader::SParams params;
+		params.workerCount = workerCount;
+		params.maxInFlight = s_maxInFlight;
+		params.maxReadSize = s_maxReadSize;
+		params.batchSize = s_batchSize;
+
+		CAssetLoader loader(file, archive, params);
+		batched = loader.Load(ids.data(), ids.size(), nullptr, nullptr);
+	}
+
+	if (seq.sum != batched.sum)
+	{
+		std::cerr << "Batched sum " << batched.sum << " differs from " << seq.sum << std::endl;
+		__debugbreak();
+	}
+
+	STimestamp batchLatency{};
+	STimestamp maxBatchLatency{};
+	STimestamp prevDone{};
+	for (const STimestamp& t : batched.batchDoneTime)
+	{
+		// Batches overlap, so time from previous batch completion is what consumer waits for the next one.
+		const STimestamp d = t - prevDone;
+		batchLatency += d;
+		maxBatchLatency.time = std::max(maxBatchLatency.time, d.time);
+		prevDone.time = std::max(prevDone.time, t.time);
+	}
+	const size_t batchCount = std::max<size_t>(batched.batchDoneTime.size(), 1);
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Stage " << GetActiveProcessingStage().name << std::endl;
+	std::cout << "Assets " << batched.assetCount << " of " << assetCount << ", missing " << batched.missingCount << ", bytes " << batched.bytes << std::endl;
+	std::cout << "One by one:" << std::endl;
+	std::cout << "Total took  " << ms(seq.totalTime.dur()) << " - MB/s " << MBsec(seq.bytes, seq.totalTime) << " - assets/s " << batched.assetCount / sec(seq.totalTime.dur()) << std::endl;
+	std::cout << "Lookup took " << ms(seq.lookupTime.dur()) << std::endl;
+	std::cout << "Read took   " << ms(seq.readTime.dur()) << " - MB/s " << MBsec(seq.bytes, seq.readTime) << std::endl;
+	seq.assetLatency.Print("Asset");
+	std::cout << "Sum took    " << ms(seq.sumTime.dur()) << " - MB/s " << MBsec(seq.bytes, seq.sumTime) << std::endl;
+	std::cout << "reads " << seq.readCount << std::endl;
+	std::cout << "Batched:" << std::endl;
+	std::cout << "Total took  " << ms(batched.totalTime.dur()) << " - MB/s " << MBsec(batched.bytes, batched.totalTime) << " - assets/s " << batched.assetCount / sec(batched.totalTime.dur()) << std::endl;
+	batched.assetLatency.Print("Asset");
+	std::cout << "Batch latency avg " << ms(batchLatency.dur() / batchCount) << " max " << ms(maxBatchLatency.dur()) << std::endl;
+	std::cout << "reads " << batched.readCount << " batches " << batched.batchDoneTime.size() << " of " << s_batchSize << std::endl;
+	std::cout << "Speedup " << sec(seq.totalTime.dur()) / sec(batched.totalTime.dur()) << std::endl;
+	std::cout << "Sum is " << batched.sum << std::endl;
+	std::cout << "workerCount " << workerCount << std::endl;
+	std::cout << std::endl;
+}
@@ -0,0 +1,207 @@
+#include "testdata.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+static constexpr size_t s_genBlockSize = 4096;
+// Multiple of s_processingBlockSize, so hash stages see the same blocks as tests do.
+static constexpr size_t s_genBufSize = 4 * 1024 * 1024;
+static_assert(s_genBufSize % s_processingBlockSize == 0, "Hash blocks have to stay aligned");
+
+static SExpectedSums s_expectedSums;
+
+bool ParseDataSize(const char* szSize, uint64& size)
+{
+	char* pEnd = nullptr;
+	uint64 v = strtoull(szSize, &pEnd, 10);
+	if (pEnd == szSize)
+		return false;
+	switch (*pEnd)
+	{
+	case 'k': case 'K': v <<= 10; ++pEnd; break;
+	case 'm': case 'M': v <<= 20; ++pEnd; break;
+	case 'g': case 'G': v <<= 30; ++pEnd; break;
+	default: break;
+	}
+	if (*pEnd)
+		return false;
+	size = v;
+	return true;
+}
+
+static uint64 SplitMix64(uint64& state)
+{
+	uint64 z = (state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// Every block has its own generator state, so content doesn't depend on how the file is written.
+static void FillBlock(char* pBlock, uint64 blockIdx, uint64 seed, size_t randomBytes)
+{
+	uint64 state = seed ^ (blockIdx * 0xD1B54A32D192ED03ull);
+	size_t off = 0;
+	for (; off < randomBytes; off += 8)
+	{
+		const uint64 v = SplitMix64(state);
+		memcpy(pBlock + off, &v, 8);
+	}
+	if (off == 0)
+	{
+		const uint64 v = SplitMix64(state);
+		memcpy(pBlock, &v, 8);
+		off = 8;
+	}
+	// Rest repeats what is already there, LZ matches at distance off.
+	for (size_t src = 0; off < s_genBlockSize; off += 8, src += 8)
+		memcpy(pBlock + off, pBlock + src, 8);
+}
+
+static std::string GetSidecarName(const char* szFilename)
+{
+	return std::string(szFilename) + ".sums";
+}
+
+int GenerateTestFile(const char* szFilename, const STestDataParams& params)
+{
+	PROF_FUNC();
+
+	if (params.compressibility < 0 || params.compressibility > 1)
+	{
+		std::cerr << "Compressibility has to be in [0, 1]" << std::endl;
+		return 1;
+	}
+
+	FILE* f = fopen(szFilename, "wb");
+	if (!f)
+	{
+		std::cerr << "Failed to open " << szFilename << std::endl;
+		return 1;
+	}
+	std::unique_ptr<FILE, decltype(&fclose)> fCloser(f, &fclose);
+
+	const size_t randomBytes = (size_t((1 - params.compressibility) * s_genBlockSize) + 7) / 8 * 8;
+
+	SExpectedSums sums;
+	sums.size = params.size;
+	std::unique_ptr<char[]> pBuf(new char[s_genBufSize]);
+
+	auto startTime = ts::now();
+
+	uint64 blockIdx = 0;
+	for (uint64 off = 0; off < params.size; off += s_genBufSize)
+	{
+		const size_t size = size_t(std::min<uint64>(s_genBufSize, params.size - off));
+		for (size_t b = 0; b < size; b += s_genBlockSize, ++blockIdx)
+			FillBlock(pBuf.get() + b, blockIdx, params.seed, randomBytes);
+
+		for (size_t s = 0; s < size_t(EProcessingStage::Count); ++s)
+			sums.sums[s] += GetProcessingStage(EProcessingStage(s)).func(pBuf.get(), size);
+
+		if (fwrite(pBuf.get(), 1, size, f) != size)
+		{
+			std::cerr << "Failed to write " << szFilename << std::endl;
+			return 2;
+		}
+	}
+	fCloser.reset();
+
+	auto endTime = ts::now();
+
+	const std::string sidecar = GetSidecarName(szFilename);
+	FILE* fSums = fopen(sidecar.c_str(), "wb");
+	if (!fSums)
+	{
+		std::cerr << "Failed to open " << sidecar << std::endl;
+		return 1;
+	}
+	fprintf(fSums, "size %" PRIu64 "\n", params.size);
+	fprintf(fSums, "seed %" PRIu64 "\n", params.seed);
+	fprintf(fSums, "compressibility %g\n", params.compressibility);
+	for (size_t s = 0; s < size_t(EProcessingStage::Count); ++s)
+		fprintf(fSums, "%s %" PRIu64 "\n", GetProcessingStage(EProcessingStage(s)).name, sums.sums[s]);
+	fclose(fSums);
+
+	std::cout << __FUNCTION__ << std::endl;
+	std::cout << "Size " << params.size << " seed " << params.seed << " compressibility " << params.compressibility << std::endl;
+	std::cout << "Total took  " << ms((endTime - startTime).dur()) << " - MB/s " << MBsec(params.size, endTime - startTime) << std::endl;
+	for (size_t s = 0; s < size_t(EProcessingStage::Count); ++s)
+		std::cout << GetProcessingStage(EProcessingStage(s)).name << " " << sums.sums[s] << std::endl;
+	std::cout << std::endl;
+	return 0;
+}
+
+bool LoadExpectedSums(const char* szFilename, SExpectedSums& sums)
+{
+	const std::string sidecar = GetSidecarName(szFilename);
+	FILE* fSums = fopen(sidecar.c_str(), "rb");
+	if (!fSums)
+		return false;
+	std::unique_ptr<FILE, decltype(&fclose)> sumsCloser(fSums, &fclose);
+
+	SExpectedSums res;
+	char name[64];
+	char value[64];
+	while (fscanf(fSums, "%63s %63s", name, value) == 2)
+	{
+		const uint64 v = strtoull(value, nullptr, 10);
+		if (strcmp(name, "size") == 0)
+			res.size = v;
+		for (size_t s = 0; s < size_t(EProcessingStage::Count); ++s)
+		{
+			if (strcmp(name, GetProcessingStage(EProcessingStage(s)).name) == 0)
+			{
+				res.known[s] = true;
+				res.sums[s] = v;
+			}
+		}
+	}
+
+	FILE* f = fopen(szFilename, "rb");
+	if (!f)
+		return false;
+#ifdef _WIN32
+	_fseeki64(f, 0, SEEK_END);
+	const uint64 fsize = uint64(_ftelli64(f));
+#else
+	fseeko(f, 0, SEEK_END);
+	const uint64 fsize = uint64(ftello(f));
+#endif
+	fclose(f);
+	if (fsize != res.size)
+	{
+		std::cerr << sidecar << " is for size " << res.size << ", file has " << fsize << ", ignored" << std::endl;
+		return false;
+	}
+
+	sums = res;
+	return true;
+}
+
+void SetExpectedSums(const SExpectedSums& sums)
+{
+	s_expectedSums = sums;
+}
+
+bool GetExpectedSum(uint64& sum)
+{
+	const size_t stage = size_t(GetActiveProcessingStage().id);
+	if (!s_expectedSums.known[stage])
+		return false;
+	sum = s_expectedSums.sums[stage];
+	return true;
+}
+
+bool CheckExpectedSum(uint64 sum)
+{
+	uint64 expected = 0;
+	if (!GetExpectedSum(expected) || sum == expected)
+		return true;
+	std::cerr << GetActiveProcessingStage().name << " result " << sum << " differs from expected " << expected << std::endl;
+	return false;
+}
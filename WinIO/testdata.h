@@ -0,0 +1,40 @@
+#pragma once
+
+#include "common.h"
+#include "checksum.h"
+
+// Generated test files, so tests can check their results on any machine instead of one private file.
+// Content depends only on seed, compressibility and offset. Next to the file goes "<file>.sums",
+// a text sidecar with the expected result of every processing stage for the whole file.
+
+struct STestDataParams
+{
+	uint64 size = 1024 * 1024 * 1024;
+	uint64 seed = 1;
+	// 0 is random data, 1 repeats a single 8 byte pattern. In between, this part of every 4 KiB block
+	// repeats the random start of the block, roughly the ratio LZ4 gets.
+	double compressibility = 0.5;
+};
+
+// "123", "4k", "100m", "5g". Returns false on bad input.
+bool ParseDataSize(const char* szSize, uint64& size);
+
+// Writes the file and its sidecar. Returns exit code.
+int GenerateTestFile(const char* szFilename, const STestDataParams& params);
+
+struct SExpectedSums
+{
+	uint64 size = 0;
+	bool known[size_t(EProcessingStage::Count)] = {};
+	uint64 sums[size_t(EProcessingStage::Count)] = {};
+};
+
+// Reads "<file>.sums". Returns false if there is none or it is for a different size.
+bool LoadExpectedSums(const char* szFilename, SExpectedSums& sums);
+
+// Sums tests compare their result with.
+void SetExpectedSums(const SExpectedSums& sums);
+// Expected result of the active processing stage, false if it's unknown.
+bool GetExpectedSum(uint64& sum);
+// True when the result matches or nothing is known for the active stage.
+bool CheckExpectedSum(uint64 sum);
@@ -1,8 +1,26 @@
 #pragma once
 
 #include "common.h"
+#include "checksum.h"
 
+#include <cstdio>
+
+void Test8_SumKernels();
+void Test9_Archive(const char* szArchive, uint32 requestCount);
+void Test12_Coroutines(const char* szFilename, const int64 fsizePos);
+
+#ifdef _WIN32
 void Test1_Seq(FILE* f, const fpos_t fsizePos);
 void Test2_Par(FILE* f, const fpos_t fsizePos);
 void Test3_CompIOWorkers(const char* szFilename, const fpos_t fsizePos);
 void Test4_DStorage(const char* szFilename, const fpos_t fsizePos);
+#endif
+
+#ifdef __linux__
+void Test5_IoUring(const char* szFilename, const int64 fsizePos);
+void Test6_LinuxAio(const char* szFilename, const int64 fsizePos);
+void Test7_Mmap(const char* szFilename, const int64 fsizePos);
+void Test10_DStorageQueue(const char* szFilename, const int64 fsizePos);
+void Test11_CompPortWorkers(const char* szFilename, const int64 fsizePos);
+void Test13_Priority(const char* szFilename, const int64 fsizePos);
+#endif
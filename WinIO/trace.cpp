@@ -0,0 +1,168 @@
+#include "trace.h"
+#include "common.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+std::atomic<bool> g_traceEnabled = { false };
+thread_local CTraceBuffer* t_pTraceBuffer = nullptr;
+
+namespace
+{
+
+struct STraceState
+{
+	std::mutex mtx;
+	// Buffers outlive their threads, workers are joined before the trace is written.
+	std::vector<std::unique_ptr<CTraceBuffer>> buffers;
+	std::string filename;
+	bool started = false;
+
+	uint64_t startTsc = 0;
+	STimestamp startTime{};
+};
+
+STraceState& GetTraceState()
+{
+	static STraceState s;
+	return s;
+}
+
+void WriteJsonString(FILE* f, const char* sz)
+{
+	fputc('"', f);
+	for (; *sz; ++sz)
+	{
+		const char c = *sz;
+		if (c == '"' || c == '\\')
+			fputc('\\', f);
+		if (uint8(c) < 0x20)
+			fprintf(f, "\\u%04x", unsigned(c));
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+void WriteTraceAtExit()
+{
+	WriteTrace();
+}
+
+}
+
+CTraceBuffer::CTraceBuffer(uint32_t threadIdx)
+	: m_pEvents(new STraceEvent[s_capacity])
+	, m_threadIdx(threadIdx)
+{
+	snprintf(m_name, sizeof(m_name), "Thread_%u", threadIdx);
+}
+
+void CTraceBuffer::SetName(const char* szName)
+{
+	snprintf(m_name, sizeof(m_name), "%s", szName);
+}
+
+CTraceBuffer* CreateTraceBuffer()
+{
+	STraceState& state = GetTraceState();
+	std::scoped_lock lock(state.mtx);
+	state.buffers.emplace_back(new CTraceBuffer(uint32_t(state.buffers.size())));
+	t_pTraceBuffer = state.buffers.back().get();
+	return t_pTraceBuffer;
+}
+
+void StartTrace(const char* szFilename)
+{
+	STraceState& state = GetTraceState();
+	{
+		std::scoped_lock lock(state.mtx);
+		if (state.started)
+			return;
+		state.started = true;
+		state.filename = szFilename;
+		state.startTime = STimestamp::now();
+		state.startTsc = TraceTimestamp();
+	}
+	std::atexit(&WriteTraceAtExit);
+	g_traceEnabled.store(true, std::memory_order_relaxed);
+}
+
+bool WriteTrace()
+{
+	g_traceEnabled.store(false, std::memory_order_relaxed);
+
+	STraceState& state = GetTraceState();
+	std::scoped_lock lock(state.mtx);
+	if (!state.started)
+		return false;
+	state.started = false;
+
+	// TSC rate is measured over the whole trace against STimestamp.
+	const uint64_t endTsc = TraceTimestamp();
+	const double elapsedUs = sec((STimestamp::now() - state.startTime).dur()) * 1e6;
+	const double ticksPerUs = elapsedUs > 0 ? double(endTsc - state.startTsc) / elapsedUs : 1.0;
+
+	FILE* f = fopen(state.filename.c_str(), "wb");
+	if (!f)
+	{
+		std::cerr << "Failed to open " << state.filename << std::endl;
+		return false;
+	}
+
+	uint64_t eventCount = 0;
+	uint64_t droppedCount = 0;
+	bool first = true;
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (const std::unique_ptr<CTraceBuffer>& pBuf : state.buffers)
+	{
+		const uint32_t tid = pBuf->GetThreadIdx();
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", tid);
+		WriteJsonString(f, pBuf->GetName());
+		fprintf(f, "}}");
+		first = false;
+
+		const uint64_t head = pBuf->GetHead();
+		const uint64_t begin = head > CTraceBuffer::s_capacity ? head - CTraceBuffer::s_capacity : 0;
+		droppedCount += begin;
+
+		// Ends of regions which began before the overwritten part are skipped.
+		uint32_t depth = 0;
+		for (uint64_t i = begin; i < head; ++i)
+		{
+			const STraceEvent& ev = pBuf->GetEvent(i);
+			const double ts = double(int64(ev.tsc - state.startTsc)) / ticksPerUs;
+			if (ev.name)
+			{
+				fprintf(f, ",\n{\"name\":");
+				WriteJsonString(f, ev.name);
+				fprintf(f, ",\"ph\":\"B\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", tid, ts);
+				++depth;
+			}
+			else if (depth > 0)
+			{
+				fprintf(f, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", tid, ts);
+				--depth;
+			}
+			++eventCount;
+		}
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	fclose(f);
+
+	std::cout << "Trace " << state.filename << " - events " << eventCount << " dropped " << droppedCount
+		<< " threads " << state.buffers.size() << " - ticks/us " << ticksPerUs << std::endl;
+	return true;
+}
+
+void SetTraceThreadName(const char* szName)
+{
+	if (!g_traceEnabled.load(std::memory_order_relaxed))
+		return;
+	CTraceBuffer* pBuf = t_pTraceBuffer ? t_pTraceBuffer : CreateTraceBuffer();
+	pBuf->SetName(szName);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define TRACE_USE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_USE_TSC
+#endif
+
+// Built-in recorder behind PROF_FUNC/PROF_REGION, works without PIX.
+// Every thread writes begin/end events into its own ring buffer, nothing is shared on the hot path.
+// When the ring is full the oldest events are overwritten. Names have to outlive the trace (literals, __FUNCTION__).
+// StartTrace() enables recording, the trace is written as Chrome trace JSON at exit,
+// open it in chrome://tracing or ui.perfetto.dev.
+
+struct STraceEvent
+{
+	uint64_t tsc;
+	// nullptr marks end of the last open region
+	const char* name;
+};
+
+class alignas(128) CTraceBuffer
+{
+public:
+	static constexpr size_t s_capacity = size_t(1) << 16;
+
+	CTraceBuffer(uint32_t threadIdx);
+
+	void Push(uint64_t tsc, const char* name)
+	{
+		const uint64_t h = m_head.load(std::memory_order_relaxed);
+		m_pEvents[h & (s_capacity - 1)] = STraceEvent{ tsc, name };
+		m_head.store(h + 1, std::memory_order_release);
+	}
+
+	uint64_t GetHead() const { return m_head.load(std::memory_order_acquire); }
+	const STraceEvent& GetEvent(uint64_t idx) const { return m_pEvents[idx & (s_capacity - 1)]; }
+
+	uint32_t GetThreadIdx() const { return m_threadIdx; }
+	const char* GetName() const { return m_name; }
+	void SetName(const char* szName);
+
+private:
+	std::atomic<uint64_t> m_head = { 0 };
+	std::unique_ptr<STraceEvent[]> m_pEvents;
+	uint32_t m_threadIdx;
+	char m_name[32] = {};
+};
+
+extern std::atomic<bool> g_traceEnabled;
+extern thread_local CTraceBuffer* t_pTraceBuffer;
+
+CTraceBuffer* CreateTraceBuffer();
+
+inline uint64_t TraceTimestamp()
+{
+#ifdef TRACE_USE_TSC
+	return __rdtsc();
+#else
+	return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+class CTraceScope
+{
+public:
+	explicit CTraceScope(const char* name)
+	{
+		if (g_traceEnabled.load(std::memory_order_relaxed))
+		{
+			m_pBuf = t_pTraceBuffer ? t_pTraceBuffer : CreateTraceBuffer();
+			m_pBuf->Push(TraceTimestamp(), name);
+		}
+	}
+
+	~CTraceScope()
+	{
+		if (m_pBuf)
+			m_pBuf->Push(TraceTimestamp(), nullptr);
+	}
+
+	CTraceScope(const CTraceScope&) = delete;
+	CTraceScope& operator=(const CTraceScope&) = delete;
+
+private:
+	CTraceBuffer* m_pBuf = nullptr;
+};
+
+// Starts recording, trace is written to szFilename at exit.
+void StartTrace(const char* szFilename);
+// Writes recorded events now and stops recording. Returns false if trace wasn't started or file can't be written.
+bool WriteTrace();
+// Shown as thread name in the trace, called from SetThreadName.
+void SetTraceThreadName(const char* szName);
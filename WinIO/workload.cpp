@@ -0,0 +1,243 @@
+#include "workload.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+static const char* s_patternNames[] = { "uniform", "zipf", "hotset" };
+static_assert(sizeof(s_patternNames) / sizeof(s_patternNames[0]) == size_t(EAccessPattern::Count), "Missing pattern name");
+
+const char* GetAccessPatternName(EAccessPattern pattern)
+{
+	return s_patternNames[size_t(pattern)];
+}
+
+bool ParseAccessPattern(const char* szName, EAccessPattern& pattern)
+{
+	for (size_t i = 0; i < size_t(EAccessPattern::Count); ++i)
+	{
+		if (strcmp(szName, s_patternNames[i]) == 0)
+		{
+			pattern = EAccessPattern(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ParseSizeMix(const char* szMix, std::vector<SRequestSize>& mix)
+{
+	std::vector<SRequestSize> res;
+	const char* p = szMix;
+	while (*p)
+	{
+		char* pEnd = nullptr;
+		uint64 size = strtoull(p, &pEnd, 10);
+		if (pEnd == p)
+			return false;
+		p = pEnd;
+		if (*p == 'k' || *p == 'K')
+		{
+			size *= 1024;
+			++p;
+		}
+		else if (*p == 'm' || *p == 'M')
+		{
+			size *= 1024 * 1024;
+			++p;
+		}
+
+		uint64 weight = 1;
+		if (*p == ':')
+		{
+			++p;
+			weight = strtoull(p, &pEnd, 10);
+			if (pEnd == p)
+				return false;
+			p = pEnd;
+		}
+		if (*p == ',')
+			++p;
+		else if (*p)
+			return false;
+
+		if (size == 0 || size > UINT32_MAX || weight == 0)
+			return false;
+		res.push_back(SRequestSize{ uint32(size), uint32(weight) });
+	}
+	if (res.empty())
+		return false;
+	mix = std::move(res);
+	return true;
+}
+
+
+namespace
+{
+
+// Gray et al. "Quickly generating billion-record synthetic databases", as used by YCSB.
+class CZipfGenerator
+{
+public:
+	CZipfGenerator(uint64 n, double theta)
+		: m_n(n)
+	{
+		double zetan = 0;
+		for (uint64 i = 1; i <= n; ++i)
+			zetan += 1.0 / std::pow(double(i), theta);
+		const double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+
+		m_zetan = zetan;
+		m_alpha = 1.0 / (1.0 - theta);
+		m_eta = (1.0 - std::pow(2.0 / double(n), 1.0 - theta)) / (1.0 - zeta2 / zetan);
+		m_half = 1.0 + std::pow(0.5, theta);
+	}
+
+	// Rank, 0 is the most popular.
+	template<typename Rng>
+	uint64 operator()(Rng& rng)
+	{
+		const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+		const double uz = u * m_zetan;
+		if (uz < 1.0)
+			return 0;
+		if (uz < m_half)
+			return std::min<uint64>(1, m_n - 1);
+		const uint64 rank = uint64(double(m_n) * std::pow(m_eta * u - m_eta + 1.0, m_alpha));
+		return std::min(rank, m_n - 1);
+	}
+
+private:
+	uint64 m_n;
+	double m_zetan;
+	double m_alpha;
+	double m_eta;
+	double m_half;
+};
+
+// Spreads popular ranks over the file instead of keeping them at its start.
+uint64 ScrambleSlot(uint64 rank, uint64 n)
+{
+	uint64 h = rank + 0x9E3779B97F4A7C15ull;
+	h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+	h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+	h ^= h >> 31;
+	return h % n;
+}
+
+}
+
+bool GenerateWorkload(const SWorkloadParams& params, uint64 fileSize, SWorkload& workload)
+{
+	PROF_FUNC();
+
+	if (params.alignment == 0 || params.sizeMix.empty() || fileSize == 0)
+		return false;
+	if (params.pattern == EAccessPattern::Zipf && (params.zipfTheta <= 0 || params.zipfTheta == 1.0))
+		return false;
+
+	const uint64 alignment = params.alignment;
+	const uint64 alignedFileSize = (fileSize + alignment - 1) / alignment * alignment;
+	const uint64 slotCount = alignedFileSize / alignment;
+	const uint64 hotSlots = std::max<uint64>(uint64(double(slotCount) * params.hotSetFraction), 1);
+
+	std::vector<uint32> sizes;
+	std::vector<uint32> weights;
+	for (const SRequestSize& s : params.sizeMix)
+	{
+		sizes.push_back(uint32((s.size + alignment - 1) / alignment * alignment));
+		weights.push_back(s.weight);
+	}
+
+	std::mt19937_64 rng(params.seed);
+	std::discrete_distribution<size_t> sizeDist(weights.begin(), weights.end());
+	std::uniform_int_distribution<uint64> uniformSlot(0, slotCount - 1);
+	std::uniform_int_distribution<uint64> hotSlot(0, hotSlots - 1);
+	std::uniform_int_distribution<uint64> coldSlot(std::min(hotSlots, slotCount - 1), slotCount - 1);
+	std::bernoulli_distribution isHot(params.hotAccessFraction);
+	std::unique_ptr<CZipfGenerator> pZipf;
+	if (params.pattern == EAccessPattern::Zipf)
+		pZipf.reset(new CZipfGenerator(slotCount, params.zipfTheta));
+
+	workload.params = params;
+	workload.requests.clear();
+	workload.requests.reserve(size_t(params.requestCount));
+	workload.totalBytes = 0;
+	workload.maxRequestSize = 0;
+
+	std::vector<bool> touched(size_t(slotCount), false);
+	uint64 uniqueSlots = 0;
+
+	for (uint64 i = 0; i < params.requestCount; ++i)
+	{
+		uint64 slot = 0;
+		switch (params.pattern)
+		{
+		case EAccessPattern::Uniform:
+			slot = uniformSlot(rng);
+			break;
+		case EAccessPattern::Zipf:
+			slot = ScrambleSlot((*pZipf)(rng), slotCount);
+			break;
+		case EAccessPattern::HotSet:
+			slot = isHot(rng) ? hotSlot(rng) : coldSlot(rng);
+			break;
+		default:
+			return false;
+		}
+
+		const uint64 offset = slot * alignment;
+		// Requests near the end are cut, the tail stays aligned.
+		const uint32 size = uint32(std::min<uint64>(sizes[sizeDist(rng)], alignedFileSize - offset));
+
+		workload.requests.push_back(SIoRequest{ offset, size });
+		workload.totalBytes += std::min<uint64>(size, fileSize - offset);
+		workload.maxRequestSize = std::max(workload.maxRequestSize, size);
+
+		for (uint64 s = slot; s < slot + size / alignment; ++s)
+		{
+			if (!touched[size_t(s)])
+			{
+				touched[size_t(s)] = true;
+				++uniqueSlots;
+			}
+		}
+	}
+	workload.uniqueSlots = uniqueSlots;
+	return true;
+}
+
+void PrintWorkload(const SWorkload& workload)
+{
+	const SWorkloadParams& params = workload.params;
+	std::cout << "Pattern " << GetAccessPatternName(params.pattern);
+	if (params.pattern == EAccessPattern::Zipf)
+		std::cout << " theta " << params.zipfTheta;
+	else if (params.pattern == EAccessPattern::HotSet)
+		std::cout << " " << params.hotAccessFraction * 100 << "% of reads to " << params.hotSetFraction * 100 << "% of file";
+	std::cout << std::endl;
+
+	std::cout << "Sizes";
+	for (const SRequestSize& s : params.sizeMix)
+		std::cout << " " << s.size / 1024 << "k:" << s.weight;
+	std::cout << std::endl;
+
+	const uint64 avgSize = workload.requests.empty() ? 0 : workload.totalBytes / workload.requests.size();
+	std::cout << "Requests " << workload.requests.size() << " avg size " << avgSize << " unique MB " << workload.uniqueSlots * params.alignment / 1024 / 1024 << std::endl;
+}
+
+
+static const SWorkload* s_pActiveWorkload = nullptr;
+
+const SWorkload* GetActiveWorkload()
+{
+	return s_pActiveWorkload;
+}
+
+void SetWorkload(const SWorkload* pWorkload)
+{
+	s_pActiveWorkload = pWorkload;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "common.h"
+
+#include <vector>
+
+// Random access workloads for the async engines. Instead of streaming the file with fi.off.fetch_add,
+// engines take requests one by one from a pregenerated list, so every engine reads exactly the same offsets.
+
+enum class EAccessPattern
+{
+	Uniform,
+	// Few slots get most of the reads, like YCSB zipfian with scrambled ranks.
+	Zipf,
+	// hotSetFraction of the file gets hotAccessFraction of the reads.
+	HotSet,
+
+	Count
+};
+
+const char* GetAccessPatternName(EAccessPattern pattern);
+bool ParseAccessPattern(const char* szName, EAccessPattern& pattern);
+
+struct SRequestSize
+{
+	uint32 size;
+	uint32 weight;
+};
+
+struct SWorkloadParams
+{
+	EAccessPattern pattern = EAccessPattern::Uniform;
+	uint64 requestCount = 64 * 1024;
+	// Offsets and sizes are multiples of it, so requests work with unbuffered IO.
+	uint32 alignment = 4096;
+	double zipfTheta = 0.99;
+	double hotSetFraction = 0.1;
+	double hotAccessFraction = 0.9;
+	// Mostly small reads with some big ones.
+	std::vector<SRequestSize> sizeMix = {
+		{ 4 * 1024, 50 },
+		{ 16 * 1024, 20 },
+		{ 64 * 1024, 15 },
+		{ 256 * 1024, 10 },
+		{ 1024 * 1024, 4 },
+		{ 4 * 1024 * 1024, 1 },
+	};
+	uint64 seed = 42;
+};
+
+// "4k:50,64k:10,4m:1", sizes with optional k/m suffix. Returns false on bad input.
+bool ParseSizeMix(const char* szMix, std::vector<SRequestSize>& mix);
+
+struct SIoRequest
+{
+	uint64 offset;
+	uint32 size;
+};
+
+struct SWorkload
+{
+	SWorkloadParams params;
+	std::vector<SIoRequest> requests;
+	uint64 totalBytes = 0;
+	uint32 maxRequestSize = 0;
+	// Distinct alignment slots touched, shows how much reuse the pattern has.
+	uint64 uniqueSlots = 0;
+};
+
+// Deterministic for the same params and file size.
+bool GenerateWorkload(const SWorkloadParams& params, uint64 fileSize, SWorkload& workload);
+
+// Pattern, size mix and footprint lines for test reports.
+void PrintWorkload(const SWorkload& workload);
+
+// Workload used by async engines, nullptr means streaming the whole file.
+const SWorkload* GetActiveWorkload();
+void SetWorkload(const SWorkload* pWorkload);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <atomic>
+#include <type_traits>
+
+// Bounded Chase-Lev work-stealing deque, memory orders from Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models". The owner thread pushes and pops at the bottom (LIFO, hot in cache),
+// any other thread steals from the top (FIFO, oldest work). Only the last item is contended.
+// Items are stored in relaxed atomics, so T has to be small and trivially copyable, e.g. an index.
+template <class T, size_t Capacity>
+class CWorkStealingDeque
+{
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity has to be power of two");
+	static_assert(std::is_trivially_copyable<T>::value, "Items are copied by steal before it knows it won");
+	static constexpr size_t s_cacheLine = 128;
+
+public:
+	CWorkStealingDeque() = default;
+	CWorkStealingDeque(const CWorkStealingDeque&) = delete;
+	CWorkStealingDeque& operator=(const CWorkStealingDeque&) = delete;
+
+	// Owner only. False when full.
+	bool Push(const T& value)
+	{
+		const int64 b = m_bottom.load(std::memory_order_relaxed);
+		const int64 t = m_top.load(std::memory_order_acquire);
+		if (b - t >= int64(Capacity))
+			return false;
+		m_items[size_t(b) & (Capacity - 1)].store(value, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_bottom.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Owner only.
+	bool Pop(T& value)
+	{
+		const int64 b = m_bottom.load(std::memory_order_relaxed) - 1;
+		m_bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64 t = m_top.load(std::memory_order_relaxed);
+		if (t > b)
+		{
+			m_bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		value = m_items[size_t(b) & (Capacity - 1)].load(std::memory_order_relaxed);
+		if (t < b)
+			return true;
+
+		// Last item, race thieves for it.
+		const bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		m_bottom.store(b + 1, std::memory_order_relaxed);
+		return won;
+	}
+
+	// Any thread. False when empty or another thread took the item first.
+	bool Steal(T& value)
+	{
+		int64 t = m_top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const int64 b = m_bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return false;
+
+		value = m_items[size_t(t) & (Capacity - 1)].load(std::memory_order_relaxed);
+		return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+private:
+	alignas(s_cacheLine) std::atomic<int64> m_top = { 0 };
+	alignas(s_cacheLine) std::atomic<int64> m_bottom = { 0 };
+	alignas(s_cacheLine) std::array<std::atomic<T>, Capacity> m_items = {};
+};